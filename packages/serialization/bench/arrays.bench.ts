@@ -0,0 +1,32 @@
+import { bench, describe } from 'vitest';
+import { parse, stringify } from '../src/index.js';
+
+// Large dense arrays, where per-element overhead dominates. Numeric series are
+// also run with packNumbers, which writes them as raw float64 data.
+const series = Array.from({ length: 1_000_000 }, (_, i) => 20 + Math.sin(i / 60) * 5);
+const labels = Array.from({ length: 1_000_000 }, (_, i) => `s${i % 1000}`);
+
+const payloads: Array<[string, unknown]> = [
+  ['1M number series', series],
+  ['1M short strings', labels],
+];
+
+for (const [name, value] of payloads) {
+  const text = stringify(value);
+  const packed = stringify(value, { packNumbers: true });
+
+  describe(name, () => {
+    bench('stringify', () => {
+      stringify(value);
+    });
+    bench('stringify packNumbers', () => {
+      stringify(value, { packNumbers: true });
+    });
+    bench('parse', () => {
+      parse(text);
+    });
+    bench('parse packed', () => {
+      parse(packed);
+    });
+  });
+}
@@ -0,0 +1,58 @@
+import { afterAll, bench, describe } from 'vitest';
+import { parse, stringify } from '../src/index.js';
+
+// Binary payloads are dominated by base64 work; each case records the bytes it
+// moved so throughput can be reported in GB/s next to vitest's hz figures.
+const SIZES_MB = [1, 4, 16];
+
+interface Throughput {
+  bytes: number;
+  ms: number;
+}
+
+const results = new Map<string, Throughput>();
+
+function measured(name: string, bytes: number, fn: () => void): () => void {
+  const entry: Throughput = { bytes: 0, ms: 0 };
+  results.set(name, entry);
+  return () => {
+    const start = performance.now();
+    fn();
+    entry.ms += performance.now() - start;
+    entry.bytes += bytes;
+  };
+}
+
+function payload(sizeMb: number): Buffer {
+  const bytes = Buffer.allocUnsafe(sizeMb * 1024 * 1024);
+  for (let i = 0; i < bytes.length; i++) {
+    bytes[i] = (i * 2654435761) >>> 24;
+  }
+  return bytes;
+}
+
+describe('base64 throughput', () => {
+  for (const sizeMb of SIZES_MB) {
+    const buf = payload(sizeMb);
+    const floats = new Float32Array(buf.buffer, buf.byteOffset, buf.length / 4);
+    const encodedBuf = stringify(buf);
+    const encodedFloats = stringify(floats);
+
+    let name = `stringify Buffer ${sizeMb} MB`;
+    bench(name, measured(name, buf.length, () => stringify(buf)));
+    name = `parse Buffer ${sizeMb} MB`;
+    bench(name, measured(name, buf.length, () => parse(encodedBuf)));
+    name = `stringify Float32Array ${sizeMb} MB`;
+    bench(name, measured(name, buf.length, () => stringify(floats)));
+    name = `parse Float32Array ${sizeMb} MB`;
+    bench(name, measured(name, buf.length, () => parse(encodedFloats)));
+  }
+});
+
+afterAll(() => {
+  const rows = Array.from(results, ([name, { bytes, ms }]) => ({
+    name,
+    'GB/s': ms > 0 ? Number((bytes / 1e6 / ms).toFixed(2)) : 0,
+  }));
+  console.table(rows);
+});
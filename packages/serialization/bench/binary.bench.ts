@@ -0,0 +1,54 @@
+import { afterAll, bench, describe } from 'vitest';
+import { parse, parseBinary, stringify, stringifyBinary } from '../src/index.js';
+
+// Same service-style payloads through both wire formats; sizes are printed
+// once at the end so the speed and size ratios can be read side by side.
+function records(count: number): unknown {
+  return Array.from({ length: count }, (_, i) => ({
+    id: i,
+    name: `record-${i}`,
+    score: i * 0.37,
+    createdAt: new Date(1_700_000_000_000 + i * 1000),
+    tags: new Set(['alpha', 'beta']),
+    samples: new Float32Array(32).fill(i),
+  }));
+}
+
+const payloads: Array<[string, unknown]> = [
+  ['1k records', records(1_000)],
+  ['10k records', records(10_000)],
+  ['1 MB Float64Array', new Float64Array(128 * 1024).map((_, i) => Math.sin(i))],
+];
+
+const sizes: Array<{ payload: string; text: number; binary: number; ratio: number }> = [];
+
+for (const [name, value] of payloads) {
+  const text = stringify(value);
+  const binary = stringifyBinary(value);
+  const textBytes = Buffer.byteLength(text);
+  sizes.push({
+    payload: name,
+    text: textBytes,
+    binary: binary.length,
+    ratio: Number((textBytes / binary.length).toFixed(2)),
+  });
+
+  describe(name, () => {
+    bench('stringify', () => {
+      stringify(value);
+    });
+    bench('stringifyBinary', () => {
+      stringifyBinary(value);
+    });
+    bench('parse', () => {
+      parse(text);
+    });
+    bench('parseBinary', () => {
+      parseBinary(binary);
+    });
+  });
+}
+
+afterAll(() => {
+  console.table(sizes);
+});
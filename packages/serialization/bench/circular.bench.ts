@@ -0,0 +1,50 @@
+import { bench, describe } from 'vitest';
+import { stringify } from '../src/index.js';
+
+// Identity lookups should keep the cost per object flat as graphs grow:
+// compare hz * size across the sizes below.
+const SIZES = [1_000, 10_000, 50_000, 200_000];
+
+function buildGraph(size: number): Array<{ i: number; next?: unknown }> {
+  const nodes: Array<{ i: number; next?: unknown }> = [];
+  for (let i = 0; i < size; i++) {
+    nodes.push({ i });
+  }
+  for (let i = 0; i < size; i++) {
+    nodes[i].next = nodes[(i * 7 + 1) % size];
+  }
+  return nodes;
+}
+
+function buildChain(size: number): unknown {
+  let head: { v: number; next?: unknown } = { v: 0 };
+  for (let i = 1; i < size; i++) {
+    head = { v: i, next: head };
+  }
+  return head;
+}
+
+describe('circularReferences: true', () => {
+  for (const size of SIZES) {
+    const graph = buildGraph(size);
+    bench(`${size} objects`, () => {
+      stringify(graph, { circularReferences: true });
+    });
+  }
+});
+
+describe('cycle detection (circularReferences: false)', () => {
+  for (const size of SIZES) {
+    const rows = Array.from({ length: size }, (_, i) => ({ i, tags: [i] }));
+    bench(`${size} objects`, () => {
+      stringify(rows);
+    });
+  }
+  // Deep nesting exercises the ancestor stack rather than its width.
+  for (const depth of [100, 1_000, 5_000]) {
+    const chain = buildChain(depth);
+    bench(`depth ${depth}`, () => {
+      stringify(chain);
+    });
+  }
+});
@@ -0,0 +1,32 @@
+import { bench, describe } from 'vitest';
+import { parse, parseBinary, stringify, stringifyBinary } from '../src/index.js';
+
+// Many records repeating the same ten keys: decode cost is dominated by
+// creating and setting property keys.
+const records = Array.from({ length: 200_000 }, (_, i) => ({
+  userId: i,
+  firstName: 'Ada',
+  lastName: 'Lovelace',
+  email: `user${i}@example.com`,
+  active: i % 2 === 0,
+  score: i % 7,
+  country: 'GB',
+  city: 'London',
+  zip: 'N1',
+  tags: null,
+}));
+const text = stringify(records);
+const binary = stringifyBinary(records);
+const identity = (value: unknown) => value;
+
+describe('200k ten-key records', () => {
+  bench('parse', () => {
+    parse(text);
+  });
+  bench('parse with reviver', () => {
+    parse(text, { reviver: identity });
+  });
+  bench('parseBinary', () => {
+    parseBinary(binary);
+  });
+});
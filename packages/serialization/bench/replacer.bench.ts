@@ -0,0 +1,26 @@
+import { bench, describe } from 'vitest';
+import { stringify } from '../src/index.js';
+
+// Records with one Date each, redacted by a replacer. With replacerTypes the
+// replacer only runs for the Dates instead of for every value.
+const records = Array.from({ length: 50_000 }, (_, i) => ({
+  id: i,
+  name: `user ${i}`,
+  createdAt: new Date(1_700_000_000_000 + i),
+  tags: ['a', 'b'],
+}));
+const redact = (value: unknown, replace: (next: unknown) => void) => {
+  if (value instanceof Date) replace(null);
+};
+
+describe('50k records', () => {
+  bench('stringify', () => {
+    stringify(records);
+  });
+  bench('stringify with replacer', () => {
+    stringify(records, { replacer: redact });
+  });
+  bench('stringify with replacerTypes', () => {
+    stringify(records, { replacer: redact, replacerTypes: ['Date'] });
+  });
+});
@@ -0,0 +1,30 @@
+import { bench, describe } from 'vitest';
+import { parse, stringify } from '../src/index.js';
+
+// Records with one Date each, turned into timestamps by a reviver. The plain
+// reviver sees every raw node; reviverTypes only calls it for decoded Dates.
+const text = stringify(
+  Array.from({ length: 50_000 }, (_, i) => ({
+    id: i,
+    name: `user ${i}`,
+    createdAt: new Date(1_700_000_000_000 + i),
+    tags: ['a', 'b'],
+  }))
+);
+
+describe('50k records', () => {
+  bench('parse', () => {
+    parse(text);
+  });
+  bench('parse with reviver', () => {
+    parse(text, {
+      reviver: (value) =>
+        value !== null && typeof value === 'object' && '$$type' in value
+          ? Date.parse((value as { value: string }).value)
+          : value,
+    });
+  });
+  bench('parse with reviverTypes', () => {
+    parse(text, { reviver: (value) => (value as Date).getTime(), reviverTypes: ['Date'] });
+  });
+});
@@ -0,0 +1,32 @@
+import { bench, describe } from 'vitest';
+import { parse, registerShape, stringify } from '../src/index.js';
+
+// Table-like rows that all share one key layout. The second set uses keys of the
+// same length that are registered as a shape; the text is encoded the same way.
+function makeRows(keys: string[]): Array<Record<string, unknown>> {
+  return Array.from({ length: 200_000 }, (_, i) => {
+    const values = [i, `row ${i}`, i % 3 === 0, i % 100, null];
+    return Object.fromEntries(keys.map((key, k) => [key, values[k]]));
+  });
+}
+
+const shapeKeys = ['ID', 'NAME', 'ACTIVE', 'SCORE', 'GROUP'];
+registerShape(shapeKeys);
+
+const payloads: Array<[string, unknown]> = [
+  ['200k rows', makeRows(['id', 'name', 'active', 'score', 'group'])],
+  ['200k rows, registered shape', makeRows(shapeKeys)],
+];
+
+for (const [name, value] of payloads) {
+  const text = stringify(value);
+
+  describe(name, () => {
+    bench('stringify', () => {
+      stringify(value);
+    });
+    bench('parse', () => {
+      parse(text);
+    });
+  });
+}
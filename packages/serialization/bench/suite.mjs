@@ -0,0 +1,332 @@
+// Reproducible benchmark suite: runs each codec over generated corpora and
+// reports ops/s, MB/s, p50/p99 latency and peak RSS, as a table and as JSON.
+//
+//   node bench/suite.mjs [--out results.json] [--compare previous.json]
+//                        [--filter text] [--time ms]
+//
+// Every case (corpus x codec x operation) runs in a fresh child process so its
+// peak RSS is its own. Corpora come from a seeded generator, so runs on the same
+// build see identical inputs. The addon is loaded directly (src/index.ts only
+// forwards to it), which keeps the harness runnable with plain node.
+import { execSync, fork } from 'node:child_process';
+import { readFileSync, mkdirSync, writeFileSync } from 'node:fs';
+import { createRequire } from 'node:module';
+import { cpus } from 'node:os';
+import { dirname, join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import v8 from 'node:v8';
+
+const here = dirname(fileURLToPath(import.meta.url));
+const require = createRequire(import.meta.url);
+
+// --- corpora ---
+
+function random(seed) {
+  // mulberry32
+  let state = seed >>> 0;
+  return () => {
+    state = (state + 0x6d2b79f5) >>> 0;
+    let t = state;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+function word(next, length) {
+  let text = '';
+  for (let i = 0; i < length; i++) text += String.fromCharCode(97 + Math.floor(next() * 26));
+  return text;
+}
+
+// `json`: JSON.stringify/parse round-trips the corpus (no Map, binary or cycles).
+// `options`: passed to stringify/stringifyBinary.
+const corpora = {
+  'flat-records': {
+    json: true,
+    build() {
+      const next = random(1);
+      return Array.from({ length: 50_000 }, (_, i) => {
+        const record = { id: i };
+        for (let k = 0; k < 6; k++) record[`text${k}`] = word(next, 4 + (k % 8));
+        for (let k = 0; k < 6; k++) record[`count${k}`] = Math.floor(next() * 100_000);
+        for (let k = 0; k < 4; k++) record[`ratio${k}`] = next();
+        for (let k = 0; k < 3; k++) record[`flag${k}`] = next() < 0.5;
+        return record;
+      });
+    },
+  },
+  'deep-nesting': {
+    json: true,
+    build() {
+      const next = random(2);
+      return Array.from({ length: 200 }, () => {
+        let node = { leaf: word(next, 8) };
+        for (let depth = 0; depth < 200; depth++) {
+          node = depth % 2 ? { depth, child: node } : [depth, node];
+        }
+        return node;
+      });
+    },
+  },
+  'maps-sets': {
+    json: false,
+    build() {
+      const next = random(3);
+      const map = new Map();
+      for (let i = 0; i < 50_000; i++) map.set(`key${i}`, { n: i, tag: word(next, 6) });
+      const set = new Set(Array.from({ length: 50_000 }, () => Math.floor(next() * 1e9)));
+      return { map, set };
+    },
+  },
+  'binary-heavy': {
+    json: false,
+    build() {
+      const next = random(4);
+      return Array.from({ length: 128 }, (_, i) => {
+        const bytes = Buffer.alloc(64 * 1024);
+        for (let j = 0; j < bytes.length; j += 4) bytes.writeUInt32LE((next() * 2 ** 32) >>> 0, j);
+        return { id: i, bytes, samples: new Float32Array(bytes.buffer, bytes.byteOffset, 1024) };
+      });
+    },
+  },
+  'number-heavy': {
+    json: true,
+    packNumbers: true,
+    build() {
+      const next = random(5);
+      return Array.from({ length: 100 }, () =>
+        Array.from({ length: 10_000 }, () => Math.round(next() * 1e6) / 1e3)
+      );
+    },
+  },
+  'cyclic-graph': {
+    json: false,
+    options: { circularReferences: true },
+    build() {
+      // A 4-ary tree of about 22k nodes with parent pointers, plus a link from
+      // each node to a random node created (and so written) before it.
+      const next = random(6);
+      const nodes = [];
+      const grow = (parent, depth) => {
+        const node = { id: nodes.length, parent, peer: null, children: [] };
+        if (nodes.length > 0) node.peer = nodes[Math.floor(next() * nodes.length)];
+        nodes.push(node);
+        if (depth < 7) for (let k = 0; k < 4; k++) node.children.push(grow(node, depth + 1));
+        return node;
+      };
+      return grow(null, 0);
+    },
+  },
+};
+
+// --- codecs ---
+
+function loadAddon() {
+  return require(join(here, '..', 'build', 'Release', 'bas_serde.node'));
+}
+
+// Each codec returns { encode, decode } closures for a corpus, or null when it
+// cannot represent it. structuredClone only has a combined 'clone' operation.
+const codecs = {
+  bas(corpus) {
+    const addon = loadAddon();
+    const options = corpus.options;
+    return { encode: (v) => addon.stringify(v, options), decode: (t) => addon.parse(t) };
+  },
+  'bas-packed'(corpus) {
+    if (!corpus.packNumbers) return null;
+    const addon = loadAddon();
+    const options = { ...corpus.options, packNumbers: true };
+    return { encode: (v) => addon.stringify(v, options), decode: (t) => addon.parse(t) };
+  },
+  'bas-binary'(corpus) {
+    const addon = loadAddon();
+    const options = corpus.options;
+    return {
+      encode: (v) => addon.stringifyBinary(v, options),
+      decode: (b) => addon.parseBinary(b),
+    };
+  },
+  json(corpus) {
+    if (!corpus.json) return null;
+    return { encode: (v) => JSON.stringify(v), decode: (t) => JSON.parse(t) };
+  },
+  v8() {
+    return { encode: (v) => v8.serialize(v), decode: (b) => v8.deserialize(b) };
+  },
+  structuredClone() {
+    return { clone: (v) => structuredClone(v) };
+  },
+};
+
+function listCases(filter) {
+  const cases = [];
+  for (const [corpusName, corpus] of Object.entries(corpora)) {
+    for (const [codecName, makeCodec] of Object.entries(codecs)) {
+      const codec = makeCodec(corpus);
+      if (codec === null) continue;
+      for (const operation of Object.keys(codec)) {
+        const id = `${corpusName}/${codecName}/${operation}`;
+        if (!filter || id.includes(filter)) cases.push({ id, corpusName, codecName, operation });
+      }
+    }
+  }
+  return cases;
+}
+
+// --- one case, in a child process ---
+
+function byteSize(encoded) {
+  return typeof encoded === 'string' ? Buffer.byteLength(encoded) : encoded.byteLength;
+}
+
+function percentile(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor((sorted.length * p) / 100))];
+}
+
+function runCase({ corpusName, codecName, operation }, timeMs) {
+  const corpus = corpora[corpusName];
+  const value = corpus.build();
+  const codec = codecs[codecName](corpus);
+  const encoded = codec.encode ? codec.encode(value) : null;
+  const input = operation === 'decode' ? encoded : value;
+  const run = codec[operation];
+
+  // Warm up for a fifth of the budget (at least two calls), then sample.
+  const warmUntil = performance.now() + timeMs / 5;
+  for (let i = 0; i < 2 || performance.now() < warmUntil; i++) run(input);
+  globalThis.gc?.();
+  const baseRss = process.memoryUsage().rss;
+
+  const samples = [];
+  const end = performance.now() + timeMs;
+  while (samples.length < 5 || performance.now() < end) {
+    const start = process.hrtime.bigint();
+    run(input);
+    samples.push(Number(process.hrtime.bigint() - start) / 1e6);
+  }
+  samples.sort((a, b) => a - b);
+  const mean = samples.reduce((sum, ms) => sum + ms, 0) / samples.length;
+  const bytes = encoded === null ? null : byteSize(encoded);
+  return {
+    samples: samples.length,
+    opsPerSec: 1000 / mean,
+    meanMs: mean,
+    p50Ms: percentile(samples, 50),
+    p99Ms: percentile(samples, 99),
+    encodedBytes: bytes,
+    mbPerSec: bytes === null ? null : bytes / 1e6 / (mean / 1000),
+    baseRssMb: baseRss / 1e6,
+    peakRssMb: (process.resourceUsage().maxRSS * 1024) / 1e6,
+  };
+}
+
+function runInChild(testCase, timeMs) {
+  return new Promise((resolve, reject) => {
+    const child = fork(fileURLToPath(import.meta.url), ['--child', JSON.stringify(testCase)], {
+      execArgv: ['--expose-gc'],
+      env: { ...process.env, BENCH_TIME_MS: String(timeMs) },
+    });
+    let result = null;
+    child.on('message', (message) => {
+      result = message;
+    });
+    child.on('error', reject);
+    // A failing case is reported in its row instead of ending the run.
+    child.on('exit', (code, signal) => {
+      resolve(result ?? { error: `exited with ${signal ?? `code ${code}`}` });
+    });
+  });
+}
+
+// --- driver ---
+
+// Accepts `--name value` and `--name=value` (the form nx forwards).
+function readArgs(argv) {
+  const args = { time: 1000 };
+  for (let i = 0; i < argv.length; i++) {
+    const [flag, inline] = argv[i].split(/=(.*)/s);
+    const name = flag.replace(/^--/, '');
+    if (!['out', 'compare', 'filter', 'time', 'child'].includes(name)) {
+      throw new Error(`Unknown argument: ${argv[i]}`);
+    }
+    args[name] = inline ?? argv[++i];
+  }
+  args.time = Number(args.time);
+  return args;
+}
+
+function gitCommit() {
+  try {
+    const options = { cwd: here, stdio: ['ignore', 'pipe', 'ignore'] };
+    return execSync('git rev-parse --short HEAD', options).toString().trim();
+  } catch {
+    return null;
+  }
+}
+
+function format(value, digits) {
+  return value === null || value === undefined ? '-' : value.toFixed(digits);
+}
+
+async function main() {
+  const args = readArgs(process.argv.slice(2));
+  if (args.child) {
+    const testCase = JSON.parse(args.child);
+    try {
+      process.send(runCase(testCase, Number(process.env.BENCH_TIME_MS)));
+    } catch (err) {
+      process.send({ error: err instanceof Error ? err.message : String(err) });
+    }
+    return;
+  }
+
+  const previous = args.compare ? JSON.parse(readFileSync(args.compare, 'utf8')) : null;
+  const baseline = new Map((previous?.results ?? []).map((r) => [r.id, r]));
+  const header = ['case', 'ops/s', 'MB/s', 'p50 ms', 'p99 ms', 'peak RSS MB'];
+  if (previous) header.push('vs previous');
+  console.log(header.join('\t'));
+
+  const results = [];
+  for (const testCase of listCases(args.filter)) {
+    const result = { id: testCase.id, ...(await runInChild(testCase, args.time)) };
+    results.push(result);
+    if (result.error) {
+      console.log(`${result.id}\terror: ${result.error}`);
+      continue;
+    }
+    const row = [
+      result.id,
+      format(result.opsPerSec, 2),
+      format(result.mbPerSec, 1),
+      format(result.p50Ms, 3),
+      format(result.p99Ms, 3),
+      format(result.peakRssMb, 0),
+    ];
+    const before = baseline.get(result.id);
+    if (previous) {
+      row.push(before?.opsPerSec ? `${format(result.opsPerSec / before.opsPerSec, 2)}x` : '-');
+    }
+    console.log(row.join('\t'));
+  }
+
+  if (args.out) {
+    const report = {
+      meta: {
+        date: new Date().toISOString(),
+        commit: gitCommit(),
+        node: process.version,
+        v8: process.versions.v8,
+        platform: `${process.platform}-${process.arch}`,
+        cpu: cpus()[0]?.model ?? null,
+        timeMs: args.time,
+      },
+      results,
+    };
+    mkdirSync(dirname(args.out), { recursive: true });
+    writeFileSync(args.out, `${JSON.stringify(report, null, 2)}\n`);
+  }
+}
+
+await main();
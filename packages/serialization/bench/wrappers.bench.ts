@@ -0,0 +1,37 @@
+import { bench, describe } from 'vitest';
+import { parse, stringify } from '../src/index.js';
+
+// Wrapper-dense payloads: nearly every object carries a $$type, so decode time
+// is dominated by recognising wrappers. The identity reviver takes the
+// JSON.parse-then-walk path instead of the direct text decoder.
+const identity = (value: unknown) => value;
+
+const payloads: Array<[string, unknown]> = [
+  [
+    'Map of 10k Dates',
+    new Map(Array.from({ length: 10_000 }, (_, i) => [i, new Date(1_700_000_000_000 + i)])),
+  ],
+  [
+    '10k small typed arrays',
+    Array.from({ length: 10_000 }, (_, i) =>
+      i % 2 ? new Uint8Array(4).fill(i) : new Float32Array(2).fill(i)
+    ),
+  ],
+  [
+    '10k sparse arrays',
+    Array.from({ length: 10_000 }, () => [1, , 3, , 5, undefined, NaN]),
+  ],
+];
+
+for (const [name, value] of payloads) {
+  const text = stringify(value);
+
+  describe(name, () => {
+    bench('parse', () => {
+      parse(text);
+    });
+    bench('parse with reviver', () => {
+      parse(text, { reviver: identity });
+    });
+  });
+}
@@ -4,9 +4,26 @@
       "target_name": "bas_serde",
       "sources": [
         "src/native/addon.cc",
+        "src/native/addon_data.cc",
+        "src/native/async_worker.cc",
+        "src/native/base64.cc",
+        "src/native/binary_decode.cc",
+        "src/native/binary_encode.cc",
+        "src/native/compression.cc",
         "src/native/encode.cc",
+        "src/native/identity_table.cc",
         "src/native/decode.cc",
-        "src/native/serde_utils.cc"
+        "src/native/diff.cc",
+        "src/native/dictionary.cc",
+        "src/native/json_reader.cc",
+        "src/native/json_writer.cc",
+        "src/native/key_interner.cc",
+        "src/native/lazy.cc",
+        "src/native/serde_utils.cc",
+        "src/native/shapes.cc",
+        "src/native/stats.cc",
+        "src/native/stream_decoder.cc",
+        "src/native/stream_encoder.cc"
       ],
       "cflags_cc": ["-std=c++17", "-fexceptions"],
       "xcode_settings": {
@@ -1,24 +1,149 @@
 import { createRequire } from 'node:module';
 import { fileURLToPath } from 'node:url';
 import { dirname, join } from 'node:path';
+import { Readable } from 'node:stream';
 
 export type SerializedString = string;
 export type ReplacerCallback = (nextValue: unknown) => void;
 export type Replacer = (value: unknown, replace: ReplacerCallback) => void;
-export type Reviver = (value: unknown) => unknown;
+export type ReplacerType =
+  | 'undefined'
+  | 'null'
+  | 'boolean'
+  | 'number'
+  | 'string'
+  | 'bigint'
+  | 'object'
+  | 'Array'
+  | 'ArrayBuffer'
+  | 'Buffer'
+  | 'DataView'
+  | 'TypedArray'
+  | 'Date'
+  | 'RegExp'
+  | 'Error'
+  | 'Set'
+  | 'Map';
+export type ReviverType = ReplacerType;
+export type Reviver = (value: unknown, key?: unknown) => unknown;
+export type Attachment = ArrayBuffer | ArrayBufferView;
+export type AttachmentMode = 'inline' | 'external';
 export type StringifyOptions = {
   replacer?: Replacer;
+  replacerTypes?: ReadonlyArray<ReplacerType>;
   circularReferences?: boolean;
+  attachments?: AttachmentMode;
+  packNumbers?: boolean;
+  shareArrayBuffers?: boolean;
+  dedupeStrings?: boolean;
+  dictionary?: Dictionary;
+  compress?: Compression;
+  maxDepth?: number;
 };
+export type Compression = 'deflate' | 'gzip';
+export type ExternalStringifyOptions = StringifyOptions & { attachments: 'external' };
+export type CompressedStringifyOptions = StringifyOptions & { compress: Compression };
+export type AsyncStringifyOptions = Omit<StringifyOptions, 'compress'>;
+export type SerializedWithAttachments = {
+  text: SerializedString;
+  attachments: Attachment[];
+};
+export type Dictionary = { readonly strings: string[] };
+export type BinaryStringifyOptions = Pick<
+  StringifyOptions,
+  'replacer' | 'replacerTypes' | 'circularReferences' | 'dictionary' | 'maxDepth'
+>;
+export type TrainDictionaryOptions = Omit<BinaryStringifyOptions, 'dictionary'> & {
+  maxEntries?: number;
+};
+export type StreamStringifyOptions = Pick<
+  StringifyOptions,
+  | 'replacer'
+  | 'replacerTypes'
+  | 'circularReferences'
+  | 'packNumbers'
+  | 'shareArrayBuffers'
+  | 'dedupeStrings'
+  | 'dictionary'
+  | 'maxDepth'
+> & { highWaterMark?: number };
+export type ParseInput = SerializedString | Uint8Array | ArrayBuffer;
 export type ParseOptions = {
   reviver?: Reviver;
+  reviverTypes?: ReadonlyArray<ReviverType>;
+  reviverKeys?: ReadonlyArray<string>;
+  attachments?: ReadonlyArray<Attachment>;
+  dictionary?: Dictionary;
+  maxDepth?: number;
+};
+export type BinaryParseOptions = Pick<ParseOptions, 'dictionary' | 'maxDepth'>;
+
+export type ParserChunk = string | Uint8Array | ArrayBuffer;
+export type ParserOptions = Pick<ParseOptions, 'attachments' | 'dictionary' | 'maxDepth'>;
+export type Parser = {
+  write: (chunk: ParserChunk) => void;
+  end: () => unknown;
+};
+
+export type StatsTiming = {
+  total: number;
+  walk: number;
+  base64: number;
+  text: number;
+};
+export type DirectionStats = {
+  calls: number;
+  nodes: Partial<Record<ReplacerType | 'unsupported' | 'reference', number>>;
+  base64Bytes: number;
+  circularIds: number;
+  maxDepth: number;
+  timeMs: StatsTiming;
+};
+export type SerializationStats = {
+  enabled: boolean;
+  stringify: DirectionStats & { replacerCalls: number };
+  parse: DirectionStats & { reviverCalls: number };
+};
+
+type NativeStringifyStream = {
+  read: () => Buffer | null;
 };
 
 type NativeModule = {
-  stringify: (value: unknown, options?: StringifyOptions) => string;
-  parse: (text: string, options?: ParseOptions) => unknown;
+  stringify: (
+    value: unknown,
+    options?: StringifyOptions
+  ) => SerializedString | SerializedWithAttachments | Buffer;
+  parse: (text: ParseInput, options?: ParseOptions) => unknown;
+  stringifyToFd: (value: unknown, fd: number, options?: StreamStringifyOptions) => number;
+  StringifyStream: new (
+    value: unknown,
+    options?: StreamStringifyOptions
+  ) => NativeStringifyStream;
+  PushParser: new (options?: ParserOptions) => Parser;
+  stringifyAsync: (
+    value: unknown,
+    options?: AsyncStringifyOptions
+  ) => Promise<SerializedString | SerializedWithAttachments>;
+  parseAsync: (text: string, options?: ParseOptions) => Promise<unknown>;
+  parseLazy: (text: string) => unknown;
+  stringifyBinary: (value: unknown, options?: BinaryStringifyOptions) => Buffer;
+  parseBinary: (data: Uint8Array | ArrayBuffer, options?: BinaryParseOptions) => unknown;
+  registerShape: (keys: ReadonlyArray<string>) => void;
+  Dictionary: new (strings: ReadonlyArray<string>) => Dictionary;
+  trainDictionary: (
+    samples: ReadonlyArray<unknown>,
+    options?: TrainDictionaryOptions
+  ) => Dictionary;
+  diff: (prev: unknown, next: unknown) => SerializedString;
+  applyPatch: (target: unknown, patch: SerializedString) => unknown;
+  enableStats: (enabled: boolean) => void;
+  getStats: () => SerializationStats;
+  resetStats: () => void;
 };
 
+const DEFAULT_CHUNK_SIZE = 64 * 1024;
+
 const require = createRequire(import.meta.url);
 const __dirname = dirname(fileURLToPath(import.meta.url));
 const nativePath = join(__dirname, '..', 'build', 'Release', 'bas_serde.node');
@@ -41,10 +166,144 @@ function loadNative(): NativeModule {
   }
 }
 
-export function stringify(value: unknown, options?: StringifyOptions): SerializedString {
+export function stringify(
+  value: unknown,
+  options: ExternalStringifyOptions
+): SerializedWithAttachments;
+export function stringify(value: unknown, options: CompressedStringifyOptions): Buffer;
+export function stringify(value: unknown, options?: StringifyOptions): SerializedString;
+export function stringify(
+  value: unknown,
+  options?: StringifyOptions
+): SerializedString | SerializedWithAttachments | Buffer {
   return loadNative().stringify(value, options);
 }
 
-export function parse(text: SerializedString, options?: ParseOptions): unknown {
+export function parse(text: ParseInput, options?: ParseOptions): unknown {
   return loadNative().parse(text, options);
 }
+
+export function createStringifyStream(
+  value: unknown,
+  options?: StreamStringifyOptions
+): Readable {
+  const encoder = new (loadNative().StringifyStream)(value, options);
+  return new Readable({
+    highWaterMark: options?.highWaterMark ?? DEFAULT_CHUNK_SIZE,
+    read() {
+      try {
+        this.push(encoder.read());
+      } catch (err) {
+        this.destroy(err instanceof Error ? err : new Error(String(err)));
+      }
+    },
+  });
+}
+
+export function stringifyToFd(
+  value: unknown,
+  fd: number,
+  options?: StreamStringifyOptions
+): number {
+  return loadNative().stringifyToFd(value, fd, options);
+}
+
+function isHighSurrogate(code: number): boolean {
+  return code >= 0xd800 && code <= 0xdbff;
+}
+
+export function createParser(options?: ParserOptions): Parser {
+  const native = new (loadNative().PushParser)(options);
+  // A string chunk may end between the halves of a surrogate pair; hold the
+  // high half back so it is converted to UTF-8 together with the low half.
+  let held = '';
+  return {
+    write(chunk) {
+      if (typeof chunk === 'string') {
+        chunk = held + chunk;
+        held = '';
+        if (chunk.length > 0 && isHighSurrogate(chunk.charCodeAt(chunk.length - 1))) {
+          held = chunk.slice(-1);
+          chunk = chunk.slice(0, -1);
+        }
+      }
+      native.write(chunk);
+    },
+    end() {
+      if (held) {
+        native.write(held);
+        held = '';
+      }
+      return native.end();
+    },
+  };
+}
+
+export function stringifyAsync(
+  value: unknown,
+  options: AsyncStringifyOptions & { attachments: 'external' }
+): Promise<SerializedWithAttachments>;
+export function stringifyAsync(
+  value: unknown,
+  options?: AsyncStringifyOptions
+): Promise<SerializedString>;
+export function stringifyAsync(
+  value: unknown,
+  options?: AsyncStringifyOptions
+): Promise<SerializedString | SerializedWithAttachments> {
+  return loadNative().stringifyAsync(value, options);
+}
+
+export function parseAsync(text: SerializedString, options?: ParseOptions): Promise<unknown> {
+  return loadNative().parseAsync(text, options);
+}
+
+export function parseLazy(text: SerializedString): unknown {
+  return loadNative().parseLazy(text);
+}
+
+export function stringifyBinary(value: unknown, options?: BinaryStringifyOptions): Buffer {
+  return loadNative().stringifyBinary(value, options);
+}
+
+export function parseBinary(
+  data: Uint8Array | ArrayBuffer,
+  options?: BinaryParseOptions
+): unknown {
+  return loadNative().parseBinary(data, options);
+}
+
+export function registerShape(keys: ReadonlyArray<string>): void {
+  loadNative().registerShape(keys);
+}
+
+export function trainDictionary(
+  samples: ReadonlyArray<unknown>,
+  options?: TrainDictionaryOptions
+): Dictionary {
+  return loadNative().trainDictionary(samples, options);
+}
+
+export function createDictionary(strings: ReadonlyArray<string>): Dictionary {
+  return new (loadNative().Dictionary)(strings);
+}
+
+export function diff(prev: unknown, next: unknown): SerializedString {
+  return loadNative().diff(prev, next);
+}
+
+export function applyPatch(target: unknown, patch: SerializedString): unknown {
+  return loadNative().applyPatch(target, patch);
+}
+
+export function enableStats(enabled = true): void {
+  loadNative().enableStats(enabled);
+}
+
+export function getStats(): SerializationStats {
+  return loadNative().getStats();
+}
+
+export function resetStats(): void {
+  loadNative().resetStats();
+}
@@ -1,9 +1,36 @@
+#include <cmath>
+
+#include "async_worker.h"
+#include "compression.h"
 #include "decode.h"
+#include "dictionary.h"
+#include "diff.h"
 #include "encode.h"
+#include "lazy.h"
 #include "serde_utils.h"
+#include "shapes.h"
+#include "stream_decoder.h"
+#include "stream_encoder.h"
 
 namespace bas_serde {
 
+// Reads the `attachments` mode of the text encoders.
+static void ReadAttachmentMode(const Napi::CallbackInfo &info, EncodeContext &ctx) {
+  if (info.Length() < 2 || !info[1].IsObject()) {
+    return;
+  }
+  Napi::Object options = info[1].As<Napi::Object>();
+  if (options.Has("attachments")) {
+    Napi::Value modeVal = options.Get("attachments");
+    std::string mode = modeVal.IsString() ? modeVal.As<Napi::String>().Utf8Value() : "";
+    if (mode == "external") {
+      ctx.attachments = Napi::Array::New(info.Env());
+    } else if (!modeVal.IsUndefined() && mode != "inline") {
+      throw Napi::TypeError::New(info.Env(), "attachments must be 'inline' or 'external'");
+    }
+  }
+}
+
 Napi::Value NativeStringify(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
   if (info.Length() < 1) {
@@ -12,77 +39,295 @@ Napi::Value NativeStringify(const Napi::CallbackInfo &info) {
 
   // Parse stringify options.
   Replacer replacer;
-  EncodeContext ctx;
-
-  if (info.Length() >= 2 && info[1].IsObject()) {
-    Napi::Object options = info[1].As<Napi::Object>();
-    if (options.Has("replacer")) {
-      Napi::Value replVal = options.Get("replacer");
-      if (!replVal.IsUndefined() && !replVal.IsNull()) {
-        if (!replVal.IsFunction()) {
-          throw Napi::TypeError::New(env, "replacer must be a function");
-        }
-        replacer.enabled = true;
-        replacer.fn = replVal.As<Napi::Function>();
-      }
-    }
-    if (options.Has("circularReferences")) {
-      Napi::Value circularVal = options.Get("circularReferences");
-      if (circularVal.IsBoolean()) {
-        ctx.allowCircular = circularVal.ToBoolean().Value();
-      }
+  EncodeContext ctx(GetMutableAddonData(env));
+  ReadStringifyOptions(info[1], replacer, ctx);
+  ReadAttachmentMode(info, ctx);
+  Compression compression = ReadCompression(info[1]);
+  if (compression != Compression::kNone) {
+    if (!ctx.attachments.IsEmpty()) {
+      throw Napi::TypeError::New(env, "compress cannot be used with external attachments");
     }
+    return StringifyCompressed(env, info[0], ctx, replacer, compression);
+  }
+
+  // Serialize straight to JSON text.
+  EncodeValue(env, info[0], ctx, replacer, true);
+  Napi::String text;
+  {
+    StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+    text = Napi::String::New(env, ctx.out.Data(), ctx.out.Size());
+  }
+  if (ctx.attachments.IsEmpty()) {
+    return text;
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("text", text);
+  result.Set("attachments", ctx.attachments);
+  return result;
+}
+
+// Writes the text chunk by chunk, so the whole output never sits in memory.
+Napi::Value NativeStringifyToFd(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 2) {
+    throw Napi::TypeError::New(env, "Expected a value and a file descriptor");
+  }
+  double fd = info[1].IsNumber() ? info[1].As<Napi::Number>().DoubleValue() : -1;
+  if (!(fd >= 0 && fd <= INT32_MAX) || std::floor(fd) != fd) {
+    throw Napi::TypeError::New(env, "fd must be a file descriptor");
   }
 
-  // Serialize to wrapper graph, then JSON.stringify.
-  Napi::Value encoded = EncodeValue(env, info[0], ctx, replacer, true);
-  Napi::Object json = env.Global().Get("JSON").As<Napi::Object>();
-  Napi::Function stringify = json.Get("stringify").As<Napi::Function>();
-  return stringify.Call(json, {encoded});
+  Replacer replacer;
+  EncodeContext ctx(GetMutableAddonData(env));
+  ReadStringifyOptions(info[2], replacer, ctx);
+  size_t chunkSize = ReadChunkSize(info[2]);
+  size_t written =
+      StringifyToFd(env, info[0], static_cast<int>(fd), ctx, replacer, chunkSize);
+  return Napi::Number::New(env, static_cast<double>(written));
+}
+
+// Reads a Buffer/Uint8Array or ArrayBuffer argument; false for anything else.
+static bool GetBytes(const Napi::Value &value, const uint8_t **bytes, size_t *len) {
+  if (value.IsArrayBuffer()) {
+    Napi::ArrayBuffer buf = value.As<Napi::ArrayBuffer>();
+    *bytes = static_cast<const uint8_t *>(buf.Data());
+    *len = buf.ByteLength();
+    return true;
+  }
+  if (value.IsTypedArray() &&
+      value.As<Napi::TypedArray>().TypedArrayType() == napi_uint8_array) {
+    Napi::Uint8Array view = value.As<Napi::Uint8Array>();
+    *bytes = view.Data();
+    *len = view.ByteLength();
+    return true;
+  }
+  return false;
 }
 
 Napi::Value NativeParse(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  const uint8_t *compressed = nullptr;
+  size_t compressedLen = 0;
+  if (info.Length() < 1 ||
+      !(info[0].IsString() || GetBytes(info[0], &compressed, &compressedLen))) {
+    throw Napi::TypeError::New(env, "Expected a JSON string or compressed Buffer to parse");
+  }
+
+  // Parse reviver and attachment options.
+  AddonData &data = GetMutableAddonData(env);
+  DecodeContext ctx(data);
+  Reviver reviver;
+  ReadParseOptions(info[1], reviver, ctx);
+
+  if (compressed != nullptr) {
+    if (!reviver.enabled || reviver.decoded) {
+      return ParseCompressed(env, compressed, compressedLen, data.ctors, reviver, ctx);
+    }
+    std::string text;
+    {
+      StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+      InflateText(env, compressed, compressedLen, text);
+    }
+    Napi::Value parsed = data.jsonParse.Call(
+        data.json.Value(), {Napi::String::New(env, text.data(), text.size())});
+    return DecodeValue(env, parsed, data.ctors, reviver, ctx, true);
+  }
+
+  if (!reviver.enabled || reviver.decoded) {
+    std::string text;
+    {
+      StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+      text = info[0].As<Napi::String>().Utf8Value();
+    }
+    return ParseText(env, text.data(), text.size(), data.ctors, reviver, ctx);
+  }
+
+  // A plain reviver sees raw JSON.parse nodes, so keep the tree path for it.
+  Napi::Value parsed;
+  {
+    StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+    parsed = data.jsonParse.Call(data.json.Value(), {info[0]});
+  }
+  return DecodeValue(env, parsed, data.ctors, reviver, ctx, true);
+}
+
+Napi::Value NativeParseLazy(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
   if (info.Length() < 1 || !info[0].IsString()) {
     throw Napi::TypeError::New(env, "Expected a JSON string to parse");
   }
+  DecodeContext ctx(GetMutableAddonData(env));
+  std::string text;
+  {
+    StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+    text = info[0].As<Napi::String>().Utf8Value();
+  }
+  return LazyDocument::Parse(env, std::move(text), ctx);
+}
 
-  // Parse reviver options.
-  Reviver reviver;
-  if (info.Length() >= 2 && info[1].IsObject()) {
-    Napi::Object options = info[1].As<Napi::Object>();
-    if (options.Has("reviver")) {
-      Napi::Value revVal = options.Get("reviver");
-      if (!revVal.IsUndefined() && !revVal.IsNull()) {
-        if (!revVal.IsFunction()) {
-          throw Napi::TypeError::New(env, "reviver must be a function");
-        }
-        reviver.enabled = true;
-        reviver.fn = revVal.As<Napi::Function>();
-      }
+// Snapshots the value on the JS thread (strings and binary payloads are copied)
+// and formats the text on the threadpool.
+Napi::Value NativeStringifyAsync(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  try {
+    if (info.Length() < 1) {
+      throw Napi::TypeError::New(env, "Expected a value to stringify");
     }
+    Replacer replacer;
+    EncodeContext ctx(GetMutableAddonData(env));
+    ReadStringifyOptions(info[1], replacer, ctx);
+    ReadAttachmentMode(info, ctx);
+    ctx.out.Defer();
+    EncodeValue(env, info[0], ctx, replacer, true);
+
+    StringifyWorker *worker = new StringifyWorker(env, std::move(ctx.out), ctx.attachments);
+    worker->Queue();
+    return worker->Promise();
+  } catch (const Napi::Error &error) {
+    Napi::Promise::Deferred failed = Napi::Promise::Deferred::New(env);
+    failed.Reject(error.Value());
+    return failed.Promise();
+  }
+}
+
+Napi::Value NativeParseAsync(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  try {
+    if (info.Length() < 1 || !info[0].IsString()) {
+      throw Napi::TypeError::New(env, "Expected a JSON string to parse");
+    }
+    DecodeContext ctx(GetMutableAddonData(env));
+    ctx.stats.Discard();  // the worker counts the decode
+    Reviver reviver;
+    ReadParseOptions(info[1], reviver, ctx);
+
+    ParseWorker *worker =
+        new ParseWorker(env, info[0].As<Napi::String>().Utf8Value(), reviver, ctx.attachments,
+                        HoldDictionary(info[1]), ctx.maxDepth);
+    worker->Queue();
+    return worker->Promise();
+  } catch (const Napi::Error &error) {
+    Napi::Promise::Deferred failed = Napi::Promise::Deferred::New(env);
+    failed.Reject(error.Value());
+    return failed.Promise();
+  }
+}
+
+Napi::Value NativeStringifyBinary(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 1) {
+    throw Napi::TypeError::New(env, "Expected a value to stringify");
+  }
+
+  Replacer replacer;
+  EncodeContext ctx(GetMutableAddonData(env));
+  ReadStringifyOptions(info[1], replacer, ctx);
+
+  ctx.bytes.Byte(kBinaryMagic);
+  ctx.bytes.Byte(kBinaryVersion);
+  uint8_t flags = ctx.allowCircular ? kBinaryFlagIds : 0;
+  if (ctx.dictionary != nullptr) flags |= kBinaryFlagDictionary;
+  ctx.bytes.Byte(flags);
+  if (ctx.dictionary != nullptr) ctx.bytes.Uint32(ctx.dictionary->Checksum());
+  EncodeBinaryValue(env, info[0], ctx, replacer, true);
+  StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+  return Napi::Buffer<char>::Copy(env, ctx.bytes.Data(), ctx.bytes.Size());
+}
+
+Napi::Value NativeParseBinary(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  const uint8_t *bytes;
+  size_t len;
+  if (info.Length() < 1 || !GetBytes(info[0], &bytes, &len)) {
+    throw Napi::TypeError::New(env, "Expected a Buffer to parse");
   }
 
-  // JSON.parse then decode wrappers.
-  Napi::Object json = env.Global().Get("JSON").As<Napi::Object>();
-  Napi::Function parse = json.Get("parse").As<Napi::Function>();
-  Napi::Value parsed = parse.Call(json, {info[0]});
+  AddonData &data = GetMutableAddonData(env);
+  DecodeContext ctx(data);
+  ctx.maxDepth = ReadMaxDepth(info[1]);
+  ctx.dictionary = ReadDictionary(info[1]);
+  return ParseBinaryPayload(env, bytes, len, data.ctors, ctx);
+}
+
+Napi::Value NativeRegisterShape(const Napi::CallbackInfo &info) {
+  RegisterShape(info.Env(), info[0]);
+  return info.Env().Undefined();
+}
+
+Napi::Value NativeTrainDictionary(const Napi::CallbackInfo &info) {
+  return TrainDictionary(info.Env(), info[0], info[1]);
+}
+
+// Writes the patch from the first value to the second. Patches are not
+// counted as stringify calls.
+Napi::Value NativeDiff(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 2) {
+    throw Napi::TypeError::New(env, "Expected the previous and next values to diff");
+  }
+  EncodeContext ctx(GetMutableAddonData(env));
+  ctx.stats.Discard();
+  DiffValues(env, info[0], info[1], ctx);
+  return Napi::String::New(env, ctx.out.Data(), ctx.out.Size());
+}
 
-  Ctors ctors{
-      env.Global().Get("Map").As<Napi::Function>(),
-      env.Global().Get("Set").As<Napi::Function>(),
-      env.Global().Get("Date").As<Napi::Function>(),
-      env.Global().Get("RegExp").As<Napi::Function>(),
-      env.Global().Get("BigInt").As<Napi::Function>(),
-  };
+Napi::Value NativeApplyPatch(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 2 || !info[1].IsString()) {
+    throw Napi::TypeError::New(env, "Expected a patch string to apply");
+  }
+  DecodeContext ctx(GetMutableAddonData(env));
+  ctx.stats.Discard();
+  std::string patch = info[1].As<Napi::String>().Utf8Value();
+  return ApplyPatch(env, info[0], patch.data(), patch.size(), ctx);
+}
+
+// Turns statistics collection on or off for this environment. Totals are kept
+// until resetStats(); calls already running keep their setting.
+Napi::Value NativeEnableStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  AddonData &data = GetMutableAddonData(env);
+  data.statsEnabled = info.Length() < 1 || info[0].ToBoolean().Value();
+  return env.Undefined();
+}
+
+Napi::Value NativeGetStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  const AddonData &data = GetAddonData(env);
+  Napi::Object stats = Napi::Object::New(env);
+  stats.Set("enabled", Napi::Boolean::New(env, BAS_SERDE_STATS && data.statsEnabled));
+  stats.Set("stringify", data.encodeStats.ToObject(env, "replacerCalls"));
+  stats.Set("parse", data.decodeStats.ToObject(env, "reviverCalls"));
+  return stats;
+}
 
-  DecodeContext ctx;
-  return DecodeValue(env, parsed, ctors, reviver, ctx, true);
+Napi::Value NativeResetStats(const Napi::CallbackInfo &info) {
+  AddonData &data = GetMutableAddonData(info.Env());
+  data.encodeStats = Stats();
+  data.decodeStats = Stats();
+  return info.Env().Undefined();
 }
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
+  InitAddonData(env);
   exports.Set("stringify", Napi::Function::New(env, NativeStringify));
   exports.Set("parse", Napi::Function::New(env, NativeParse));
+  exports.Set("stringifyToFd", Napi::Function::New(env, NativeStringifyToFd));
+  exports.Set("StringifyStream", StringifyStream::Init(env));
+  exports.Set("PushParser", PushParser::Init(env));
+  exports.Set("stringifyAsync", Napi::Function::New(env, NativeStringifyAsync));
+  exports.Set("parseAsync", Napi::Function::New(env, NativeParseAsync));
+  exports.Set("parseLazy", Napi::Function::New(env, NativeParseLazy));
+  exports.Set("stringifyBinary", Napi::Function::New(env, NativeStringifyBinary));
+  exports.Set("parseBinary", Napi::Function::New(env, NativeParseBinary));
+  exports.Set("registerShape", Napi::Function::New(env, NativeRegisterShape));
+  exports.Set("Dictionary", Dictionary::Init(env));
+  exports.Set("trainDictionary", Napi::Function::New(env, NativeTrainDictionary));
+  exports.Set("diff", Napi::Function::New(env, NativeDiff));
+  exports.Set("applyPatch", Napi::Function::New(env, NativeApplyPatch));
+  exports.Set("enableStats", Napi::Function::New(env, NativeEnableStats));
+  exports.Set("getStats", Napi::Function::New(env, NativeGetStats));
+  exports.Set("resetStats", Napi::Function::New(env, NativeResetStats));
   return exports;
 }
 
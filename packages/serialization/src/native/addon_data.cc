@@ -0,0 +1,123 @@
+#include "addon_data.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "serde_utils.h"
+
+namespace bas_serde {
+
+// Indexed by KeyId.
+constexpr const char *kKeyNames[] = {
+    kTypeKey, kValueKey, kIdKey,     kSourceKey, kFlagsKey, kNameKey,
+    kMessageKey, kStackKey, kDescriptionKey, kLengthKey, "done", "next",
+    "values", "entries", "add", "set", "get", "has", "delete", "splice",
+    "toISOString",
+};
+static_assert(sizeof(kKeyNames) / sizeof(kKeyNames[0]) ==
+                  static_cast<size_t>(KeyId::kCount),
+              "kKeyNames must match KeyId");
+
+constexpr const char kPackNumbersSource[] =
+    "(function packNumbers(array) {\n"
+    "  const length = array.length;\n"
+    "  if (typeof array[0] !== 'number') return undefined;\n"
+    "  const packed = new Float64Array(length);\n"
+    "  for (let i = 0; i < length; i++) {\n"
+    "    const value = array[i];\n"
+    "    if (typeof value !== 'number') return undefined;\n"
+    "    packed[i] = value;\n"
+    "  }\n"
+    "  return packed;\n"
+    "})";
+
+Napi::Value RunScript(const Napi::Env &env, const std::string &source) {
+  napi_value script;
+  napi_value result;
+  if (napi_create_string_utf8(env, source.data(), source.size(), &script) != napi_ok ||
+      napi_run_script(env, script, &result) != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::Error::New(env, "napi_run_script failed: " + message);
+  }
+  return Napi::Value(env, result);
+}
+
+static Napi::FunctionReference GlobalFunction(const Napi::Object &global,
+                                              const char *name) {
+  Napi::Value value = global.Get(name);
+  if (!value.IsFunction()) return Napi::FunctionReference();
+  return Napi::Persistent(value.As<Napi::Function>());
+}
+
+void InitAddonData(const Napi::Env &env) {
+  Napi::Object global = env.Global();
+  AddonData *data = new AddonData();
+  data->ctors.mapCtor = GlobalFunction(global, "Map");
+  data->ctors.setCtor = GlobalFunction(global, "Set");
+  data->ctors.dateCtor = GlobalFunction(global, "Date");
+  data->ctors.regexpCtor = GlobalFunction(global, "RegExp");
+  data->ctors.bigintCtor = GlobalFunction(global, "BigInt");
+  data->errorCtor = GlobalFunction(global, "Error");
+  data->bufferCtor = GlobalFunction(global, "Buffer");
+  if (!data->bufferCtor.IsEmpty()) {
+    data->bufferFrom =
+        Napi::Persistent(data->bufferCtor.Value().Get("from").As<Napi::Function>());
+  }
+
+  Napi::Object objectCtor = global.Get("Object").As<Napi::Object>();
+  data->objectPrototype = Napi::Persistent(objectCtor.Get("prototype").As<Napi::Object>());
+  data->getOwnPropertySymbols =
+      Napi::Persistent(objectCtor.Get("getOwnPropertySymbols").As<Napi::Function>());
+
+  Napi::Object symbolCtor = global.Get("Symbol").As<Napi::Object>();
+  data->symbolCtor = Napi::Persistent(symbolCtor);
+  data->symbolFor = Napi::Persistent(symbolCtor.Get("for").As<Napi::Function>());
+  data->symbolKeyFor = Napi::Persistent(symbolCtor.Get("keyFor").As<Napi::Function>());
+
+  Napi::Object json = global.Get("JSON").As<Napi::Object>();
+  data->json = Napi::Persistent(json);
+  data->jsonParse = Napi::Persistent(json.Get("parse").As<Napi::Function>());
+
+  Napi::Object arrayCtor = global.Get("Array").As<Napi::Object>();
+  data->arrayFrom = Napi::Persistent(arrayCtor.Get("from").As<Napi::Function>());
+  Napi::Object arrayPrototype = arrayCtor.Get("prototype").As<Napi::Object>();
+  data->arrayPush = Napi::Persistent(arrayPrototype.Get("push").As<Napi::Function>());
+  data->packNumbers =
+      Napi::Persistent(RunScript(env, kPackNumbersSource).As<Napi::Function>());
+
+  Napi::Array keys = Napi::Array::New(env, static_cast<size_t>(KeyId::kCount));
+  for (uint32_t i = 0; i < static_cast<uint32_t>(KeyId::kCount); i++) {
+    keys.Set(i, Napi::String::New(env, kKeyNames[i]));
+  }
+  data->keys = Napi::Persistent(static_cast<Napi::Object>(keys));
+
+  env.SetInstanceData(data);
+}
+
+const AddonData &GetAddonData(const Napi::Env &env) {
+  return *env.GetInstanceData<AddonData>();
+}
+
+AddonData &GetMutableAddonData(const Napi::Env &env) {
+  return *env.GetInstanceData<AddonData>();
+}
+
+napi_value KeyCache::Get(const Napi::Env &env, KeyId id) {
+  size_t index = static_cast<size_t>(id);
+  if (keys_[index] != nullptr) return keys_[index];
+  if (holder_ == nullptr) holder_ = data_.keys.Value();
+  napi_status status =
+      napi_get_element(env, holder_, static_cast<uint32_t>(index), &keys_[index]);
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "napi_get_element failed: " + message);
+  }
+  return keys_[index];
+}
+
+void KeyCache::Reset() {
+  holder_ = nullptr;
+  std::fill(std::begin(keys_), std::end(keys_), nullptr);
+}
+
+}  // namespace bas_serde
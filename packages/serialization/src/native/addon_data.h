@@ -0,0 +1,133 @@
+#ifndef BAS_UTILS_SERIALIZATION_ADDON_DATA_H
+#define BAS_UTILS_SERIALIZATION_ADDON_DATA_H
+
+#include <napi.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+namespace bas_serde {
+
+struct Ctors {
+  Napi::FunctionReference mapCtor;
+  Napi::FunctionReference setCtor;
+  Napi::FunctionReference dateCtor;
+  Napi::FunctionReference regexpCtor;
+  Napi::FunctionReference bigintCtor;
+};
+
+// Property keys the codec reads or writes on every call.
+enum class KeyId : uint8_t {
+  kType,
+  kValue,
+  kId,
+  kSource,
+  kFlags,
+  kName,
+  kMessage,
+  kStack,
+  kDescription,
+  kLength,
+  kDone,
+  kNext,
+  kValues,
+  kEntries,
+  kAdd,
+  kSet,
+  kGet,
+  kHas,
+  kDelete,
+  kSplice,
+  kToISOString,
+  kCount,
+};
+
+// An object layout registered with registerShape.
+struct Shape {
+  std::vector<std::string> keys;       // UTF-8, compared with decoded keys
+  std::vector<std::string> fragments;  // each key as the encoder writes it: `"key":`
+  // (v0, v1, ...) => ({key0: v0, key1: v1, ...}): objects built from one literal
+  // share a hidden class.
+  Napi::FunctionReference create;
+  // The shape trie node reached after each number of keys, from the root on.
+  std::vector<size_t> nodes;
+};
+
+constexpr size_t kNoShape = static_cast<size_t>(-1);
+
+// A node of the trie over registered key lists: the nodes of the next keys, the
+// first shape registered through it and the shape that ends at it.
+struct ShapeNode {
+  std::map<std::string, size_t, std::less<>> next;
+  size_t shape = kNoShape;
+  size_t exact = kNoShape;
+};
+
+// Per-environment state, created once by Init and stored as instance data:
+// the constructors values are classified by and the interned key strings.
+struct AddonData {
+  Ctors ctors;
+  Napi::FunctionReference errorCtor;
+  Napi::FunctionReference bufferCtor;
+  Napi::FunctionReference bufferFrom;
+  Napi::ObjectReference objectPrototype;
+  Napi::ObjectReference symbolCtor;
+  Napi::FunctionReference symbolFor;
+  Napi::FunctionReference symbolKeyFor;
+  Napi::FunctionReference getOwnPropertySymbols;
+  Napi::ObjectReference json;
+  Napi::FunctionReference jsonParse;
+  Napi::FunctionReference arrayFrom;
+  Napi::FunctionReference arrayPush;
+  // packNumbers(array): a Float64Array copy of a dense all-number array, or
+  // undefined. Written in JS so the scan is one call, not one per element.
+  Napi::FunctionReference packNumbers;
+  // Registered shapes, indexed by shape id. matchShape(object) returns
+  // [id, ...values] when the object's keys are exactly a shape's, in order.
+  std::vector<Shape> shapes;
+  std::vector<ShapeNode> shapeNodes;  // the root first, once a shape is registered
+  Napi::FunctionReference matchShape;
+  Napi::FunctionReference addShape;
+  // The Dictionary class, to recognize the `dictionary` option.
+  Napi::FunctionReference dictionaryCtor;
+  // Array of key strings indexed by KeyId. Primitives cannot be referenced
+  // directly before N-API 10, so they are held through this array.
+  Napi::ObjectReference keys;
+  // enableStats(): calls add their counters to these totals, read by getStats().
+  bool statsEnabled = false;
+  Stats encodeStats;
+  Stats decodeStats;
+};
+
+void InitAddonData(const Napi::Env &env);
+const AddonData &GetAddonData(const Napi::Env &env);
+// For the callers that change the data: the options that register shapes or
+// switch stats on, and the contexts that add to the stats totals.
+AddonData &GetMutableAddonData(const Napi::Env &env);
+// Evaluates a script in the current context; used for the few helpers that
+// are cheaper as one JS call than as a sequence of N-API calls.
+Napi::Value RunScript(const Napi::Env &env, const std::string &source);
+
+// Hands out interned keys for one native call, loading each on first use.
+class KeyCache {
+ public:
+  explicit KeyCache(const AddonData &data) : data_(data) {}
+
+  napi_value Get(const Napi::Env &env, KeyId id);
+  // Forgets the loaded handles, for a cache reused by a later native call.
+  void Reset();
+
+ private:
+  const AddonData &data_;
+  napi_value holder_ = nullptr;
+  napi_value keys_[static_cast<size_t>(KeyId::kCount)] = {};
+};
+
+}  // namespace bas_serde
+
+#endif
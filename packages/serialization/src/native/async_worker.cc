@@ -0,0 +1,105 @@
+#include "async_worker.h"
+
+#include "decode.h"
+#include "dictionary.h"
+
+namespace bas_serde {
+
+StringifyWorker::StringifyWorker(const Napi::Env &env, JsonWriter &&out,
+                                 const Napi::Array &attachments)
+    : Napi::AsyncWorker(env, "bas_serde.stringifyAsync"),
+      deferred_(Napi::Promise::Deferred::New(env)),
+      out_(std::move(out)) {
+  if (!attachments.IsEmpty()) {
+    attachments_ = Napi::Persistent(static_cast<Napi::Object>(attachments));
+  }
+}
+
+void StringifyWorker::Execute() {
+  StatsTimer timer(&pool_, &Stats::textNs);
+  out_.Render();
+}
+
+void StringifyWorker::OnOK() {
+  Napi::Env env = Env();
+  Napi::String text;
+  {
+    StatsTimer timer(&pool_, &Stats::textNs);
+    text = Napi::String::New(env, out_.Data(), out_.Size());
+  }
+  AddonData &data = GetMutableAddonData(env);
+  if (data.statsEnabled) {
+    pool_.totalNs = pool_.textNs;
+    data.encodeStats.Add(pool_);
+  }
+  if (attachments_.IsEmpty()) {
+    deferred_.Resolve(text);
+    return;
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("text", text);
+  result.Set("attachments", attachments_.Value());
+  deferred_.Resolve(result);
+}
+
+void StringifyWorker::OnError(const Napi::Error &error) { deferred_.Reject(error.Value()); }
+
+ParseWorker::ParseWorker(const Napi::Env &env, std::string text, const Reviver &reviver,
+                         const Napi::Array &attachments, Napi::ObjectReference dictionary,
+                         size_t maxDepth)
+    : Napi::AsyncWorker(env, "bas_serde.parseAsync"),
+      deferred_(Napi::Promise::Deferred::New(env)),
+      text_(std::move(text)),
+      dictionary_(std::move(dictionary)),
+      maxDepth_(maxDepth) {
+  if (reviver.enabled) {
+    reviver_ = Napi::Persistent(reviver.fn);
+    options_ = reviver;
+    options_.fn = Napi::Function();  // the handle does not outlive this call
+  }
+  if (!attachments.IsEmpty()) {
+    attachments_ = Napi::Persistent(static_cast<Napi::Object>(attachments));
+  }
+}
+
+void ParseWorker::Execute() {
+  if (options_.enabled && !options_.decoded) return;
+  StatsTimer timer(&pool_, &Stats::textNs);
+  try {
+    tape_.Build(text_.data(), text_.size());
+  } catch (const JsonSyntaxError &err) {
+    syntaxError_ = err.what();
+  }
+}
+
+void ParseWorker::OnOK() {
+  Napi::Env env = Env();
+  AddonData &data = GetMutableAddonData(env);
+  try {
+    if (!syntaxError_.empty()) {
+      Napi::Function ctor = env.Global().Get("SyntaxError").As<Napi::Function>();
+      deferred_.Reject(ctor.New({Napi::String::New(env, syntaxError_)}));
+      return;
+    }
+    DecodeContext ctx(data);
+    ctx.maxDepth = maxDepth_;
+    pool_.totalNs = pool_.textNs;
+    SERDE_STAT(ctx.stats, Add(pool_));
+    if (!attachments_.IsEmpty()) ctx.attachments = attachments_.Value().As<Napi::Array>();
+    if (!dictionary_.IsEmpty()) ctx.dictionary = Dictionary::Unwrap(dictionary_.Value());
+    if (!reviver_.IsEmpty()) options_.fn = reviver_.Value();
+    if (!options_.enabled || options_.decoded) {
+      deferred_.Resolve(ParseTape(env, tape_, data.ctors, options_, ctx));
+      return;
+    }
+    Napi::Value parsed =
+        data.jsonParse.Call(data.json.Value(), {Napi::String::New(env, text_)});
+    deferred_.Resolve(DecodeValue(env, parsed, data.ctors, options_, ctx, true));
+  } catch (const Napi::Error &error) {
+    deferred_.Reject(error.Value());
+  }
+}
+
+void ParseWorker::OnError(const Napi::Error &error) { deferred_.Reject(error.Value()); }
+
+}  // namespace bas_serde
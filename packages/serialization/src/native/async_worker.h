@@ -0,0 +1,63 @@
+#ifndef BAS_UTILS_SERIALIZATION_ASYNC_WORKER_H
+#define BAS_UTILS_SERIALIZATION_ASYNC_WORKER_H
+
+#include <string>
+
+#include "json_reader.h"
+#include "serde_utils.h"
+
+namespace bas_serde {
+
+// Formats a deferred JsonWriter on the libuv threadpool, then resolves with the
+// text (or { text, attachments } when attachments were collected).
+class StringifyWorker : public Napi::AsyncWorker {
+ public:
+  StringifyWorker(const Napi::Env &env, JsonWriter &&out, const Napi::Array &attachments);
+
+  Napi::Promise Promise() const { return deferred_.Promise(); }
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error &error) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  JsonWriter out_;
+  Napi::ObjectReference attachments_;
+  Stats pool_;  // time spent on the threadpool, added to the totals in OnOK
+};
+
+// Tokenizes JSON text into a JsonTape on the libuv threadpool, then builds the
+// final values on the JS thread. With a plain reviver the whole decode stays on
+// the JS thread, since the reviver sees JSON.parse nodes; a decoded-mode one
+// runs while the tape is decoded.
+class ParseWorker : public Napi::AsyncWorker {
+ public:
+  ParseWorker(const Napi::Env &env, std::string text, const Reviver &reviver,
+              const Napi::Array &attachments, Napi::ObjectReference dictionary,
+              size_t maxDepth);
+
+  Napi::Promise Promise() const { return deferred_.Promise(); }
+
+ protected:
+  void Execute() override;
+  void OnOK() override;
+  void OnError(const Napi::Error &error) override;
+
+ private:
+  Napi::Promise::Deferred deferred_;
+  std::string text_;
+  JsonTape tape_;
+  std::string syntaxError_;
+  Napi::FunctionReference reviver_;
+  Reviver options_;  // reviver settings; `fn` is restored from reviver_
+  Napi::ObjectReference attachments_;
+  Napi::ObjectReference dictionary_;
+  size_t maxDepth_;
+  Stats pool_;  // time spent on the threadpool, added to the call's stats in OnOK
+};
+
+}  // namespace bas_serde
+
+#endif
@@ -0,0 +1,281 @@
+#include "base64.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BAS_SERDE_BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bas_serde {
+
+constexpr const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Sextet value per input byte; 0xFF marks bytes outside the alphabet.
+struct DecodeTable {
+  uint8_t values[256];
+  constexpr DecodeTable() : values() {
+    for (int i = 0; i < 256; i++) values[i] = 0xFF;
+    for (int i = 0; i < 64; i++) {
+      values[static_cast<unsigned char>(kBase64Alphabet[i])] = static_cast<uint8_t>(i);
+    }
+  }
+};
+constexpr DecodeTable kDecodeTable;
+
+size_t Base64EncodedLength(size_t len) { return ((len + 2) / 3) * 4; }
+
+size_t Base64DecodedLength(const char *input, size_t len) {
+  size_t out = (len / 4) * 3;
+  if (len >= 4 && len % 4 == 0) {
+    if (input[len - 1] == '=') out--;
+    if (input[len - 2] == '=') out--;
+  }
+  return out;
+}
+
+// Scalar kernels; also finish whatever tail the vector kernels leave.
+
+static void EncodeScalar(const uint8_t *data, size_t len, char *out) {
+  size_t i = 0;
+  for (; i + 2 < len; i += 3) {
+    uint32_t triple = (static_cast<uint32_t>(data[i]) << 16) |
+                      (static_cast<uint32_t>(data[i + 1]) << 8) |
+                      static_cast<uint32_t>(data[i + 2]);
+    out[0] = kBase64Alphabet[(triple >> 18) & 0x3F];
+    out[1] = kBase64Alphabet[(triple >> 12) & 0x3F];
+    out[2] = kBase64Alphabet[(triple >> 6) & 0x3F];
+    out[3] = kBase64Alphabet[triple & 0x3F];
+    out += 4;
+  }
+
+  if (i < len) {
+    uint32_t triple = static_cast<uint32_t>(data[i]) << 16;
+    if (i + 1 < len) {
+      triple |= static_cast<uint32_t>(data[i + 1]) << 8;
+    }
+    out[0] = kBase64Alphabet[(triple >> 18) & 0x3F];
+    out[1] = kBase64Alphabet[(triple >> 12) & 0x3F];
+    out[2] = i + 1 < len ? kBase64Alphabet[(triple >> 6) & 0x3F] : '=';
+    out[3] = '=';
+  }
+}
+
+// Decodes len characters (a multiple of four) and returns false on any
+// character outside the alphabet; '=' is only accepted as final padding.
+static bool DecodeScalar(const char *input, size_t len, uint8_t *out) {
+  const uint8_t *in = reinterpret_cast<const uint8_t *>(input);
+  size_t full = len;
+  if (len > 0 && input[len - 1] == '=') full -= 4;
+
+  uint8_t invalid = 0;
+  for (size_t i = 0; i < full; i += 4) {
+    uint8_t a = kDecodeTable.values[in[i]];
+    uint8_t b = kDecodeTable.values[in[i + 1]];
+    uint8_t c = kDecodeTable.values[in[i + 2]];
+    uint8_t d = kDecodeTable.values[in[i + 3]];
+    invalid |= a | b | c | d;
+    uint32_t triple = (static_cast<uint32_t>(a) << 18) | (static_cast<uint32_t>(b) << 12) |
+                      (static_cast<uint32_t>(c) << 6) | d;
+    out[0] = static_cast<uint8_t>(triple >> 16);
+    out[1] = static_cast<uint8_t>(triple >> 8);
+    out[2] = static_cast<uint8_t>(triple);
+    out += 3;
+  }
+  // Valid sextets never set the top two bits.
+  if (invalid & 0xC0) return false;
+  if (full == len) return true;
+
+  // Last quartet: "xx==" or "xxx=".
+  const uint8_t *q = in + full;
+  uint8_t a = kDecodeTable.values[q[0]];
+  uint8_t b = kDecodeTable.values[q[1]];
+  if ((a | b) & 0xC0) return false;
+  out[0] = static_cast<uint8_t>((a << 2) | (b >> 4));
+  if (q[2] == '=') return true;
+  uint8_t c = kDecodeTable.values[q[2]];
+  if (c & 0xC0) return false;
+  out[1] = static_cast<uint8_t>((b << 4) | (c >> 2));
+  return true;
+}
+
+#ifdef BAS_SERDE_BASE64_X86
+
+// Vector kernels after W. Mula and D. Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions". Each handles whole blocks and returns the
+// number of input bytes consumed; the scalar code finishes the rest.
+
+__attribute__((target("ssse3,sse4.1"))) static inline __m128i EncodeTranslate128(
+    __m128i indices) {
+  // 0..25 -> 'A', 26..51 -> 'a' - 26, 52..61 -> '0' - 52, 62 -> '+', 63 -> '/'.
+  __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  return _mm_add_epi8(_mm_shuffle_epi8(shift, result), indices);
+}
+
+__attribute__((target("ssse3,sse4.1"))) static size_t EncodeSse41(const uint8_t *data,
+                                                                   size_t len, char *out) {
+  const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  size_t i = 0;
+  // Loads 16 bytes to use 12.
+  for (; i + 16 <= len; i += 12) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    in = _mm_shuffle_epi8(in, shuffle);
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t1, t3);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), EncodeTranslate128(indices));
+    out += 16;
+  }
+  return i;
+}
+
+__attribute__((target("ssse3,sse4.1"))) static size_t DecodeSse41(const char *input,
+                                                                   size_t len, uint8_t *out) {
+  const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                      0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+                                        0, 0);
+  const __m128i mask2F = _mm_set1_epi8(0x2F);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  size_t i = 0;
+  // Stores 16 bytes to produce 12; keep two quartets back so the spare bytes
+  // land inside the output and padding is left to the scalar tail.
+  for (; i + 24 <= len; i += 16) {
+    __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask2F);
+    __m128i loNibbles = _mm_and_si128(str, mask2F);
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    if (!_mm_test_all_zeros(lo, hi)) break;
+    __m128i eq2F = _mm_cmpeq_epi8(str, mask2F);
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    str = _mm_add_epi8(str, roll);
+
+    __m128i merged = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(merged, pack));
+    out += 12;
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t EncodeAvx2(const uint8_t *data, size_t len,
+                                                         char *out) {
+  const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                          10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i shift = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  // Two 12-byte groups per iteration, one per 128-bit lane; reads 28 bytes.
+  for (; i + 28 <= len; i += 24) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 12));
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    in = _mm256_shuffle_epi8(in, shuffle);
+    __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(t1, t3);
+
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_add_epi8(_mm256_shuffle_epi8(shift, result), indices);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), result);
+    out += 32;
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t DecodeAvx2(const char *input, size_t len,
+                                                         uint8_t *out) {
+  const __m256i lutLo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B,
+      0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+      0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lutHi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10);
+  const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0,
+                                           0, 0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0,
+                                           0, 0, 0, 0, 0, 0);
+  const __m256i mask2F = _mm256_set1_epi8(0x2F);
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1,
+                                        -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                                        -1, -1);
+  const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+  size_t i = 0;
+  // Stores 32 bytes to produce 24; see DecodeSse41 for the slack.
+  for (; i + 48 <= len; i += 32) {
+    __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + i));
+    __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask2F);
+    __m256i loNibbles = _mm256_and_si256(str, mask2F);
+    __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+    __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+    if (!_mm256_testz_si256(lo, hi)) break;
+    __m256i eq2F = _mm256_cmpeq_epi8(str, mask2F);
+    __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+    str = _mm256_add_epi8(str, roll);
+
+    __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    merged = _mm256_shuffle_epi8(merged, pack);
+    merged = _mm256_permutevar8x32_epi32(merged, gather);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), merged);
+    out += 24;
+  }
+  return i;
+}
+
+#endif  // BAS_SERDE_BASE64_X86
+
+struct Base64Kernels {
+  size_t (*encode)(const uint8_t *, size_t, char *);
+  size_t (*decode)(const char *, size_t, uint8_t *);
+};
+
+static Base64Kernels SelectKernels() {
+#ifdef BAS_SERDE_BASE64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return {EncodeAvx2, DecodeAvx2};
+  if (__builtin_cpu_supports("sse4.1")) return {EncodeSse41, DecodeSse41};
+#endif
+  return {nullptr, nullptr};
+}
+
+static const Base64Kernels &Kernels() {
+  static const Base64Kernels kernels = SelectKernels();
+  return kernels;
+}
+
+void Base64Encode(const uint8_t *data, size_t len, char *out) {
+  const Base64Kernels &kernels = Kernels();
+  size_t done = kernels.encode ? kernels.encode(data, len, out) : 0;
+  EncodeScalar(data + done, len - done, out + (done / 3) * 4);
+}
+
+bool Base64Decode(const char *input, size_t len, uint8_t *out) {
+  if (len % 4 != 0) return false;
+  const Base64Kernels &kernels = Kernels();
+  size_t done = kernels.decode ? kernels.decode(input, len, out) : 0;
+  // The vector kernels stop before the final quartet and at invalid blocks, so
+  // padding and error reporting are left to the scalar pass.
+  return DecodeScalar(input + done, len - done, out + (done / 4) * 3);
+}
+
+}  // namespace bas_serde
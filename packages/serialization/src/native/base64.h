@@ -0,0 +1,25 @@
+#ifndef BAS_UTILS_SERIALIZATION_BASE64_H
+#define BAS_UTILS_SERIALIZATION_BASE64_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bas_serde {
+
+// Number of base64 characters (including padding) needed for len bytes.
+size_t Base64EncodedLength(size_t len);
+
+// Writes Base64EncodedLength(len) characters of padded standard base64.
+void Base64Encode(const uint8_t *data, size_t len, char *out);
+
+// Decoded size of padded base64 text; exact when the text is valid.
+size_t Base64DecodedLength(const char *input, size_t len);
+
+// Strictly decodes padded standard base64 into `out`, which must hold
+// Base64DecodedLength(input, len) bytes. Returns false when the length is not a
+// multiple of four, a character is outside the alphabet or padding is misplaced.
+bool Base64Decode(const char *input, size_t len, uint8_t *out);
+
+}  // namespace bas_serde
+
+#endif
@@ -0,0 +1,500 @@
+#include "decode.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dictionary.h"
+
+namespace bas_serde {
+
+// A container being filled. Containers are kept on an explicit stack rather
+// than the C++ call stack, so nesting is only bounded by memory (or maxDepth).
+struct BinaryFrame {
+  enum Kind : uint8_t { kArray, kObject, kSet, kMap, kError } kind;
+  bool isProto;       // kObject: the pending member is named "__proto__"
+  bool haveKey;       // kMap: the entry's key is read, its value is next
+  size_t index;       // kArray, kObject, kError: items read
+  size_t count;       // kArray: length; kObject, kError: members
+  napi_value target;
+  napi_value fn;      // kSet: add; kMap: set
+  napi_value key;     // the pending member's or entry's key
+};
+
+struct BinaryDecoder {
+  const Napi::Env &env;
+  ByteReader &in;
+  const Ctors &ctors;
+  DecodeContext &ctx;
+  // Objects by implicit id (index + 1); only filled when the payload has ids.
+  bool trackIds;
+  std::vector<napi_value> objects = {};
+  // Dictionary strings by index, loaded on first use (see Dictionary::Strings).
+  napi_value dictionary = nullptr;
+  std::vector<napi_value> dictStrings = {};
+  std::u16string scratch = {};
+  std::vector<BinaryFrame> frames = {};
+  Napi::Value result = {};  // the value of the outermost frame
+};
+
+static void CheckBinaryStatus(const Napi::Env &env, napi_status status,
+                              const char *call) {
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, std::string(call) + " failed: " + message);
+  }
+}
+
+// Registers a new object under the next implicit id, before its children.
+static void TrackObject(BinaryDecoder &p, const Napi::Value &value) {
+  if (!p.trackIds) return;
+  SERDE_STAT(p.ctx.stats, circularIds++);
+  p.objects.push_back(value);
+}
+
+constexpr const char kProtoKey[] = "__proto__";
+constexpr size_t kProtoKeyLength = sizeof(kProtoKey) - 1;
+
+// Returns the dictionary's own string at the next varint index.
+static Napi::Value ReadDictString(BinaryDecoder &p) {
+  const Dictionary *dict = p.ctx.dictionary;
+  if (dict == nullptr) throw BinaryFormatError("Dictionary string without a dictionary");
+  uint64_t index = p.in.Varint();
+  if (index >= dict->Size()) throw BinaryFormatError("Dictionary index out of range");
+  if (p.dictionary == nullptr) {
+    p.dictionary = dict->Strings();
+    p.dictStrings.resize(dict->Size());
+  }
+  napi_value &slot = p.dictStrings[index];
+  if (slot == nullptr) {
+    CheckBinaryStatus(p.env,
+                      napi_get_element(p.env, p.dictionary, static_cast<uint32_t>(index), &slot),
+                      "napi_get_element");
+  }
+  return Napi::Value(p.env, slot);
+}
+
+// Reads a string; `isProto`, when given, marks a property key and reports
+// whether it is "__proto__". Latin-1 keys are interned.
+static Napi::Value ReadBinaryString(BinaryDecoder &p, BinaryTag tag,
+                                    bool *isProto = nullptr) {
+  napi_value result;
+  if (tag == BinaryTag::kDictString) {
+    // Dictionaries never hold "__proto__".
+    if (isProto != nullptr) *isProto = false;
+    return ReadDictString(p);
+  }
+  if (tag == BinaryTag::kLatin1String) {
+    size_t length = p.in.Length(1);
+    const char *bytes = reinterpret_cast<const char *>(p.in.Take(length));
+    napi_value *slot = nullptr;
+    if (isProto != nullptr) {
+      *isProto = length == kProtoKeyLength &&
+                 std::memcmp(bytes, kProtoKey, kProtoKeyLength) == 0;
+      slot = p.ctx.names.Slot(std::string_view(bytes, length));
+      if (slot != nullptr && *slot != nullptr) return Napi::Value(p.env, *slot);
+    }
+    CheckBinaryStatus(p.env, napi_create_string_latin1(p.env, bytes, length, &result),
+                      "napi_create_string_latin1");
+    if (slot != nullptr) *slot = result;
+  } else if (tag == BinaryTag::kUtf16String) {
+    size_t length = p.in.Length(2);
+    const uint8_t *bytes = p.in.Take(length * 2);
+    p.scratch.resize(length);
+    for (size_t i = 0; i < length; i++) {
+      p.scratch[i] = static_cast<char16_t>(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+    }
+    if (isProto != nullptr) {
+      *isProto = length == kProtoKeyLength &&
+                 std::equal(p.scratch.begin(), p.scratch.end(), kProtoKey);
+    }
+    CheckBinaryStatus(p.env,
+                      napi_create_string_utf16(p.env, p.scratch.data(), length, &result),
+                      "napi_create_string_utf16");
+  } else {
+    throw BinaryFormatError("Expected a string");
+  }
+  return Napi::Value(p.env, result);
+}
+
+// Reads a string payload field that may be absent (written as kUndefined).
+static Napi::Value ReadOptionalString(BinaryDecoder &p) {
+  BinaryTag tag = p.in.Tag();
+  if (tag == BinaryTag::kUndefined) return p.env.Undefined();
+  return ReadBinaryString(p, tag);
+}
+
+// Sets a decoded member; `__proto__` becomes an own property, like JSON.parse.
+static void SetBinaryMember(BinaryDecoder &p, const Napi::Object &out,
+                            const Napi::Value &key, const Napi::Value &value,
+                            bool isProto) {
+  if (!isProto) {
+    out.Set(key, value);
+    return;
+  }
+  napi_property_descriptor desc = {
+      nullptr, key, nullptr, nullptr, nullptr, value,
+      static_cast<napi_property_attributes>(napi_writable | napi_enumerable |
+                                            napi_configurable),
+      nullptr};
+  CheckBinaryStatus(p.env, napi_define_properties(p.env, out, 1, &desc),
+                    "napi_define_properties");
+}
+
+static Napi::Value ReadBinaryBigInt(BinaryDecoder &p) {
+  int sign = p.in.Byte() != 0 ? 1 : 0;
+  size_t wordCount = p.in.Length(8);
+  // napi_create_bigint_words rejects a null word pointer even for 0n.
+  std::vector<uint64_t> words(wordCount > 0 ? wordCount : 1);
+  for (size_t i = 0; i < wordCount; i++) words[i] = p.in.Uint64();
+  napi_value result;
+  CheckBinaryStatus(p.env,
+                    napi_create_bigint_words(p.env, sign, wordCount, words.data(), &result),
+                    "napi_create_bigint_words");
+  return Napi::Value(p.env, result);
+}
+
+// Copies `len` payload bytes into a new ArrayBuffer.
+static Napi::ArrayBuffer ReadArrayBuffer(BinaryDecoder &p, size_t len) {
+  const uint8_t *bytes = p.in.Take(len);
+  Napi::ArrayBuffer buf = Napi::ArrayBuffer::New(p.env, len);
+  if (len > 0) std::memcpy(buf.Data(), bytes, len);
+  return buf;
+}
+
+static Napi::Value ReadTypedArray(BinaryDecoder &p) {
+  napi_typedarray_type type = static_cast<napi_typedarray_type>(p.in.Byte());
+  size_t bytesPerElement = TypedArrayBytesPerElement(type);
+  if (bytesPerElement == 0) throw BinaryFormatError("Unknown typed array type");
+  size_t length = p.in.Length(bytesPerElement);
+  Napi::ArrayBuffer buf = ReadArrayBuffer(p, length * bytesPerElement);
+  napi_value result;
+  CheckBinaryStatus(p.env, napi_create_typedarray(p.env, type, length, buf, 0, &result),
+                    "napi_create_typedarray");
+  return Napi::Value(p.env, result);
+}
+
+static BinaryFrame &PushBinaryFrame(BinaryDecoder &p, BinaryFrame::Kind kind,
+                                    const Napi::Value &target, size_t count) {
+  EnterContainer(p.env, p.ctx);
+  TrackObject(p, target);
+  BinaryFrame frame{};
+  frame.kind = kind;
+  frame.count = count;
+  frame.target = target;
+  p.frames.push_back(frame);
+  return p.frames.back();
+}
+
+// Creates an Error from its fields; its own properties follow as members.
+static void BeginBinaryError(BinaryDecoder &p) {
+  Napi::Value nameVal = ReadOptionalString(p);
+  Napi::Value messageVal = ReadOptionalString(p);
+  Napi::Value stackVal = ReadOptionalString(p);
+
+  Napi::Function ctor = p.ctx.data.errorCtor.Value();
+  if (nameVal.IsString()) {
+    Napi::Value candidate = p.env.Global().Get(nameVal);
+    if (candidate.IsFunction()) ctor = candidate.As<Napi::Function>();
+  }
+  Napi::Object errObj = ctor.New({messageVal});
+  PushBinaryFrame(p, BinaryFrame::kError, errObj, 0);
+  if (nameVal.IsString()) errObj.Set(p.ctx.keys.Get(p.env, KeyId::kName), nameVal);
+  if (stackVal.IsString()) errObj.Set(p.ctx.keys.Get(p.env, KeyId::kStack), stackVal);
+  p.frames.back().count = p.in.Length(1);
+}
+
+// Reads the key of an Error's next own property: a string or a symbol.
+static Napi::Value ReadErrorKey(BinaryDecoder &p) {
+  BinaryTag tag = p.in.Tag();
+  if (tag != BinaryTag::kSymbol) return ReadBinaryString(p, tag);
+  bool isGlobal = p.in.Byte() != 0;
+  Napi::Value text = ReadOptionalString(p);
+  Napi::Object symbolCtor = p.ctx.data.symbolCtor.Value();
+  return isGlobal ? p.ctx.data.symbolFor.Call(symbolCtor, {text})
+                  : symbolCtor.As<Napi::Function>().Call(p.env.Global(), {text});
+}
+
+// Counts a value by the kind its tag decodes to.
+static void CountBinaryValue(BinaryDecoder &p, BinaryTag tag) {
+  [[maybe_unused]] size_t slot;  // unused when stats are compiled out
+  switch (tag) {
+    case BinaryTag::kUndefined:
+      slot = static_cast<size_t>(ValueKind::kUndefined);
+      break;
+    case BinaryTag::kNull:
+      slot = static_cast<size_t>(ValueKind::kNull);
+      break;
+    case BinaryTag::kFalse:
+    case BinaryTag::kTrue:
+      slot = static_cast<size_t>(ValueKind::kBoolean);
+      break;
+    case BinaryTag::kInt:
+    case BinaryTag::kDouble:
+      slot = static_cast<size_t>(ValueKind::kNumber);
+      break;
+    case BinaryTag::kLatin1String:
+    case BinaryTag::kUtf16String:
+    case BinaryTag::kDictString:
+      slot = static_cast<size_t>(ValueKind::kString);
+      break;
+    case BinaryTag::kBigInt:
+      slot = static_cast<size_t>(ValueKind::kBigInt);
+      break;
+    case BinaryTag::kDate:
+      slot = static_cast<size_t>(ValueKind::kDate);
+      break;
+    case BinaryTag::kRegExp:
+      slot = static_cast<size_t>(ValueKind::kRegExp);
+      break;
+    case BinaryTag::kArray:
+      slot = static_cast<size_t>(ValueKind::kArray);
+      break;
+    case BinaryTag::kObject:
+      slot = static_cast<size_t>(ValueKind::kPlainObject);
+      break;
+    case BinaryTag::kSet:
+      slot = static_cast<size_t>(ValueKind::kSet);
+      break;
+    case BinaryTag::kMap:
+      slot = static_cast<size_t>(ValueKind::kMap);
+      break;
+    case BinaryTag::kError:
+      slot = static_cast<size_t>(ValueKind::kError);
+      break;
+    case BinaryTag::kBuffer:
+      slot = static_cast<size_t>(ValueKind::kBuffer);
+      break;
+    case BinaryTag::kArrayBuffer:
+      slot = static_cast<size_t>(ValueKind::kArrayBuffer);
+      break;
+    case BinaryTag::kTypedArray:
+      slot = static_cast<size_t>(ValueKind::kTypedArray);
+      break;
+    case BinaryTag::kDataView:
+      slot = static_cast<size_t>(ValueKind::kDataView);
+      break;
+    case BinaryTag::kReference:
+      slot = Stats::kReferenceSlot;
+      break;
+    default:
+      return;
+  }
+  SERDE_STAT(p.ctx.stats, Node(slot));
+}
+
+// Decodes a value that has no children.
+static Napi::Value ReadBinaryLeaf(BinaryDecoder &p, BinaryTag tag) {
+  const Napi::Env &env = p.env;
+  switch (tag) {
+    case BinaryTag::kUndefined:
+      return env.Undefined();
+    case BinaryTag::kNull:
+      return env.Null();
+    case BinaryTag::kFalse:
+      return Napi::Boolean::New(env, false);
+    case BinaryTag::kTrue:
+      return Napi::Boolean::New(env, true);
+    case BinaryTag::kInt: {
+      uint64_t zigzag = p.in.Varint();
+      int64_t value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+      return Napi::Number::New(env, static_cast<double>(value));
+    }
+    case BinaryTag::kDouble:
+      return Napi::Number::New(env, p.in.Double());
+    case BinaryTag::kLatin1String:
+    case BinaryTag::kUtf16String:
+    case BinaryTag::kDictString:
+      return ReadBinaryString(p, tag);
+    case BinaryTag::kBigInt:
+      return ReadBinaryBigInt(p);
+    case BinaryTag::kDate: {
+      Napi::Value date = Napi::Date::New(env, p.in.Double());
+      TrackObject(p, date);
+      return date;
+    }
+    case BinaryTag::kRegExp: {
+      // Reserve the id first: source and flags are plain strings.
+      size_t slot = p.objects.size();
+      TrackObject(p, env.Undefined());
+      Napi::Value source = ReadOptionalString(p);
+      Napi::Value flags = ReadOptionalString(p);
+      Napi::Object regex = p.ctors.regexpCtor.New({source, flags});
+      if (p.trackIds) p.objects[slot] = regex;
+      return regex;
+    }
+    case BinaryTag::kBuffer: {
+      size_t len = p.in.Length(1);
+      Napi::Buffer<uint8_t> buf =
+          Napi::Buffer<uint8_t>::Copy(env, p.in.Take(len), len);
+      TrackObject(p, buf);
+      return buf;
+    }
+    case BinaryTag::kArrayBuffer: {
+      Napi::ArrayBuffer buf = ReadArrayBuffer(p, p.in.Length(1));
+      TrackObject(p, buf);
+      return buf;
+    }
+    case BinaryTag::kTypedArray: {
+      Napi::Value typed = ReadTypedArray(p);
+      TrackObject(p, typed);
+      return typed;
+    }
+    case BinaryTag::kDataView: {
+      size_t len = p.in.Length(1);
+      Napi::ArrayBuffer buf = ReadArrayBuffer(p, len);
+      Napi::Value view = Napi::DataView::New(env, buf);
+      TrackObject(p, view);
+      return view;
+    }
+    case BinaryTag::kReference: {
+      uint64_t id = p.in.Varint();
+      if (!p.trackIds || id == 0 || id > p.objects.size() ||
+          Napi::Value(env, p.objects[id - 1]).IsUndefined()) {
+        throw Napi::TypeError::New(env, "Unknown reference id");
+      }
+      return Napi::Value(env, p.objects[id - 1]);
+    }
+    default:
+      throw BinaryFormatError("Unknown type tag");
+  }
+}
+
+// Decodes the value of `tag` into `value` and returns true, or, for a
+// container, pushes its frame and returns false; the container's value then
+// reaches the frame below once complete.
+static bool ReadBinaryValue(BinaryDecoder &p, BinaryTag tag, Napi::Value *value) {
+  const Napi::Env &env = p.env;
+  CountBinaryValue(p, tag);
+  switch (tag) {
+    case BinaryTag::kArray: {
+      size_t length = p.in.Length(1);
+      PushBinaryFrame(p, BinaryFrame::kArray, Napi::Array::New(env, length), length);
+      return false;
+    }
+    case BinaryTag::kObject: {
+      size_t count = p.in.Length(2);
+      PushBinaryFrame(p, BinaryFrame::kObject, Napi::Object::New(env), count);
+      return false;
+    }
+    case BinaryTag::kSet: {
+      Napi::Object set = p.ctors.setCtor.New({});
+      Napi::Value add = set.Get(p.ctx.keys.Get(env, KeyId::kAdd));
+      PushBinaryFrame(p, BinaryFrame::kSet, set, 0).fn = add;
+      return false;
+    }
+    case BinaryTag::kMap: {
+      Napi::Object map = p.ctors.mapCtor.New({});
+      Napi::Value set = map.Get(p.ctx.keys.Get(env, KeyId::kSet));
+      PushBinaryFrame(p, BinaryFrame::kMap, map, 0).fn = set;
+      return false;
+    }
+    case BinaryTag::kError:
+      BeginBinaryError(p);
+      return false;
+    default:
+      *value = ReadBinaryLeaf(p, tag);
+      return true;
+  }
+}
+
+// Hands a finished value to the container on top, or keeps it as the result.
+static void AddBinaryItem(BinaryDecoder &p, const Napi::Value &item) {
+  if (p.frames.empty()) {
+    p.result = item;
+    return;
+  }
+  BinaryFrame &f = p.frames.back();
+  switch (f.kind) {
+    case BinaryFrame::kArray:
+      Napi::Object(p.env, f.target).Set(static_cast<uint32_t>(f.index - 1), item);
+      break;
+    case BinaryFrame::kObject:
+      SetBinaryMember(p, Napi::Object(p.env, f.target), Napi::Value(p.env, f.key), item,
+                      f.isProto);
+      break;
+    case BinaryFrame::kSet:
+      Napi::Function(p.env, f.fn).Call(f.target, {item});
+      break;
+    case BinaryFrame::kMap:
+      if (!f.haveKey) {
+        f.key = item;
+        f.haveKey = true;
+        break;
+      }
+      Napi::Function(p.env, f.fn).Call(f.target, {f.key, item});
+      f.haveKey = false;
+      break;
+    case BinaryFrame::kError:
+      Napi::Object(p.env, f.target).Set(Napi::Value(p.env, f.key), item);
+      break;
+  }
+}
+
+// Reads items for the container on top until it completes or a child
+// container is pushed.
+static void StepBinaryFrame(BinaryDecoder &p) {
+  BinaryFrame &f = p.frames.back();
+  while (true) {
+    BinaryTag tag;
+    if (f.kind == BinaryFrame::kSet || f.kind == BinaryFrame::kMap) {
+      tag = p.in.Tag();
+      if (tag == BinaryTag::kEnd && !f.haveKey) break;
+    } else {
+      if (f.index == f.count) break;
+      f.index++;
+      if (f.kind == BinaryFrame::kObject) {
+        f.key = ReadBinaryString(p, p.in.Tag(), &f.isProto);
+      } else if (f.kind == BinaryFrame::kError) {
+        f.key = ReadErrorKey(p);
+      }
+      tag = p.in.Tag();
+      if (tag == BinaryTag::kHole && f.kind == BinaryFrame::kArray) continue;
+    }
+    Napi::Value item;
+    if (!ReadBinaryValue(p, tag, &item)) return;
+    AddBinaryItem(p, item);
+  }
+  Napi::Value done(p.env, f.target);
+  LeaveContainer(p.ctx);
+  p.frames.pop_back();
+  AddBinaryItem(p, done);
+}
+
+Napi::Value ParseBinaryPayload(const Napi::Env &env, const uint8_t *data, size_t len,
+                               const Ctors &ctors, DecodeContext &ctx) {
+  ByteReader in(data, len);
+  try {
+    if (in.Byte() != kBinaryMagic || in.Byte() != kBinaryVersion) {
+      throw BinaryFormatError("Not a serialized binary payload");
+    }
+    uint8_t flags = in.Byte();
+    if ((flags & kBinaryFlagDictionary) != 0) {
+      uint32_t checksum = in.Uint32();
+      if (ctx.dictionary == nullptr) {
+        throw Napi::TypeError::New(env, "The binary payload needs the dictionary it was "
+                                        "written with");
+      }
+      if (ctx.dictionary->Checksum() != checksum) {
+        throw Napi::TypeError::New(env, "The binary payload was written with another "
+                                        "dictionary");
+      }
+    } else {
+      ctx.dictionary = nullptr;  // kDictString is malformed here
+    }
+    BinaryDecoder p{env, in, ctors, ctx, (flags & kBinaryFlagIds) != 0};
+    Napi::Value result;
+    if (!ReadBinaryValue(p, in.Tag(), &result)) {
+      while (!p.frames.empty()) StepBinaryFrame(p);
+      result = p.result;
+    }
+    if (!in.AtEnd()) throw BinaryFormatError("Unexpected data after value");
+    return result;
+  } catch (const BinaryFormatError &err) {
+    throw Napi::TypeError::New(env, std::string("Invalid binary payload: ") + err.what());
+  }
+}
+
+}  // namespace bas_serde
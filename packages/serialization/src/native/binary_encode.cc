@@ -0,0 +1,410 @@
+#include "encode.h"
+
+#include <cmath>
+#include <vector>
+
+#include "dictionary.h"
+
+namespace bas_serde {
+
+// Largest magnitude below which every integral double is exactly representable.
+constexpr double kMaxSafeInteger = 9007199254740992.0;
+
+// A container whose items are being written. Containers are kept on an
+// explicit stack rather than the C++ call stack, so nesting is only bounded by
+// memory (or maxDepth).
+struct BinaryEncodeFrame {
+  enum Kind : uint8_t { kArray, kObject, kSet, kMap, kError } kind;
+  bool havePending;      // kMap: the entry's value is written next
+  uint32_t index;        // items written; for kError, string keys then symbols
+  uint32_t length;       // kArray: length; kObject, kError: string keys
+  uint32_t symbolCount;  // kError: own symbols
+  napi_value object;
+  napi_value keys;     // kObject, kError: own keys; kSet, kMap: the iterator
+  napi_value extra;    // kError: own symbols; kSet, kMap: the iterator's next()
+  napi_value pending;  // kMap: the entry's value
+};
+
+struct BinaryEncoder {
+  const Napi::Env &env;
+  EncodeContext &ctx;
+  const Replacer &replacer;
+  std::vector<BinaryEncodeFrame> frames = {};
+};
+
+// Writes a string as its dictionary index when it has one, else as latin1 when
+// every code unit fits in a byte, otherwise as raw UTF-16 (lone surrogates
+// survive either way).
+static void WriteBinaryString(const Napi::Env &env, napi_value value,
+                              EncodeContext &ctx) {
+  size_t length = CopyJsString(env, value, ctx.scratch);
+  const char16_t *units = ctx.scratch.data();
+  ByteWriter &out = ctx.bytes;
+  if (ctx.stringCounts != nullptr) (*ctx.stringCounts)[std::u16string(units, length)]++;
+  if (ctx.dictionary != nullptr) {
+    uint32_t index = ctx.dictionary->Find(units, length);
+    if (index != kNotInDictionary) {
+      out.Tag(BinaryTag::kDictString);
+      out.Varint(index);
+      return;
+    }
+  }
+  bool latin1 = true;
+  for (size_t i = 0; i < length; i++) {
+    if (units[i] > 0xFF) {
+      latin1 = false;
+      break;
+    }
+  }
+  if (latin1) {
+    out.Tag(BinaryTag::kLatin1String);
+    out.Varint(length);
+    uint8_t *dest = out.Reserve(length);
+    for (size_t i = 0; i < length; i++) dest[i] = static_cast<uint8_t>(units[i]);
+    return;
+  }
+  out.Tag(BinaryTag::kUtf16String);
+  out.Varint(length);
+  uint8_t *dest = out.Reserve(length * 2);
+  for (size_t i = 0; i < length; i++) {
+    dest[2 * i] = static_cast<uint8_t>(units[i]);
+    dest[2 * i + 1] = static_cast<uint8_t>(units[i] >> 8);
+  }
+}
+
+// Writes a value the JSON format would coerce to a string payload field.
+static void WriteBinaryPayloadString(const Napi::Env &env, const Napi::Value &value,
+                                     EncodeContext &ctx) {
+  if (value.IsUndefined()) {
+    ctx.bytes.Tag(BinaryTag::kUndefined);
+  } else if (value.IsString()) {
+    WriteBinaryString(env, value, ctx);
+  } else {
+    WriteBinaryString(env, value.ToString(), ctx);
+  }
+}
+
+static void WriteBinaryNumber(double num, ByteWriter &out) {
+  if (std::trunc(num) == num && std::fabs(num) < kMaxSafeInteger &&
+      !(num == 0 && std::signbit(num))) {
+    int64_t integer = static_cast<int64_t>(num);
+    out.Tag(BinaryTag::kInt);
+    out.Varint((static_cast<uint64_t>(integer) << 1) ^
+               static_cast<uint64_t>(integer >> 63));
+    return;
+  }
+  out.Tag(BinaryTag::kDouble);
+  out.Double(num);
+}
+
+static void WriteBinaryBigInt(const Napi::Env &env, napi_value value, ByteWriter &out) {
+  size_t wordCount = 0;
+  napi_status status =
+      napi_get_value_bigint_words(env, value, nullptr, &wordCount, nullptr);
+  std::vector<uint64_t> words(wordCount);
+  int sign = 0;
+  if (status == napi_ok && wordCount > 0) {
+    status = napi_get_value_bigint_words(env, value, &sign, &wordCount, words.data());
+  }
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "napi_get_value_bigint_words failed: " + message);
+  }
+  out.Tag(BinaryTag::kBigInt);
+  out.Byte(static_cast<uint8_t>(sign));
+  out.Varint(wordCount);
+  for (uint64_t word : words) out.Uint64(word);
+}
+
+static void WriteBinaryBytes(BinaryTag tag, const void *data, size_t len,
+                             ByteWriter &out) {
+  out.Tag(tag);
+  out.Varint(len);
+  out.Bytes(data, len);
+}
+
+// Opens a container: checks for cycles and depth before its header is written.
+static BinaryEncodeFrame &PushBinaryFrame(BinaryEncoder &e, BinaryEncodeFrame::Kind kind,
+                                          const Napi::Value &value) {
+  EncodeContext &ctx = e.ctx;
+  if (!ctx.allowCircular) {
+    if (ctx.stack.Find(e.env, value) != 0) {
+      throw Napi::TypeError::New(e.env, "Circular reference detected");
+    }
+    ctx.stack.Insert(e.env, value, 1);
+  }
+  EnterContainer(e.env, ctx);
+  BinaryEncodeFrame frame{};
+  frame.kind = kind;
+  frame.object = value;
+  e.frames.push_back(frame);
+  return e.frames.back();
+}
+
+static void PopBinaryFrame(BinaryEncoder &e) {
+  BinaryEncodeFrame &f = e.frames.back();
+  if (f.kind == BinaryEncodeFrame::kSet || f.kind == BinaryEncodeFrame::kMap) {
+    e.ctx.bytes.Tag(BinaryTag::kEnd);
+  }
+  if (!e.ctx.allowCircular) e.ctx.stack.Erase(e.env, Napi::Value(e.env, f.object));
+  LeaveContainer(e.ctx);
+  e.frames.pop_back();
+}
+
+// Starts iterating a Set (values) or Map ([key, value] pairs).
+static void BeginBinaryIterator(BinaryEncoder &e, BinaryEncodeFrame &f, const Napi::Object &obj,
+                                KeyId method) {
+  const Napi::Env &env = e.env;
+  Napi::Function iterFn = obj.Get(e.ctx.keys.Get(env, method)).As<Napi::Function>();
+  Napi::Object iterator = iterFn.Call(obj, {}).As<Napi::Object>();
+  f.keys = iterator;
+  f.extra = iterator.Get(e.ctx.keys.Get(env, KeyId::kNext)).As<Napi::Function>();
+}
+
+static void BeginBinaryError(BinaryEncoder &e, BinaryEncodeFrame &f, const Napi::Object &obj) {
+  const Napi::Env &env = e.env;
+  EncodeContext &ctx = e.ctx;
+  ByteWriter &out = ctx.bytes;
+  out.Tag(BinaryTag::kError);
+  WriteBinaryPayloadString(env, obj.Get(ctx.keys.Get(env, KeyId::kName)), ctx);
+  WriteBinaryPayloadString(env, obj.Get(ctx.keys.Get(env, KeyId::kMessage)), ctx);
+  WriteBinaryPayloadString(env, obj.Get(ctx.keys.Get(env, KeyId::kStack)), ctx);
+
+  Napi::Array keys = obj.GetPropertyNames();
+  Napi::Array symbols =
+      ctx.data.getOwnPropertySymbols.Call(env.Global(), {obj}).As<Napi::Array>();
+  f.keys = keys;
+  f.extra = symbols;
+  f.length = keys.Length();
+  f.symbolCount = symbols.Length();
+  out.Varint(static_cast<uint64_t>(f.length) + f.symbolCount);
+}
+
+// Writes the key of an Error's own symbol property.
+static void WriteBinarySymbolKey(BinaryEncoder &e, const Napi::Value &sym) {
+  const Napi::Env &env = e.env;
+  EncodeContext &ctx = e.ctx;
+  Napi::Object symbolCtor = ctx.data.symbolCtor.Value();
+  Napi::Value keyFor = ctx.data.symbolKeyFor.Call(symbolCtor, {sym});
+  bool isGlobal = !keyFor.IsUndefined();
+  ctx.bytes.Tag(BinaryTag::kSymbol);
+  ctx.bytes.Byte(isGlobal ? 1 : 0);
+  if (isGlobal) {
+    WriteBinaryPayloadString(env, keyFor, ctx);
+  } else {
+    WriteBinaryPayloadString(env, sym.ToObject().Get(ctx.keys.Get(env, KeyId::kDescription)),
+                             ctx);
+  }
+}
+
+// Writes `value`; a container only gets its header here and a frame for the
+// items, which StepBinaryFrame writes.
+static void WriteBinaryItem(BinaryEncoder &e, const Napi::Value &value, bool applyReplacer) {
+  const Napi::Env &env = e.env;
+  EncodeContext &ctx = e.ctx;
+  ByteWriter &out = ctx.bytes;
+
+  ValueKind kind = ClassifyValue(env, value, ctx.data);
+  if (applyReplacer && e.replacer.Wants(kind)) {
+    Napi::Value nextValue;
+    SERDE_STAT(ctx.stats, callbacks++);
+    if (ApplyReplacer(env, value, e.replacer, &nextValue)) {
+      WriteBinaryItem(e, nextValue, false);
+      return;
+    }
+  }
+  SERDE_STAT(ctx.stats, Node(static_cast<size_t>(kind)));
+
+  switch (kind) {
+    case ValueKind::kUndefined:
+      out.Tag(BinaryTag::kUndefined);
+      return;
+    case ValueKind::kNull:
+      out.Tag(BinaryTag::kNull);
+      return;
+    case ValueKind::kBoolean:
+      out.Tag(value.As<Napi::Boolean>().Value() ? BinaryTag::kTrue : BinaryTag::kFalse);
+      return;
+    case ValueKind::kNumber:
+      WriteBinaryNumber(value.As<Napi::Number>().DoubleValue(), out);
+      return;
+    case ValueKind::kString:
+      WriteBinaryString(env, value, ctx);
+      return;
+    case ValueKind::kBigInt:
+      WriteBinaryBigInt(env, value, out);
+      return;
+    case ValueKind::kUnsupported:
+      throw Napi::TypeError::New(env, "Unsupported value type");
+    default:
+      break;
+  }
+
+  // Objects: ids are implicit, assigned in the order objects are written.
+  if (ctx.allowCircular) {
+    uint32_t seenId = ctx.entries.Find(env, value);
+    if (seenId != 0) {
+      SERDE_STAT(ctx.stats, Reference(static_cast<size_t>(kind)));
+      out.Tag(BinaryTag::kReference);
+      out.Varint(seenId);
+      return;
+    }
+    SERDE_STAT(ctx.stats, circularIds++);
+    ctx.entries.Insert(env, value, ctx.nextId++);
+  }
+
+  Napi::Object obj = value.As<Napi::Object>();
+  switch (kind) {
+    case ValueKind::kArray: {
+      BinaryEncodeFrame &f = PushBinaryFrame(e, BinaryEncodeFrame::kArray, value);
+      f.length = value.As<Napi::Array>().Length();
+      out.Tag(BinaryTag::kArray);
+      out.Varint(f.length);
+      return;
+    }
+    case ValueKind::kArrayBuffer: {
+      Napi::ArrayBuffer buf = value.As<Napi::ArrayBuffer>();
+      WriteBinaryBytes(BinaryTag::kArrayBuffer, buf.Data(), buf.ByteLength(), out);
+      return;
+    }
+    case ValueKind::kBuffer: {
+      Napi::Buffer<uint8_t> buf = value.As<Napi::Buffer<uint8_t>>();
+      WriteBinaryBytes(BinaryTag::kBuffer, buf.Data(), buf.Length(), out);
+      return;
+    }
+    case ValueKind::kDataView: {
+      Napi::DataView view = value.As<Napi::DataView>();
+      WriteBinaryBytes(BinaryTag::kDataView, view.Data(), view.ByteLength(), out);
+      return;
+    }
+    case ValueKind::kTypedArray: {
+      Napi::TypedArray typed = value.As<Napi::TypedArray>();
+      napi_typedarray_type type = typed.TypedArrayType();
+      size_t bytesPerElement = TypedArrayBytesPerElement(type);
+      if (bytesPerElement == 0) {
+        throw Napi::TypeError::New(env, "Unsupported typed array");
+      }
+      Napi::ArrayBuffer buf = typed.ArrayBuffer();
+      out.Tag(BinaryTag::kTypedArray);
+      out.Byte(static_cast<uint8_t>(type));
+      out.Varint(typed.ElementLength());
+      out.Bytes(static_cast<uint8_t *>(buf.Data()) + typed.ByteOffset(),
+                typed.ElementLength() * bytesPerElement);
+      return;
+    }
+    case ValueKind::kDate:
+      out.Tag(BinaryTag::kDate);
+      out.Double(value.As<Napi::Date>().ValueOf());
+      return;
+    case ValueKind::kRegExp:
+      out.Tag(BinaryTag::kRegExp);
+      WriteBinaryPayloadString(env, obj.Get(ctx.keys.Get(env, KeyId::kSource)), ctx);
+      WriteBinaryPayloadString(env, obj.Get(ctx.keys.Get(env, KeyId::kFlags)), ctx);
+      return;
+    case ValueKind::kError:
+      BeginBinaryError(e, PushBinaryFrame(e, BinaryEncodeFrame::kError, value), obj);
+      return;
+    case ValueKind::kSet: {
+      BinaryEncodeFrame &f = PushBinaryFrame(e, BinaryEncodeFrame::kSet, value);
+      out.Tag(BinaryTag::kSet);
+      BeginBinaryIterator(e, f, obj, KeyId::kValues);
+      return;
+    }
+    case ValueKind::kMap: {
+      BinaryEncodeFrame &f = PushBinaryFrame(e, BinaryEncodeFrame::kMap, value);
+      out.Tag(BinaryTag::kMap);
+      BeginBinaryIterator(e, f, obj, KeyId::kEntries);
+      return;
+    }
+    default:
+      break;
+  }
+
+  // Plain objects (and any other object: class instances, null prototypes).
+  BinaryEncodeFrame &f = PushBinaryFrame(e, BinaryEncodeFrame::kObject, value);
+  Napi::Array keys = obj.GetPropertyNames();
+  f.keys = keys;
+  f.length = keys.Length();
+  out.Tag(BinaryTag::kObject);
+  out.Varint(f.length);
+}
+
+// Writes items of the container on top until it is closed or a child
+// container is opened.
+static void StepBinaryFrame(BinaryEncoder &e) {
+  const Napi::Env &env = e.env;
+  EncodeContext &ctx = e.ctx;
+  size_t depth = e.frames.size();
+  while (e.frames.size() == depth) {
+    BinaryEncodeFrame &f = e.frames.back();
+    Napi::Object obj(env, f.object);
+    switch (f.kind) {
+      case BinaryEncodeFrame::kArray: {
+        if (f.index == f.length) return PopBinaryFrame(e);
+        uint32_t i = f.index++;
+        if (obj.Has(i)) {
+          WriteBinaryItem(e, obj.Get(i), true);
+        } else {
+          ctx.bytes.Tag(BinaryTag::kHole);
+        }
+        break;
+      }
+      case BinaryEncodeFrame::kObject: {
+        if (f.index == f.length) return PopBinaryFrame(e);
+        Napi::Value key = Napi::Array(env, f.keys).Get(f.index++);
+        if (!key.IsString()) {
+          throw Napi::TypeError::New(env, "Only string keys are supported");
+        }
+        WriteBinaryString(env, key, ctx);
+        WriteBinaryItem(e, obj.Get(key), true);
+        break;
+      }
+      case BinaryEncodeFrame::kSet:
+      case BinaryEncodeFrame::kMap: {
+        if (f.havePending) {
+          f.havePending = false;
+          WriteBinaryItem(e, Napi::Value(env, f.pending), true);
+          break;
+        }
+        Napi::Object next =
+            Napi::Function(env, f.extra).Call(f.keys, {}).As<Napi::Object>();
+        if (next.Get(ctx.keys.Get(env, KeyId::kDone)).ToBoolean().Value()) {
+          return PopBinaryFrame(e);
+        }
+        Napi::Value item = next.Get(ctx.keys.Get(env, KeyId::kValue));
+        if (f.kind == BinaryEncodeFrame::kMap) {
+          Napi::Array entry = item.As<Napi::Array>();
+          f.pending = entry.Get(static_cast<uint32_t>(1));
+          f.havePending = true;
+          item = entry.Get(static_cast<uint32_t>(0));
+        }
+        WriteBinaryItem(e, item, true);
+        break;
+      }
+      case BinaryEncodeFrame::kError: {
+        if (f.index == f.length + f.symbolCount) return PopBinaryFrame(e);
+        uint32_t i = f.index++;
+        Napi::Value key;
+        if (i < f.length) {
+          key = Napi::Array(env, f.keys).Get(i);
+          WriteBinaryPayloadString(env, key, ctx);
+        } else {
+          key = Napi::Array(env, f.extra).Get(i - f.length);
+          WriteBinarySymbolKey(e, key);
+        }
+        WriteBinaryItem(e, obj.Get(key), true);
+        break;
+      }
+    }
+  }
+}
+
+void EncodeBinaryValue(const Napi::Env &env, const Napi::Value &value,
+                       EncodeContext &ctx, const Replacer &replacer,
+                       bool applyReplacer) {
+  BinaryEncoder e{env, ctx, replacer};
+  WriteBinaryItem(e, value, applyReplacer);
+  while (!e.frames.empty()) StepBinaryFrame(e);
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,179 @@
+#ifndef BAS_UTILS_SERIALIZATION_BINARY_FORMAT_H
+#define BAS_UTILS_SERIALIZATION_BINARY_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace bas_serde {
+
+// Tagged binary encoding used by stringifyBinary/parseBinary.
+//
+// A payload starts with kBinaryMagic, kBinaryVersion and a flags byte, then
+// holds exactly one value. Every value starts with a BinaryTag byte; lengths
+// and counts are LEB128 varints and all fixed-width numbers are little endian.
+// With kBinaryFlagIds set, every object value takes the next id (from 1) in
+// the order it is written, and kReference points back at one of them. With
+// kBinaryFlagDictionary set, the flags are followed by the 4-byte checksum of
+// the Dictionary the payload was written with, and kDictString stands for
+// one of its strings.
+constexpr uint8_t kBinaryMagic = 0xB5;
+constexpr uint8_t kBinaryVersion = 1;
+constexpr uint8_t kBinaryFlagIds = 0x01;
+constexpr uint8_t kBinaryFlagDictionary = 0x02;
+
+enum class BinaryTag : uint8_t {
+  kUndefined = 0x00,
+  kNull = 0x01,
+  kFalse = 0x02,
+  kTrue = 0x03,
+  kInt = 0x04,          // zigzag varint, for integral doubles within 2^53
+  kDouble = 0x05,       // 8-byte IEEE 754
+  kLatin1String = 0x06, // varint length, one byte per code unit
+  kUtf16String = 0x07,  // varint length, two bytes per code unit
+  kBigInt = 0x08,       // sign byte, varint word count, 64-bit words
+  kDate = 0x09,         // 8-byte time value
+  kRegExp = 0x0A,       // source string, flags string
+  kArray = 0x0B,        // varint length, elements
+  kHole = 0x0C,         // array element that does not exist
+  kObject = 0x0D,       // varint count, (string key, value) pairs
+  kSet = 0x0E,          // values up to kEnd
+  kMap = 0x0F,          // (key, value) pairs up to kEnd
+  kError = 0x10,        // name, message, stack, varint count, (key, value) pairs
+  kSymbol = 0x11,       // property key only: global flag, key or description
+  kBuffer = 0x12,       // varint byte length, bytes
+  kArrayBuffer = 0x13,  // varint byte length, bytes
+  kTypedArray = 0x14,   // napi_typedarray_type byte, varint length, bytes
+  kDataView = 0x15,     // varint byte length, bytes
+  kReference = 0x16,    // varint id
+  kEnd = 0x17,
+  kDictString = 0x18,   // varint dictionary index; wherever a string may be
+};
+
+// Thrown for truncated or malformed binary payloads.
+class BinaryFormatError : public std::runtime_error {
+ public:
+  explicit BinaryFormatError(const char *message) : std::runtime_error(message) {}
+};
+
+// Growable output buffer for the binary encoding.
+class ByteWriter {
+ public:
+  void Byte(uint8_t value) { buf_.push_back(static_cast<char>(value)); }
+  void Tag(BinaryTag tag) { Byte(static_cast<uint8_t>(tag)); }
+
+  void Varint(uint64_t value) {
+    while (value >= 0x80) {
+      Byte(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    Byte(static_cast<uint8_t>(value));
+  }
+
+  void Uint32(uint32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; i++) bytes[i] = static_cast<char>(value >> (8 * i));
+    buf_.append(bytes, 4);
+  }
+
+  void Uint64(uint64_t value) {
+    char bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = static_cast<char>(value >> (8 * i));
+    buf_.append(bytes, 8);
+  }
+
+  void Double(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    Uint64(bits);
+  }
+
+  void Bytes(const void *data, size_t len) {
+    buf_.append(static_cast<const char *>(data), len);
+  }
+
+  // Appends `len` uninitialized bytes and returns where they start.
+  uint8_t *Reserve(size_t len) {
+    size_t start = buf_.size();
+    buf_.resize(start + len);
+    return reinterpret_cast<uint8_t *>(&buf_[start]);
+  }
+
+  const char *Data() const { return buf_.data(); }
+  size_t Size() const { return buf_.size(); }
+
+ private:
+  std::string buf_;
+};
+
+// Bounds-checked cursor over a binary payload.
+class ByteReader {
+ public:
+  ByteReader(const uint8_t *data, size_t len) : data_(data), len_(len) {}
+
+  uint8_t Byte() {
+    if (pos_ >= len_) throw BinaryFormatError("Unexpected end of binary payload");
+    return data_[pos_++];
+  }
+  BinaryTag Tag() { return static_cast<BinaryTag>(Byte()); }
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = Byte();
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) return value;
+    }
+    throw BinaryFormatError("Varint too long");
+  }
+
+  // Reads a varint length and checks that `len * unit` bytes remain.
+  size_t Length(size_t unit) {
+    uint64_t len = Varint();
+    if (len > (len_ - pos_) / unit) {
+      throw BinaryFormatError("Length exceeds binary payload");
+    }
+    return static_cast<size_t>(len);
+  }
+
+  uint32_t Uint32() {
+    const uint8_t *bytes = Take(4);
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= static_cast<uint32_t>(bytes[i]) << (8 * i);
+    return value;
+  }
+
+  uint64_t Uint64() {
+    const uint8_t *bytes = Take(8);
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    return value;
+  }
+
+  double Double() {
+    uint64_t bits = Uint64();
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  const uint8_t *Take(size_t len) {
+    if (len > len_ - pos_) throw BinaryFormatError("Unexpected end of binary payload");
+    const uint8_t *start = data_ + pos_;
+    pos_ += len;
+    return start;
+  }
+
+  bool AtEnd() const { return pos_ == len_; }
+
+ private:
+  const uint8_t *data_;
+  size_t len_;
+  size_t pos_ = 0;
+};
+
+}  // namespace bas_serde
+
+#endif
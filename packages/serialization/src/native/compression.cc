@@ -0,0 +1,155 @@
+#include "compression.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "stream_encoder.h"
+
+namespace bas_serde {
+
+// zlib's window size; adding 16 selects a gzip wrapper and adding 32 lets
+// inflate detect either wrapper from the header.
+constexpr int kWindowBits = 15;
+
+// zlib counts input in uInt, so larger inputs are fed to it in parts.
+constexpr size_t kMaxInputPart = std::numeric_limits<uInt>::max();
+
+Compression ReadCompression(const Napi::Value &optionsVal) {
+  if (!optionsVal.IsObject()) return Compression::kNone;
+  Napi::Value modeVal = optionsVal.As<Napi::Object>().Get("compress");
+  if (modeVal.IsUndefined()) return Compression::kNone;
+  std::string mode = modeVal.IsString() ? modeVal.As<Napi::String>().Utf8Value() : "";
+  if (mode == "deflate") return Compression::kDeflate;
+  if (mode == "gzip") return Compression::kGzip;
+  throw Napi::TypeError::New(optionsVal.Env(), "compress must be 'deflate' or 'gzip'");
+}
+
+// A zlib stream in either direction; released on every exit path.
+class ZStream {
+ public:
+  ZStream(const Napi::Env &env, bool deflating, int windowBits)
+      : env_(env), deflating_(deflating) {
+    int status = deflating ? deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                                          windowBits, 8, Z_DEFAULT_STRATEGY)
+                           : inflateInit2(&stream_, windowBits);
+    if (status != Z_OK) {
+      throw Napi::Error::New(env, "zlib initialization failed");
+    }
+  }
+  ~ZStream() {
+    if (deflating_) {
+      deflateEnd(&stream_);
+    } else {
+      inflateEnd(&stream_);
+    }
+  }
+  ZStream(const ZStream &) = delete;
+  ZStream &operator=(const ZStream &) = delete;
+
+  // Compresses `len` bytes onto `out`; `finish` ends the stream.
+  void Deflate(const char *data, size_t len, bool finish, std::string &out) {
+    stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_.avail_in = 0;
+    int status;
+    do {
+      Feed(len);
+      // Finishing starts once the last part is fed.
+      int flush = finish && len == 0 ? Z_FINISH : Z_NO_FLUSH;
+      size_t start = out.size();
+      out.resize(start + kDefaultChunkSize);
+      stream_.next_out = reinterpret_cast<Bytef *>(&out[start]);
+      stream_.avail_out = static_cast<uInt>(kDefaultChunkSize);
+      status = deflate(&stream_, flush);
+      out.resize(out.size() - stream_.avail_out);
+      if (status == Z_STREAM_ERROR) {
+        throw Napi::Error::New(env_, "zlib deflate failed");
+      }
+    } while (stream_.avail_out == 0 || stream_.avail_in != 0 || len != 0 ||
+             (finish && status != Z_STREAM_END));
+  }
+
+  // Decompresses the whole input, handing each output chunk to `sink`.
+  template <typename Sink>
+  void Inflate(const uint8_t *data, size_t len, Sink sink) {
+    stream_.next_in = const_cast<Bytef *>(data);
+    stream_.avail_in = 0;
+    std::string chunk(kDefaultChunkSize, '\0');
+    int status;
+    do {
+      Feed(len);
+      stream_.next_out = reinterpret_cast<Bytef *>(&chunk[0]);
+      stream_.avail_out = static_cast<uInt>(chunk.size());
+      status = inflate(&stream_, Z_NO_FLUSH);
+      if (status != Z_OK && status != Z_STREAM_END) {
+        const char *reason = stream_.msg != nullptr ? stream_.msg : "truncated input";
+        throw Napi::TypeError::New(env_, std::string("Invalid compressed data: ") + reason);
+      }
+      sink(chunk.data(), chunk.size() - stream_.avail_out);
+    } while (status != Z_STREAM_END);
+    if (stream_.avail_in != 0 || len != 0) {
+      throw Napi::TypeError::New(env_, "Invalid compressed data: data after the end");
+    }
+  }
+
+ private:
+  // Moves the next part of the `rest` bytes at next_in into avail_in, once
+  // zlib has consumed the previous one.
+  void Feed(size_t &rest) {
+    if (stream_.avail_in != 0 || rest == 0) return;
+    size_t part = std::min(rest, kMaxInputPart);
+    stream_.avail_in = static_cast<uInt>(part);
+    rest -= part;
+  }
+
+  const Napi::Env &env_;
+  bool deflating_;
+  z_stream stream_ = {};
+};
+
+Napi::Value StringifyCompressed(const Napi::Env &env, const Napi::Value &value,
+                                EncodeContext &ctx, const Replacer &replacer,
+                                Compression compression) {
+  ZStream zlib(env, true, compression == Compression::kGzip ? kWindowBits + 16 : kWindowBits);
+  std::string compressed;
+  JsonEncoder encoder(ctx, replacer);
+  encoder.Start(env, value, true);
+  bool done = false;
+  while (!done) {
+    {
+      // Handles made while encoding a chunk are released with it.
+      Napi::HandleScope scope(env);
+      encoder.Resume(env);
+      done = encoder.Run(env, kDefaultChunkSize);
+      if (!done) encoder.Suspend(env);
+    }
+    zlib.Deflate(ctx.out.Data(), ctx.out.Size(), done, compressed);
+    ctx.out.Clear();
+  }
+  StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+  return Napi::Buffer<char>::Copy(env, compressed.data(), compressed.size());
+}
+
+Napi::Value ParseCompressed(const Napi::Env &env, const uint8_t *data, size_t len,
+                            const Ctors &ctors, const Reviver &reviver, DecodeContext &ctx) {
+  JsonTape tape;
+  JsonTapeWriter writer(tape);
+  try {
+    StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+    ZStream zlib(env, false, kWindowBits + 32);
+    zlib.Inflate(data, len, [&](const char *chunk, size_t size) { writer.Write(chunk, size); });
+    writer.End();
+  } catch (const JsonSyntaxError &err) {
+    Napi::Function ctor = env.Global().Get("SyntaxError").As<Napi::Function>();
+    throw Napi::Error(env, ctor.New({Napi::String::New(env, err.what())}));
+  }
+  return ParseTape(env, tape, ctors, reviver, ctx);
+}
+
+void InflateText(const Napi::Env &env, const uint8_t *data, size_t len, std::string &text) {
+  ZStream zlib(env, false, kWindowBits + 32);
+  zlib.Inflate(data, len, [&](const char *chunk, size_t size) { text.append(chunk, size); });
+}
+
+}  // namespace bas_serde
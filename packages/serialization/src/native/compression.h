@@ -0,0 +1,35 @@
+#ifndef BAS_UTILS_SERIALIZATION_COMPRESSION_H
+#define BAS_UTILS_SERIALIZATION_COMPRESSION_H
+
+#include <cstdint>
+#include <string>
+
+#include "decode.h"
+#include "encode.h"
+
+namespace bas_serde {
+
+// The `compress` option of stringify. Both formats come from the zlib that is
+// linked into Node.js, which addons may use.
+enum class Compression : uint8_t { kNone, kDeflate, kGzip };
+
+Compression ReadCompression(const Napi::Value &options);
+
+// Encodes value chunk by chunk, compressing each chunk as soon as it is
+// written, and returns the compressed document as a Buffer. The whole JSON
+// text is never held in memory.
+Napi::Value StringifyCompressed(const Napi::Env &env, const Napi::Value &value,
+                                EncodeContext &ctx, const Replacer &replacer,
+                                Compression compression);
+
+// Decompresses a zlib or gzip document (told apart by its header) chunk by
+// chunk into the tokenizer, then decodes the tape.
+Napi::Value ParseCompressed(const Napi::Env &env, const uint8_t *data, size_t len,
+                            const Ctors &ctors, const Reviver &reviver, DecodeContext &ctx);
+
+// Decompresses a zlib or gzip document into `text`, for the raw reviver path.
+void InflateText(const Napi::Env &env, const uint8_t *data, size_t len, std::string &text);
+
+}  // namespace bas_serde
+
+#endif
@@ -1,14 +1,285 @@
 #include "decode.h"
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+#include "base64.h"
+#include "dictionary.h"
+#include "json_reader.h"
+#include "lazy.h"
+#include "shapes.h"
 
 namespace bas_serde {
 
+// Decodes a base64 payload straight into a new Buffer or ArrayBuffer.
+static Napi::Value DecodeBinaryPayload(const Napi::Env &env, const char *b64, size_t len,
+                                       bool arrayBuffer, DecodeContext &ctx) {
+  size_t size = Base64DecodedLength(b64, len);
+  uint8_t *bytes;
+  Napi::Value result;
+  if (arrayBuffer) {
+    Napi::ArrayBuffer buf = Napi::ArrayBuffer::New(env, size);
+    bytes = static_cast<uint8_t *>(buf.Data());
+    result = buf;
+  } else {
+    Napi::Buffer<uint8_t> buf = Napi::Buffer<uint8_t>::New(env, size);
+    bytes = buf.Data();
+    result = buf;
+  }
+  StatsTimer timer(ctx.stats.Get(), &Stats::base64Ns);
+  SERDE_STAT(ctx.stats, base64Bytes += size);
+  if (!Base64Decode(b64, len, bytes)) {
+    throw Napi::TypeError::New(env, "Invalid base64 payload");
+  }
+  return result;
+}
+
+// Rebuilds the plain array of a PackedArray wrapper from `length` float64s.
+static Napi::Value UnpackNumbers(const Napi::Env &env, DecodeContext &ctx,
+                                 napi_value arrayBuffer, size_t byteOffset, size_t length) {
+  napi_value view;
+  napi_status status = napi_create_typedarray(env, napi_float64_array, length, arrayBuffer,
+                                              byteOffset, &view);
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "Failed to create packed array view: " + message);
+  }
+  return ctx.data.arrayFrom.Call({view});
+}
+
+// Unpacks an inline PackedArray payload.
+static Napi::Value UnpackPayload(const Napi::Env &env, DecodeContext &ctx,
+                                 const Napi::Value &payload) {
+  Napi::ArrayBuffer buf = payload.As<Napi::ArrayBuffer>();
+  if (buf.ByteLength() % sizeof(double) != 0) {
+    throw Napi::TypeError::New(env, "Malformed packed array payload");
+  }
+  return UnpackNumbers(env, ctx, buf, 0, buf.ByteLength() / sizeof(double));
+}
+
+// Memory of one caller-supplied attachment (an ArrayBuffer or any view).
+struct AttachmentSpan {
+  napi_value arrayBuffer;
+  size_t byteOffset;
+  size_t byteLength;
+  uint8_t *data;
+};
+
+static AttachmentSpan GetAttachment(const Napi::Env &env, DecodeContext &ctx,
+                                    uint32_t index) {
+  if (ctx.attachments.IsEmpty() || index >= ctx.attachments.Length()) {
+    throw Napi::TypeError::New(env, "Unknown attachment index");
+  }
+  Napi::Value value = ctx.attachments.Get(index);
+  AttachmentSpan span{value, 0, 0, nullptr};
+  void *data = nullptr;
+  if (value.IsArrayBuffer()) {
+    Napi::ArrayBuffer buf = value.As<Napi::ArrayBuffer>();
+    span.byteLength = buf.ByteLength();
+    data = buf.Data();
+  } else if (value.IsTypedArray()) {
+    napi_typedarray_type type;
+    size_t length;
+    napi_status status = napi_get_typedarray_info(env, value, &type, &length, &data,
+                                                  &span.arrayBuffer, &span.byteOffset);
+    if (status != napi_ok) {
+      std::string message = GetNapiErrorMessage(env);
+      throw Napi::TypeError::New(env, "napi_get_typedarray_info failed: " + message);
+    }
+    span.byteLength = length * TypedArrayBytesPerElement(type);
+  } else if (value.IsDataView()) {
+    napi_status status = napi_get_dataview_info(env, value, &span.byteLength, &data,
+                                                &span.arrayBuffer, &span.byteOffset);
+    if (status != napi_ok) {
+      std::string message = GetNapiErrorMessage(env);
+      throw Napi::TypeError::New(env, "napi_get_dataview_info failed: " + message);
+    }
+  } else {
+    throw Napi::TypeError::New(env, "Attachments must be ArrayBuffers or views");
+  }
+  span.data = static_cast<uint8_t *>(data);
+  return span;
+}
+
+static Napi::ArrayBuffer CopyAttachment(const Napi::Env &env, const AttachmentSpan &span,
+                                        size_t byteLength) {
+  Napi::ArrayBuffer copy = Napi::ArrayBuffer::New(env, byteLength);
+  if (byteLength > 0) std::memcpy(copy.Data(), span.data, byteLength);
+  return copy;
+}
+
+// Rebuilds a binary wrapper over attachment `index`. Views share the
+// attachment's memory; only an ArrayBuffer requested from part of a larger
+// buffer, or a typed array at a misaligned offset, is copied. Packed arrays are
+// read into a new plain array.
+static Napi::Value DecodeAttachment(const Napi::Env &env, DecodeContext &ctx,
+                                    WrapperType type, uint32_t index,
+                                    const std::string &arrayType, uint32_t length) {
+  AttachmentSpan span = GetAttachment(env, ctx, index);
+
+  if (type == WrapperType::kBuffer) {
+    return ctx.data.bufferFrom.Call(
+        ctx.data.bufferCtor.Value(),
+        {span.arrayBuffer, Napi::Number::New(env, static_cast<double>(span.byteOffset)),
+         Napi::Number::New(env, static_cast<double>(span.byteLength))});
+  }
+  if (type == WrapperType::kArrayBuffer) {
+    Napi::ArrayBuffer whole(env, span.arrayBuffer);
+    if (span.byteOffset == 0 && span.byteLength == whole.ByteLength()) return whole;
+    return CopyAttachment(env, span, span.byteLength);
+  }
+
+  size_t bytesPerElement = 1;
+  napi_typedarray_type arrayKind = napi_uint8_array;
+  if (type == WrapperType::kTypedArray) {
+    if (!TypedArrayTypeFromName(arrayType, &arrayKind)) {
+      throw Napi::TypeError::New(env, "Unknown typed array constructor");
+    }
+    bytesPerElement = TypedArrayBytesPerElement(arrayKind);
+  } else if (type == WrapperType::kPackedArray) {
+    arrayKind = napi_float64_array;
+    bytesPerElement = sizeof(double);
+  }
+  size_t byteLength = static_cast<size_t>(length) * bytesPerElement;
+  if (byteLength > span.byteLength) {
+    throw Napi::TypeError::New(env, "Attachment is smaller than its view");
+  }
+  napi_value arrayBuffer = span.arrayBuffer;
+  size_t byteOffset = span.byteOffset;
+  if (byteOffset % bytesPerElement != 0) {
+    arrayBuffer = CopyAttachment(env, span, byteLength);
+    byteOffset = 0;
+  }
+  if (type == WrapperType::kPackedArray) {
+    return UnpackNumbers(env, ctx, arrayBuffer, byteOffset, length);
+  }
+  napi_value result;
+  napi_status status =
+      type == WrapperType::kTypedArray
+          ? napi_create_typedarray(env, arrayKind, length, arrayBuffer, byteOffset,
+                                   &result)
+          : napi_create_dataview(env, byteLength, arrayBuffer, byteOffset, &result);
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "Failed to create attachment view: " + message);
+  }
+  return Napi::Value(env, result);
+}
+
+// A shared view buffer must decode to an ArrayBuffer.
+static Napi::Value CheckViewBuffer(const Napi::Env &env, const Napi::Value &buffer) {
+  if (!buffer.IsArrayBuffer()) {
+    throw Napi::TypeError::New(env, "View buffer must be an ArrayBuffer");
+  }
+  return buffer;
+}
+
 // Decodes a wrapped value based on $$type.
 static Napi::Value DecodeWrapper(const Napi::Env &env, const Napi::Object &obj,
-                                 const Ctors &ctors, const Reviver &reviver,
-                                 DecodeContext &ctx, bool applyReviver);
+                                 WrapperType type, const Ctors &ctors,
+                                 const Reviver &reviver, DecodeContext &ctx);
+
+// Reads the $$type of a JSON.parse node once; kNone for arrays, primitives and
+// plain objects. DedupedStrings is a header, so it is a wrapper only at the root.
+static WrapperType NodeWrapperType(const Napi::Env &env, const Napi::Value &value,
+                                   DecodeContext &ctx) {
+  if (!value.IsObject() || value.IsArray()) return WrapperType::kNone;
+  Napi::Value typeVal = value.As<Napi::Object>().Get(ctx.keys.Get(env, KeyId::kType));
+  WrapperType type = ReadWrapperType(env, typeVal);
+  if (type == WrapperType::kDedupedStrings && ctx.depth > 0) return WrapperType::kNone;
+  return type;
+}
+
+// Counts a wrapper by the kind of value it decodes to.
+static void CountWrapper(DecodeContext &ctx, WrapperType type) {
+  [[maybe_unused]] size_t slot;  // unused when stats are compiled out
+  switch (type) {
+    case WrapperType::kUndefined:
+      slot = static_cast<size_t>(ValueKind::kUndefined);
+      break;
+    case WrapperType::kNumber:
+      slot = static_cast<size_t>(ValueKind::kNumber);
+      break;
+    case WrapperType::kBigInt:
+      slot = static_cast<size_t>(ValueKind::kBigInt);
+      break;
+    case WrapperType::kDate:
+      slot = static_cast<size_t>(ValueKind::kDate);
+      break;
+    case WrapperType::kRegExp:
+      slot = static_cast<size_t>(ValueKind::kRegExp);
+      break;
+    case WrapperType::kSet:
+      slot = static_cast<size_t>(ValueKind::kSet);
+      break;
+    case WrapperType::kMap:
+      slot = static_cast<size_t>(ValueKind::kMap);
+      break;
+    case WrapperType::kError:
+      slot = static_cast<size_t>(ValueKind::kError);
+      break;
+    case WrapperType::kObject:
+      slot = static_cast<size_t>(ValueKind::kPlainObject);
+      break;
+    case WrapperType::kArray:
+    case WrapperType::kPackedArray:
+      slot = static_cast<size_t>(ValueKind::kArray);
+      break;
+    case WrapperType::kReference:
+      slot = Stats::kReferenceSlot;
+      break;
+    case WrapperType::kBuffer:
+      slot = static_cast<size_t>(ValueKind::kBuffer);
+      break;
+    case WrapperType::kArrayBuffer:
+      slot = static_cast<size_t>(ValueKind::kArrayBuffer);
+      break;
+    case WrapperType::kTypedArray:
+      slot = static_cast<size_t>(ValueKind::kTypedArray);
+      break;
+    case WrapperType::kDataView:
+      slot = static_cast<size_t>(ValueKind::kDataView);
+      break;
+    default:  // holes and property keys are not values
+      return;
+  }
+  SERDE_STAT(ctx.stats, Node(slot));
+}
+
+// One level of container nesting while a JSON.parse node is decoded. This
+// decoder recurses, but it calls the reviver for every node, so V8 reports a
+// RangeError before the native stack runs out.
+class NodeDepth {
+ public:
+  NodeDepth(const Napi::Env &env, DecodeContext &ctx) : ctx_(ctx) { EnterContainer(env, ctx); }
+  ~NodeDepth() { LeaveContainer(ctx_); }
+  NodeDepth(const NodeDepth &) = delete;
+  NodeDepth &operator=(const NodeDepth &) = delete;
+
+ private:
+  DecodeContext &ctx_;
+};
+
+// Decodes a node whose $$type was already read, without the reviver.
+static Napi::Value DecodeNode(const Napi::Env &env, const Napi::Value &value,
+                              WrapperType type, const Ctors &ctors,
+                              const Reviver &reviver, DecodeContext &ctx);
+
+// Decodes one element; a Hole wrapper (checked before the reviver sees it)
+// leaves `out[i]` unset.
+static void DecodeElement(const Napi::Env &env, const Napi::Array &out, uint32_t i,
+                          const Napi::Value &item, const Ctors &ctors,
+                          const Reviver &reviver, DecodeContext &ctx) {
+  WrapperType type = NodeWrapperType(env, item, ctx);
+  if (type == WrapperType::kHole) return;
+  out.Set(i, reviver.enabled ? DecodeValue(env, item, ctors, reviver, ctx, true)
+                             : DecodeNode(env, item, type, ctors, reviver, ctx));
+}
 
 // Decodes arrays while preserving holes.
 static Napi::Value DecodeArray(const Napi::Env &env, const Napi::Array &arr,
@@ -17,12 +288,10 @@ static Napi::Value DecodeArray(const Napi::Env &env, const Napi::Array &arr,
   uint32_t length = arr.Length();
   Napi::Array out = Napi::Array::New(env, length);
   for (uint32_t i = 0; i < length; i++) {
-    if (!arr.Has(i)) continue;
+    // Only an undefined read can be a hole.
     Napi::Value item = arr.Get(i);
-    if (IsWrapperType(env, item, kTypeHole)) {
-      continue;
-    }
-    out.Set(i, DecodeValue(env, item, ctors, reviver, ctx, true));
+    if (item.IsUndefined() && !arr.Has(i)) continue;
+    DecodeElement(env, out, i, item, ctors, reviver, ctx);
   }
   return out;
 }
@@ -39,20 +308,54 @@ static Napi::Value DecodeObject(const Napi::Env &env, const Napi::Object &obj,
     if (!key.IsString()) {
       throw Napi::TypeError::New(env, "Only string keys are supported");
     }
-    std::string keyStr = key.As<Napi::String>().Utf8Value();
     Napi::Value val = obj.Get(key);
-    out.Set(keyStr, DecodeValue(env, val, ctors, reviver, ctx, true));
+    SetMember(env, out, key, IsProtoKey(env, key),
+              DecodeValue(env, val, ctors, reviver, ctx, true));
   }
   return out;
 }
 
-static Napi::Value DecodeWrapper(const Napi::Env &env, const Napi::Object &obj,
-                                 const Ctors &ctors, const Reviver &reviver,
-                                 DecodeContext &ctx, bool applyReviver) {
-  Napi::Value typeVal = obj.Get(kTypeKey);
-  if (!typeVal.IsString()) return obj;
-  std::string t = typeVal.As<Napi::String>().Utf8Value();
+// Reads the memory of a TypedArray or DataView node: its shared `buffer` and
+// `byteOffset` when present, otherwise its own bytes from offset 0.
+static Napi::Value DecodeViewBuffer(const Napi::Env &env, const Napi::Object &obj,
+                                   const Ctors &ctors, const Reviver &reviver,
+                                   DecodeContext &ctx, uint32_t *byteOffset) {
+  if (obj.Has(kBufferKey)) {
+    *byteOffset = obj.Get(kByteOffsetKey).ToNumber().Uint32Value();
+    return CheckViewBuffer(
+        env, DecodeValue(env, obj.Get(kBufferKey), ctors, reviver, ctx, false));
+  }
+  std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
+  return DecodeBinaryPayload(env, b64.data(), b64.size(), true, ctx);
+}
+
+// Reads the text of a Number wrapper's value: a special value's name or a
+// number; anything else is NaN.
+static double ParseNumberText(std::string_view text) {
+  if (text == kNumNaN) return std::nan("");
+  if (text == kNumInf) return INFINITY;
+  if (text == kNumNegInf) return -INFINITY;
+  std::string repr(text);
+  char *end = nullptr;
+  double value = std::strtod(repr.c_str(), &end);
+  if (repr.empty() || end != repr.c_str() + repr.size()) return std::nan("");
+  return value;
+}
+
+// Whether a wrapper without a value is malformed. A valueless Date is an
+// Invalid Date and a valueless PropKeyString is undefined, as before; the
+// binary wrappers hold no bytes.
+static bool NeedsValue(WrapperType type) {
+  return type == WrapperType::kNumber || type == WrapperType::kBigInt ||
+         type == WrapperType::kRegExp;
+}
 
+static Napi::Value DecodeWrapper(const Napi::Env &env, const Napi::Object &obj,
+                                 WrapperType type, const Ctors &ctors,
+                                 const Reviver &reviver, DecodeContext &ctx) {
+  if (NeedsValue(type) && !obj.Has(kValueKey)) {
+    throw Napi::TypeError::New(env, "Malformed wrapper payload");
+  }
   uint32_t refId = 0;
   bool hasId = false;
   if (obj.Has(kIdKey)) {
@@ -63,216 +366,221 @@ static Napi::Value DecodeWrapper(const Napi::Env &env, const Napi::Object &obj,
     }
   }
 
-  // Reference support for circular graphs.
-  if (t == kTypeReference) {
-    return GetRefValue(ctx, refId, env);
-  }
-  if (t == kTypeUndefined) {
-    return env.Undefined();
-  }
-  if (t == kTypeHole) {
-    return obj;
-  }
-  if (t == kTypeNumber) {
-    std::string repr = obj.Get(kValueKey).ToString().Utf8Value();
-    if (repr == kNumNaN) return Napi::Number::New(env, std::nan(""));
-    if (repr == kNumInf) return Napi::Number::New(env, INFINITY);
-    if (repr == kNumNegInf) return Napi::Number::New(env, -INFINITY);
-    return Napi::Number::New(env, std::stod(repr));
-  }
-  if (t == kTypeBigInt) {
-    Napi::Value strVal = obj.Get(kValueKey);
-    return ctors.bigintCtor.Call(env.Global(), {strVal});
-  }
-  if (t == kTypeDate) {
-    Napi::Value strVal = obj.Get(kValueKey);
-    Napi::Object dateObj = ctors.dateCtor.New({strVal}).As<Napi::Object>();
-    if (hasId) StoreRef(ctx, refId, dateObj);
-    return dateObj;
-  }
-  if (t == kTypeRegExp) {
-    Napi::Object payload = obj.Get(kValueKey).As<Napi::Object>();
-    Napi::Value source = payload.Get(kSourceKey);
-    Napi::Value flags = payload.Get(kFlagsKey);
-    Napi::Object reObj = ctors.regexpCtor.New({source, flags}).As<Napi::Object>();
-    if (hasId) StoreRef(ctx, refId, reObj);
-    return reObj;
-  }
-  if (t == kTypeObject) {
-    Napi::Object payload = obj.Get(kValueKey).As<Napi::Object>();
-    Napi::Object out = Napi::Object::New(env);
-    if (hasId) StoreRef(ctx, refId, out);
-    Napi::Array keys = payload.GetPropertyNames();
-    uint32_t length = keys.Length();
-    for (uint32_t i = 0; i < length; i++) {
-      Napi::Value key = keys.Get(i);
-      if (!key.IsString()) continue;
-      std::string keyStr = key.As<Napi::String>().Utf8Value();
-      Napi::Value val = payload.Get(key);
-      out.Set(keyStr, DecodeValue(env, val, ctors, reviver, ctx, true));
-    }
-    return out;
-  }
-  if (t == kTypeArray) {
-    Napi::Array payload = obj.Get(kValueKey).As<Napi::Array>();
-    uint32_t length = payload.Length();
-    Napi::Array out = Napi::Array::New(env, length);
-    if (hasId) StoreRef(ctx, refId, out);
-    for (uint32_t i = 0; i < length; i++) {
-      if (!payload.Has(i)) continue;
-      Napi::Value item = payload.Get(i);
-      if (IsWrapperType(env, item, kTypeHole)) {
-        continue;
-      }
-      out.Set(i, DecodeValue(env, item, ctors, reviver, ctx, true));
+  if (IsBinaryWrapperType(type) && obj.Has(kAttachmentKey)) {
+    uint32_t index = obj.Get(kAttachmentKey).ToNumber().Uint32Value();
+    std::string typeName;
+    if (type == WrapperType::kTypedArray) {
+      typeName = obj.Get(kArrayTypeKey).ToString().Utf8Value();
     }
-    return out;
-  }
-  if (t == kTypePropKeyString) {
-    Napi::Value value = obj.Get(kValueKey);
-    return value.IsUndefined() ? env.Undefined() : value.ToString();
+    uint32_t length = 0;
+    if (type == WrapperType::kTypedArray || type == WrapperType::kDataView ||
+        type == WrapperType::kPackedArray) {
+      length = obj.Get(kLengthKey).ToNumber().Uint32Value();
+    }
+    Napi::Value result = DecodeAttachment(env, ctx, type, index, typeName, length);
+    if (hasId) StoreRef(ctx, refId, result);
+    return result;
   }
-  if (t == kTypePropKeySymbol) {
-    Napi::Value globalVal = obj.Get(kGlobalKey);
-    bool isGlobal = globalVal.IsBoolean() && globalVal.ToBoolean().Value();
-    Napi::Object symbolCtor = env.Global().Get("Symbol").As<Napi::Object>();
-    if (isGlobal) {
-      Napi::Value keyVal = obj.Get(kKeyKey);
-      Napi::Function keyForFn = symbolCtor.Get("for").As<Napi::Function>();
-      return keyForFn.Call(symbolCtor, {keyVal});
-    }
-    Napi::Value descVal = obj.Get(kDescriptionKey);
-    Napi::Function symbolFn = symbolCtor.As<Napi::Function>();
-    return symbolFn.Call(env.Global(), {descVal});
-  }
-  // Errors restore name/message/stack plus custom own properties.
-  if (t == kTypeError) {
-    Napi::Object payload = obj.Get(kValueKey).As<Napi::Object>();
-    Napi::Value nameVal = payload.Get(kNameKey);
-    Napi::Value messageVal = payload.Get(kMessageKey);
-    Napi::Value stackVal = payload.Get(kStackKey);
-
-    Napi::Function ctor = env.Global().Get("Error").As<Napi::Function>();
-    if (nameVal.IsString()) {
-      std::string name = nameVal.As<Napi::String>().Utf8Value();
-      Napi::Value candidate = env.Global().Get(name);
-      if (candidate.IsFunction()) {
-        ctor = candidate.As<Napi::Function>();
+
+  switch (type) {
+    // Reference support for circular graphs.
+    case WrapperType::kReference:
+      return GetRefValue(ctx, refId, env);
+    case WrapperType::kUndefined:
+      return env.Undefined();
+    case WrapperType::kNumber: {
+      // Read as ParseNumberWrapper does.
+      Napi::Value value = obj.Get(kValueKey);
+      if (value.IsNumber()) return value;
+      if (!value.IsString()) return Napi::Number::New(env, std::nan(""));
+      return Napi::Number::New(env, ParseNumberText(value.As<Napi::String>().Utf8Value()));
+    }
+    case WrapperType::kBigInt: {
+      Napi::Value strVal = obj.Get(kValueKey);
+      return ctors.bigintCtor.Call(env.Global(), {strVal});
+    }
+    case WrapperType::kDate: {
+      Napi::Value strVal = obj.Get(kValueKey);
+      Napi::Object dateObj = ctors.dateCtor.New({strVal}).As<Napi::Object>();
+      if (hasId) StoreRef(ctx, refId, dateObj);
+      return dateObj;
+    }
+    case WrapperType::kRegExp: {
+      Napi::Object payload = obj.Get(kValueKey).As<Napi::Object>();
+      Napi::Value source = payload.Get(kSourceKey);
+      Napi::Value flags = payload.Get(kFlagsKey);
+      Napi::Object reObj = ctors.regexpCtor.New({source, flags}).As<Napi::Object>();
+      if (hasId) StoreRef(ctx, refId, reObj);
+      return reObj;
+    }
+    case WrapperType::kObject: {
+      Napi::Object payload = obj.Get(kValueKey).As<Napi::Object>();
+      Napi::Object out = Napi::Object::New(env);
+      if (hasId) StoreRef(ctx, refId, out);
+      Napi::Array keys = payload.GetPropertyNames();
+      uint32_t length = keys.Length();
+      for (uint32_t i = 0; i < length; i++) {
+        Napi::Value key = keys.Get(i);
+        if (!key.IsString()) continue;
+        Napi::Value val = payload.Get(key);
+        SetMember(env, out, key, IsProtoKey(env, key),
+                  DecodeValue(env, val, ctors, reviver, ctx, true));
+      }
+      return out;
+    }
+    case WrapperType::kArray: {
+      Napi::Array payload = obj.Get(kValueKey).As<Napi::Array>();
+      uint32_t length = payload.Length();
+      Napi::Array out = Napi::Array::New(env, length);
+      if (hasId) StoreRef(ctx, refId, out);
+      for (uint32_t i = 0; i < length; i++) {
+        Napi::Value item = payload.Get(i);
+        if (item.IsUndefined() && !payload.Has(i)) continue;
+        DecodeElement(env, out, i, item, ctors, reviver, ctx);
+      }
+      return out;
+    }
+    case WrapperType::kPropKeyString: {
+      Napi::Value value = obj.Get(kValueKey);
+      return value.IsUndefined() ? env.Undefined() : value.ToString();
+    }
+    case WrapperType::kPropKeySymbol: {
+      Napi::Value globalVal = obj.Get(kGlobalKey);
+      bool isGlobal = globalVal.IsBoolean() && globalVal.ToBoolean().Value();
+      Napi::Object symbolCtor = ctx.data.symbolCtor.Value();
+      if (isGlobal) {
+        Napi::Value keyVal = obj.Get(kKeyKey);
+        return ctx.data.symbolFor.Call(symbolCtor, {keyVal});
       }
+      Napi::Value descVal = obj.Get(kDescriptionKey);
+      Napi::Function symbolFn = symbolCtor.As<Napi::Function>();
+      return symbolFn.Call(env.Global(), {descVal});
     }
+    // Errors restore name/message/stack plus custom own properties.
+    case WrapperType::kError: {
+      Napi::Object payload = obj.Get(kValueKey).As<Napi::Object>();
+      Napi::Value nameVal = payload.Get(kNameKey);
+      Napi::Value messageVal = payload.Get(kMessageKey);
+      Napi::Value stackVal = payload.Get(kStackKey);
 
-    Napi::Value msgArg = messageVal.IsUndefined() ? env.Undefined() : messageVal;
-    Napi::Object errObj = ctor.New({msgArg}).As<Napi::Object>();
-    if (hasId) StoreRef(ctx, refId, errObj);
-    if (nameVal.IsString()) errObj.Set(kNameKey, nameVal);
-    if (stackVal.IsString()) errObj.Set(kStackKey, stackVal);
+      Napi::Function ctor = ctx.data.errorCtor.Value();
+      if (nameVal.IsString()) {
+        std::string name = nameVal.As<Napi::String>().Utf8Value();
+        Napi::Value candidate = env.Global().Get(name);
+        if (candidate.IsFunction()) {
+          ctor = candidate.As<Napi::Function>();
+        }
+      }
+
+      Napi::Value msgArg = messageVal.IsUndefined() ? env.Undefined() : messageVal;
+      Napi::Object errObj = ctor.New({msgArg}).As<Napi::Object>();
+      if (hasId) StoreRef(ctx, refId, errObj);
+      if (nameVal.IsString()) errObj.Set(kNameKey, nameVal);
+      if (stackVal.IsString()) errObj.Set(kStackKey, stackVal);
 
-    Napi::Value propsVal = payload.Get(kPropsKey);
-    if (propsVal.IsArray()) {
-      Napi::Array props = propsVal.As<Napi::Array>();
-      uint32_t length = props.Length();
+      Napi::Value propsVal = payload.Get(kPropsKey);
+      if (propsVal.IsArray()) {
+        Napi::Array props = propsVal.As<Napi::Array>();
+        uint32_t length = props.Length();
+        for (uint32_t i = 0; i < length; i++) {
+          Napi::Value entryVal = props.Get(i);
+          if (!entryVal.IsArray()) continue;
+          Napi::Array pair = entryVal.As<Napi::Array>();
+          if (pair.Length() < 2) continue;
+          Napi::Value keyVal = DecodeValue(env, pair.Get(static_cast<uint32_t>(0)),
+                                           ctors, reviver, ctx, true);
+          Napi::Value val = DecodeValue(env, pair.Get(static_cast<uint32_t>(1)),
+                                        ctors, reviver, ctx, true);
+          if (keyVal.IsString() || keyVal.IsSymbol()) {
+            errObj.Set(keyVal, val);
+          }
+        }
+      }
+      return errObj;
+    }
+    case WrapperType::kSet: {
+      Napi::Array arr = obj.Get(kValueKey).As<Napi::Array>();
+      Napi::Object setObj = ctors.setCtor.New({});
+      if (hasId) StoreRef(ctx, refId, setObj);
+      Napi::Function addFn = setObj.Get("add").As<Napi::Function>();
+      uint32_t length = arr.Length();
       for (uint32_t i = 0; i < length; i++) {
-        Napi::Value entryVal = props.Get(i);
-        if (!entryVal.IsArray()) continue;
-        Napi::Array pair = entryVal.As<Napi::Array>();
-        if (pair.Length() < 2) continue;
-        Napi::Value keyVal = DecodeValue(env, pair.Get(static_cast<uint32_t>(0)),
-                                         ctors, reviver, ctx, true);
-        Napi::Value val = DecodeValue(env, pair.Get(static_cast<uint32_t>(1)),
+        Napi::Value decoded = DecodeValue(env, arr.Get(i), ctors, reviver, ctx, true);
+        addFn.Call(setObj, {decoded});
+      }
+      return setObj;
+    }
+    case WrapperType::kMap: {
+      Napi::Array arr = obj.Get(kValueKey).As<Napi::Array>();
+      Napi::Object mapObj = ctors.mapCtor.New({});
+      if (hasId) StoreRef(ctx, refId, mapObj);
+      Napi::Function setFn = mapObj.Get("set").As<Napi::Function>();
+      uint32_t length = arr.Length();
+      for (uint32_t i = 0; i < length; i++) {
+        Napi::Array entry = arr.Get(i).As<Napi::Array>();
+        Napi::Value key = DecodeValue(env, entry.Get(static_cast<uint32_t>(0)),
                                       ctors, reviver, ctx, true);
-        if (keyVal.IsString() || keyVal.IsSymbol()) {
-          errObj.Set(keyVal, val);
-        }
+        Napi::Value val = DecodeValue(env, entry.Get(static_cast<uint32_t>(1)),
+                                      ctors, reviver, ctx, true);
+        setFn.Call(mapObj, {key, val});
       }
+      return mapObj;
     }
-    return errObj;
-  }
-  if (t == kTypeSet) {
-    Napi::Array arr = obj.Get(kValueKey).As<Napi::Array>();
-    Napi::Object setObj = ctors.setCtor.New({});
-    if (hasId) StoreRef(ctx, refId, setObj);
-    Napi::Function addFn = setObj.Get("add").As<Napi::Function>();
-    uint32_t length = arr.Length();
-    for (uint32_t i = 0; i < length; i++) {
-      Napi::Value decoded = DecodeValue(env, arr.Get(i), ctors, reviver, ctx, true);
-      addFn.Call(setObj, {decoded});
-    }
-    return setObj;
-  }
-  if (t == kTypeMap) {
-    Napi::Array arr = obj.Get(kValueKey).As<Napi::Array>();
-    Napi::Object mapObj = ctors.mapCtor.New({});
-    if (hasId) StoreRef(ctx, refId, mapObj);
-    Napi::Function setFn = mapObj.Get("set").As<Napi::Function>();
-    uint32_t length = arr.Length();
-    for (uint32_t i = 0; i < length; i++) {
-      Napi::Array entry = arr.Get(i).As<Napi::Array>();
-      Napi::Value key = DecodeValue(env, entry.Get(static_cast<uint32_t>(0)),
-                                    ctors, reviver, ctx, true);
-      Napi::Value val = DecodeValue(env, entry.Get(static_cast<uint32_t>(1)),
-                                    ctors, reviver, ctx, true);
-      setFn.Call(mapObj, {key, val});
-    }
-    return mapObj;
-  }
-  if (t == kTypeBuffer) {
-    std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
-    std::vector<uint8_t> bytes = Base64Decode(b64);
-    Napi::Buffer<uint8_t> buf =
-        bytes.empty() ? Napi::Buffer<uint8_t>::New(env, 0)
-                      : Napi::Buffer<uint8_t>::Copy(env, bytes.data(), bytes.size());
-    if (hasId) StoreRef(ctx, refId, buf);
-    return buf;
-  }
-  if (t == kTypeArrayBuffer) {
-    std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
-    std::vector<uint8_t> bytes = Base64Decode(b64);
-    Napi::ArrayBuffer buf = Napi::ArrayBuffer::New(env, bytes.size());
-    if (!bytes.empty()) {
-      std::memcpy(buf.Data(), bytes.data(), bytes.size());
+    case WrapperType::kBuffer: {
+      std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
+      Napi::Value buf = DecodeBinaryPayload(env, b64.data(), b64.size(), false, ctx);
+      if (hasId) StoreRef(ctx, refId, buf);
+      return buf;
     }
-    if (hasId) StoreRef(ctx, refId, buf);
-    return buf;
-  }
-  if (t == kTypeTypedArray) {
-    std::string typeName = obj.Get(kArrayTypeKey).ToString().Utf8Value();
-    std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
-    uint32_t length = obj.Get(kLengthKey).ToNumber().Uint32Value();
-    std::vector<uint8_t> bytes = Base64Decode(b64);
-    Napi::ArrayBuffer buf = Napi::ArrayBuffer::New(env, bytes.size());
-    if (!bytes.empty()) {
-      std::memcpy(buf.Data(), bytes.data(), bytes.size());
+    case WrapperType::kArrayBuffer: {
+      std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
+      Napi::Value buf = DecodeBinaryPayload(env, b64.data(), b64.size(), true, ctx);
+      if (hasId) StoreRef(ctx, refId, buf);
+      return buf;
     }
-    Napi::Value ctorVal = env.Global().Get(typeName);
-    if (!ctorVal.IsFunction()) {
-      throw Napi::TypeError::New(env, "Unknown typed array constructor");
+    case WrapperType::kTypedArray: {
+      std::string typeName = obj.Get(kArrayTypeKey).ToString().Utf8Value();
+      uint32_t length = obj.Get(kLengthKey).ToNumber().Uint32Value();
+      uint32_t byteOffset = 0;
+      Napi::Value buf = DecodeViewBuffer(env, obj, ctors, reviver, ctx, &byteOffset);
+      Napi::Value ctorVal = env.Global().Get(typeName);
+      if (!ctorVal.IsFunction()) {
+        throw Napi::TypeError::New(env, "Unknown typed array constructor");
+      }
+      Napi::Function ctor = ctorVal.As<Napi::Function>();
+      Napi::Object typed = ctor.New(
+          {buf, Napi::Number::New(env, byteOffset), Napi::Number::New(env, length)});
+      if (hasId) StoreRef(ctx, refId, typed);
+      return typed;
     }
-    Napi::Function ctor = ctorVal.As<Napi::Function>();
-    Napi::Object typed =
-        ctor.New({buf, Napi::Number::New(env, 0), Napi::Number::New(env, length)});
-    if (hasId) StoreRef(ctx, refId, typed);
-    return typed;
-  }
-  if (t == kTypeDataView) {
-    std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
-    uint32_t length = obj.Get(kLengthKey).ToNumber().Uint32Value();
-    std::vector<uint8_t> bytes = Base64Decode(b64);
-    Napi::ArrayBuffer buf = Napi::ArrayBuffer::New(env, bytes.size());
-    if (!bytes.empty()) {
-      std::memcpy(buf.Data(), bytes.data(), bytes.size());
-    }
-    Napi::Value ctorVal = env.Global().Get("DataView");
-    if (!ctorVal.IsFunction()) {
-      throw Napi::TypeError::New(env, "DataView constructor not found");
+    case WrapperType::kDataView: {
+      uint32_t length = obj.Get(kLengthKey).ToNumber().Uint32Value();
+      uint32_t byteOffset = 0;
+      Napi::Value buf = DecodeViewBuffer(env, obj, ctors, reviver, ctx, &byteOffset);
+      Napi::Value ctorVal = env.Global().Get("DataView");
+      if (!ctorVal.IsFunction()) {
+        throw Napi::TypeError::New(env, "DataView constructor not found");
+      }
+      Napi::Function ctor = ctorVal.As<Napi::Function>();
+      Napi::Object view = ctor.New(
+          {buf, Napi::Number::New(env, byteOffset), Napi::Number::New(env, length)});
+      if (hasId) StoreRef(ctx, refId, view);
+      return view;
+    }
+    case WrapperType::kPackedArray: {
+      std::string b64 = obj.Get(kValueKey).ToString().Utf8Value();
+      Napi::Value buf = DecodeBinaryPayload(env, b64.data(), b64.size(), true, ctx);
+      Napi::Value numbers = UnpackPayload(env, ctx, buf);
+      if (hasId) StoreRef(ctx, refId, numbers);
+      return numbers;
     }
-    Napi::Function ctor = ctorVal.As<Napi::Function>();
-    Napi::Object view =
-        ctor.New({buf, Napi::Number::New(env, 0), Napi::Number::New(env, length)});
-    if (hasId) StoreRef(ctx, refId, view);
-    return view;
+    case WrapperType::kDedupedStrings:
+      // Raw nodes may be replaced before their references are resolved.
+      throw Napi::TypeError::New(
+          env, "dedupeStrings output needs a reviver with reviverTypes or reviverKeys");
+    default:
+      return obj;
   }
-
-  return obj;
 }
 
 // Entry point that optionally applies a reviver.
@@ -280,26 +588,1352 @@ Napi::Value DecodeValue(const Napi::Env &env, const Napi::Value &value,
                         const Ctors &ctors, const Reviver &reviver,
                         DecodeContext &ctx, bool applyReviver) {
   if (applyReviver && reviver.enabled) {
+    SERDE_STAT(ctx.stats, callbacks++);
     Napi::Value nextValue = reviver.fn.Call(env.Global(), {value});
     return DecodeValue(env, nextValue, ctors, reviver, ctx, false);
   }
+  return DecodeNode(env, value, NodeWrapperType(env, value, ctx), ctors, reviver, ctx);
+}
+
+static Napi::Value DecodeNode(const Napi::Env &env, const Napi::Value &value,
+                              WrapperType type, const Ctors &ctors,
+                              const Reviver &reviver, DecodeContext &ctx) {
+  if (type != WrapperType::kNone) {
+    CountWrapper(ctx, type);
+    if (!IsContainerWrapperType(type)) {
+      return DecodeWrapper(env, value.As<Napi::Object>(), type, ctors, reviver, ctx);
+    }
+    NodeDepth depth(env, ctx);
+    return DecodeWrapper(env, value.As<Napi::Object>(), type, ctors, reviver, ctx);
+  }
   if (value.IsArray()) {
+    NodeDepth depth(env, ctx);
+    SERDE_STAT(ctx.stats, Node(static_cast<size_t>(ValueKind::kArray)));
     return DecodeArray(env, value.As<Napi::Array>(), ctors, reviver, ctx, true);
   }
   if (value.IsObject()) {
-    Napi::Object obj = value.As<Napi::Object>();
-    if (obj.Has(kTypeKey)) {
-      Napi::Value typeVal = obj.Get(kTypeKey);
-      if (typeVal.IsString()) {
-        std::string t = typeVal.As<Napi::String>().Utf8Value();
-        if (IsKnownWrapperType(t)) {
-          return DecodeWrapper(env, obj, ctors, reviver, ctx, true);
+    NodeDepth depth(env, ctx);
+    SERDE_STAT(ctx.stats, Node(static_cast<size_t>(ValueKind::kPlainObject)));
+    return DecodeObject(env, value.As<Napi::Object>(), ctors, reviver, ctx, true);
+  }
+  SERDE_STAT(ctx.stats, Node(static_cast<size_t>(ClassifyValue(env, value, ctx.data))));
+  return value;
+}
+
+// Direct JSON text decoding: builds final values from reader tokens without an
+// intermediate JSON.parse tree. The containers being filled are kept on an
+// explicit stack of frames rather than the C++ call stack, so nesting is only
+// bounded by memory (or the maxDepth option).
+
+// Raised when a reference names an id whose wrapper has not been stored yet
+// (Set/Map/Error write $$id after their value). The enclosing wrapper with that
+// id re-decodes its value span.
+struct ForwardReference {
+  uint32_t id;
+};
+
+enum class TextFrameKind : uint8_t {
+  kArray,    // a plain array, or the payload of an array wrapper
+  kObject,   // an object that may still turn out to be a wrapper
+  kMembers,  // the payload of an object wrapper
+  kSet,
+  kMap,
+  kError,    // the payload of an Error wrapper
+  kWrapper,  // the members of a container wrapper, around its payload
+};
+
+enum class TextFrameState : uint8_t {
+  kStart,
+  kPlainMembers,    // kObject: past the members that follow a registered shape
+  kMapEntry,        // kMap: inside an entry, reading [key, value, ...]
+  kErrorField,      // kError: a name/message/stack field holding a container
+  kErrorJunk,       // kError: a props value that is not a list, dropped
+  kErrorProps,      // kError: inside the props list
+  kErrorEntryJunk,  // kError: a props entry that is not a pair, dropped
+  kErrorPair,       // kError: inside a props entry, reading [key, value, ...]
+};
+
+struct TextFrame {
+  TextFrameKind kind;
+  TextFrameState state;
+  WrapperType type;  // kWrapper
+  bool inArray;      // kObject: a Hole wrapper here leaves no element
+  bool entered;      // counted as a level of nesting (see EnterObject)
+  bool isProto;      // the pending member is named "__proto__"
+  bool revive;       // the pending member is passed to the reviver
+  bool hasId;        // kWrapper, kError: $$id read before the payload
+  bool haveValue;    // kWrapper
+  bool indexed;      // kWrapper: registered with its payload, by p.ids
+  bool pending;      // kWrapper: the payload is decoded before its $$id
+  bool created;      // kError: `target` exists
+  uint32_t refId;
+  uint32_t index;    // kArray: elements read, holes included; kMap, kError:
+                     // items of the current entry, or the pending field
+  uint32_t length;   // kArray: elements in `target`
+  size_t base;       // first of p.elements owned by this frame
+  size_t shape;      // kObject: the registered shape matched so far
+  size_t matched;
+  size_t provisional;      // kWrapper: ctx.provisional size to roll back to
+  JsonReader::Mark mark;   // kObject: after '{'; kWrapper: at the payload
+  napi_value target;       // the container being filled
+  napi_value fn;           // kSet: add; kMap: set
+  napi_value key;          // the pending member's name, or the entry's key
+  napi_value value;        // the current entry's value
+  napi_value fields[3];    // kError: name, message, stack
+};
+
+// An entry of a DedupedStrings string table, kept as text for the keys that
+// refer to it.
+struct TableText {
+  std::string text;
+  bool ascii;
+  bool wtf8;
+};
+
+struct TextDecoder {
+  const Napi::Env &env;
+  JsonReader &in;
+  const Ctors &ctors;
+  const Reviver &reviver;  // decoded mode only
+  DecodeContext &ctx;
+  // Elements not yet appended to their arrays. Nested arrays use the space
+  // past their parent's pending elements.
+  std::vector<napi_value> elements = {};
+  std::vector<TextFrame> frames = {};
+  // Frames below `base` belong to an enclosing ParseValue call, which gets
+  // the value of the frame at `base` as `result`.
+  size_t base = 0;
+  Napi::Value result = {};
+  unsigned calls = 0;  // nested ParseValue calls
+  // Under a DedupedStrings header: what string values and property keys
+  // starting with kStringRefMark refer to. The dictionary's first `dictSize`
+  // entries, fetched when first used, come before the header's string table.
+  bool deduped = false;
+  uint32_t dictSize = 0;
+  napi_value dictionary = nullptr;  // the dictionary's Strings()
+  std::vector<napi_value> strings = {};
+  std::vector<TableText> texts = {};
+  // Once a reference names an id not stored yet: the $$id of each wrapper in
+  // the value begun at `start`, by the position of its payload.
+  JsonReader::Mark start = in.Save();
+  std::unordered_map<size_t, uint32_t> ids = {};
+  bool indexed = false;
+};
+
+static Napi::Value ParseValue(TextDecoder &p, const JsonToken &token, bool inArray);
+
+static Napi::Value MakeString(const Napi::Env &env, const JsonToken &token) {
+  napi_value result;
+  napi_status status;
+  if (token.ascii) {
+    status = napi_create_string_latin1(env, token.text.data(), token.text.size(), &result);
+  } else if (!token.wtf8) {
+    status = napi_create_string_utf8(env, token.text.data(), token.text.size(), &result);
+  } else {
+    std::u16string units = Wtf8ToUtf16(token.text);
+    status = napi_create_string_utf16(env, units.data(), units.size(), &result);
+  }
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "napi_create_string failed: " + message);
+  }
+  return Napi::Value(env, result);
+}
+
+// Reads the index N of a reference "~N", given the digits after the mark.
+static size_t ReadStringRef(const TextDecoder &p, std::string_view digits) {
+  size_t index = 0;
+  const char *end = digits.data() + digits.size();
+  auto [last, error] = std::from_chars(digits.data(), end, index);
+  if (digits.empty() || error != std::errc() || last != end || index >= p.strings.size()) {
+    throw Napi::TypeError::New(p.env, "Unknown string reference");
+  }
+  return index;
+}
+
+// Decodes a string value that starts with kStringRefMark under a DedupedStrings
+// header: with the mark doubled it is a literal, else it names an entry of the
+// dictionary or of the header's string table.
+static Napi::Value ResolveStringRef(TextDecoder &p, const JsonToken &token) {
+  std::string_view digits = token.text.substr(1);
+  if (!digits.empty() && digits[0] == kStringRefMark) {
+    JsonToken literal = token;
+    literal.text = digits;
+    return MakeString(p.env, literal);
+  }
+  size_t index = ReadStringRef(p, digits);
+  napi_value &slot = p.strings[index];
+  if (slot == nullptr) {
+    if (p.dictionary == nullptr) p.dictionary = p.ctx.dictionary->Strings();
+    if (napi_get_element(p.env, p.dictionary, static_cast<uint32_t>(index), &slot) !=
+        napi_ok) {
+      throw Napi::Error::New(p.env);
+    }
+  }
+  return Napi::Value(p.env, slot);
+}
+
+// Replaces a property key that starts with kStringRefMark under a
+// DedupedStrings header with the text it stands for, so that the key is
+// matched and created like any other.
+static void ResolveKeyRef(TextDecoder &p, JsonToken &key) {
+  if (!p.deduped || key.type != JsonTokenType::kKey || key.text.empty() ||
+      key.text[0] != kStringRefMark) {
+    return;
+  }
+  std::string_view digits = key.text.substr(1);
+  if (!digits.empty() && digits[0] == kStringRefMark) {
+    key.text = digits;
+    return;
+  }
+  size_t index = ReadStringRef(p, digits);
+  if (index < p.dictSize) {
+    const Dictionary *dict = p.ctx.dictionary;
+    uint32_t entry = static_cast<uint32_t>(index);
+    key.text = dict->Text(entry);
+    key.ascii = dict->TextIsAscii(entry);
+    key.wtf8 = dict->TextIsWtf8(entry);
+    return;
+  }
+  const TableText &entry = p.texts[index - p.dictSize];
+  key.text = entry.text;
+  key.ascii = entry.ascii;
+  key.wtf8 = entry.wtf8;
+}
+
+// Creates a property key, reusing the string made for an earlier key with the
+// same text.
+Napi::Value MakePropertyKey(const Napi::Env &env, DecodeContext &ctx,
+                            const JsonToken &token) {
+  napi_value *slot = ctx.names.Slot(token.text);
+  if (slot == nullptr) return MakeString(env, token);
+  if (*slot == nullptr) *slot = MakeString(env, token);
+  return Napi::Value(env, *slot);
+}
+
+static Napi::Value MakeKey(TextDecoder &p, const JsonToken &token) {
+  return MakePropertyKey(p.env, p.ctx, token);
+}
+
+static bool TokenIs(const JsonToken &token, std::string_view text) {
+  return token.text == text;
+}
+
+static Napi::Value NextValue(TextDecoder &p) {
+  JsonToken token = p.in.Next();
+  return ParseValue(p, token, false);
+}
+
+// Decodes a field of a wrapper payload. Its scalars are part of the wrapper,
+// so unlike ParseValue this does not count them as values.
+static Napi::Value ParseField(TextDecoder &p, const JsonToken &token) {
+  switch (token.type) {
+    case JsonTokenType::kString:
+      return MakeString(p.env, token);
+    case JsonTokenType::kNumber:
+      return Napi::Number::New(p.env, token.number);
+    case JsonTokenType::kTrue:
+    case JsonTokenType::kFalse:
+      return Napi::Boolean::New(p.env, token.type == JsonTokenType::kTrue);
+    case JsonTokenType::kNull:
+      return p.env.Null();
+    default:
+      return ParseValue(p, token, false);
+  }
+}
+
+static Napi::Value NextField(TextDecoder &p) {
+  JsonToken token = p.in.Next();
+  return ParseField(p, token);
+}
+
+// A decoded-mode reviver sees each value as it is stored, after its children,
+// with the key it is stored under. Values stored under a property name are
+// passed when reviverKeys lists the name; the rest (elements, Set and Map
+// members, the root) only without reviverKeys.
+static bool RevivesKey(const TextDecoder &p, std::string_view key) {
+  const Reviver &reviver = p.reviver;
+  if (!reviver.decoded) return false;
+  return reviver.allKeys ||
+         std::find(reviver.keys.begin(), reviver.keys.end(), key) != reviver.keys.end();
+}
+
+static bool RevivesUnnamed(const TextDecoder &p) {
+  return p.reviver.decoded && p.reviver.allKeys;
+}
+
+// Calls the reviver when the value's kind is selected; returns its result.
+static Napi::Value Revive(TextDecoder &p, const Napi::Value &value, napi_value key) {
+  if (!p.reviver.Wants(ClassifyValue(p.env, value, p.ctx.data))) return value;
+  SERDE_STAT(p.ctx.stats, callbacks++);
+  if (key == nullptr) key = p.env.Undefined();
+  napi_value args[2] = {value, key};
+  napi_value result;
+  napi_status status =
+      napi_call_function(p.env, p.env.Undefined(), p.reviver.fn, 2, args, &result);
+  if (status != napi_ok) throw Napi::Error::New(p.env);
+  return Napi::Value(p.env, result);
+}
+
+static void ExpectToken(TextDecoder &p, const JsonToken &token, JsonTokenType type) {
+  if (token.type != type) {
+    throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+  }
+}
+
+uint32_t TokenUint32(double value) {
+  if (!std::isfinite(value)) return 0;
+  double wrapped = std::fmod(std::trunc(value), 4294967296.0);
+  if (wrapped < 0) wrapped += 4294967296.0;
+  return static_cast<uint32_t>(wrapped);
+}
+
+// Appends the pending elements from `base` on to `out` with a single push.
+static void FlushElements(TextDecoder &p, const Napi::Array &out, size_t base) {
+  if (p.elements.size() == base) return;
+  napi_value result;
+  napi_status status =
+      napi_call_function(p.env, out, p.ctx.data.arrayPush.Value(),
+                         p.elements.size() - base, p.elements.data() + base, &result);
+  p.elements.resize(base);
+  if (status != napi_ok) throw Napi::Error::New(p.env);
+}
+
+static Napi::Value ParseBinary(TextDecoder &p, const JsonToken &token, bool arrayBuffer) {
+  if (token.type != JsonTokenType::kString) {
+    throw Napi::TypeError::New(p.env, "Malformed binary payload");
+  }
+  if (token.decoded.data() == nullptr) {
+    return DecodeBinaryPayload(p.env, token.text.data(), token.text.size(), arrayBuffer,
+                               p.ctx);
+  }
+  // Decoded ahead of time by JsonTape.
+  const std::string_view &bytes = token.decoded;
+  SERDE_STAT(p.ctx.stats, base64Bytes += bytes.size());
+  if (arrayBuffer) {
+    Napi::ArrayBuffer buf = Napi::ArrayBuffer::New(p.env, bytes.size());
+    if (!bytes.empty()) std::memcpy(buf.Data(), bytes.data(), bytes.size());
+    return buf;
+  }
+  return Napi::Buffer<uint8_t>::Copy(p.env, reinterpret_cast<const uint8_t *>(bytes.data()),
+                                     bytes.size());
+}
+
+static Napi::Value ParseNumberWrapper(TextDecoder &p, const JsonToken &token) {
+  if (token.type == JsonTokenType::kNumber) {
+    return Napi::Number::New(p.env, token.number);
+  }
+  if (token.type != JsonTokenType::kString) {
+    ParseValue(p, token, false);
+    return Napi::Number::New(p.env, std::nan(""));
+  }
+  return Napi::Number::New(p.env, ParseNumberText(token.text));
+}
+
+static Napi::Value ParseRegExpPayload(TextDecoder &p, const JsonToken &token) {
+  ExpectToken(p, token, JsonTokenType::kBeginObject);
+  Napi::Value source = p.env.Undefined();
+  Napi::Value flags = p.env.Undefined();
+  while (true) {
+    JsonToken key = p.in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    if (TokenIs(key, kSourceKey)) {
+      source = NextField(p);
+    } else if (TokenIs(key, kFlagsKey)) {
+      flags = NextField(p);
+    } else {
+      p.in.SkipValue();
+    }
+  }
+  return p.ctors.regexpCtor.New({source, flags});
+}
+
+static Napi::Object NewError(TextDecoder &p, const Napi::Value &nameVal,
+                             const Napi::Value &messageVal) {
+  Napi::Function ctor = p.ctx.data.errorCtor.Value();
+  if (nameVal.IsString()) {
+    Napi::Value candidate = p.env.Global().Get(nameVal);
+    if (candidate.IsFunction()) {
+      ctor = candidate.As<Napi::Function>();
+    }
+  }
+  return ctor.New({messageVal});
+}
+
+// Pushes the frame of a container. All but objects and wrappers count as a
+// level of nesting straight away.
+static TextFrame &PushFrame(TextDecoder &p, TextFrameKind kind, napi_value target) {
+  bool entered = kind != TextFrameKind::kObject && kind != TextFrameKind::kWrapper;
+  if (entered) EnterContainer(p.env, p.ctx);
+  TextFrame frame{};
+  frame.kind = kind;
+  frame.entered = entered;
+  frame.target = target;
+  frame.base = p.elements.size();
+  p.frames.push_back(frame);
+  return p.frames.back();
+}
+
+static void PopFrame(TextDecoder &p) {
+  if (p.frames.back().entered) LeaveContainer(p.ctx);
+  if (p.frames.back().pending) p.ctx.pendingIds--;
+  p.frames.pop_back();
+}
+
+// An object counts as a level of nesting once it has a member, so a wrapper
+// that leads with its $$type never does.
+static void EnterObject(TextDecoder &p, TextFrame &f) {
+  if (f.entered) return;
+  EnterContainer(p.env, p.ctx);
+  f.entered = true;
+}
+
+static void Deliver(TextDecoder &p, const Napi::Value &value);
+
+// Pops the frame on top and hands its value to the frame below.
+static void Complete(TextDecoder &p, const Napi::Value &value) {
+  PopFrame(p);
+  Deliver(p, value);
+}
+
+// Starts the value at `token`. A scalar is stored in `value` and true returned;
+// a container pushes its frame instead, and its value reaches the frame below
+// through Deliver once complete. Nothing else touches the frames, so
+// references to them stay valid while this returns true.
+static bool BeginValue(TextDecoder &p, const JsonToken &token, bool inArray,
+                       Napi::Value *value) {
+  switch (token.type) {
+    case JsonTokenType::kBeginObject: {
+      TextFrame &frame = PushFrame(p, TextFrameKind::kObject, nullptr);
+      frame.inArray = inArray;
+      frame.shape = kNoShape;
+      frame.mark = p.in.Save();
+      return false;
+    }
+    case JsonTokenType::kBeginArray:
+      SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kArray)));
+      PushFrame(p, TextFrameKind::kArray, Napi::Array::New(p.env));
+      return false;
+    case JsonTokenType::kString:
+      SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kString)));
+      if (p.deduped && !token.text.empty() && token.text[0] == kStringRefMark) {
+        *value = ResolveStringRef(p, token);
+      } else {
+        *value = MakeString(p.env, token);
+      }
+      return true;
+    case JsonTokenType::kNumber:
+      SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kNumber)));
+      *value = Napi::Number::New(p.env, token.number);
+      return true;
+    case JsonTokenType::kTrue:
+    case JsonTokenType::kFalse:
+      SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kBoolean)));
+      *value = Napi::Boolean::New(p.env, token.type == JsonTokenType::kTrue);
+      return true;
+    case JsonTokenType::kNull:
+      SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kNull)));
+      *value = p.env.Null();
+      return true;
+    default:
+      throw Napi::TypeError::New(p.env, "Unexpected JSON token");
+  }
+}
+
+// Adds an element to an array, leaving Hole slots (empty values) unset.
+// Elements are appended in batches, one call each rather than one per element.
+static void AddElement(TextDecoder &p, TextFrame &f, Napi::Value item) {
+  constexpr size_t kBatchSize = 1024;
+  f.index++;
+  if (item.IsEmpty()) return;
+  if (RevivesUnnamed(p)) item = Revive(p, item, Napi::Number::New(p.env, f.index - 1));
+  Napi::Array out(p.env, f.target);
+  if (f.length + (p.elements.size() - f.base) + 1 != f.index) {
+    // Holes before this element: extend `out` over them first.
+    FlushElements(p, out, f.base);
+    out.Set(p.ctx.keys.Get(p.env, KeyId::kLength), Napi::Number::New(p.env, f.index - 1));
+    f.length = f.index - 1;
+  }
+  p.elements.push_back(item);
+  if (p.elements.size() - f.base == kBatchSize) {
+    FlushElements(p, out, f.base);
+    f.length += kBatchSize;
+  }
+}
+
+static void StepArray(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  while (true) {
+    JsonToken token = p.in.Next();
+    if (token.type == JsonTokenType::kEndArray) break;
+    Napi::Value item;
+    if (!BeginValue(p, token, true, &item)) return;
+    AddElement(p, f, item);
+  }
+  Napi::Array out(p.env, f.target);
+  f.length += static_cast<uint32_t>(p.elements.size() - f.base);
+  FlushElements(p, out, f.base);
+  if (f.length != f.index) {
+    out.Set(p.ctx.keys.Get(p.env, KeyId::kLength), Napi::Number::New(p.env, f.index));
+  }
+  Complete(p, out);
+}
+
+// Adds a member to an object: to p.elements while the members follow a
+// registered shape, onto `target` afterwards.
+static void AddMember(TextDecoder &p, TextFrame &f, Napi::Value value) {
+  if (f.revive) value = Revive(p, value, f.key);
+  if (f.state == TextFrameState::kStart) {
+    p.elements.push_back(value);
+    f.matched++;
+    return;
+  }
+  SetMember(p.env, Napi::Object(p.env, f.target), Napi::Value(p.env, f.key), f.isProto,
+            value);
+}
+
+static bool BeginWrapper(TextDecoder &p, WrapperType type, bool inArray,
+                         Napi::Value *value);
+
+// Reads an object: a wrapper when it carries a known $$type (anywhere among its
+// members), a plain object otherwise.
+static void StepObject(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  JsonReader &in = p.in;
+  // Members that follow a registered shape are collected and the object is
+  // built from the shape's literal in one call.
+  const std::vector<Shape> &shapes = p.ctx.data.shapes;
+  while (true) {
+    JsonToken key = in.Next();
+    ResolveKeyRef(p, key);
+    if (f.state == TextFrameState::kStart) {
+      if (key.type == JsonTokenType::kKey && !shapes.empty()) {
+        size_t next = f.shape != kNoShape && f.matched < shapes[f.shape].keys.size() &&
+                              shapes[f.shape].keys[f.matched] == key.text
+                          ? f.shape
+                          : FindShape(p.ctx.data, f.shape, f.matched, key.text);
+        if (next != kNoShape) {
+          f.shape = next;
+          f.revive = RevivesKey(p, key.text);
+          f.key = f.revive ? static_cast<napi_value>(MakeKey(p, key)) : nullptr;
+          EnterObject(p, f);
+          JsonToken token = in.Next();
+          Napi::Value value;
+          if (!BeginValue(p, token, false, &value)) return;
+          AddMember(p, f, value);
+          continue;
+        }
+      }
+      if (f.shape != kNoShape && key.type == JsonTokenType::kEndObject) {
+        size_t exact = f.matched == shapes[f.shape].keys.size()
+                           ? f.shape
+                           : FindShapePrefix(p.ctx.data, f.shape, f.matched);
+        if (exact != kNoShape) {
+          napi_value result;
+          napi_status status = napi_call_function(p.env, p.env.Undefined(),
+                                                  shapes[exact].create.Value(), f.matched,
+                                                  p.elements.data() + f.base, &result);
+          p.elements.resize(f.base);
+          if (status != napi_ok) throw Napi::Error::New(p.env);
+          SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kPlainObject)));
+          Complete(p, Napi::Value(p.env, result));
+          return;
+        }
+      }
+      Napi::Object out = Napi::Object::New(p.env);
+      for (size_t i = 0; i < f.matched; i++) {
+        // `shape` starts with every key matched so far.
+        const std::string &name = shapes[f.shape].keys[i];
+        SetMember(p.env, out, Napi::String::New(p.env, name), name == "__proto__",
+                  Napi::Value(p.env, p.elements[f.base + i]));
+      }
+      p.elements.resize(f.base);
+      f.target = out;
+      f.state = TextFrameState::kPlainMembers;
+    }
+    if (key.type != JsonTokenType::kKey) {
+      SERDE_STAT(p.ctx.stats, Node(static_cast<size_t>(ValueKind::kPlainObject)));
+      Complete(p, Napi::Value(p.env, f.target));
+      return;
+    }
+    JsonToken token;
+    if (TokenIs(key, kTypeKey)) {
+      token = in.Next();
+      WrapperType type = token.type == JsonTokenType::kString
+                             ? WrapperTypeFromName(token.text)
+                             : WrapperType::kNone;
+      // DedupedStrings is a header, so it is a wrapper only at the root.
+      if (type == WrapperType::kDedupedStrings &&
+          (p.calls != 1 || p.frames.size() != 1 || p.deduped)) {
+        type = WrapperType::kNone;
+      }
+      if (type != WrapperType::kNone) {
+        // $$type after other members: rewind and decode as a wrapper.
+        if (f.entered) in.Restore(f.mark);
+        bool inArray = f.inArray;
+        PopFrame(p);
+        Napi::Value value;
+        if (BeginWrapper(p, type, inArray, &value)) Deliver(p, value);
+        return;
+      }
+      f.key = p.ctx.keys.Get(p.env, KeyId::kType);
+      f.isProto = false;
+      f.revive = RevivesKey(p, kTypeKey);
+    } else {
+      f.key = MakeKey(p, key);
+      f.isProto = TokenIs(key, "__proto__");
+      f.revive = RevivesKey(p, key.text);
+      token = in.Next();
+    }
+    EnterObject(p, f);
+    Napi::Value value;
+    if (!BeginValue(p, token, false, &value)) return;
+    AddMember(p, f, value);
+  }
+}
+
+// Fills an object wrapper's payload (no $$type check).
+static void StepMembers(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  while (true) {
+    JsonToken key = p.in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    ResolveKeyRef(p, key);
+    f.key = MakeKey(p, key);
+    f.isProto = TokenIs(key, "__proto__");
+    f.revive = RevivesKey(p, key.text);
+    JsonToken token = p.in.Next();
+    Napi::Value value;
+    if (!BeginValue(p, token, false, &value)) return;
+    AddMember(p, f, value);
+  }
+  Complete(p, Napi::Value(p.env, f.target));
+}
+
+static void AddSetMember(TextDecoder &p, TextFrame &f, Napi::Value member) {
+  if (RevivesUnnamed(p)) member = Revive(p, member, nullptr);
+  Napi::Function(p.env, f.fn).Call(f.target, {member});
+}
+
+static void StepSet(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  while (true) {
+    JsonToken item = p.in.Next();
+    if (item.type == JsonTokenType::kEndArray) break;
+    Napi::Value member;
+    if (!BeginValue(p, item, false, &member)) return;
+    AddSetMember(p, f, member);
+  }
+  Complete(p, Napi::Value(p.env, f.target));
+}
+
+// Keeps the first two items of a Map entry or Error prop; further ones are
+// decoded and dropped.
+static void AddEntryItem(TextFrame &f, const Napi::Value &item) {
+  if (f.index == 0) {
+    f.key = item;
+  } else if (f.index == 1) {
+    f.value = item;
+  }
+  f.index++;
+}
+
+static void StepMap(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  while (true) {
+    JsonToken token = p.in.Next();
+    if (f.state == TextFrameState::kStart) {
+      if (token.type == JsonTokenType::kEndArray) break;
+      ExpectToken(p, token, JsonTokenType::kBeginArray);
+      f.state = TextFrameState::kMapEntry;
+      f.index = 0;
+      f.key = f.value = p.env.Undefined();
+      continue;
+    }
+    if (token.type == JsonTokenType::kEndArray) {
+      Napi::Value key(p.env, f.key);
+      Napi::Value val(p.env, f.value);
+      if (RevivesUnnamed(p)) {
+        // Map values are revived with their Map key.
+        key = Revive(p, key, nullptr);
+        val = Revive(p, val, key);
+      }
+      Napi::Function(p.env, f.fn).Call(f.target, {key, val});
+      f.state = TextFrameState::kStart;
+      continue;
+    }
+    Napi::Value item;
+    if (!BeginValue(p, token, false, &item)) return;
+    AddEntryItem(f, item);
+  }
+  Complete(p, Napi::Value(p.env, f.target));
+}
+
+// Creates the Error once the fields it is constructed from are read.
+static void CreateError(TextDecoder &p, TextFrame &f) {
+  Napi::Value nameVal(p.env, f.fields[0]);
+  Napi::Value stackVal(p.env, f.fields[2]);
+  Napi::Object target = NewError(p, nameVal, Napi::Value(p.env, f.fields[1]));
+  f.target = target;
+  if (f.hasId) StoreRef(p.ctx, f.refId, target);
+  if (nameVal.IsString()) target.Set(p.ctx.keys.Get(p.env, KeyId::kName), nameVal);
+  if (stackVal.IsString()) target.Set(p.ctx.keys.Get(p.env, KeyId::kStack), stackVal);
+  f.created = true;
+}
+
+static void AddErrorItem(TextDecoder &p, TextFrame &f, const Napi::Value &item) {
+  switch (f.state) {
+    case TextFrameState::kErrorField:
+      f.fields[f.index] = item;
+      f.state = TextFrameState::kStart;
+      break;
+    case TextFrameState::kErrorJunk:
+      f.state = TextFrameState::kStart;
+      break;
+    case TextFrameState::kErrorEntryJunk:
+      f.state = TextFrameState::kErrorProps;
+      break;
+    default:
+      AddEntryItem(f, item);
+  }
+}
+
+static void SetErrorProp(TextDecoder &p, TextFrame &f) {
+  if (f.index < 2) return;
+  Napi::Value key(p.env, f.key);
+  Napi::Value value(p.env, f.value);
+  if (key.IsString() && p.reviver.decoded &&
+      RevivesKey(p, key.As<Napi::String>().Utf8Value())) {
+    value = Revive(p, value, key);
+  }
+  if (key.IsString() || key.IsSymbol()) {
+    Napi::Object(p.env, f.target).Set(key, value);
+  }
+}
+
+// Error payload: {name, message, stack, props}; props come last and hold
+// [key, value] pairs.
+static void StepError(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  while (true) {
+    JsonToken token = p.in.Next();
+    if (f.state == TextFrameState::kStart) {
+      if (token.type != JsonTokenType::kKey) break;
+      int field = TokenIs(token, kNameKey)      ? 0
+                  : TokenIs(token, kMessageKey) ? 1
+                  : TokenIs(token, kStackKey)   ? 2
+                                                : -1;
+      if (field >= 0) {
+        token = p.in.Next();
+        if (token.type != JsonTokenType::kBeginObject &&
+            token.type != JsonTokenType::kBeginArray) {
+          f.fields[field] = ParseField(p, token);
+          continue;
+        }
+        f.state = TextFrameState::kErrorField;
+        f.index = static_cast<uint32_t>(field);
+      } else if (TokenIs(token, kPropsKey)) {
+        if (!f.created) CreateError(p, f);
+        token = p.in.Next();
+        if (token.type == JsonTokenType::kBeginArray) {
+          f.state = TextFrameState::kErrorProps;
+          continue;
+        }
+        f.state = TextFrameState::kErrorJunk;
+      } else {
+        p.in.SkipValue();
+        continue;
+      }
+    } else if (f.state == TextFrameState::kErrorProps) {
+      if (token.type == JsonTokenType::kEndArray) {
+        f.state = TextFrameState::kStart;
+        continue;
+      }
+      if (token.type == JsonTokenType::kBeginArray) {
+        f.state = TextFrameState::kErrorPair;
+        f.index = 0;
+        continue;
+      }
+      f.state = TextFrameState::kErrorEntryJunk;
+    } else if (token.type == JsonTokenType::kEndArray) {  // kErrorPair
+      SetErrorProp(p, f);
+      f.state = TextFrameState::kErrorProps;
+      continue;
+    }
+    Napi::Value item;
+    if (!BeginValue(p, token, false, &item)) return;
+    AddErrorItem(p, f, item);
+  }
+  if (!f.created) CreateError(p, f);
+  Complete(p, Napi::Value(p.env, f.target));
+}
+
+// Starts the container payload of an object/array/Set/Map/Error wrapper. The
+// container is created (and registered under a known $$id) before its children;
+// an Error once its name and message are read.
+static void BeginPayload(TextDecoder &p, WrapperType type, uint32_t refId, bool hasId) {
+  JsonToken token = p.in.Next();
+  Napi::Object target;
+  TextFrameKind kind;
+  napi_value fn = nullptr;
+  if (type == WrapperType::kObject) {
+    ExpectToken(p, token, JsonTokenType::kBeginObject);
+    target = Napi::Object::New(p.env);
+    kind = TextFrameKind::kMembers;
+  } else if (type == WrapperType::kArray) {
+    ExpectToken(p, token, JsonTokenType::kBeginArray);
+    target = Napi::Array::New(p.env);
+    kind = TextFrameKind::kArray;
+  } else if (type == WrapperType::kSet) {
+    ExpectToken(p, token, JsonTokenType::kBeginArray);
+    target = p.ctors.setCtor.New({});
+    fn = target.Get(p.ctx.keys.Get(p.env, KeyId::kAdd));
+    kind = TextFrameKind::kSet;
+  } else if (type == WrapperType::kMap) {
+    ExpectToken(p, token, JsonTokenType::kBeginArray);
+    target = p.ctors.mapCtor.New({});
+    fn = target.Get(p.ctx.keys.Get(p.env, KeyId::kSet));
+    kind = TextFrameKind::kMap;
+  } else {
+    ExpectToken(p, token, JsonTokenType::kBeginObject);
+    TextFrame &frame = PushFrame(p, TextFrameKind::kError, nullptr);
+    frame.refId = refId;
+    frame.hasId = hasId;
+    frame.fields[0] = frame.fields[1] = frame.fields[2] = p.env.Undefined();
+    return;
+  }
+  if (hasId) StoreRef(p.ctx, refId, target);
+  TextFrame &frame = PushFrame(p, kind, target);
+  frame.fn = fn;
+  if (kind == TextFrameKind::kMembers) frame.state = TextFrameState::kPlainMembers;
+}
+
+static void SetPayload(TextDecoder &p, TextFrame &f, const Napi::Value &payload) {
+  f.target = payload;
+  if (!f.pending) return;
+  f.pending = false;
+  if (--p.ctx.pendingIds == 0) p.ctx.provisional.clear();
+}
+
+// Reads the members of a container wrapper whose $$type was already read, in
+// any order, and its payload when the `value` member comes up. `$$type`
+// members are skipped.
+static void StepWrapper(TextDecoder &p) {
+  TextFrame &f = p.frames.back();
+  JsonReader &in = p.in;
+  while (true) {
+    JsonToken key = in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    if (TokenIs(key, kIdKey)) {
+      JsonToken idToken = in.Next();
+      if (idToken.type != JsonTokenType::kNumber) continue;
+      f.refId = TokenUint32(idToken.number);
+      f.hasId = true;
+      if (f.haveValue && !f.indexed) StoreRef(p.ctx, f.refId, Napi::Value(p.env, f.target));
+    } else if (TokenIs(key, kValueKey) && !f.haveValue) {
+      f.mark = in.Save();
+      f.haveValue = true;
+      auto it = f.hasId ? p.ids.end() : p.ids.find(f.mark.pos);
+      if (it != p.ids.end()) {
+        f.refId = it->second;
+        f.hasId = true;
+        f.indexed = true;
+      } else if (!f.hasId) {
+        // Undone by RecoverForwardReference if the payload refers to this
+        // wrapper before its $$id.
+        f.pending = true;
+        f.provisional = p.ctx.provisional.size();
+        f.base = p.elements.size();
+        p.ctx.pendingIds++;
+      }
+      BeginPayload(p, f.type, f.refId, f.hasId);
+      return;
+    } else {
+      in.SkipValue();
+    }
+  }
+  if (!f.haveValue) {
+    throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+  }
+  Complete(p, Napi::Value(p.env, f.target));
+}
+
+// Records the $$id of each wrapper in the value being decoded by the position
+// of its payload, reading that value once more from its start.
+static void IndexIds(TextDecoder &p) {
+  struct Open {
+    bool haveValue;
+    bool hasId;
+    uint32_t id;
+    size_t value;
+  };
+  std::vector<Open> open;
+  JsonReader in = p.in;
+  in.Restore(p.start);
+  bool isId = false;  // the token is the value of a $$id member
+  do {
+    JsonToken token = in.Next();
+    if (isId && token.type == JsonTokenType::kNumber) {
+      open.back().id = TokenUint32(token.number);
+      open.back().hasId = true;
+    }
+    isId = false;
+    switch (token.type) {
+      case JsonTokenType::kBeginObject:
+      case JsonTokenType::kBeginArray:
+        open.push_back(Open{});
+        break;
+      case JsonTokenType::kKey:
+        if (TokenIs(token, kIdKey)) {
+          isId = true;
+        } else if (TokenIs(token, kValueKey) && !open.back().haveValue) {
+          open.back().haveValue = true;
+          open.back().value = in.Save().pos;
+        }
+        break;
+      case JsonTokenType::kEndObject:
+      case JsonTokenType::kEndArray:
+        if (open.back().haveValue && open.back().hasId) {
+          p.ids[open.back().value] = open.back().id;
+        }
+        open.pop_back();
+        break;
+      case JsonTokenType::kEnd:
+        return;
+      default:
+        break;
+    }
+  } while (!open.empty());
+}
+
+// Unwinds to the wrapper with $$id `id` whose payload is being decoded before
+// that $$id, and decodes the payload again with the wrapper registered first.
+// The ids of the value are indexed on the first call, so wrappers begun after
+// it are registered up front and no payload is decoded more than twice.
+// Returns false when no such wrapper is among the current call's frames.
+static bool RecoverForwardReference(TextDecoder &p, uint32_t id) {
+  if (!p.indexed) {
+    IndexIds(p);
+    p.indexed = true;
+  }
+  size_t index = p.frames.size();
+  while (true) {
+    if (index == p.base) return false;
+    const TextFrame &f = p.frames[--index];
+    if (!f.pending) continue;
+    auto it = p.ids.find(f.mark.pos);
+    if (it != p.ids.end() && it->second == id) break;
+  }
+  while (p.frames.size() > index + 1) PopFrame(p);
+  TextFrame &f = p.frames.back();
+  p.ctx.pendingIds--;
+  p.elements.resize(f.base);
+  for (size_t i = f.provisional; i < p.ctx.provisional.size(); i++) {
+    p.ctx.refs.erase(p.ctx.provisional[i]);
+  }
+  p.ctx.provisional.resize(f.provisional);
+  f.pending = false;
+  f.refId = id;
+  f.hasId = true;
+  f.indexed = true;
+  p.in.Restore(f.mark);
+  BeginPayload(p, f.type, id, true);
+  return true;
+}
+
+// Decodes the remaining members of a scalar, binary or symbol wrapper whose
+// $$type was already read. Fields are accepted in any order; `$$type` members
+// are skipped.
+static Napi::Value ParseScalarWrapper(TextDecoder &p, WrapperType type, bool inArray) {
+  JsonReader &in = p.in;
+  uint32_t refId = 0;
+  bool hasId = false;
+  Napi::Value result = p.env.Undefined();
+  Napi::Value arrayType;
+  Napi::Value buffer;  // a view's shared ArrayBuffer, instead of its own bytes
+  uint32_t byteOffset = 0;
+  uint32_t length = 0;
+  bool isGlobal = false;
+  Napi::Value symbolKey = p.env.Undefined();
+  Napi::Value description = p.env.Undefined();
+  uint32_t attachment = 0;
+  bool hasAttachment = false;
+  bool hasValue = false;
+  bool isHole = type == WrapperType::kHole;
+  bool isReference = type == WrapperType::kReference;
+
+  while (true) {
+    JsonToken key = in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    if (TokenIs(key, kIdKey)) {
+      JsonToken idToken = in.Next();
+      if (idToken.type != JsonTokenType::kNumber) continue;
+      refId = TokenUint32(idToken.number);
+      hasId = true;
+      continue;
+    }
+    if (isHole || isReference || type == WrapperType::kUndefined) {
+      in.SkipValue();
+      continue;
+    }
+    if (TokenIs(key, kValueKey)) {
+      JsonToken token = in.Next();
+      hasValue = true;
+      switch (type) {
+        case WrapperType::kNumber:
+          result = ParseNumberWrapper(p, token);
+          break;
+        case WrapperType::kBigInt:
+          result = p.ctors.bigintCtor.Call(p.env.Global(), {ParseField(p, token)});
+          break;
+        case WrapperType::kDate:
+          result = p.ctors.dateCtor.New({ParseField(p, token)});
+          break;
+        case WrapperType::kRegExp:
+          result = ParseRegExpPayload(p, token);
+          break;
+        case WrapperType::kPropKeyString: {
+          Napi::Value value = ParseField(p, token);
+          result = value.IsUndefined() ? p.env.Undefined() : value.ToString();
+          break;
         }
+        case WrapperType::kBuffer:
+          result = ParseBinary(p, token, false);
+          break;
+        case WrapperType::kArrayBuffer:
+        case WrapperType::kTypedArray:
+        case WrapperType::kDataView:
+        case WrapperType::kPackedArray:
+          result = ParseBinary(p, token, true);
+          break;
+        default:
+          ParseValue(p, token, false);
+      }
+    } else if (TokenIs(key, kArrayTypeKey)) {
+      arrayType = NextField(p);
+    } else if (TokenIs(key, kLengthKey)) {
+      JsonToken token = in.Next();
+      if (token.type == JsonTokenType::kNumber) {
+        length = TokenUint32(token.number);
+      } else {
+        ParseValue(p, token, false);
+      }
+    } else if (TokenIs(key, kBufferKey)) {
+      buffer = NextField(p);
+    } else if (TokenIs(key, kByteOffsetKey)) {
+      JsonToken token = in.Next();
+      if (token.type == JsonTokenType::kNumber) {
+        byteOffset = TokenUint32(token.number);
+      } else {
+        ParseValue(p, token, false);
+      }
+    } else if (TokenIs(key, kAttachmentKey)) {
+      JsonToken token = in.Next();
+      if (token.type == JsonTokenType::kNumber) {
+        attachment = TokenUint32(token.number);
+        hasAttachment = true;
+      } else {
+        ParseValue(p, token, false);
       }
+    } else if (TokenIs(key, kGlobalKey)) {
+      isGlobal = in.Next().type == JsonTokenType::kTrue;
+    } else if (TokenIs(key, kKeyKey)) {
+      symbolKey = NextField(p);
+    } else if (TokenIs(key, kDescriptionKey)) {
+      description = NextField(p);
+    } else {
+      in.SkipValue();
+    }
+  }
+
+  if (!hasValue && NeedsValue(type)) {
+    throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+  }
+  if (isReference) {
+    if (p.ctx.lazy != nullptr) p.ctx.lazy->Resolve(p.env, p.ctx, refId);
+    if (p.ctx.pendingIds > 0 && p.ctx.refs.find(refId) == p.ctx.refs.end()) {
+      throw ForwardReference{refId};
+    }
+    return GetRefValue(p.ctx, refId, p.env);
+  }
+  if (isHole) {
+    if (inArray) return Napi::Value();
+    Napi::Object hole = Napi::Object::New(p.env);
+    hole.Set(p.ctx.keys.Get(p.env, KeyId::kType), kTypeHole);
+    return hole;
+  }
+  if (type == WrapperType::kPropKeySymbol) {
+    Napi::Object symbolCtor = p.ctx.data.symbolCtor.Value();
+    if (isGlobal) {
+      return p.ctx.data.symbolFor.Call(symbolCtor, {symbolKey});
     }
-    return DecodeObject(env, obj, ctors, reviver, ctx, true);
+    return symbolCtor.As<Napi::Function>().Call(p.env.Global(), {description});
   }
+  if (hasAttachment && IsBinaryWrapperType(type)) {
+    std::string typeName;
+    if (type == WrapperType::kTypedArray && !arrayType.IsEmpty()) {
+      typeName = arrayType.ToString().Utf8Value();
+    }
+    result = DecodeAttachment(p.env, p.ctx, type, attachment, typeName, length);
+  } else if (type == WrapperType::kTypedArray || type == WrapperType::kDataView) {
+    if (!buffer.IsEmpty()) {
+      result = CheckViewBuffer(p.env, buffer);
+    } else {
+      // The view's own bytes always start at 0.
+      byteOffset = 0;
+      if (result.IsUndefined()) result = Napi::ArrayBuffer::New(p.env, 0);
+    }
+    std::string ctorName = "DataView";
+    if (type == WrapperType::kTypedArray) {
+      ctorName = arrayType.IsEmpty() ? "undefined" : arrayType.ToString().Utf8Value();
+    }
+    Napi::Value ctorVal = p.env.Global().Get(ctorName);
+    if (!ctorVal.IsFunction()) {
+      throw Napi::TypeError::New(p.env, type == WrapperType::kTypedArray
+                                            ? "Unknown typed array constructor"
+                                            : "DataView constructor not found");
+    }
+    result = ctorVal.As<Napi::Function>().New(
+        {result, Napi::Number::New(p.env, byteOffset), Napi::Number::New(p.env, length)});
+  } else if (type == WrapperType::kPackedArray) {
+    result = result.IsUndefined() ? Napi::Array::New(p.env)
+                                  : UnpackPayload(p.env, p.ctx, result);
+  } else if (type == WrapperType::kBuffer && result.IsUndefined()) {
+    result = Napi::Buffer<uint8_t>::New(p.env, 0);
+  } else if (type == WrapperType::kArrayBuffer && result.IsUndefined()) {
+    result = Napi::ArrayBuffer::New(p.env, 0);
+  } else if (type == WrapperType::kDate && result.IsUndefined()) {
+    result = p.ctors.dateCtor.New({p.env.Undefined()});  // an Invalid Date
+  }
+  if (hasId && result.IsObject()) StoreRef(p.ctx, refId, result);
+  return result;
+}
+
+// Decodes the document under a DedupedStrings header, after the checksum of
+// its dictionary and its string table. StepObject only reads the root as such
+// a header.
+static Napi::Value ParseDedupedStrings(TextDecoder &p) {
+  JsonReader &in = p.in;
+  p.deduped = true;
+  Napi::Value result;
+  bool haveDictionary = false;
+  bool haveStrings = false;
+  bool haveValue = false;
+  while (true) {
+    JsonToken key = in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    if (TokenIs(key, kDictionaryKey) && !haveDictionary && !haveStrings && !haveValue) {
+      // References number the dictionary's entries before the table's.
+      JsonToken checksum = in.Next();
+      if (checksum.type != JsonTokenType::kNumber) {
+        throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+      }
+      const Dictionary *dict = p.ctx.dictionary;
+      if (dict == nullptr) {
+        throw Napi::TypeError::New(p.env, "The payload needs the dictionary it was written with");
+      }
+      if (dict->Checksum() != checksum.number) {
+        throw Napi::TypeError::New(p.env, "The payload was written with another dictionary");
+      }
+      p.dictSize = dict->Size();
+      p.strings.assign(p.dictSize, nullptr);
+      haveDictionary = true;
+    } else if (TokenIs(key, kStringsKey) && !haveStrings && !haveValue) {
+      // The value is decoded as it is read, so the table comes first.
+      if (in.Next().type != JsonTokenType::kBeginArray) {
+        throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+      }
+      for (JsonToken token = in.Next(); token.type != JsonTokenType::kEndArray;
+           token = in.Next()) {
+        if (token.type != JsonTokenType::kString) {
+          throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+        }
+        p.strings.push_back(MakeString(p.env, token));
+        p.texts.push_back({std::string(token.text), token.ascii, token.wtf8});
+      }
+      haveStrings = true;
+    } else if (TokenIs(key, kValueKey) && !haveValue) {
+      result = NextValue(p);
+      haveValue = true;
+    } else {
+      in.SkipValue();
+    }
+  }
+  if (!haveValue) {
+    throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+  }
+  return result;
+}
+
+// Counts and starts a wrapper whose $$type was already read. Container
+// wrappers push a frame and return false, like BeginValue; the others are
+// decoded here.
+static bool BeginWrapper(TextDecoder &p, WrapperType type, bool inArray,
+                         Napi::Value *value) {
+  if (type == WrapperType::kDedupedStrings) {
+    *value = ParseDedupedStrings(p);
+    return true;
+  }
+  CountWrapper(p.ctx, type);
+  if (IsContainerWrapperType(type)) {
+    PushFrame(p, TextFrameKind::kWrapper, nullptr).type = type;
+    return false;
+  }
+  *value = ParseScalarWrapper(p, type, inArray);
+  return true;
+}
+
+static void Deliver(TextDecoder &p, const Napi::Value &value) {
+  if (p.frames.size() == p.base) {
+    p.result = value;
+    return;
+  }
+  TextFrame &f = p.frames.back();
+  switch (f.kind) {
+    case TextFrameKind::kArray:
+      AddElement(p, f, value);
+      break;
+    case TextFrameKind::kObject:
+    case TextFrameKind::kMembers:
+      AddMember(p, f, value);
+      break;
+    case TextFrameKind::kSet:
+      AddSetMember(p, f, value);
+      break;
+    case TextFrameKind::kMap:
+      AddEntryItem(f, value);
+      break;
+    case TextFrameKind::kError:
+      AddErrorItem(p, f, value);
+      break;
+    case TextFrameKind::kWrapper:
+      SetPayload(p, f, value);
+      break;
+  }
+}
+
+// Reads tokens for the frame on top until it completes or pushes a child.
+static void StepFrame(TextDecoder &p) {
+  switch (p.frames.back().kind) {
+    case TextFrameKind::kArray:
+      StepArray(p);
+      break;
+    case TextFrameKind::kObject:
+      StepObject(p);
+      break;
+    case TextFrameKind::kMembers:
+      StepMembers(p);
+      break;
+    case TextFrameKind::kSet:
+      StepSet(p);
+      break;
+    case TextFrameKind::kMap:
+      StepMap(p);
+      break;
+    case TextFrameKind::kError:
+      StepError(p);
+      break;
+    case TextFrameKind::kWrapper:
+      StepWrapper(p);
+      break;
+  }
+}
+
+// Wrapper fields meant to hold scalars are decoded with a nested ParseValue
+// when they hold a container. Only malformed input does that, so the nesting
+// of such calls is capped instead of being moved off the call stack.
+constexpr unsigned kMaxNestedCalls = 256;
+
+// Decodes the value starting at `token`, running frames until the one begun
+// here is complete.
+static Napi::Value ParseValue(TextDecoder &p, const JsonToken &token, bool inArray) {
+  if (p.calls == kMaxNestedCalls) {
+    throw Napi::TypeError::New(p.env, "Malformed wrapper payload");
+  }
+  size_t outer = p.base;
+  p.base = p.frames.size();
+  p.calls++;
+  Napi::Value value;
+  try {
+    if (!BeginValue(p, token, inArray, &value)) {
+      while (p.frames.size() > p.base) {
+        try {
+          StepFrame(p);
+        } catch (const ForwardReference &ref) {
+          if (!RecoverForwardReference(p, ref.id)) throw;
+        }
+      }
+      value = p.result;
+    }
+  } catch (...) {
+    while (p.frames.size() > p.base) PopFrame(p);
+    p.base = outer;
+    p.calls--;
+    throw;
+  }
+  p.base = outer;
+  p.calls--;
   return value;
 }
 
+static Napi::Error ToSyntaxError(const Napi::Env &env, const JsonSyntaxError &err) {
+  Napi::Function ctor = env.Global().Get("SyntaxError").As<Napi::Function>();
+  return Napi::Error(env, ctor.New({Napi::String::New(env, err.what())}));
+}
+
+static Napi::Value ParseDocument(const Napi::Env &env, JsonReader &in,
+                                 const Ctors &ctors, const Reviver &reviver,
+                                 DecodeContext &ctx) {
+  TextDecoder p{env, in, ctors, reviver, ctx};
+  try {
+    Napi::Value result = NextValue(p);
+    in.Next();  // rejects trailing data
+    return RevivesUnnamed(p) ? Revive(p, result, nullptr) : result;
+  } catch (const JsonSyntaxError &err) {
+    throw ToSyntaxError(env, err);
+  } catch (const ForwardReference &) {
+    throw Napi::TypeError::New(env, "Unknown reference id");
+  }
+}
+
+Napi::Value ParseText(const Napi::Env &env, const char *data, size_t len,
+                      const Ctors &ctors, const Reviver &reviver, DecodeContext &ctx) {
+  JsonReader in(data, len);
+  try {
+    return ParseDocument(env, in, ctors, reviver, ctx);
+  } catch (const Napi::Error &) {
+    // Decoding stops at the first bad wrapper, but JSON.parse reports a syntax
+    // error anywhere in the text first; only a failed parse pays for the scan.
+    JsonReader check(data, len);
+    try {
+      check.SkipValue();
+      check.Next();
+    } catch (const JsonSyntaxError &err) {
+      throw ToSyntaxError(env, err);
+    }
+    throw;
+  }
+}
+
+Napi::Value ParseTape(const Napi::Env &env, const JsonTape &tape, const Ctors &ctors,
+                      const Reviver &reviver, DecodeContext &ctx) {
+  JsonReader in(tape);
+  return ParseDocument(env, in, ctors, reviver, ctx);
+}
+
+Napi::Value ParseTapeValue(const Napi::Env &env, const JsonTape &tape, size_t index,
+                           const Ctors &ctors, DecodeContext &ctx) {
+  JsonReader in(tape, index);
+  Reviver reviver;
+  TextDecoder p{env, in, ctors, reviver, ctx};
+  // Counted as nested, so a DedupedStrings header here is a plain object, as
+  // it is anywhere but the root.
+  p.calls = 1;
+  try {
+    return NextValue(p);
+  } catch (const ForwardReference &) {
+    throw Napi::TypeError::New(env, "Unknown reference id");
+  }
+}
+
 }  // namespace bas_serde
@@ -1,6 +1,7 @@
 #ifndef BAS_UTILS_SERIALIZATION_DECODE_H
 #define BAS_UTILS_SERIALIZATION_DECODE_H
 
+#include "json_reader.h"
 #include "serde_utils.h"
 
 namespace bas_serde {
@@ -9,6 +10,33 @@ Napi::Value DecodeValue(const Napi::Env &env, const Napi::Value &value,
                         const Ctors &ctors, const Reviver &reviver,
                         DecodeContext &ctx, bool applyReviver);
 
+// Decodes serialized JSON text straight into final values, applying a
+// decoded-mode reviver (see Reviver) if set. Malformed input throws a JS
+// SyntaxError.
+Napi::Value ParseText(const Napi::Env &env, const char *data, size_t len,
+                      const Ctors &ctors, const Reviver &reviver, DecodeContext &ctx);
+
+// Same as ParseText over a tape built ahead of time (see JsonTape).
+Napi::Value ParseTape(const Napi::Env &env, const JsonTape &tape, const Ctors &ctors,
+                      const Reviver &reviver, DecodeContext &ctx);
+
+// Decodes the value whose first token is entry `index` of `tape`, which must
+// lie inside the document's root value (see LazyDocument).
+Napi::Value ParseTapeValue(const Napi::Env &env, const JsonTape &tape, size_t index,
+                           const Ctors &ctors, DecodeContext &ctx);
+
+// Converts a number token to the uint32 a $$id or wrapper field holds.
+uint32_t TokenUint32(double value);
+
+// Creates the property key for a kKey token, shared through ctx.names.
+Napi::Value MakePropertyKey(const Napi::Env &env, DecodeContext &ctx,
+                            const JsonToken &token);
+
+// Decodes a stringifyBinary payload (see binary_format.h). Malformed input
+// throws a JS TypeError.
+Napi::Value ParseBinaryPayload(const Napi::Env &env, const uint8_t *data, size_t len,
+                               const Ctors &ctors, DecodeContext &ctx);
+
 }  // namespace bas_serde
 
 #endif
@@ -0,0 +1,235 @@
+#include "dictionary.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "encode.h"
+
+namespace bas_serde {
+
+// Indexes are varints, and those past 16384 already take three bytes, so
+// larger dictionaries would gain little.
+constexpr uint32_t kMaxDictionaryEntries = 65536;
+constexpr uint32_t kDefaultDictionaryEntries = 1024;
+
+static uint32_t HashUnits(const char16_t *units, size_t length) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (units[i] & 0xFF)) * 16777619u;
+    hash = (hash ^ (units[i] >> 8)) * 16777619u;
+  }
+  return hash;
+}
+
+// Appends UTF-16 units as WTF-8: UTF-8 that encodes lone surrogates like any
+// other code point. Returns whether any lone surrogate was written.
+static bool AppendWtf8(const char16_t *units, size_t length, std::string &out) {
+  bool lone = false;
+  for (size_t i = 0; i < length; i++) {
+    uint32_t c = units[i];
+    if (c >= 0xD800 && c <= 0xDBFF && i + 1 < length && units[i + 1] >= 0xDC00 &&
+        units[i + 1] <= 0xDFFF) {
+      c = 0x10000 + ((c - 0xD800) << 10) + (units[++i] - 0xDC00);
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+      lone = true;
+    }
+    if (c < 0x80) {
+      out.push_back(static_cast<char>(c));
+    } else if (c < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (c >> 6)));
+      out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (c >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (c >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+    }
+  }
+  return lone;
+}
+
+static size_t VarintSize(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7) size++;
+  return size;
+}
+
+Napi::Function Dictionary::Init(Napi::Env env) {
+  Napi::Function ctor = DefineClass(
+      env, "Dictionary", {InstanceAccessor("strings", &Dictionary::GetStrings, nullptr)});
+  GetMutableAddonData(env).dictionaryCtor = Napi::Persistent(ctor);
+  return ctor;
+}
+
+Dictionary::Dictionary(const Napi::CallbackInfo &info) : Napi::ObjectWrap<Dictionary>(info) {
+  Napi::Env env = info.Env();
+  if (!info[0].IsArray()) {
+    throw Napi::TypeError::New(env, "Dictionary expects an array of strings");
+  }
+  Napi::Array strings = info[0].As<Napi::Array>();
+  uint32_t count = strings.Length();
+  if (count > kMaxDictionaryEntries) {
+    throw Napi::RangeError::New(env, "A dictionary holds at most 65536 strings");
+  }
+
+  Napi::Array copy = Napi::Array::New(env, count);
+  size_t capacity = 16;
+  while (capacity < count * 2) capacity *= 2;  // at most half full
+  slots_.assign(capacity, 0);
+  offsets_.reserve(count + 1);
+  offsets_.push_back(0);
+  textOffsets_.reserve(count + 1);
+  textOffsets_.push_back(0);
+  checksum_ = HashUnits(nullptr, 0);
+  std::u16string scratch;
+  for (uint32_t i = 0; i < count; i++) {
+    Napi::Value entry = strings.Get(i);
+    if (!entry.IsString()) {
+      throw Napi::TypeError::New(env, "Dictionary entries must be strings");
+    }
+    size_t length = CopyJsString(env, entry, scratch);
+    // A key written by index is set with a plain assignment when decoded.
+    if (std::u16string_view(scratch.data(), length) == u"__proto__") {
+      throw Napi::TypeError::New(env, "__proto__ cannot be a dictionary entry");
+    }
+    if (Find(scratch.data(), length) != kNotInDictionary) {
+      throw Napi::TypeError::New(env, "Dictionary entries must be unique");
+    }
+    uint32_t hash = HashUnits(scratch.data(), length);
+    size_t mask = slots_.size() - 1;
+    size_t slot = hash & mask;
+    while (slots_[slot] != 0) slot = (slot + 1) & mask;
+    slots_[slot] = i + 1;
+    hashes_.push_back(hash);
+    units_.append(scratch.data(), length);
+    offsets_.push_back(static_cast<uint32_t>(units_.size()));
+    bool ascii = std::all_of(scratch.data(), scratch.data() + length,
+                             [](char16_t c) { return c < 0x80; });
+    bool lone = AppendWtf8(scratch.data(), length, text_);
+    textOffsets_.push_back(static_cast<uint32_t>(text_.size()));
+    textKinds_.push_back(ascii ? kAscii : lone ? kWtf8 : kUtf8);
+    // The checksum covers the order of the entries as well as their text.
+    checksum_ = (checksum_ ^ hash) * 16777619u;
+    copy.Set(i, entry);
+  }
+  strings_ = Napi::Persistent(static_cast<Napi::Object>(copy));
+}
+
+uint32_t Dictionary::Find(const char16_t *units, size_t length) const {
+  uint32_t hash = HashUnits(units, length);
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask; slots_[slot] != 0; slot = (slot + 1) & mask) {
+    uint32_t index = slots_[slot] - 1;
+    if (hashes_[index] != hash) continue;
+    uint32_t begin = offsets_[index];
+    if (offsets_[index + 1] - begin == length &&
+        std::memcmp(units_.data() + begin, units, length * sizeof(char16_t)) == 0) {
+      return index;
+    }
+  }
+  return kNotInDictionary;
+}
+
+Napi::Value Dictionary::GetStrings(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Array strings(env, Strings());
+  uint32_t count = strings.Length();
+  Napi::Array copy = Napi::Array::New(env, count);
+  for (uint32_t i = 0; i < count; i++) copy.Set(i, strings.Get(i));
+  return copy;
+}
+
+const Dictionary *ReadDictionary(const Napi::Value &optionsVal) {
+  if (!optionsVal.IsObject()) return nullptr;
+  Napi::Value dictVal = optionsVal.As<Napi::Object>().Get("dictionary");
+  if (dictVal.IsUndefined()) return nullptr;
+  const AddonData &data = GetAddonData(optionsVal.Env());
+  if (!dictVal.IsObject() ||
+      !dictVal.As<Napi::Object>().InstanceOf(data.dictionaryCtor.Value())) {
+    throw Napi::TypeError::New(optionsVal.Env(), "dictionary must be a Dictionary");
+  }
+  return Dictionary::Unwrap(dictVal.As<Napi::Object>());
+}
+
+Napi::ObjectReference HoldDictionary(const Napi::Value &options) {
+  if (ReadDictionary(options) == nullptr) return Napi::ObjectReference();
+  return Napi::Persistent(options.As<Napi::Object>().Get("dictionary").As<Napi::Object>());
+}
+
+// A string the samples wrote, with the bytes it would save as an entry.
+struct Candidate {
+  const std::u16string *text;
+  uint32_t count;
+  uint64_t saving;
+};
+
+Napi::Value TrainDictionary(const Napi::Env &env, const Napi::Value &samplesVal,
+                            const Napi::Value &options) {
+  if (!samplesVal.IsArray()) {
+    throw Napi::TypeError::New(env, "trainDictionary expects an array of samples");
+  }
+  uint32_t maxEntries = kDefaultDictionaryEntries;
+  if (options.IsObject()) {
+    Napi::Value maxVal = options.As<Napi::Object>().Get("maxEntries");
+    if (!maxVal.IsUndefined()) {
+      double max = maxVal.IsNumber() ? maxVal.As<Napi::Number>().DoubleValue() : 0;
+      if (!(max >= 1 && max <= kMaxDictionaryEntries) || std::trunc(max) != max) {
+        throw Napi::TypeError::New(env, "maxEntries must be an integer from 1 to 65536");
+      }
+      maxEntries = static_cast<uint32_t>(max);
+    }
+  }
+
+  // Each sample is encoded on its own, as it would be sent.
+  AddonData &data = GetMutableAddonData(env);
+  std::unordered_map<std::u16string, uint32_t> counts;
+  Napi::Array samples = samplesVal.As<Napi::Array>();
+  for (uint32_t i = 0; i < samples.Length(); i++) {
+    Napi::HandleScope scope(env);
+    Replacer replacer;
+    EncodeContext ctx(data);
+    ctx.stats.Discard();
+    ReadStringifyOptions(options, replacer, ctx);
+    ctx.dictionary = nullptr;  // count every string, not just the new ones
+    ctx.stringCounts = &counts;
+    EncodeBinaryValue(env, samples.Get(i), ctx, replacer, true);
+  }
+
+  // A string written in full costs its tag, length and units; by index, its
+  // tag and (for the first 128 entries) one byte.
+  std::vector<Candidate> candidates;
+  for (const auto &[text, count] : counts) {
+    if (count < 2 || text == u"__proto__") continue;
+    bool latin1 = std::all_of(text.begin(), text.end(), [](char16_t c) { return c <= 0xFF; });
+    size_t written = 1 + VarintSize(text.size()) + text.size() * (latin1 ? 1 : 2);
+    if (written <= 2) continue;
+    candidates.push_back({&text, count, static_cast<uint64_t>(count) * (written - 2)});
+  }
+  auto bySaving = [](const Candidate &a, const Candidate &b) {
+    return a.saving != b.saving ? a.saving > b.saving : *a.text < *b.text;
+  };
+  if (candidates.size() > maxEntries) {
+    std::partial_sort(candidates.begin(), candidates.begin() + maxEntries, candidates.end(),
+                      bySaving);
+    candidates.resize(maxEntries);
+  }
+  // The most frequent strings get the shortest indexes.
+  std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+    return a.count != b.count ? a.count > b.count : *a.text < *b.text;
+  });
+
+  Napi::Array strings = Napi::Array::New(env, candidates.size());
+  for (size_t i = 0; i < candidates.size(); i++) {
+    const std::u16string &text = *candidates[i].text;
+    strings.Set(static_cast<uint32_t>(i), Napi::String::New(env, text.data(), text.size()));
+  }
+  return data.dictionaryCtor.New({strings});
+}
+
+}  // namespace bas_serde
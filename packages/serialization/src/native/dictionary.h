@@ -0,0 +1,73 @@
+#ifndef BAS_UTILS_SERIALIZATION_DICTIONARY_H
+#define BAS_UTILS_SERIALIZATION_DICTIONARY_H
+
+#include <napi.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bas_serde {
+
+constexpr uint32_t kNotInDictionary = static_cast<uint32_t>(-1);
+
+// Strings known to both ends of an exchange: property keys and values that
+// recur across messages. The encoders write a known string as its index and
+// the decoders hand back the dictionary's own JS string for it. Created with
+// new Dictionary(strings) or by trainDictionary.
+class Dictionary : public Napi::ObjectWrap<Dictionary> {
+ public:
+  static Napi::Function Init(Napi::Env env);
+  explicit Dictionary(const Napi::CallbackInfo &info);
+
+  // Returns the index of the string, or kNotInDictionary.
+  uint32_t Find(const char16_t *units, size_t length) const;
+  uint32_t Size() const { return static_cast<uint32_t>(offsets_.size() - 1); }
+  // Identifies the entries, so a payload is only decoded with its own dictionary.
+  uint32_t Checksum() const { return checksum_; }
+  // Entry `index` as WTF-8 (lone surrogates kept), for the text decoder, which
+  // reads a key written by index as the key's text.
+  std::string_view Text(uint32_t index) const {
+    return std::string_view(text_).substr(textOffsets_[index],
+                                          textOffsets_[index + 1] - textOffsets_[index]);
+  }
+  bool TextIsAscii(uint32_t index) const { return textKinds_[index] == kAscii; }
+  bool TextIsWtf8(uint32_t index) const { return textKinds_[index] == kWtf8; }
+  // The array of entry strings. Primitives cannot be referenced directly
+  // before N-API 10, so they are held through this array.
+  napi_value Strings() const { return strings_.Value(); }
+
+ private:
+  // Returns a copy of the entries, to persist the dictionary or send it to
+  // the other end.
+  Napi::Value GetStrings(const Napi::CallbackInfo &info);
+
+  // Open addressing over entry indexes + 1; 0 marks an empty slot.
+  std::vector<uint32_t> slots_;
+  std::vector<uint32_t> hashes_;
+  // Entry i is units_[offsets_[i], offsets_[i + 1]).
+  std::vector<uint32_t> offsets_;
+  std::u16string units_;
+  enum TextKind : uint8_t { kAscii, kUtf8, kWtf8 };
+  std::string text_;
+  std::vector<uint32_t> textOffsets_;
+  std::vector<TextKind> textKinds_;
+  uint32_t checksum_ = 0;
+  Napi::ObjectReference strings_;
+};
+
+// Finds the Dictionary passed as the `dictionary` option, or nullptr.
+const Dictionary *ReadDictionary(const Napi::Value &options);
+// Holds the `dictionary` option, once ReadDictionary accepted it, for the
+// calls that use it after the one that read it.
+Napi::ObjectReference HoldDictionary(const Napi::Value &options);
+
+// Encodes each sample with the binary encoder, counting the strings it
+// writes, and builds a Dictionary of those that save the most bytes.
+Napi::Value TrainDictionary(const Napi::Env &env, const Napi::Value &samples,
+                            const Napi::Value &options);
+
+}  // namespace bas_serde
+
+#endif
@@ -0,0 +1,1004 @@
+#include "diff.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "base64.h"
+#include "decode.h"
+#include "encode.h"
+
+namespace bas_serde {
+
+constexpr const char kOpKey[] = "op";
+constexpr const char kPathKey[] = "path";
+constexpr const char kIndexKey[] = "index";
+constexpr const char kRemoveKey[] = "remove";
+constexpr const char kOffsetKey[] = "offset";
+
+// Changed byte ranges of a binary value closer than this are sent as one op,
+// which costs less than writing a second op.
+constexpr size_t kMinByteGap = 32;
+
+// Values handed to one Array.prototype.splice call when a patch inserts them.
+constexpr uint32_t kSpliceChunk = 4096;
+
+static void CheckStatus(const Napi::Env &env, napi_status status, const char *call) {
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, std::string(call) + " failed: " + message);
+  }
+}
+
+static bool StrictEquals(const Napi::Env &env, napi_value a, napi_value b) {
+  bool equal = false;
+  CheckStatus(env, napi_strict_equals(env, a, b, &equal), "napi_strict_equals");
+  return equal;
+}
+
+// Numbers as stringify tells them apart: NaN equals itself, and -0 equals 0
+// since both are written as 0.
+static bool SameNumber(double a, double b) {
+  return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+// How Sets and Maps compare members and keys (SameValueZero).
+static bool SameMember(const Napi::Env &env, napi_value a, napi_value b) {
+  if (StrictEquals(env, a, b)) return true;
+  Napi::Value x(env, a);
+  Napi::Value y(env, b);
+  return x.IsNumber() && y.IsNumber() && std::isnan(x.As<Napi::Number>().DoubleValue()) &&
+         std::isnan(y.As<Napi::Number>().DoubleValue());
+}
+
+static bool IsObjectValue(const Napi::Env &env, napi_value value) {
+  napi_valuetype type;
+  CheckStatus(env, napi_typeof(env, value, &type), "napi_typeof");
+  return type == napi_object || type == napi_function;
+}
+
+// Kinds whose contents are compared member by member.
+static bool IsContainerKind(ValueKind kind) {
+  return kind == ValueKind::kPlainObject || kind == ValueKind::kObject ||
+         kind == ValueKind::kArray || kind == ValueKind::kSet || kind == ValueKind::kMap;
+}
+
+static Napi::Value CallMethod(const Napi::Env &env, KeyCache &keys, napi_value object,
+                              KeyId name, std::initializer_list<napi_value> args) {
+  Napi::Object obj(env, object);
+  return obj.Get(keys.Get(env, name)).As<Napi::Function>().Call(object, args);
+}
+
+// The memory of an ArrayBuffer, Buffer, TypedArray or DataView; `type` tells
+// typed arrays with different elements apart.
+struct BinaryView {
+  uint8_t *data = nullptr;
+  size_t length = 0;
+  int type = -1;
+};
+
+static bool GetBinaryView(const Napi::Env &env, napi_value value, ValueKind kind,
+                          BinaryView *view) {
+  void *data = nullptr;
+  switch (kind) {
+    case ValueKind::kArrayBuffer:
+      CheckStatus(env, napi_get_arraybuffer_info(env, value, &data, &view->length),
+                  "napi_get_arraybuffer_info");
+      break;
+    case ValueKind::kBuffer:
+    case ValueKind::kTypedArray: {
+      napi_typedarray_type type;
+      size_t length;
+      CheckStatus(env,
+                  napi_get_typedarray_info(env, value, &type, &length, &data, nullptr, nullptr),
+                  "napi_get_typedarray_info");
+      view->length = length * TypedArrayBytesPerElement(type);
+      view->type = static_cast<int>(type);
+      break;
+    }
+    case ValueKind::kDataView:
+      CheckStatus(env,
+                  napi_get_dataview_info(env, value, &view->length, &data, nullptr, nullptr),
+                  "napi_get_dataview_info");
+      break;
+    default:
+      return false;
+  }
+  view->data = static_cast<uint8_t *>(data);
+  return true;
+}
+
+// Walks `prev` and `next` side by side and writes an op wherever they differ.
+// Like the encoder, the walk lives on an explicit stack, and the containers of
+// `next` on the current path stay in ctx.stack to detect cycles.
+class Differ {
+ public:
+  Differ(const Napi::Env &env, EncodeContext &ctx) : env_(env), ctx_(ctx) {}
+
+  void Run(napi_value prev, napi_value next);
+
+ private:
+  // A step of a path: an object key, an array index or a Map key.
+  struct Segment {
+    enum class Kind : uint8_t { kNone, kKey, kIndex, kMapKey };
+    Kind kind;
+    uint32_t index;
+    napi_value key;
+  };
+
+  enum class FrameKind : uint8_t {
+    kPair,  // two values still to compare
+    kObject,
+    kArray,
+    kMap,
+  };
+
+  struct Frame {
+    FrameKind kind;
+    bool deleting;        // kObject, kMap: past next's members, deleting prev's others
+    uint32_t index;
+    uint32_t length;
+    size_t depth;         // path length of the container, or of a pair's container
+    Segment segment;      // kPair: its step from the container
+    napi_value prev;
+    napi_value next;
+    napi_value items;      // kObject: next's keys; kMap: next's entries
+    napi_value prevItems;  // kObject: prev's keys; kMap: prev's entries
+  };
+
+  // A pair of values queued by Equal; `leave` marks the end of a container.
+  struct Item {
+    napi_value a;
+    napi_value b;
+    bool leave;
+  };
+
+  ValueKind Classify(napi_value value) { return ClassifyValue(env_, value, ctx_.data); }
+  void Enter(napi_value value);
+  void Leave(napi_value value);
+  void PushPair(napi_value prev, napi_value next, const Segment &segment, size_t depth);
+  void PushContainer(FrameKind kind, napi_value prev, napi_value next);
+  void Close();
+
+  void DiffPair(napi_value prev, napi_value next);
+  void DiffArray(napi_value prev, napi_value next);
+  void DiffMap(napi_value prev, napi_value next);
+  void DiffSet(napi_value prev, napi_value next);
+  void DiffBytes(napi_value prev, napi_value next, ValueKind kind);
+  void StepObject();
+  void StepArray();
+  void StepMap();
+  void DiffElement(const Napi::Array &x, uint32_t prevIndex, const Napi::Array &y,
+                   uint32_t index, size_t depth);
+  bool CanPatchMembers(napi_value prev, const Napi::Array &prevMembers, napi_value next,
+                       const Napi::Array &members, bool isMap);
+
+  bool Equal(napi_value a, napi_value b);
+  bool ElementEqual(const Napi::Array &x, uint32_t i, const Napi::Array &y, uint32_t j);
+  bool CompareItem(napi_value a, napi_value b);
+  bool LeafEqual(ValueKind kind, napi_value a, napi_value b);
+
+  void BeginOp(const char *op, const Segment *last);
+  void WriteSegment(const Segment &segment);
+  void WriteSet(napi_value value, const Segment *last);
+  void WriteDelete(const Segment &last);
+  void WriteMember(const char *op, napi_value value);
+  void WriteSplice(napi_value next, uint32_t index, uint32_t removed, uint32_t inserted);
+
+  Napi::Env env_;
+  EncodeContext &ctx_;
+  Replacer replacer_;  // disabled: op values are written as stringify writes them
+  std::vector<Frame> stack_;
+  std::vector<Segment> path_;
+  std::vector<Item> work_;
+  bool first_ = true;
+};
+
+void Differ::Run(napi_value prev, napi_value next) {
+  ctx_.out.Raw('[');
+  PushPair(prev, next, Segment{}, 0);
+  while (!stack_.empty()) {
+    switch (stack_.back().kind) {
+      case FrameKind::kPair: {
+        Frame frame = stack_.back();
+        stack_.pop_back();
+        path_.resize(frame.depth);
+        if (frame.segment.kind != Segment::Kind::kNone) path_.push_back(frame.segment);
+        DiffPair(frame.prev, frame.next);
+        break;
+      }
+      case FrameKind::kObject:
+        StepObject();
+        break;
+      case FrameKind::kArray:
+        StepArray();
+        break;
+      case FrameKind::kMap:
+        StepMap();
+        break;
+    }
+  }
+  ctx_.out.Raw(']');
+}
+
+void Differ::Enter(napi_value value) {
+  Napi::Value object(env_, value);
+  if (ctx_.stack.Find(env_, object) != 0) {
+    throw Napi::TypeError::New(env_, "Circular reference detected");
+  }
+  ctx_.stack.Insert(env_, object, 1);
+}
+
+void Differ::Leave(napi_value value) { ctx_.stack.Erase(env_, Napi::Value(env_, value)); }
+
+void Differ::PushPair(napi_value prev, napi_value next, const Segment &segment, size_t depth) {
+  Frame frame{};
+  frame.kind = FrameKind::kPair;
+  frame.depth = depth;
+  frame.segment = segment;
+  frame.prev = prev;
+  frame.next = next;
+  stack_.push_back(frame);
+}
+
+// Pushes a container of `next` that Enter already put on the path.
+void Differ::PushContainer(FrameKind kind, napi_value prev, napi_value next) {
+  Frame frame{};
+  frame.kind = kind;
+  frame.depth = path_.size();
+  frame.prev = prev;
+  frame.next = next;
+  stack_.push_back(frame);
+}
+
+void Differ::Close() {
+  napi_value next = stack_.back().next;
+  stack_.pop_back();
+  Leave(next);
+}
+
+// Compares two values at the current path. Values of different kinds, and
+// changed values without contents, are replaced outright; containers of the
+// same kind are walked. One object on both sides is unchanged.
+void Differ::DiffPair(napi_value prev, napi_value next) {
+  ValueKind kind = Classify(next);
+  if (Classify(prev) != kind) {
+    WriteSet(next, nullptr);
+    return;
+  }
+  if (IsContainerKind(kind) && StrictEquals(env_, prev, next)) return;
+  switch (kind) {
+    case ValueKind::kPlainObject:
+    case ValueKind::kObject: {
+      Enter(next);
+      PushContainer(FrameKind::kObject, prev, next);
+      Frame &frame = stack_.back();
+      Napi::Array keys = Napi::Object(env_, next).GetPropertyNames();
+      frame.items = keys;
+      frame.prevItems = Napi::Object(env_, prev).GetPropertyNames();
+      frame.length = keys.Length();
+      return;
+    }
+    case ValueKind::kArray:
+      DiffArray(prev, next);
+      return;
+    case ValueKind::kMap:
+      DiffMap(prev, next);
+      return;
+    case ValueKind::kSet:
+      DiffSet(prev, next);
+      return;
+    case ValueKind::kArrayBuffer:
+    case ValueKind::kBuffer:
+    case ValueKind::kTypedArray:
+    case ValueKind::kDataView:
+      DiffBytes(prev, next, kind);
+      return;
+    default:
+      if (!LeafEqual(kind, prev, next)) WriteSet(next, nullptr);
+      return;
+  }
+}
+
+// Trims the elements both arrays start and end with. When the rest has the
+// same length it is compared element by element, so edits stay in place.
+// Otherwise single edited elements next to the trimmed ends are compared as
+// pairs too, and what remains is written as one splice. The pairs are
+// written after the splice, so they are addressed by their index in `next`.
+void Differ::DiffArray(napi_value prev, napi_value next) {
+  Enter(next);
+  Napi::Array x(env_, prev);
+  Napi::Array y(env_, next);
+  uint32_t head = 0;
+  uint32_t prevEnd = x.Length();
+  uint32_t end = y.Length();
+  std::vector<std::pair<uint32_t, uint32_t>> edits;
+  while (true) {
+    while (head < prevEnd && head < end && ElementEqual(x, head, y, head)) head++;
+    while (prevEnd > head && end > head && ElementEqual(x, prevEnd - 1, y, end - 1)) {
+      prevEnd--;
+      end--;
+    }
+    uint32_t removed = prevEnd - head;
+    uint32_t inserted = end - head;
+    if (removed == inserted || removed == 0 || inserted == 0) break;
+    // Lengths differ, so one side has at least two elements left.
+    if (removed > 1 && inserted > 1 && ElementEqual(x, head + 1, y, head + 1)) {
+      edits.emplace_back(head, head);
+      head++;
+    } else if (removed > 1 && inserted > 1 && ElementEqual(x, prevEnd - 2, y, end - 2)) {
+      edits.emplace_back(prevEnd - 1, end - 1);
+      prevEnd--;
+      end--;
+    } else {
+      break;
+    }
+  }
+  uint32_t removed = prevEnd - head;
+  uint32_t inserted = end - head;
+  if (removed != inserted) {
+    WriteSplice(next, head, removed, inserted);
+  }
+  if (edits.empty() && (removed != inserted || removed == 0)) {
+    Leave(next);
+    return;
+  }
+  PushContainer(FrameKind::kArray, prev, next);
+  Frame &frame = stack_.back();
+  frame.index = head;
+  frame.length = removed == inserted ? prevEnd : head;
+  size_t depth = frame.depth;
+  for (const auto &[prevIndex, index] : edits) {
+    DiffElement(x, prevIndex, y, index, depth);
+  }
+}
+
+void Differ::DiffMap(napi_value prev, napi_value next) {
+  Enter(next);
+  Napi::Array prevEntries = ctx_.data.arrayFrom.Call({prev}).As<Napi::Array>();
+  Napi::Array entries = ctx_.data.arrayFrom.Call({next}).As<Napi::Array>();
+  if (!CanPatchMembers(prev, prevEntries, next, entries, true)) {
+    Leave(next);
+    WriteSet(next, nullptr);
+    return;
+  }
+  PushContainer(FrameKind::kMap, prev, next);
+  Frame &frame = stack_.back();
+  frame.items = entries;
+  frame.prevItems = prevEntries;
+  frame.length = entries.Length();
+}
+
+// Set members have no contents to walk: they are either kept or removed and
+// added, so the ops are written here.
+void Differ::DiffSet(napi_value prev, napi_value next) {
+  Napi::Array prevMembers = ctx_.data.arrayFrom.Call({prev}).As<Napi::Array>();
+  Napi::Array members = ctx_.data.arrayFrom.Call({next}).As<Napi::Array>();
+  if (!CanPatchMembers(prev, prevMembers, next, members, false)) {
+    WriteSet(next, nullptr);
+    return;
+  }
+  for (uint32_t i = 0; i < prevMembers.Length(); i++) {
+    Napi::Value member = prevMembers.Get(i);
+    if (!CallMethod(env_, ctx_.keys, next, KeyId::kHas, {member}).ToBoolean().Value()) {
+      WriteMember("remove", member);
+    }
+  }
+  for (uint32_t i = 0; i < members.Length(); i++) {
+    Napi::Value member = members.Get(i);
+    if (!CallMethod(env_, ctx_.keys, prev, KeyId::kHas, {member}).ToBoolean().Value()) {
+      WriteMember("add", member);
+    }
+  }
+}
+
+// Whether keyed ops can turn one Set or Map into the other. Additions go to
+// the end, so kept members must come first and in their old order. An object
+// member or key cannot be named by a patch once decoded elsewhere, so it can
+// be added but not removed, and a Map entry under one must be unchanged.
+bool Differ::CanPatchMembers(napi_value prev, const Napi::Array &prevMembers,
+                             napi_value next, const Napi::Array &members, bool isMap) {
+  auto keyOf = [&](const Napi::Array &list, uint32_t i) -> Napi::Value {
+    Napi::Value member = list.Get(i);
+    return isMap ? member.As<Napi::Array>().Get(static_cast<uint32_t>(0)) : member;
+  };
+  uint32_t prevLength = prevMembers.Length();
+  uint32_t length = members.Length();
+  uint32_t kept = 0;
+  bool added = false;
+  for (uint32_t i = 0; i < length; i++) {
+    Napi::Value key = keyOf(members, i);
+    if (!CallMethod(env_, ctx_.keys, prev, KeyId::kHas, {key}).ToBoolean().Value()) {
+      added = true;
+      continue;
+    }
+    if (added) return false;
+    // Members of prev ahead of this one must have been removed.
+    while (true) {
+      if (kept == prevLength) return false;
+      Napi::Value prevKey = keyOf(prevMembers, kept++);
+      if (SameMember(env_, prevKey, key)) break;
+      if (IsObjectValue(env_, prevKey) ||
+          CallMethod(env_, ctx_.keys, next, KeyId::kHas, {prevKey}).ToBoolean().Value()) {
+        return false;
+      }
+    }
+    if (isMap && IsObjectValue(env_, key)) {
+      Napi::Value prevValue =
+          prevMembers.Get(kept - 1).As<Napi::Array>().Get(static_cast<uint32_t>(1));
+      Napi::Value value = members.Get(i).As<Napi::Array>().Get(static_cast<uint32_t>(1));
+      if (!Equal(prevValue, value)) return false;
+    }
+  }
+  for (; kept < prevLength; kept++) {
+    if (IsObjectValue(env_, keyOf(prevMembers, kept))) return false;
+  }
+  return true;
+}
+
+// Writes the changed byte ranges of two binary values of the same type and
+// length, or the whole value when that would be shorter.
+void Differ::DiffBytes(napi_value prev, napi_value next, ValueKind kind) {
+  BinaryView a;
+  BinaryView b;
+  GetBinaryView(env_, prev, kind, &a);
+  GetBinaryView(env_, next, kind, &b);
+  if (a.type != b.type || a.length != b.length) {
+    WriteSet(next, nullptr);
+    return;
+  }
+  size_t length = b.length;
+  std::vector<std::pair<size_t, size_t>> ranges;
+  size_t changed = 0;
+  size_t i = 0;
+  while (true) {
+    while (i + 64 <= length && std::memcmp(a.data + i, b.data + i, 64) == 0) i += 64;
+    while (i < length && a.data[i] == b.data[i]) i++;
+    if (i == length) break;
+    size_t start = i;
+    size_t end = ++i;
+    for (; i < length && i - end < kMinByteGap; i++) {
+      if (a.data[i] != b.data[i]) end = i + 1;
+    }
+    ranges.emplace_back(start, end);
+    changed += end - start;
+  }
+  if (changed > length / 2) {
+    WriteSet(next, nullptr);
+    return;
+  }
+  JsonWriter &out = ctx_.out;
+  for (const auto &[start, end] : ranges) {
+    BeginOp("bytes", nullptr);
+    out.Field(kOffsetKey);
+    out.Number(static_cast<double>(start));
+    out.Field(kValueKey);
+    out.Base64String(b.data + start, end - start);
+    out.Raw('}');
+  }
+}
+
+void Differ::StepObject() {
+  Frame &frame = stack_.back();
+  size_t depth = frame.depth;
+  path_.resize(depth);
+  Napi::Object x(env_, frame.prev);
+  Napi::Object y(env_, frame.next);
+  if (!frame.deleting) {
+    if (frame.index == frame.length) {
+      frame.deleting = true;
+      frame.index = 0;
+      frame.length = Napi::Array(env_, frame.prevItems).Length();
+      return;
+    }
+    Napi::Value key = Napi::Array(env_, frame.items).Get(frame.index++);
+    if (!key.IsString()) {
+      throw Napi::TypeError::New(env_, "Only string keys are supported");
+    }
+    Segment segment{Segment::Kind::kKey, 0, key};
+    if (!x.HasOwnProperty(key)) {
+      WriteSet(y.Get(key), &segment);
+      return;
+    }
+    PushPair(x.Get(key), y.Get(key), segment, depth);
+    return;
+  }
+  if (frame.index == frame.length) {
+    Close();
+    return;
+  }
+  Napi::Value key = Napi::Array(env_, frame.prevItems).Get(frame.index++);
+  if (!key.IsString()) {
+    throw Napi::TypeError::New(env_, "Only string keys are supported");
+  }
+  if (!y.HasOwnProperty(key)) {
+    WriteDelete(Segment{Segment::Kind::kKey, 0, key});
+  }
+}
+
+void Differ::StepArray() {
+  Frame &frame = stack_.back();
+  if (frame.index == frame.length) {
+    Close();
+    return;
+  }
+  size_t depth = frame.depth;
+  uint32_t i = frame.index++;
+  path_.resize(depth);
+  DiffElement(Napi::Array(env_, frame.prev), i, Napi::Array(env_, frame.next), i, depth);
+}
+
+// Compares prev[prevIndex] with next[index], which is at `index` in the
+// patched array. A hole is written as a delete.
+void Differ::DiffElement(const Napi::Array &x, uint32_t prevIndex, const Napi::Array &y,
+                         uint32_t index, size_t depth) {
+  Napi::Value prevItem = x.Get(prevIndex);
+  Napi::Value item = y.Get(index);
+  bool prevHole = prevItem.IsUndefined() && !x.Has(prevIndex);
+  bool hole = item.IsUndefined() && !y.Has(index);
+  Segment segment{Segment::Kind::kIndex, index, nullptr};
+  if (hole) {
+    if (!prevHole) WriteDelete(segment);
+  } else if (prevHole) {
+    WriteSet(item, &segment);
+  } else {
+    PushPair(prevItem, item, segment, depth);
+  }
+}
+
+// Walks next's entries (kept ones are compared, new ones set), then deletes
+// prev's entries that next lacks. CanPatchMembers checked the order.
+void Differ::StepMap() {
+  Frame &frame = stack_.back();
+  size_t depth = frame.depth;
+  path_.resize(depth);
+  if (!frame.deleting) {
+    if (frame.index == frame.length) {
+      frame.deleting = true;
+      frame.index = 0;
+      frame.length = Napi::Array(env_, frame.prevItems).Length();
+      return;
+    }
+    napi_value prev = frame.prev;
+    Napi::Array entry = Napi::Array(env_, frame.items).Get(frame.index++).As<Napi::Array>();
+    Napi::Value key = entry.Get(static_cast<uint32_t>(0));
+    Napi::Value value = entry.Get(static_cast<uint32_t>(1));
+    Segment segment{Segment::Kind::kMapKey, 0, key};
+    if (!CallMethod(env_, ctx_.keys, prev, KeyId::kHas, {key}).ToBoolean().Value()) {
+      WriteSet(value, &segment);
+      return;
+    }
+    // Entries under object keys were compared by CanPatchMembers.
+    if (IsObjectValue(env_, key)) return;
+    PushPair(CallMethod(env_, ctx_.keys, prev, KeyId::kGet, {key}), value, segment, depth);
+    return;
+  }
+  if (frame.index == frame.length) {
+    Close();
+    return;
+  }
+  Napi::Array entry = Napi::Array(env_, frame.prevItems).Get(frame.index++).As<Napi::Array>();
+  Napi::Value key = entry.Get(static_cast<uint32_t>(0));
+  if (!CallMethod(env_, ctx_.keys, frame.next, KeyId::kHas, {key}).ToBoolean().Value()) {
+    WriteDelete(Segment{Segment::Kind::kMapKey, 0, key});
+  }
+}
+
+// Compares two values in full, with the contents of containers queued on
+// work_ rather than the C++ stack.
+bool Differ::Equal(napi_value a, napi_value b) {
+  work_.push_back({a, b, false});
+  bool equal = true;
+  while (!work_.empty()) {
+    Item item = work_.back();
+    work_.pop_back();
+    if (item.leave) {
+      Leave(item.b);
+    } else if (!CompareItem(item.a, item.b)) {
+      equal = false;
+      break;
+    }
+  }
+  // Containers left unfinished by a difference leave the path too.
+  for (const Item &item : work_) {
+    if (item.leave) Leave(item.b);
+  }
+  work_.clear();
+  return equal;
+}
+
+bool Differ::ElementEqual(const Napi::Array &x, uint32_t i, const Napi::Array &y, uint32_t j) {
+  Napi::Value a = x.Get(i);
+  Napi::Value b = y.Get(j);
+  bool aHole = a.IsUndefined() && !x.Has(i);
+  bool bHole = b.IsUndefined() && !y.Has(j);
+  if (aHole || bHole) return aHole == bHole;
+  return Equal(a, b);
+}
+
+// Compares two values without looking into their contents, which are queued
+// for Equal instead. Object keys, Set members and Map entries must be in the
+// same order.
+bool Differ::CompareItem(napi_value a, napi_value b) {
+  ValueKind kind = Classify(b);
+  if (Classify(a) != kind) return false;
+  if (!IsContainerKind(kind)) return LeafEqual(kind, a, b);
+  if (StrictEquals(env_, a, b)) return true;
+  Enter(b);
+  work_.push_back({nullptr, b, true});
+  if (kind == ValueKind::kArray) {
+    Napi::Array x(env_, a);
+    Napi::Array y(env_, b);
+    uint32_t length = y.Length();
+    if (x.Length() != length) return false;
+    for (uint32_t i = 0; i < length; i++) {
+      Napi::Value u = x.Get(i);
+      Napi::Value v = y.Get(i);
+      bool uHole = u.IsUndefined() && !x.Has(i);
+      bool vHole = v.IsUndefined() && !y.Has(i);
+      if (uHole != vHole) return false;
+      if (!vHole) work_.push_back({u, v, false});
+    }
+    return true;
+  }
+  if (kind == ValueKind::kSet || kind == ValueKind::kMap) {
+    Napi::Array x = ctx_.data.arrayFrom.Call({a}).As<Napi::Array>();
+    Napi::Array y = ctx_.data.arrayFrom.Call({b}).As<Napi::Array>();
+    uint32_t length = y.Length();
+    if (x.Length() != length) return false;
+    for (uint32_t i = 0; i < length; i++) {
+      Napi::Value u = x.Get(i);
+      Napi::Value v = y.Get(i);
+      if (kind == ValueKind::kSet) {
+        if (!SameMember(env_, u, v)) return false;
+        continue;
+      }
+      Napi::Array uEntry = u.As<Napi::Array>();
+      Napi::Array vEntry = v.As<Napi::Array>();
+      if (!SameMember(env_, uEntry.Get(static_cast<uint32_t>(0)),
+                      vEntry.Get(static_cast<uint32_t>(0)))) {
+        return false;
+      }
+      work_.push_back(
+          {uEntry.Get(static_cast<uint32_t>(1)), vEntry.Get(static_cast<uint32_t>(1)), false});
+    }
+    return true;
+  }
+  Napi::Object x(env_, a);
+  Napi::Object y(env_, b);
+  Napi::Array xKeys = x.GetPropertyNames();
+  Napi::Array yKeys = y.GetPropertyNames();
+  uint32_t length = yKeys.Length();
+  if (xKeys.Length() != length) return false;
+  for (uint32_t i = 0; i < length; i++) {
+    Napi::Value key = yKeys.Get(i);
+    if (!StrictEquals(env_, xKeys.Get(i), key)) return false;
+    work_.push_back({x.Get(key), y.Get(key), false});
+  }
+  return true;
+}
+
+// Compares two values of one kind that have no contents to walk.
+bool Differ::LeafEqual(ValueKind kind, napi_value a, napi_value b) {
+  switch (kind) {
+    case ValueKind::kUndefined:
+    case ValueKind::kNull:
+      return true;
+    case ValueKind::kBoolean:
+    case ValueKind::kString:
+    case ValueKind::kBigInt:
+      return StrictEquals(env_, a, b);
+    case ValueKind::kNumber:
+      return SameNumber(Napi::Value(env_, a).As<Napi::Number>().DoubleValue(),
+                        Napi::Value(env_, b).As<Napi::Number>().DoubleValue());
+    case ValueKind::kDate: {
+      double x;
+      double y;
+      CheckStatus(env_, napi_get_date_value(env_, a, &x), "napi_get_date_value");
+      CheckStatus(env_, napi_get_date_value(env_, b, &y), "napi_get_date_value");
+      return SameNumber(x, y);
+    }
+    case ValueKind::kArrayBuffer:
+    case ValueKind::kBuffer:
+    case ValueKind::kTypedArray:
+    case ValueKind::kDataView: {
+      BinaryView x;
+      BinaryView y;
+      GetBinaryView(env_, a, kind, &x);
+      GetBinaryView(env_, b, kind, &y);
+      return x.type == y.type && x.length == y.length &&
+             (x.length == 0 || std::memcmp(x.data, y.data, x.length) == 0);
+    }
+    case ValueKind::kRegExp:
+    case ValueKind::kError: {
+      // Equal when stringify writes them the same way.
+      EncodeContext left(GetMutableAddonData(env_));
+      EncodeContext right(GetMutableAddonData(env_));
+      left.stats.Discard();
+      right.stats.Discard();
+      EncodeValue(env_, Napi::Value(env_, a), left, replacer_, false);
+      EncodeValue(env_, Napi::Value(env_, b), right, replacer_, false);
+      return left.out.Size() == right.out.Size() &&
+             std::memcmp(left.out.Data(), right.out.Data(), left.out.Size()) == 0;
+    }
+    default:
+      throw Napi::TypeError::New(env_, "Unsupported value type");
+  }
+}
+
+// Writes `{"op":"<op>","path":[...]` for the current path followed by `last`.
+void Differ::BeginOp(const char *op, const Segment *last) {
+  JsonWriter &out = ctx_.out;
+  if (!first_) out.Raw(',');
+  first_ = false;
+  out.Raw('{');
+  out.Key(kOpKey);
+  out.AsciiString(op);
+  out.Field(kPathKey);
+  out.Raw('[');
+  for (size_t i = 0; i < path_.size(); i++) {
+    if (i > 0) out.Raw(',');
+    WriteSegment(path_[i]);
+  }
+  if (last != nullptr) {
+    if (!path_.empty()) out.Raw(',');
+    WriteSegment(*last);
+  }
+  out.Raw(']');
+}
+
+// Object keys are strings and array indexes numbers; Map keys are written as
+// values, so their types survive.
+void Differ::WriteSegment(const Segment &segment) {
+  switch (segment.kind) {
+    case Segment::Kind::kKey: {
+      size_t length = CopyJsString(env_, segment.key, ctx_.scratch);
+      ctx_.out.String(ctx_.scratch.data(), length);
+      break;
+    }
+    case Segment::Kind::kIndex:
+      ctx_.out.Uint(segment.index);
+      break;
+    case Segment::Kind::kMapKey:
+      EncodeValue(env_, Napi::Value(env_, segment.key), ctx_, replacer_, false);
+      break;
+    case Segment::Kind::kNone:
+      break;
+  }
+}
+
+void Differ::WriteSet(napi_value value, const Segment *last) {
+  BeginOp("set", last);
+  ctx_.out.Field(kValueKey);
+  EncodeValue(env_, Napi::Value(env_, value), ctx_, replacer_, false);
+  ctx_.out.Raw('}');
+}
+
+void Differ::WriteDelete(const Segment &last) {
+  BeginOp("delete", &last);
+  ctx_.out.Raw('}');
+}
+
+void Differ::WriteMember(const char *op, napi_value value) {
+  BeginOp(op, nullptr);
+  ctx_.out.Field(kValueKey);
+  EncodeValue(env_, Napi::Value(env_, value), ctx_, replacer_, false);
+  ctx_.out.Raw('}');
+}
+
+void Differ::WriteSplice(napi_value next, uint32_t index, uint32_t removed,
+                         uint32_t inserted) {
+  JsonWriter &out = ctx_.out;
+  BeginOp("splice", nullptr);
+  out.Field(kIndexKey);
+  out.Uint(index);
+  out.Field(kRemoveKey);
+  out.Uint(removed);
+  out.Field(kValueKey);
+  out.Raw('[');
+  Napi::Array y(env_, next);
+  for (uint32_t i = index; i < index + inserted; i++) {
+    if (i > index) out.Raw(',');
+    Napi::Value item = y.Get(i);
+    if (item.IsUndefined() && !y.Has(i)) {
+      WriteWrapperOpen(out, kTypeHole);
+      out.Raw('}');
+    } else {
+      EncodeValue(env_, item, ctx_, replacer_, false);
+    }
+  }
+  out.Literal("]}");
+}
+
+void DiffValues(const Napi::Env &env, const Napi::Value &prev, const Napi::Value &next,
+                EncodeContext &ctx) {
+  Differ differ(env, ctx);
+  differ.Run(prev, next);
+}
+
+[[noreturn]] static void ThrowInvalidPatch(const Napi::Env &env, const char *reason) {
+  throw Napi::TypeError::New(env, std::string("Invalid patch: ") + reason);
+}
+
+static double ReadOffset(const Napi::Env &env, const Napi::Value &value, double max) {
+  double number = value.IsNumber() ? value.As<Napi::Number>().DoubleValue() : -1;
+  if (!(number >= 0 && number <= max) || std::trunc(number) != number) {
+    ThrowInvalidPatch(env, "expected an index within the target");
+  }
+  return number;
+}
+
+static uint32_t ReadIndex(const Napi::Env &env, const Napi::Value &value) {
+  return static_cast<uint32_t>(ReadOffset(env, value, 4294967294.0));
+}
+
+// Follows one path segment from an array, Map or object.
+static Napi::Value GetChild(const Napi::Env &env, DecodeContext &ctx,
+                            const Napi::Value &container, const Napi::Value &segment) {
+  switch (ClassifyValue(env, container, ctx.data)) {
+    case ValueKind::kArray:
+      return container.As<Napi::Array>().Get(ReadIndex(env, segment));
+    case ValueKind::kMap:
+      return CallMethod(env, ctx.keys, container, KeyId::kGet, {segment});
+    case ValueKind::kPlainObject:
+    case ValueKind::kObject:
+      if (!segment.IsString()) ThrowInvalidPatch(env, "expected a string key");
+      return container.As<Napi::Object>().Get(segment);
+    default:
+      ThrowInvalidPatch(env, "the path does not match the target");
+  }
+}
+
+static void SetChild(const Napi::Env &env, DecodeContext &ctx, const Napi::Value &container,
+                     const Napi::Value &segment, const Napi::Value &value) {
+  switch (ClassifyValue(env, container, ctx.data)) {
+    case ValueKind::kArray:
+      container.As<Napi::Array>().Set(ReadIndex(env, segment), value);
+      return;
+    case ValueKind::kMap:
+      CallMethod(env, ctx.keys, container, KeyId::kSet, {segment, value});
+      return;
+    case ValueKind::kPlainObject:
+    case ValueKind::kObject:
+      if (!segment.IsString()) ThrowInvalidPatch(env, "expected a string key");
+      SetMember(env, container.As<Napi::Object>(), segment, IsProtoKey(env, segment), value);
+      return;
+    default:
+      ThrowInvalidPatch(env, "the path does not match the target");
+  }
+}
+
+// Deleting an array element leaves a hole, as the delete operator does.
+static void DeleteChild(const Napi::Env &env, DecodeContext &ctx, const Napi::Value &container,
+                        const Napi::Value &segment) {
+  bool deleted;
+  switch (ClassifyValue(env, container, ctx.data)) {
+    case ValueKind::kArray:
+      CheckStatus(env, napi_delete_element(env, container, ReadIndex(env, segment), &deleted),
+                  "napi_delete_element");
+      return;
+    case ValueKind::kMap:
+      CallMethod(env, ctx.keys, container, KeyId::kDelete, {segment});
+      return;
+    case ValueKind::kPlainObject:
+    case ValueKind::kObject:
+      if (!segment.IsString()) ThrowInvalidPatch(env, "expected a string key");
+      CheckStatus(env, napi_delete_property(env, container, segment, &deleted),
+                  "napi_delete_property");
+      return;
+    default:
+      ThrowInvalidPatch(env, "the path does not match the target");
+  }
+}
+
+static void SpliceArray(const Napi::Env &env, DecodeContext &ctx, const Napi::Value &container,
+                        const Napi::Object &op) {
+  if (!container.IsArray()) ThrowInvalidPatch(env, "splice needs an array");
+  Napi::Value itemsVal = op.Get(kValueKey);
+  if (!itemsVal.IsArray()) ThrowInvalidPatch(env, "splice needs an array of values");
+  Napi::Array arr = container.As<Napi::Array>();
+  uint32_t length = arr.Length();
+  uint32_t index = static_cast<uint32_t>(ReadOffset(env, op.Get(kIndexKey), length));
+  uint32_t removed = static_cast<uint32_t>(ReadOffset(env, op.Get(kRemoveKey), length - index));
+  Napi::Array items = itemsVal.As<Napi::Array>();
+  uint32_t count = items.Length();
+  Napi::Function splice = arr.Get(ctx.keys.Get(env, KeyId::kSplice)).As<Napi::Function>();
+  std::vector<napi_value> args;
+  uint32_t done = 0;
+  do {
+    uint32_t chunk = std::min(count - done, kSpliceChunk);
+    args.clear();
+    args.push_back(Napi::Number::New(env, index + done));
+    args.push_back(Napi::Number::New(env, done == 0 ? removed : 0));
+    for (uint32_t i = 0; i < chunk; i++) args.push_back(items.Get(done + i));
+    splice.Call(arr, args);
+    done += chunk;
+  } while (done < count);
+  // Holes among the values were passed as undefined.
+  for (uint32_t i = 0; i < count; i++) {
+    if (items.Has(i)) continue;
+    bool deleted;
+    CheckStatus(env, napi_delete_element(env, arr, index + i, &deleted), "napi_delete_element");
+  }
+}
+
+static void WriteBytes(const Napi::Env &env, DecodeContext &ctx, const Napi::Value &container,
+                       const Napi::Object &op) {
+  BinaryView view;
+  if (!GetBinaryView(env, container, ClassifyValue(env, container, ctx.data), &view)) {
+    ThrowInvalidPatch(env, "bytes needs a binary value");
+  }
+  Napi::Value textVal = op.Get(kValueKey);
+  if (!textVal.IsString()) ThrowInvalidPatch(env, "bytes needs a base64 value");
+  std::string text = textVal.As<Napi::String>().Utf8Value();
+  size_t offset = static_cast<size_t>(ReadOffset(env, op.Get(kOffsetKey),
+                                                 static_cast<double>(view.length)));
+  size_t size = Base64DecodedLength(text.data(), text.size());
+  if (size > view.length - offset) ThrowInvalidPatch(env, "bytes past the end of the target");
+  std::vector<uint8_t> bytes(size);
+  if (!Base64Decode(text.data(), text.size(), bytes.data())) {
+    ThrowInvalidPatch(env, "invalid base64 data");
+  }
+  if (size > 0) std::memcpy(view.data + offset, bytes.data(), size);
+}
+
+static void ChangeMember(const Napi::Env &env, DecodeContext &ctx, const Napi::Value &container,
+                         KeyId method, const Napi::Value &member) {
+  if (ClassifyValue(env, container, ctx.data) != ValueKind::kSet) {
+    ThrowInvalidPatch(env, "add and remove need a Set");
+  }
+  CallMethod(env, ctx.keys, container, method, {member});
+}
+
+Napi::Value ApplyPatch(const Napi::Env &env, const Napi::Value &target, const char *patch,
+                       size_t len, DecodeContext &ctx) {
+  Reviver reviver;
+  Napi::Value opsVal = ParseText(env, patch, len, ctx.data.ctors, reviver, ctx);
+  if (!opsVal.IsArray()) ThrowInvalidPatch(env, "expected an array of operations");
+  Napi::Array ops = opsVal.As<Napi::Array>();
+  Napi::Value root = target;
+  for (uint32_t i = 0; i < ops.Length(); i++) {
+    Napi::Value opVal = ops.Get(i);
+    if (!opVal.IsObject()) ThrowInvalidPatch(env, "expected an operation object");
+    Napi::Object op = opVal.As<Napi::Object>();
+    Napi::Value nameVal = op.Get(kOpKey);
+    Napi::Value pathVal = op.Get(kPathKey);
+    if (!nameVal.IsString() || !pathVal.IsArray()) {
+      ThrowInvalidPatch(env, "an operation needs an op name and a path");
+    }
+    std::string name = nameVal.As<Napi::String>().Utf8Value();
+    Napi::Array path = pathVal.As<Napi::Array>();
+    uint32_t length = path.Length();
+    // set and delete name the member they change; the others the container.
+    bool keyed = name == "set" || name == "delete";
+    if (keyed && length == 0) {
+      if (name == "delete") ThrowInvalidPatch(env, "the root cannot be deleted");
+      root = op.Get(kValueKey);
+      continue;
+    }
+    Napi::Value container = root;
+    for (uint32_t j = 0; j < (keyed ? length - 1 : length); j++) {
+      container = GetChild(env, ctx, container, path.Get(j));
+    }
+    if (name == "set") {
+      SetChild(env, ctx, container, path.Get(length - 1), op.Get(kValueKey));
+    } else if (name == "delete") {
+      DeleteChild(env, ctx, container, path.Get(length - 1));
+    } else if (name == "splice") {
+      SpliceArray(env, ctx, container, op);
+    } else if (name == "bytes") {
+      WriteBytes(env, ctx, container, op);
+    } else if (name == "add") {
+      ChangeMember(env, ctx, container, KeyId::kAdd, op.Get(kValueKey));
+    } else if (name == "remove") {
+      ChangeMember(env, ctx, container, KeyId::kDelete, op.Get(kValueKey));
+    } else {
+      ThrowInvalidPatch(env, "unknown operation");
+    }
+  }
+  return root;
+}
+
+}  // namespace bas_serde
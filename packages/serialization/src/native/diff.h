@@ -0,0 +1,23 @@
+#ifndef BAS_UTILS_SERIALIZATION_DIFF_H
+#define BAS_UTILS_SERIALIZATION_DIFF_H
+
+#include "serde_utils.h"
+
+namespace bas_serde {
+
+// Writes a patch that turns `prev` into `next` into ctx.out: a JSON array of
+// operations on paths into the value, whose values are written the way
+// stringify writes them. Unchanged parts of the graph are not written.
+void DiffValues(const Napi::Env &env, const Napi::Value &prev, const Napi::Value &next,
+                EncodeContext &ctx);
+
+// Applies a patch written by DiffValues to `target`, which must equal the
+// `prev` it was made from, and returns the result. Containers are changed in
+// place; the result is a new value only when the patch replaces the root.
+// A patch that does not fit the target throws a JS TypeError.
+Napi::Value ApplyPatch(const Napi::Env &env, const Napi::Value &target, const char *patch,
+                       size_t len, DecodeContext &ctx);
+
+}  // namespace bas_serde
+
+#endif
@@ -1,71 +1,421 @@
 #include "encode.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include "dictionary.h"
+
 namespace bas_serde {
 
-// Tracks the current recursion stack to detect cycles when circular refs are disabled.
-struct SeenGuard {
-  SeenStack &seen;
-  bool active;
+// Shorter all-number arrays stay plain: the wrapper would outweigh the savings.
+constexpr uint32_t kMinPackedLength = 16;
+
+// dedupeStrings picks its string table from this many values at the start of
+// the document, so the walk ahead of encoding stays cheap for large documents.
+constexpr uint32_t kStringTableSample = 16384;
+
+// Writes a JS string escaped, via the UTF-16 scratch buffer.
+static void WriteJsString(const Napi::Env &env, napi_value value, EncodeContext &ctx) {
+  size_t length = CopyJsString(env, value, ctx.scratch);
+  ctx.out.String(ctx.scratch.data(), length);
+}
+
+// Writes a string value or property key under a DedupedStrings header: an
+// entry of the dictionary or of the header's string table as a reference to
+// it, any other string in full, with a leading kStringRefMark doubled.
+static void WriteStringRef(const Napi::Env &env, napi_value value, EncodeContext &ctx) {
+  size_t length = CopyJsString(env, value, ctx.scratch);
+  uint32_t index = kNotInDictionary;
+  if (ctx.dictionary != nullptr) index = ctx.dictionary->Find(ctx.scratch.data(), length);
+  if (index == kNotInDictionary && !ctx.strings.empty()) {
+    auto it = ctx.strings.find(std::u16string_view(ctx.scratch.data(), length));
+    if (it != ctx.strings.end()) index = it->second;
+  }
+  if (index != kNotInDictionary) {
+    char ref[16] = {kStringRefMark};
+    char *end = std::to_chars(ref + 1, ref + sizeof(ref), index).ptr;
+    ctx.out.AsciiString(ref, end - ref);
+    return;
+  }
+  if (length > 0 && ctx.scratch[0] == kStringRefMark) {
+    ctx.scratch.insert(ctx.scratch.begin(), static_cast<char16_t>(kStringRefMark));
+    length++;
+  }
+  ctx.out.String(ctx.scratch.data(), length);
+}
 
-  SeenGuard(SeenStack &stack, const Napi::Value &value) : seen(stack), active(true) {
-    seen.emplace_back(Napi::Persistent(value));
+// Counts the string values of the first kStringTableSample values under
+// `value`, in document order. Shared and circular values count each time they
+// are met. The replacer is not called, so strings it substitutes are written in
+// full.
+static void CountStringValues(const Napi::Env &env, napi_value value, EncodeContext &ctx,
+                              std::unordered_map<std::u16string, uint32_t> &counts) {
+  std::vector<napi_value> pending = {value};
+  std::vector<napi_value> children;
+  uint32_t budget = kStringTableSample;
+  while (!pending.empty() && budget > 0) {
+    budget--;
+    Napi::Value item(env, pending.back());
+    pending.pop_back();
+    ValueKind kind = ClassifyValue(env, item, ctx.data);
+    if (kind == ValueKind::kString) {
+      size_t length = CopyJsString(env, item, ctx.scratch);
+      counts[std::u16string(ctx.scratch.data(), length)]++;
+      continue;
+    }
+    children.clear();
+    if (kind == ValueKind::kArray) {
+      Napi::Array arr = item.As<Napi::Array>();
+      uint32_t length = std::min(arr.Length(), budget);
+      for (uint32_t i = 0; i < length; i++) children.push_back(arr.Get(i));
+    } else if (kind == ValueKind::kSet || kind == ValueKind::kMap) {
+      bool isSet = kind == ValueKind::kSet;
+      Napi::Object obj = item.As<Napi::Object>();
+      Napi::Function iterate =
+          obj.Get(ctx.keys.Get(env, isSet ? KeyId::kValues : KeyId::kEntries))
+              .As<Napi::Function>();
+      Napi::Object iterator = iterate.Call(obj, {}).As<Napi::Object>();
+      Napi::Function nextFn =
+          iterator.Get(ctx.keys.Get(env, KeyId::kNext)).As<Napi::Function>();
+      while (children.size() < budget) {
+        Napi::Object next = nextFn.Call(iterator, {}).As<Napi::Object>();
+        if (next.Get(ctx.keys.Get(env, KeyId::kDone)).ToBoolean().Value()) break;
+        Napi::Value entry = next.Get(ctx.keys.Get(env, KeyId::kValue));
+        if (isSet) {
+          children.push_back(entry);
+        } else {
+          children.push_back(entry.As<Napi::Array>().Get(static_cast<uint32_t>(0)));
+          children.push_back(entry.As<Napi::Array>().Get(static_cast<uint32_t>(1)));
+        }
+      }
+    } else if (kind == ValueKind::kPlainObject || kind == ValueKind::kObject) {
+      Napi::Object obj = item.As<Napi::Object>();
+      Napi::Array keys = obj.GetPropertyNames();
+      uint32_t length = std::min(keys.Length(), budget);
+      for (uint32_t i = 0; i < length; i++) {
+        Napi::Value key = keys.Get(i);
+        if (key.IsString()) children.push_back(obj.Get(key));
+      }
+    }
+    pending.insert(pending.end(), children.rbegin(), children.rend());
   }
+}
 
-  ~SeenGuard() {
-    if (active) {
-      seen.pop_back();
+// Writes the dedupeStrings string table, whose entries are numbered after the
+// dictionary's. An entry costs its text, quotes and a comma once; each
+// reference to it costs the mark, the index and quotes instead of the text and
+// quotes. Only entries that save more than they cost are kept, the most
+// repeated first so they get the shortest indexes. Lengths count UTF-16 units,
+// which the UTF-8 text never undercuts.
+static void WriteStringTable(const Napi::Env &env, napi_value value, EncodeContext &ctx) {
+  std::unordered_map<std::u16string, uint32_t> counts;
+  CountStringValues(env, value, ctx, counts);
+  std::vector<std::pair<const std::u16string *, uint32_t>> candidates;
+  for (const auto &[text, count] : counts) {
+    if (count < 2) continue;
+    if (ctx.dictionary != nullptr &&
+        ctx.dictionary->Find(text.data(), text.size()) != kNotInDictionary) {
+      continue;
     }
+    candidates.emplace_back(&text, count);
   }
+  std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+    return a.second != b.second ? a.second > b.second : *a.first < *b.first;
+  });
+
+  uint64_t base = ctx.dictionary != nullptr ? ctx.dictionary->Size() : 0;
+  size_t digits = 1;
+  uint64_t nextPowerOfTen = 10;
+  for (; nextPowerOfTen <= base; nextPowerOfTen *= 10) digits++;
+  for (const auto &[text, count] : candidates) {
+    if (base + ctx.stringTable.size() == nextPowerOfTen) {
+      digits++;
+      nextPowerOfTen *= 10;
+    }
+    uint64_t length = text->size();
+    if (length <= 1 + digits || count * (length - 1 - digits) <= length + 3) continue;
+    ctx.stringTable.push_back(*text);
+  }
+
+  JsonWriter &out = ctx.out;
+  out.Field(kStringsKey);
+  out.Raw('[');
+  for (size_t i = 0; i < ctx.stringTable.size(); i++) {
+    const std::u16string &text = ctx.stringTable[i];
+    if (i > 0) out.Raw(',');
+    out.String(text.data(), text.size());
+    ctx.strings.emplace(text, static_cast<uint32_t>(base + i));
+  }
+  out.Raw(']');
+}
+
+// Writes the DedupedStrings header: the checksum of the dictionary the
+// references are resolved with, and the string table under dedupeStrings.
+static void WriteStringHeader(const Napi::Env &env, napi_value value, EncodeContext &ctx) {
+  JsonWriter &out = ctx.out;
+  WriteWrapperOpen(out, kTypeDedupedStrings);
+  if (ctx.dictionary != nullptr) {
+    out.Field(kDictionaryKey);
+    out.Uint(ctx.dictionary->Checksum());
+  }
+  if (ctx.dedupeStrings) WriteStringTable(env, value, ctx);
+  out.Field(kValueKey);
+  ctx.stringRefs = true;
+}
+
+// Writes a value that JSON.stringify would coerce inside a wrapper payload.
+static void WritePayloadString(const Napi::Env &env, const Napi::Value &value,
+                               EncodeContext &ctx) {
+  if (value.IsString()) {
+    WriteJsString(env, value, ctx);
+  } else {
+    WriteJsString(env, value.ToString(), ctx);
+  }
+}
+
+// Writes the bytes of a binary value: inline as a base64 `value`, or, with
+// external attachments, as the index of `owner` in the attachment list.
+static void WriteBinaryPayload(const Napi::Value &owner, const uint8_t *data,
+                               size_t len, EncodeContext &ctx) {
+  if (ctx.attachments.IsEmpty()) {
+    ctx.out.Field(kValueKey);
+    StatsTimer timer(ctx.stats.Get(), &Stats::base64Ns);
+    SERDE_STAT(ctx.stats, base64Bytes += len);
+    ctx.out.Base64String(data, len);
+    return;
+  }
+  uint32_t index = ctx.attachments.Length();
+  ctx.attachments.Set(index, owner);
+  ctx.out.Field(kAttachmentKey);
+  ctx.out.Uint(index);
+}
+
+void JsonEncoder::Start(const Napi::Env &env, napi_value value, bool applyReplacer) {
+  if (ctx_.dedupeStrings || ctx_.dictionary != nullptr) {
+    WriteStringHeader(env, value, ctx_);
+    PushLiteral("}");
+  }
+  PushValue(value);
+  stack_.back().applyReplacer = applyReplacer;
+}
+
+bool JsonEncoder::Run(const Napi::Env &env, size_t limit) {
+  while (!stack_.empty()) {
+    if (limit != 0 && ctx_.out.Size() >= limit) {
+      return false;
+    }
+    switch (stack_.back().kind) {
+      case FrameKind::kValue: {
+        napi_value value = stack_.back().value;
+        bool applyReplacer = stack_.back().applyReplacer;
+        stack_.pop_back();
+        WriteValue(env, value, applyReplacer);
+        break;
+      }
+      case FrameKind::kLiteral: {
+        const char *text = stack_.back().literal;
+        stack_.pop_back();
+        ctx_.out.Raw(text, std::strlen(text));
+        break;
+      }
+      case FrameKind::kArray:
+        StepArray(env);
+        break;
+      case FrameKind::kObject:
+        StepObject(env);
+        break;
+      case FrameKind::kShape:
+        StepShape(env);
+        break;
+      case FrameKind::kSet:
+      case FrameKind::kMap:
+        StepCollection(env);
+        break;
+      case FrameKind::kErrorProps:
+      case FrameKind::kErrorSymbols:
+        StepError(env);
+        break;
+    }
+  }
+  return true;
+}
+
+// Handles only stay valid for the native call that created them, so the ones
+// the stack holds are parked in a JS array in between calls. Primitives cannot
+// be referenced on their own before N-API 10.
+void JsonEncoder::Suspend(const Napi::Env &env) {
+  Napi::Array held = Napi::Array::New(env);
+  uint32_t count = 0;
+  auto hold = [&](napi_value handle) {
+    if (handle != nullptr) held.Set(count++, Napi::Value(env, handle));
+  };
+  for (const Frame &frame : stack_) {
+    hold(frame.value);
+    hold(frame.items);
+    hold(frame.next);
+  }
+  if (replacer_.enabled) {
+    hold(replacer_.fn);
+    hold(replacer_.replace);
+  }
+  if (!ctx_.attachments.IsEmpty()) hold(ctx_.attachments);
+  suspended_ = Napi::Persistent(static_cast<Napi::Object>(held));
+}
+
+void JsonEncoder::Resume(const Napi::Env &env) {
+  ctx_.keys.Reset();
+  if (suspended_.IsEmpty()) return;
+  Napi::Array held = suspended_.Value().As<Napi::Array>();
+  uint32_t count = 0;
+  auto restore = [&](napi_value &handle) {
+    if (handle != nullptr) handle = held.Get(count++);
+  };
+  for (Frame &frame : stack_) {
+    restore(frame.value);
+    restore(frame.items);
+    restore(frame.next);
+  }
+  if (replacer_.enabled) {
+    replacer_.fn = held.Get(count++).As<Napi::Function>();
+    replacer_.replace = held.Get(count++).As<Napi::Function>();
+  }
+  if (!ctx_.attachments.IsEmpty()) {
+    ctx_.attachments = held.Get(count++).As<Napi::Array>();
+  }
+  suspended_.Reset();
+}
+
+void JsonEncoder::PushValue(napi_value value) {
+  Frame frame{};
+  frame.kind = FrameKind::kValue;
+  frame.applyReplacer = true;
+  frame.value = value;
+  stack_.push_back(frame);
+}
+
+void JsonEncoder::PushLiteral(const char *text) {
+  Frame frame{};
+  frame.kind = FrameKind::kLiteral;
+  frame.literal = text;
+  stack_.push_back(frame);
+}
+
+void JsonEncoder::PushContainer(const Napi::Env &env, FrameKind kind, napi_value object,
+                                uint32_t id, bool wrapped) {
+  EnterContainer(env, ctx_);
+  Frame frame{};
+  frame.kind = kind;
+  frame.wrapped = wrapped;
+  frame.first = true;
+  frame.id = id;
+  frame.value = object;
+  stack_.push_back(frame);
+}
+
+// Pops a finished container. Without circular references it also leaves the
+// ancestor path used for cycle detection.
+void JsonEncoder::Close(const Napi::Env &env) {
+  napi_value value = stack_.back().value;
+  stack_.pop_back();
+  LeaveContainer(ctx_);
+  if (!ctx_.allowCircular) {
+    ctx_.stack.Erase(env, Napi::Value(env, value));
+  }
+}
+
+// Writes a primitive or a binary/built-in value outright; containers write
+// their opening and push a frame that walks their contents.
+// Writes the memory of a TypedArray or DataView: its own bytes at offset 0, or
+// with shareArrayBuffers its backing ArrayBuffer (a reference after the first
+// view) and its offset into it. SharedArrayBuffer memory is always copied.
+void JsonEncoder::WriteViewBytes(const Napi::Env &env, napi_value view, const uint8_t *data,
+                                 size_t byteLength, napi_value arraybuffer,
+                                 size_t byteOffset) {
+  JsonWriter &out = ctx_.out;
+  if (ctx_.shareArrayBuffers && Napi::Value(env, arraybuffer).IsArrayBuffer()) {
+    out.Field(kBufferKey);
+    WriteValue(env, arraybuffer, false);
+    out.Field(kByteOffsetKey);
+    out.Number(static_cast<double>(byteOffset));
+    return;
+  }
+  WriteBinaryPayload(Napi::Value(env, view), data, byteLength, ctx_);
+  out.Field(kByteOffsetKey);
+  out.Raw('0');
+}
 
-  SeenGuard(const SeenGuard &) = delete;
-  SeenGuard &operator=(const SeenGuard &) = delete;
-};
-
-Napi::Value EncodeValue(const Napi::Env &env, const Napi::Value &value,
-                        EncodeContext &ctx, const Replacer &replacer,
-                        bool applyReplacer) {
-  // Apply replacer before serialization if enabled.
-  if (applyReplacer && replacer.enabled) {
-    ReplaceState state;
-    Napi::Function cb =
-        Napi::Function::New(env, ReplaceCallback, "replace", &state);
-    replacer.fn.Call(env.Global(), {value, cb});
-    if (state.replaced) {
-      Napi::Value nextValue = Napi::Value(env, state.value);
-      return EncodeValue(env, nextValue, ctx, replacer, false);
+void JsonEncoder::WriteValue(const Napi::Env &env, napi_value handle,
+                             bool applyReplacer) {
+  JsonWriter &out = ctx_.out;
+  Napi::Value value(env, handle);
+  EncodeContext &ctx = ctx_;
+  ValueKind kind = ClassifyValue(env, value, ctx.data);
+
+  // Apply replacer before serialization if enabled for this kind of value.
+  if (applyReplacer && replacer_.Wants(kind)) {
+    Napi::Value nextValue;
+    SERDE_STAT(ctx.stats, callbacks++);
+    if (ApplyReplacer(env, value, replacer_, &nextValue)) {
+      WriteValue(env, nextValue, false);
+      return;
     }
   }
+  SERDE_STAT(ctx.stats, Node(static_cast<size_t>(kind)));
 
   // Primitives and special numbers.
-  if (value.IsUndefined()) {
-    return MakeWrapper(env, kTypeUndefined);
+  if (kind == ValueKind::kUndefined) {
+    WriteWrapperOpen(out, kTypeUndefined);
+    out.Raw('}');
+    return;
+  }
+  if (kind == ValueKind::kNull) {
+    out.Literal("null");
+    return;
   }
-  if (value.IsNull()) {
-    return env.Null();
+  if (kind == ValueKind::kBoolean) {
+    if (value.As<Napi::Boolean>().Value()) {
+      out.Literal("true");
+    } else {
+      out.Literal("false");
+    }
+    return;
   }
-  if (value.IsBoolean() || value.IsString()) {
-    return value;
+  if (kind == ValueKind::kString) {
+    if (ctx.stringRefs) {
+      WriteStringRef(env, value, ctx);
+    } else {
+      WriteJsString(env, value, ctx);
+    }
+    return;
   }
-  if (value.IsNumber()) {
+  if (kind == ValueKind::kNumber) {
     double num = value.As<Napi::Number>().DoubleValue();
     if (!std::isfinite(num)) {
+      WriteWrapperOpen(out, kTypeNumber);
+      out.Field(kValueKey);
       if (std::isnan(num)) {
-        return MakeWrapper(env, kTypeNumber, Napi::String::New(env, kNumNaN));
+        out.AsciiString(kNumNaN);
+      } else {
+        out.AsciiString(num > 0 ? kNumInf : kNumNegInf);
       }
-      return MakeWrapper(env, kTypeNumber,
-                         Napi::String::New(env, num > 0 ? kNumInf : kNumNegInf));
+      out.Raw('}');
+      return;
     }
-    return value;
+    out.Number(num);
+    return;
   }
-  if (value.IsBigInt()) {
+  if (kind == ValueKind::kBigInt) {
     std::string text = value.ToString().Utf8Value();
-    return MakeWrapper(env, kTypeBigInt, Napi::String::New(env, text));
-  }
-  // Unsupported types.
-  if (value.IsFunction() || value.IsSymbol()) {
-    throw Napi::TypeError::New(env, "Unsupported value type");
+    WriteWrapperOpen(out, kTypeBigInt);
+    out.Field(kValueKey);
+    out.AsciiString(text.data(), text.size());
+    out.Raw('}');
+    return;
   }
-  if (!value.IsObject()) {
+  // Unsupported types (functions, symbols, externals).
+  if (kind == ValueKind::kUnsupported) {
     throw Napi::TypeError::New(env, "Unsupported value type");
   }
 
@@ -73,67 +423,43 @@ Napi::Value EncodeValue(const Napi::Env &env, const Napi::Value &value,
   uint32_t currentId = 0;
   bool hasId = false;
 
-  // Circular reference handling.
-  if (ctx.allowCircular) {
-    int seenId = FindSeenId(ctx.entries, value);
-    if (seenId >= 0) {
-      return MakeReference(env, static_cast<uint32_t>(seenId));
+  // Circular reference handling. Shared ArrayBuffers are tracked the same way.
+  if (ctx.allowCircular || (ctx.shareArrayBuffers && kind == ValueKind::kArrayBuffer)) {
+    uint32_t seenId = ctx.entries.Find(env, value);
+    if (seenId != 0) {
+      SERDE_STAT(ctx.stats, Reference(static_cast<size_t>(kind)));
+      WriteReference(out, seenId);
+      return;
     }
+    SERDE_STAT(ctx.stats, circularIds++);
     currentId = ctx.nextId++;
     hasId = true;
-    ctx.entries.push_back({Napi::Persistent(value), currentId});
-  } else if (SeenContains(ctx.stack, value)) {
+    ctx.entries.Insert(env, value, currentId);
+  } else if (ctx.stack.Find(env, value) != 0) {
     throw Napi::TypeError::New(env, "Circular reference detected");
   }
 
-  SeenGuard guard(ctx.stack, value);
-
-  // Arrays (preserve holes).
-  if (value.IsArray()) {
-    Napi::Array arr = value.As<Napi::Array>();
-    uint32_t length = arr.Length();
-    Napi::Array out = Napi::Array::New(env, length);
-    for (uint32_t i = 0; i < length; i++) {
-      if (arr.Has(i)) {
-        out.Set(i, EncodeValue(env, arr.Get(i), ctx, replacer, true));
-      } else {
-        out.Set(i, MakeWrapper(env, kTypeHole));
-      }
-    }
-    if (ctx.allowCircular && hasId) {
-      Napi::Object wrapper = MakeWrapperWithId(env, kTypeArray, currentId);
-      wrapper.Set(kValueKey, out);
-      return wrapper;
-    }
-    return out;
-  }
-
   // Buffers and binary types.
-  if (value.IsArrayBuffer()) {
+  if (kind == ValueKind::kArrayBuffer) {
     Napi::ArrayBuffer buf = value.As<Napi::ArrayBuffer>();
-    std::string b64 = Base64Encode(static_cast<uint8_t *>(buf.Data()),
-                                   buf.ByteLength());
-    Napi::Object wrapper = MakeWrapper(env, kTypeArrayBuffer, Napi::String::New(env, b64));
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+    WriteWrapperOpen(out, kTypeArrayBuffer);
+    WriteBinaryPayload(value, static_cast<uint8_t *>(buf.Data()), buf.ByteLength(), ctx);
+    WriteIdIfNeeded(out, hasId, currentId);
+    out.Raw('}');
+    return;
   }
 
-  if (IsBufferInstance(env, value)) {
+  if (kind == ValueKind::kBuffer) {
     Napi::Buffer<uint8_t> buf = value.As<Napi::Buffer<uint8_t>>();
-    std::string b64 = Base64Encode(buf.Data(), buf.Length());
-    Napi::Object wrapper = MakeWrapper(env, kTypeBuffer, Napi::String::New(env, b64));
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+    WriteWrapperOpen(out, kTypeBuffer);
+    WriteBinaryPayload(value, buf.Data(), buf.Length(), ctx);
+    WriteIdIfNeeded(out, hasId, currentId);
+    out.Raw('}');
+    return;
   }
 
   // DataView and TypedArray handling via N-API.
-  bool isDataView = false;
-  napi_status dataViewStatus = napi_is_dataview(env, value, &isDataView);
-  if (dataViewStatus != napi_ok) {
-    std::string message = GetNapiErrorMessage(env);
-    throw Napi::TypeError::New(env, "napi_is_dataview failed: " + message);
-  }
-  if (isDataView) {
+  if (kind == ValueKind::kDataView) {
     size_t byteLength;
     void *data;
     napi_value arraybuffer;
@@ -145,22 +471,17 @@ Napi::Value EncodeValue(const Napi::Env &env, const Napi::Value &value,
       std::string message = GetNapiErrorMessage(env);
       throw Napi::TypeError::New(env, "napi_get_dataview_info failed: " + message);
     }
-    std::string b64 = Base64Encode(static_cast<uint8_t *>(data), byteLength);
-    Napi::Object wrapper = MakeWrapper(env, kTypeDataView);
-    wrapper.Set(kValueKey, Napi::String::New(env, b64));
-    wrapper.Set(kByteOffsetKey, Napi::Number::New(env, 0));
-    wrapper.Set(kLengthKey, Napi::Number::New(env, byteLength));
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
-  }
-
-  bool isTypedArray = false;
-  napi_status typedArrayStatus = napi_is_typedarray(env, value, &isTypedArray);
-  if (typedArrayStatus != napi_ok) {
-    std::string message = GetNapiErrorMessage(env);
-    throw Napi::TypeError::New(env, "napi_is_typedarray failed: " + message);
-  }
-  if (isTypedArray) {
+    WriteWrapperOpen(out, kTypeDataView);
+    WriteViewBytes(env, value, static_cast<uint8_t *>(data), byteLength, arraybuffer,
+                   byteOffset);
+    out.Field(kLengthKey);
+    out.Number(static_cast<double>(byteLength));
+    WriteIdIfNeeded(out, hasId, currentId);
+    out.Raw('}');
+    return;
+  }
+
+  if (kind == ValueKind::kTypedArray) {
     napi_typedarray_type type;
     size_t length;
     void *data;
@@ -179,158 +500,330 @@ Napi::Value EncodeValue(const Napi::Env &env, const Napi::Value &value,
       throw Napi::TypeError::New(env, "Unsupported typed array");
     }
     size_t byteLength = length * bytesPerElement;
-    std::string b64 = Base64Encode(static_cast<uint8_t *>(data), byteLength);
-    Napi::Object wrapper = MakeWrapper(env, kTypeTypedArray);
-    wrapper.Set(kArrayTypeKey, Napi::String::New(env, typeName));
-    wrapper.Set(kValueKey, Napi::String::New(env, b64));
-    wrapper.Set(kByteOffsetKey, Napi::Number::New(env, 0));
-    wrapper.Set(kLengthKey, Napi::Number::New(env, length));
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+    WriteWrapperOpen(out, kTypeTypedArray);
+    out.Field(kArrayTypeKey);
+    out.AsciiString(typeName.data(), typeName.size());
+    WriteViewBytes(env, value, static_cast<uint8_t *>(data), byteLength, arraybuffer,
+                   byteOffset);
+    out.Field(kLengthKey);
+    out.Number(static_cast<double>(length));
+    WriteIdIfNeeded(out, hasId, currentId);
+    out.Raw('}');
+    return;
   }
 
   // Built-in complex types.
-  if (obj.InstanceOf(env.Global().Get("Date").As<Napi::Function>())) {
-    Napi::Function toISOString = obj.Get("toISOString").As<Napi::Function>();
+  if (kind == ValueKind::kDate) {
+    Napi::Function toISOString =
+        obj.Get(ctx.keys.Get(env, KeyId::kToISOString)).As<Napi::Function>();
     Napi::Value iso = toISOString.Call(obj, {});
-    Napi::Object wrapper = MakeWrapper(env, kTypeDate, iso);
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+    WriteWrapperOpen(out, kTypeDate);
+    out.Field(kValueKey);
+    WritePayloadString(env, iso, ctx);
+    WriteIdIfNeeded(out, hasId, currentId);
+    out.Raw('}');
+    return;
   }
 
-  if (obj.InstanceOf(env.Global().Get("RegExp").As<Napi::Function>())) {
-    Napi::Value source = obj.Get(kSourceKey);
-    Napi::Value flags = obj.Get(kFlagsKey);
-    Napi::Object payload = Napi::Object::New(env);
-    payload.Set(kSourceKey, source);
-    payload.Set(kFlagsKey, flags);
-    Napi::Object wrapper = MakeWrapper(env, kTypeRegExp, payload);
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+  if (kind == ValueKind::kRegExp) {
+    Napi::Value source = obj.Get(ctx.keys.Get(env, KeyId::kSource));
+    Napi::Value flags = obj.Get(ctx.keys.Get(env, KeyId::kFlags));
+    WriteWrapperOpen(out, kTypeRegExp);
+    out.Field(kValueKey);
+    out.Raw('{');
+    out.Key(kSourceKey);
+    WritePayloadString(env, source, ctx);
+    out.Field(kFlagsKey);
+    WritePayloadString(env, flags, ctx);
+    out.Raw('}');
+    WriteIdIfNeeded(out, hasId, currentId);
+    out.Raw('}');
+    return;
   }
 
-  // Errors (own properties + symbols).
-  if (obj.InstanceOf(env.Global().Get("Error").As<Napi::Function>())) {
-    Napi::Object payload = Napi::Object::New(env);
-    Napi::Value name = obj.Get(kNameKey);
-    Napi::Value message = obj.Get(kMessageKey);
-    Napi::Value stack = obj.Get(kStackKey);
-    payload.Set(kNameKey, name.IsUndefined() ? env.Undefined() : name.ToString());
-    payload.Set(kMessageKey,
-                message.IsUndefined() ? env.Undefined() : message.ToString());
-    payload.Set(kStackKey, stack.IsUndefined() ? env.Undefined() : stack.ToString());
-
-    Napi::Array props = Napi::Array::New(env);
-    uint32_t idx = 0;
-    Napi::Array keys = obj.GetPropertyNames();
-    uint32_t length = keys.Length();
-    for (uint32_t i = 0; i < length; i++) {
-      Napi::Value key = keys.Get(i);
-      if (!key.IsString()) {
-        continue;
+  // Dense all-number arrays as raw float64 data. A replacer called for numbers
+  // has to see each element, so it turns packing off.
+  if (kind == ValueKind::kArray && ctx.packNumbers &&
+      !replacer_.Wants(ValueKind::kNumber) &&
+      value.As<Napi::Array>().Length() >= kMinPackedLength) {
+    Napi::Value packed = ctx.data.packNumbers.Call({value});
+    if (packed.IsTypedArray()) {
+      napi_typedarray_type type;
+      size_t length;
+      void *data;
+      napi_status status = napi_get_typedarray_info(env, packed, &type, &length, &data,
+                                                    nullptr, nullptr);
+      if (status != napi_ok) {
+        std::string message = GetNapiErrorMessage(env);
+        throw Napi::TypeError::New(env, "napi_get_typedarray_info failed: " + message);
       }
-      Napi::Array pair = Napi::Array::New(env, 2);
-      pair.Set(static_cast<uint32_t>(0), MakePropKeyString(env, key));
-      pair.Set(static_cast<uint32_t>(1), EncodeValue(env, obj.Get(key), ctx, replacer, true));
-      props.Set(idx++, pair);
+      WriteWrapperOpen(out, kTypePackedArray);
+      WriteBinaryPayload(packed, static_cast<uint8_t *>(data), length * sizeof(double), ctx);
+      out.Field(kLengthKey);
+      out.Number(static_cast<double>(length));
+      WriteIdIfNeeded(out, hasId, currentId);
+      out.Raw('}');
+      return;
     }
+  }
 
-    Napi::Object objectCtor = env.Global().Get("Object").As<Napi::Object>();
-    Napi::Function getOwnPropertySymbols =
-        objectCtor.Get("getOwnPropertySymbols").As<Napi::Function>();
-    Napi::Array symbols =
-        getOwnPropertySymbols.Call(objectCtor, {obj}).As<Napi::Array>();
-    uint32_t symLength = symbols.Length();
-    Napi::Object symbolCtor = env.Global().Get("Symbol").As<Napi::Object>();
-    Napi::Function keyForFn = symbolCtor.Get("keyFor").As<Napi::Function>();
-
-    for (uint32_t i = 0; i < symLength; i++) {
-      Napi::Value sym = symbols.Get(i);
-      if (!sym.IsSymbol()) {
-        continue;
-      }
-      Napi::Value keyFor = keyForFn.Call(symbolCtor, {sym});
-      bool isGlobal = !keyFor.IsUndefined() && !keyFor.IsNull();
-      Napi::Value descVal = env.Undefined();
-      if (!isGlobal) {
-        Napi::Object symObj = sym.ToObject();
-        descVal = symObj.Get(kDescriptionKey);
-      }
-      Napi::Array pair = Napi::Array::New(env, 2);
-      pair.Set(static_cast<uint32_t>(0),
-               MakePropKeySymbol(env, isGlobal, isGlobal ? keyFor : descVal));
-      pair.Set(static_cast<uint32_t>(1), EncodeValue(env, obj.Get(sym), ctx, replacer, true));
-      props.Set(idx++, pair);
-    }
+  // Everything below has contents, walked by the frame pushed for it. Without
+  // circular references it stays on the ancestor path until that frame closes.
+  if (!ctx.allowCircular) {
+    ctx.stack.Insert(env, value, 1);
+  }
 
-    payload.Set(kPropsKey, props);
-    Napi::Object wrapper = MakeWrapper(env, kTypeError, payload);
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+  // Arrays (preserve holes).
+  if (kind == ValueKind::kArray) {
+    if (hasId) {
+      WriteWrapperOpenWithId(out, kTypeArray, currentId);
+      out.Field(kValueKey);
+    }
+    out.Raw('[');
+    PushContainer(env, FrameKind::kArray, value, currentId, hasId);
+    stack_.back().length = value.As<Napi::Array>().Length();
+    return;
   }
 
-  // Collections.
-  if (obj.InstanceOf(env.Global().Get("Set").As<Napi::Function>())) {
-    Napi::Function valuesFn = obj.Get("values").As<Napi::Function>();
-    Napi::Object iterator = valuesFn.Call(obj, {}).As<Napi::Object>();
-    Napi::Function nextFn = iterator.Get("next").As<Napi::Function>();
-    Napi::Array arr = Napi::Array::New(env);
-    uint32_t idx = 0;
-    while (true) {
-      Napi::Object next = nextFn.Call(iterator, {}).As<Napi::Object>();
-      bool done = next.Get("done").ToBoolean().Value();
-      if (done) break;
-      Napi::Value v = next.Get("value");
-      arr.Set(idx++, EncodeValue(env, v, ctx, replacer, true));
+  // Errors (own properties + symbols).
+  if (kind == ValueKind::kError) {
+    Napi::Value name = obj.Get(ctx.keys.Get(env, KeyId::kName));
+    Napi::Value message = obj.Get(ctx.keys.Get(env, KeyId::kMessage));
+    Napi::Value stack = obj.Get(ctx.keys.Get(env, KeyId::kStack));
+    WriteWrapperOpen(out, kTypeError);
+    out.Field(kValueKey);
+    out.Raw('{');
+    // Undefined payload fields are omitted, as JSON.stringify would.
+    if (!name.IsUndefined()) {
+      out.Key(kNameKey);
+      WritePayloadString(env, name, ctx);
+      out.Raw(',');
+    }
+    if (!message.IsUndefined()) {
+      out.Key(kMessageKey);
+      WritePayloadString(env, message, ctx);
+      out.Raw(',');
     }
-    Napi::Object wrapper = MakeWrapper(env, kTypeSet, arr);
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
-  }
-
-  if (obj.InstanceOf(env.Global().Get("Map").As<Napi::Function>())) {
-    Napi::Function entriesFn = obj.Get("entries").As<Napi::Function>();
-    Napi::Object iterator = entriesFn.Call(obj, {}).As<Napi::Object>();
-    Napi::Function nextFn = iterator.Get("next").As<Napi::Function>();
-    Napi::Array arr = Napi::Array::New(env);
-    uint32_t idx = 0;
-    while (true) {
-      Napi::Object next = nextFn.Call(iterator, {}).As<Napi::Object>();
-      bool done = next.Get("done").ToBoolean().Value();
-      if (done) break;
-      Napi::Array entry = next.Get("value").As<Napi::Array>();
-      Napi::Array pair = Napi::Array::New(env, 2);
-      pair.Set(static_cast<uint32_t>(0),
-               EncodeValue(env, entry.Get(static_cast<uint32_t>(0)), ctx, replacer, true));
-      pair.Set(static_cast<uint32_t>(1),
-               EncodeValue(env, entry.Get(static_cast<uint32_t>(1)), ctx, replacer, true));
-      arr.Set(idx++, pair);
+    if (!stack.IsUndefined()) {
+      out.Key(kStackKey);
+      WritePayloadString(env, stack, ctx);
+      out.Raw(',');
     }
-    Napi::Object wrapper = MakeWrapper(env, kTypeMap, arr);
-    SetIdIfNeeded(env, wrapper, hasId, currentId);
-    return wrapper;
+    out.Key(kPropsKey);
+    out.Raw('[');
+    Napi::Array keys = obj.GetPropertyNames();
+    PushContainer(env, FrameKind::kErrorProps, value, currentId, false);
+    stack_.back().items = keys;
+    stack_.back().length = keys.Length();
+    return;
+  }
+
+  // Collections.
+  if (kind == ValueKind::kSet || kind == ValueKind::kMap) {
+    bool isSet = kind == ValueKind::kSet;
+    Napi::Function iterate =
+        obj.Get(ctx.keys.Get(env, isSet ? KeyId::kValues : KeyId::kEntries))
+            .As<Napi::Function>();
+    Napi::Object iterator = iterate.Call(obj, {}).As<Napi::Object>();
+    Napi::Function nextFn =
+        iterator.Get(ctx.keys.Get(env, KeyId::kNext)).As<Napi::Function>();
+    WriteWrapperOpen(out, isSet ? kTypeSet : kTypeMap);
+    out.Field(kValueKey);
+    out.Raw('[');
+    PushContainer(env, isSet ? FrameKind::kSet : FrameKind::kMap, value, currentId, false);
+    stack_.back().items = iterator;
+    stack_.back().next = nextFn;
+    return;
   }
 
-  // Plain objects.
+  // Plain objects (and any other object: class instances, null prototypes).
+  if (hasId) {
+    WriteWrapperOpenWithId(out, kTypeObject, currentId);
+    out.Field(kValueKey);
+  }
+  out.Raw('{');
+  // Shapes carry their keys as text, so they are not used for keys written as
+  // references.
+  if (!ctx.data.shapes.empty() && !ctx.stringRefs) {
+    Napi::Value match = ctx.data.matchShape.Call({value});
+    if (match.IsArray()) {
+      Napi::Array values = match.As<Napi::Array>();
+      Napi::Value shapeId = values.Get(static_cast<uint32_t>(0));
+      PushContainer(env, FrameKind::kShape, value, currentId, hasId);
+      stack_.back().items = values;
+      stack_.back().shape = shapeId.As<Napi::Number>().Uint32Value();
+      stack_.back().length = values.Length() - 1;
+      return;
+    }
+  }
   Napi::Array keys = obj.GetPropertyNames();
-  uint32_t length = keys.Length();
-  Napi::Object out = Napi::Object::New(env);
-  for (uint32_t i = 0; i < length; i++) {
-    Napi::Value key = keys.Get(i);
-    if (!key.IsString()) {
-      throw Napi::TypeError::New(env, "Only string keys are supported");
+  PushContainer(env, FrameKind::kObject, value, currentId, hasId);
+  stack_.back().items = keys;
+  stack_.back().length = keys.Length();
+}
+
+void JsonEncoder::StepArray(const Napi::Env &env) {
+  JsonWriter &out = ctx_.out;
+  Frame &frame = stack_.back();
+  if (frame.index == frame.length) {
+    out.Raw(']');
+    if (frame.wrapped) out.Raw('}');
+    Close(env);
+    return;
+  }
+  uint32_t i = frame.index++;
+  Napi::Array arr(env, frame.value);
+  if (i > 0) out.Raw(',');
+  // Dense arrays cost one call per element; only an undefined read can be a hole.
+  // N-API has no bulk read. Passing runs of elements through a JS helper as
+  // call arguments was tried; it saved little, since classifying and writing
+  // each element costs more than the Get, and it doubled the cost per object.
+  Napi::Value item = arr.Get(i);
+  if (!item.IsUndefined() || arr.Has(i)) {
+    WriteValue(env, item, true);
+  } else {
+    WriteWrapperOpen(out, kTypeHole);
+    out.Raw('}');
+  }
+}
+
+void JsonEncoder::StepObject(const Napi::Env &env) {
+  JsonWriter &out = ctx_.out;
+  Frame &frame = stack_.back();
+  if (frame.index == frame.length) {
+    out.Raw('}');
+    if (frame.wrapped) out.Raw('}');
+    Close(env);
+    return;
+  }
+  uint32_t i = frame.index++;
+  Napi::Object obj(env, frame.value);
+  Napi::Value key = Napi::Array(env, frame.items).Get(i);
+  if (!key.IsString()) {
+    throw Napi::TypeError::New(env, "Only string keys are supported");
+  }
+  if (i > 0) out.Raw(',');
+  if (ctx_.stringRefs) {
+    WriteStringRef(env, key, ctx_);
+  } else {
+    WriteJsString(env, key, ctx_);
+  }
+  out.Raw(':');
+  WriteValue(env, obj.Get(key), true);
+}
+
+// Same as StepObject, with the key text and values prepared by matchShape.
+void JsonEncoder::StepShape(const Napi::Env &env) {
+  JsonWriter &out = ctx_.out;
+  Frame &frame = stack_.back();
+  if (frame.index == frame.length) {
+    out.Raw('}');
+    if (frame.wrapped) out.Raw('}');
+    Close(env);
+    return;
+  }
+  uint32_t i = frame.index++;
+  if (i > 0) out.Raw(',');
+  const std::string &fragment = ctx_.data.shapes[frame.shape].fragments[i];
+  out.Raw(fragment.data(), fragment.size());
+  WriteValue(env, Napi::Array(env, frame.items).Get(i + 1), true);
+}
+
+// Advances a Set or Map iterator by one entry. A Map entry's value and the
+// punctuation around it are pushed so they follow the key once it is written.
+void JsonEncoder::StepCollection(const Napi::Env &env) {
+  JsonWriter &out = ctx_.out;
+  Frame &frame = stack_.back();
+  Napi::Function nextFn(env, frame.next);
+  Napi::Object next = nextFn.Call(frame.items, {}).As<Napi::Object>();
+  if (next.Get(ctx_.keys.Get(env, KeyId::kDone)).ToBoolean().Value()) {
+    out.Raw(']');
+    WriteIdIfNeeded(out, ctx_.allowCircular, frame.id);
+    out.Raw('}');
+    Close(env);
+    return;
+  }
+  if (!frame.first) out.Raw(',');
+  frame.first = false;
+  Napi::Value item = next.Get(ctx_.keys.Get(env, KeyId::kValue));
+  if (frame.kind == FrameKind::kSet) {
+    WriteValue(env, item, true);
+    return;
+  }
+  Napi::Array entry = item.As<Napi::Array>();
+  out.Raw('[');
+  PushLiteral("]");
+  PushValue(entry.Get(static_cast<uint32_t>(1)));
+  PushLiteral(",");
+  WriteValue(env, entry.Get(static_cast<uint32_t>(0)), true);
+}
+
+// Writes the next own property of an Error: string keys first, then symbols.
+void JsonEncoder::StepError(const Napi::Env &env) {
+  JsonWriter &out = ctx_.out;
+  Frame &frame = stack_.back();
+  Napi::Object obj(env, frame.value);
+  Napi::Array keys(env, frame.items);
+  bool symbols = frame.kind == FrameKind::kErrorSymbols;
+  while (frame.index < frame.length) {
+    Napi::Value key = keys.Get(frame.index++);
+    if (symbols ? !key.IsSymbol() : !key.IsString()) {
+      continue;
     }
-    std::string keyStr = key.As<Napi::String>().Utf8Value();
-    out.Set(keyStr, EncodeValue(env, obj.Get(key), ctx, replacer, true));
+    if (!frame.first) out.Raw(',');
+    frame.first = false;
+    out.Raw('[');
+    if (!symbols) {
+      WriteWrapperOpen(out, kTypePropKeyString);
+      out.Field(kValueKey);
+      WriteJsString(env, key, ctx_);
+    } else {
+      Napi::Object symbolCtor = ctx_.data.symbolCtor.Value();
+      Napi::Value keyFor = ctx_.data.symbolKeyFor.Call(symbolCtor, {key});
+      bool isGlobal = !keyFor.IsUndefined() && !keyFor.IsNull();
+      WriteWrapperOpen(out, kTypePropKeySymbol);
+      out.Field(kGlobalKey);
+      if (isGlobal) {
+        out.Literal("true");
+        out.Field(kKeyKey);
+        WritePayloadString(env, keyFor, ctx_);
+      } else {
+        out.Literal("false");
+        Napi::Value descVal =
+            key.ToObject().Get(ctx_.keys.Get(env, KeyId::kDescription));
+        if (!descVal.IsUndefined()) {
+          out.Field(kDescriptionKey);
+          WritePayloadString(env, descVal, ctx_);
+        }
+      }
+    }
+    out.Literal("},");
+    PushLiteral("]");
+    WriteValue(env, obj.Get(key), true);
+    return;
   }
 
-  if (ctx.allowCircular && hasId) {
-    Napi::Object wrapper = MakeWrapperWithId(env, kTypeObject, currentId);
-    wrapper.Set(kValueKey, out);
-    return wrapper;
+  if (!symbols) {
+    Napi::Array own =
+        ctx_.data.getOwnPropertySymbols.Call(env.Global(), {obj}).As<Napi::Array>();
+    frame.kind = FrameKind::kErrorSymbols;
+    frame.items = own;
+    frame.index = 0;
+    frame.length = own.Length();
+    return;
   }
+  out.Literal("]}");
+  WriteIdIfNeeded(out, ctx_.allowCircular, frame.id);
+  out.Raw('}');
+  Close(env);
+}
 
-  return out;
+void EncodeValue(const Napi::Env &env, const Napi::Value &value,
+                 EncodeContext &ctx, const Replacer &replacer,
+                 bool applyReplacer) {
+  JsonEncoder encoder(ctx, replacer);
+  encoder.Start(env, value, applyReplacer);
+  encoder.Run(env, 0);
 }
 
 }  // namespace bas_serde
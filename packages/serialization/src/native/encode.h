@@ -1,13 +1,93 @@
 #ifndef BAS_UTILS_SERIALIZATION_ENCODE_H
 #define BAS_UTILS_SERIALIZATION_ENCODE_H
 
+#include <vector>
+
 #include "serde_utils.h"
 
 namespace bas_serde {
 
-Napi::Value EncodeValue(const Napi::Env &env, const Napi::Value &value,
-                        EncodeContext &ctx, const Replacer &replacer,
-                        bool applyReplacer);
+// Writes the JSON text of a value graph into ctx.out.
+//
+// The traversal state lives on an explicit stack instead of the C++ call
+// stack, so Run can stop once enough output is buffered and carry on in a
+// later native call. Between calls the stack's handles must be moved into a
+// persistent holder with Suspend and brought back with Resume.
+class JsonEncoder {
+ public:
+  JsonEncoder(EncodeContext &ctx, const Replacer &replacer)
+      : ctx_(ctx), replacer_(replacer) {}
+
+  // With dedupeStrings or a dictionary this first writes the DedupedStrings
+  // header, walking `value` for its string table under dedupeStrings.
+  void Start(const Napi::Env &env, napi_value value, bool applyReplacer);
+  // Encodes until the value is fully written or ctx.out holds at least
+  // `limit` bytes (0: no limit). Returns true once the value is done.
+  bool Run(const Napi::Env &env, size_t limit);
+  bool Done() const { return stack_.empty(); }
+
+  void Suspend(const Napi::Env &env);
+  void Resume(const Napi::Env &env);
+
+ private:
+  enum class FrameKind : uint8_t {
+    kValue,    // a value still to be written
+    kLiteral,  // punctuation to write after the value above it
+    kArray,
+    kObject,
+    kShape,    // an object matching a registered shape
+    kSet,
+    kMap,
+    kErrorProps,
+    kErrorSymbols,
+  };
+
+  struct Frame {
+    FrameKind kind;
+    bool applyReplacer;  // kValue
+    bool wrapped;        // array or object written inside an $$id wrapper
+    bool first;          // no element written yet
+    const char *literal; // kLiteral
+    uint32_t id;         // $$id written when the frame closes, 0 for none
+    uint32_t index;
+    uint32_t length;
+    uint32_t shape;      // kShape: id of the matched shape
+    napi_value value;    // the pending value, or the container being walked
+    napi_value items;    // property names, symbols, the collection iterator, or
+                         // a shape's [id, ...values]
+    napi_value next;     // the iterator's next function
+  };
+
+  void WriteValue(const Napi::Env &env, napi_value value, bool applyReplacer);
+  void WriteViewBytes(const Napi::Env &env, napi_value view, const uint8_t *data,
+                      size_t byteLength, napi_value arraybuffer, size_t byteOffset);
+  void PushValue(napi_value value);
+  void PushLiteral(const char *text);
+  void PushContainer(const Napi::Env &env, FrameKind kind, napi_value object, uint32_t id,
+                     bool wrapped);
+  void StepArray(const Napi::Env &env);
+  void StepObject(const Napi::Env &env);
+  void StepShape(const Napi::Env &env);
+  void StepCollection(const Napi::Env &env);
+  void StepError(const Napi::Env &env);
+  void Close(const Napi::Env &env);
+
+  EncodeContext &ctx_;
+  Replacer replacer_;
+  std::vector<Frame> stack_;
+  Napi::ObjectReference suspended_;
+};
+
+// Writes the JSON text for value into ctx.out.
+void EncodeValue(const Napi::Env &env, const Napi::Value &value,
+                 EncodeContext &ctx, const Replacer &replacer,
+                 bool applyReplacer);
+
+// Writes the tagged binary encoding of value (see binary_format.h) into
+// ctx.bytes. The caller writes the payload header.
+void EncodeBinaryValue(const Napi::Env &env, const Napi::Value &value,
+                       EncodeContext &ctx, const Replacer &replacer,
+                       bool applyReplacer);
 
 }  // namespace bas_serde
 
@@ -0,0 +1,49 @@
+#include "identity_table.h"
+
+namespace bas_serde {
+
+uint32_t IdentityTable::Find(const Napi::Env &env, const Napi::Value &value) const {
+  for (const auto &entry : linear_) {
+    if (value.StrictEquals(entry.ref.Value())) {
+      return entry.id;
+    }
+  }
+  if (overflow_ == 0) return 0;
+  Napi::Value found = get_.Call(map_.Value(), {value});
+  return found.IsNumber() ? found.As<Napi::Number>().Uint32Value() : 0;
+}
+
+void IdentityTable::Insert(const Napi::Env &env, const Napi::Value &value, uint32_t id) {
+  if (linear_.size() < kLinearLimit) {
+    linear_.push_back({Napi::Persistent(value), id});
+    return;
+  }
+  EnsureMap(env);
+  set_.Call(map_.Value(), {value, Napi::Number::New(env, id)});
+  overflow_++;
+}
+
+void IdentityTable::Erase(const Napi::Env &env, const Napi::Value &value) {
+  if (overflow_ > 0 && delete_.Call(map_.Value(), {value}).ToBoolean().Value()) {
+    overflow_--;
+    return;
+  }
+  for (size_t i = linear_.size(); i-- > 0;) {
+    if (value.StrictEquals(linear_[i].ref.Value())) {
+      linear_.erase(linear_.begin() + static_cast<std::ptrdiff_t>(i));
+      return;
+    }
+  }
+}
+
+void IdentityTable::EnsureMap(const Napi::Env &env) {
+  if (!map_.IsEmpty()) return;
+  Napi::Function ctor = env.Global().Get("Map").As<Napi::Function>();
+  Napi::Object map = ctor.New({});
+  map_ = Napi::Persistent(map);
+  get_ = Napi::Persistent(map.Get("get").As<Napi::Function>());
+  set_ = Napi::Persistent(map.Get("set").As<Napi::Function>());
+  delete_ = Napi::Persistent(map.Get("delete").As<Napi::Function>());
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,42 @@
+#ifndef BAS_UTILS_SERIALIZATION_IDENTITY_TABLE_H
+#define BAS_UTILS_SERIALIZATION_IDENTITY_TABLE_H
+
+#include <napi.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace bas_serde {
+
+// Maps objects (by identity) to non-zero ids. The first kLinearLimit entries
+// are scanned linearly, which is cheapest for shallow graphs; the overflow goes
+// into a JS Map, so lookups stay O(1) however large the table grows.
+class IdentityTable {
+ public:
+  static constexpr size_t kLinearLimit = 32;
+
+  // Returns the id stored for `value`, or 0 when absent.
+  uint32_t Find(const Napi::Env &env, const Napi::Value &value) const;
+  void Insert(const Napi::Env &env, const Napi::Value &value, uint32_t id);
+  // Removes `value`; cheapest when entries are removed in LIFO order.
+  void Erase(const Napi::Env &env, const Napi::Value &value);
+
+ private:
+  struct Entry {
+    Napi::Reference<Napi::Value> ref;
+    uint32_t id;
+  };
+
+  void EnsureMap(const Napi::Env &env);
+
+  std::vector<Entry> linear_;
+  size_t overflow_ = 0;
+  Napi::ObjectReference map_;
+  Napi::FunctionReference get_;
+  Napi::FunctionReference set_;
+  Napi::FunctionReference delete_;
+};
+
+}  // namespace bas_serde
+
+#endif
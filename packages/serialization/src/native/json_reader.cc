@@ -0,0 +1,575 @@
+#include "json_reader.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "base64.h"
+#include "serde_utils.h"
+
+namespace bas_serde {
+
+static inline bool IsJsonWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+static inline int HexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static void AppendUtf8(std::string &out, uint32_t cp) {
+  if (cp < 0x80) {
+    out.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+void JsonReader::Fail(const char *what, bool inJson) const {
+  if (pos_ >= len_) {
+    if (partial_) throw JsonIncomplete();
+    throw JsonSyntaxError("Unexpected end of JSON input", base_ + pos_);
+  }
+  std::string message = what;
+  if (inJson) message += " in JSON";
+  message += " at position ";
+  message += std::to_string(base_ + pos_);
+  throw JsonSyntaxError(message, base_ + pos_);
+}
+
+void JsonReader::SkipWhitespace() {
+  while (pos_ < len_ && IsJsonWhitespace(data_[pos_])) pos_++;
+}
+
+void JsonReader::Restore(const Mark &mark) {
+  pos_ = mark.pos;
+  stack_.resize(mark.depth);
+  if (mark.depth > 0) stack_.back() = mark.top;
+  state_ = mark.state;
+}
+
+void JsonReader::AfterValue() {
+  state_ = stack_.empty() ? kExpectEnd : kExpectSeparator;
+}
+
+JsonToken JsonReader::Next() {
+  if (tape_ != nullptr) return NextFromTape();
+  while (true) {
+    SkipWhitespace();
+    if (pos_ >= len_) {
+      if (state_ == kExpectEnd) {
+        return JsonToken{};
+      }
+      Fail("Unexpected end of JSON input");
+    }
+    char c = data_[pos_];
+    switch (state_) {
+      case kExpectValue:
+        return ReadValue(c);
+      case kExpectFirstValue:
+        if (c == ']') {
+          pos_++;
+          stack_.pop_back();
+          AfterValue();
+          JsonToken token;
+          token.type = JsonTokenType::kEndArray;
+          return token;
+        }
+        return ReadValue(c);
+      case kExpectFirstKey:
+        if (c == '}') {
+          pos_++;
+          stack_.pop_back();
+          AfterValue();
+          JsonToken token;
+          token.type = JsonTokenType::kEndObject;
+          return token;
+        }
+        [[fallthrough]];
+      case kExpectKey: {
+        if (c != '"') Fail("Expected property name");
+        JsonToken token;
+        token.type = JsonTokenType::kKey;
+        ReadString(token);
+        SkipWhitespace();
+        if (pos_ >= len_ || data_[pos_] != ':') Fail("Expected ':' after property name");
+        pos_++;
+        state_ = kExpectValue;
+        return token;
+      }
+      case kExpectSeparator: {
+        char open = stack_.back();
+        if (c == ',') {
+          pos_++;
+          state_ = open == '{' ? kExpectKey : kExpectValue;
+          continue;
+        }
+        if ((open == '{' && c == '}') || (open == '[' && c == ']')) {
+          pos_++;
+          stack_.pop_back();
+          AfterValue();
+          JsonToken token;
+          token.type = open == '{' ? JsonTokenType::kEndObject : JsonTokenType::kEndArray;
+          return token;
+        }
+        Fail("Unexpected token");
+      }
+      case kExpectEnd:
+      default:
+        Fail("Unexpected non-whitespace character after JSON", false);
+    }
+  }
+}
+
+JsonToken JsonReader::ReadValue(char c) {
+  JsonToken token;
+  switch (c) {
+    case '{':
+      pos_++;
+      stack_.push_back('{');
+      state_ = kExpectFirstKey;
+      token.type = JsonTokenType::kBeginObject;
+      return token;
+    case '[':
+      pos_++;
+      stack_.push_back('[');
+      state_ = kExpectFirstValue;
+      token.type = JsonTokenType::kBeginArray;
+      return token;
+    case '"':
+      token.type = JsonTokenType::kString;
+      ReadString(token);
+      break;
+    case 't':
+      ReadLiteral("true", 4);
+      token.type = JsonTokenType::kTrue;
+      break;
+    case 'f':
+      ReadLiteral("false", 5);
+      token.type = JsonTokenType::kFalse;
+      break;
+    case 'n':
+      ReadLiteral("null", 4);
+      token.type = JsonTokenType::kNull;
+      break;
+    default:
+      if (c == '-' || IsDigit(c)) {
+        token.type = JsonTokenType::kNumber;
+        ReadNumber(token);
+        break;
+      }
+      Fail("Unexpected token");
+  }
+  AfterValue();
+  return token;
+}
+
+void JsonReader::ReadLiteral(const char *word, size_t len) {
+  size_t avail = len_ - pos_;
+  if (avail < len || std::memcmp(data_ + pos_, word, len) != 0) {
+    if (partial_ && avail < len && std::memcmp(data_ + pos_, word, avail) == 0) {
+      pos_ = len_;
+    }
+    Fail("Unexpected token");
+  }
+  pos_ += len;
+}
+
+void JsonReader::ReadNumber(JsonToken &token) {
+  size_t start = pos_;
+  bool negative = false;
+  if (data_[pos_] == '-') {
+    negative = true;
+    pos_++;
+  }
+  if (pos_ >= len_ || !IsDigit(data_[pos_])) Fail("No number after minus sign");
+
+  // Integers of up to 15 digits are exact in a double; accumulate them directly.
+  uint64_t mantissa = 0;
+  size_t digits = 0;
+  if (data_[pos_] == '0') {
+    pos_++;
+    digits = 1;
+  } else {
+    while (pos_ < len_ && IsDigit(data_[pos_])) {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(data_[pos_] - '0');
+      pos_++;
+      digits++;
+    }
+  }
+  bool integral = true;
+  if (pos_ < len_ && data_[pos_] == '.') {
+    integral = false;
+    pos_++;
+    if (pos_ >= len_ || !IsDigit(data_[pos_])) Fail("Unterminated fractional number");
+    while (pos_ < len_ && IsDigit(data_[pos_])) pos_++;
+  }
+  if (pos_ < len_ && (data_[pos_] == 'e' || data_[pos_] == 'E')) {
+    integral = false;
+    pos_++;
+    if (pos_ < len_ && (data_[pos_] == '+' || data_[pos_] == '-')) pos_++;
+    if (pos_ >= len_ || !IsDigit(data_[pos_])) Fail("Exponent part is missing a number");
+    while (pos_ < len_ && IsDigit(data_[pos_])) pos_++;
+  }
+  // More digits may follow in the next chunk.
+  if (partial_ && pos_ >= len_) Fail("Unterminated number");
+  if (skipping_) return;
+
+  if (integral && digits <= 15) {
+    double value = static_cast<double>(mantissa);
+    token.number = negative ? -value : value;
+    return;
+  }
+  // The span is validated JSON, which strtod parses identically; copy it so
+  // strtod cannot run past the token.
+  std::string text(data_ + start, pos_ - start);
+  token.number = std::strtod(text.c_str(), nullptr);
+}
+
+void JsonReader::ReadString(JsonToken &token) {
+  pos_++;  // opening quote
+  size_t start = pos_;
+  uint8_t high = 0;
+
+  // Fast path: no escapes, the token views the input directly.
+  while (pos_ < len_) {
+    unsigned char c = static_cast<unsigned char>(data_[pos_]);
+    if (c == '"') {
+      token.text = std::string_view(data_ + start, pos_ - start);
+      token.ascii = (high & 0x80) == 0;
+      token.wtf8 = false;
+      pos_++;
+      return;
+    }
+    if (c == '\\') break;
+    if (c < 0x20) Fail("Bad control character in string literal");
+    high |= c;
+    pos_++;
+  }
+  if (pos_ >= len_) Fail("Unterminated string");
+
+  std::string &out = scratch_;
+  out.assign(data_ + start, pos_ - start);
+  bool wtf8 = false;
+  while (true) {
+    if (pos_ >= len_) Fail("Unterminated string");
+    unsigned char c = static_cast<unsigned char>(data_[pos_]);
+    if (c == '"') {
+      pos_++;
+      break;
+    }
+    if (c < 0x20) Fail("Bad control character in string literal");
+    if (c != '\\') {
+      high |= c;
+      out.push_back(static_cast<char>(c));
+      pos_++;
+      continue;
+    }
+    pos_++;
+    if (pos_ >= len_) Fail("Unterminated string");
+    char esc = data_[pos_++];
+    switch (esc) {
+      case '"':
+        out.push_back('"');
+        break;
+      case '\\':
+        out.push_back('\\');
+        break;
+      case '/':
+        out.push_back('/');
+        break;
+      case 'b':
+        out.push_back('\b');
+        break;
+      case 'f':
+        out.push_back('\f');
+        break;
+      case 'n':
+        out.push_back('\n');
+        break;
+      case 'r':
+        out.push_back('\r');
+        break;
+      case 't':
+        out.push_back('\t');
+        break;
+      case 'u': {
+        auto readHex4 = [this]() -> uint32_t {
+          if (len_ - pos_ < 4) {
+            if (partial_) pos_ = len_;
+            Fail("Bad Unicode escape");
+          }
+          uint32_t value = 0;
+          for (int i = 0; i < 4; i++) {
+            int h = HexValue(data_[pos_ + i]);
+            if (h < 0) Fail("Bad Unicode escape");
+            value = (value << 4) | static_cast<uint32_t>(h);
+          }
+          pos_ += 4;
+          return value;
+        };
+        uint32_t cp = readHex4();
+        // The low half of a pair may be in the next chunk.
+        if (partial_ && cp >= 0xD800 && cp <= 0xDBFF && len_ - pos_ < 6) {
+          pos_ = len_;
+          Fail("Bad Unicode escape");
+        }
+        if (cp >= 0xD800 && cp <= 0xDBFF && len_ - pos_ >= 6 && data_[pos_] == '\\' &&
+            data_[pos_ + 1] == 'u') {
+          size_t save = pos_;
+          pos_ += 2;
+          uint32_t low = readHex4();
+          if (low >= 0xDC00 && low <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          } else {
+            pos_ = save;
+          }
+        }
+        if (cp >= 0xD800 && cp <= 0xDFFF) wtf8 = true;
+        if (cp >= 0x80) high |= 0x80;
+        AppendUtf8(out, cp);
+        break;
+      }
+      default:
+        pos_--;
+        Fail("Bad escaped character");
+    }
+  }
+  token.text = std::string_view(out.data(), out.size());
+  token.ascii = (high & 0x80) == 0;
+  token.wtf8 = wtf8;
+}
+
+void JsonReader::SkipValue() {
+  if (tape_ != nullptr) {
+    if (pos_ >= tape_->entries_.size()) Fail("Unexpected end of JSON input");
+    const JsonTape::Entry &entry = tape_->entries_[pos_];
+    bool container = entry.type == JsonTokenType::kBeginObject ||
+                     entry.type == JsonTokenType::kBeginArray;
+    pos_ = container ? entry.offset : pos_ + 1;
+    return;
+  }
+  skipping_ = true;
+  size_t depth = 0;
+  try {
+    do {
+      JsonToken token = Next();
+      switch (token.type) {
+        case JsonTokenType::kBeginObject:
+        case JsonTokenType::kBeginArray:
+          depth++;
+          break;
+        case JsonTokenType::kEndObject:
+        case JsonTokenType::kEndArray:
+          depth--;
+          break;
+        case JsonTokenType::kEnd:
+          Fail("Unexpected end of JSON input");
+        default:
+          break;
+      }
+    } while (depth > 0);
+  } catch (...) {
+    skipping_ = false;
+    throw;
+  }
+  skipping_ = false;
+}
+
+JsonToken JsonReader::NextFromTape() {
+  if (pos_ >= tape_->entries_.size()) return JsonToken{};
+  return tape_->Token(pos_++);
+}
+
+JsonToken JsonTape::Token(size_t index) const {
+  const Entry &entry = entries_[index];
+  JsonToken token;
+  token.type = entry.type;
+  token.ascii = entry.ascii;
+  token.wtf8 = entry.wtf8;
+  token.number = entry.number;
+  switch (entry.storage) {
+    case kInput:
+      token.text = std::string_view(source_ + entry.offset, entry.length);
+      break;
+    case kText:
+      token.text = std::string_view(text_.data() + entry.offset, entry.length);
+      break;
+    case kBytes:
+      token.decoded = std::string_view(bytes_.data() + entry.offset, entry.length);
+      token.text = token.decoded;
+      break;
+  }
+  return token;
+}
+
+void JsonTape::Build(const char *data, size_t len, bool decodeBinary) {
+  source_ = data;
+  sourceLen_ = len;
+  decodeBinary_ = decodeBinary;
+  entries_.clear();
+  open_.clear();
+  text_.clear();
+  bytes_.clear();
+  JsonReader in(data, len);
+  Record(in, true);
+}
+
+// Records tokens until the document ends or, when more input may follow, until
+// the next token is cut off. Returns the number of input bytes consumed.
+size_t JsonTape::Record(JsonReader &in, bool final) {
+  while (true) {
+    JsonReader::Mark mark = in.Save();
+    JsonToken token;
+    try {
+      token = in.Next();
+    } catch (const JsonIncomplete &) {
+      in.Restore(mark);
+      return mark.pos;
+    }
+    if (token.type == JsonTokenType::kEnd && !final) {
+      return in.Offset();
+    }
+
+    Entry entry{token.type, token.ascii, token.wtf8, kInput, 0, 0, token.number};
+    if (token.type == JsonTokenType::kKey || token.type == JsonTokenType::kString) {
+      const char *text = token.text.data();
+      if (source_ != nullptr && text >= source_ && text < source_ + sourceLen_) {
+        entry.offset = static_cast<size_t>(text - source_);
+      } else {
+        entry.storage = kText;
+        entry.offset = text_.size();
+        text_.append(token.text);
+      }
+      entry.length = token.text.size();
+    }
+    entries_.push_back(entry);
+
+    switch (token.type) {
+      case JsonTokenType::kEnd:
+        return in.Offset();
+      case JsonTokenType::kBeginObject:
+      case JsonTokenType::kBeginArray:
+        open_.push_back({entries_.size() - 1, false});
+        break;
+      case JsonTokenType::kEndObject:
+      case JsonTokenType::kEndArray: {
+        OpenContainer frame = open_.back();
+        open_.pop_back();
+        entries_[frame.index].offset = entries_.size();
+        if (frame.binary && decodeBinary_) DecodeBinaryMembers(frame.index);
+        break;
+      }
+      case JsonTokenType::kString:
+        if (entries_.size() >= 2 && !open_.empty() &&
+            IsBinaryWrapperType(WrapperTypeFromName(token.text))) {
+          JsonToken key = Token(entries_.size() - 2);
+          if (key.type == JsonTokenType::kKey && key.text == kTypeKey) {
+            open_.back().binary = true;
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void JsonTapeWriter::Write(const char *data, size_t len) {
+  pending_.append(data, len);
+  if (pending_.size() >= retryAt_) Drain(false);
+}
+
+void JsonTapeWriter::End() { Drain(true); }
+
+void JsonTapeWriter::Drain(bool final) {
+  reader_.Rebase(pending_.data(), pending_.size(), consumed_, !final);
+  size_t used = tape_.Record(reader_, final);
+  pending_.erase(0, used);
+  consumed_ += used;
+  retryAt_ = pending_.size() * 2;
+}
+
+// Decodes the base64 `value` members of the binary wrapper starting at
+// `begin`. Invalid payloads are left as text for the decoder to reject.
+void JsonTape::DecodeBinaryMembers(size_t begin) {
+  size_t end = entries_[begin].offset - 1;
+  size_t i = begin + 1;
+  while (i < end) {
+    JsonToken key = Token(i);
+    Entry &value = entries_[i + 1];
+    if (key.text == kValueKey && value.type == JsonTokenType::kString) {
+      JsonToken payload = Token(i + 1);
+      size_t size = Base64DecodedLength(payload.text.data(), payload.text.size());
+      size_t offset = bytes_.size();
+      bytes_.resize(offset + size);
+      if (Base64Decode(payload.text.data(), payload.text.size(),
+                       reinterpret_cast<uint8_t *>(&bytes_[offset]))) {
+        // Drop the copied base64 text when nothing was stored after it.
+        if (value.storage == kText && value.offset + value.length == text_.size()) {
+          text_.resize(value.offset);
+        }
+        value.storage = kBytes;
+        value.offset = offset;
+        value.length = size;
+      } else {
+        bytes_.resize(offset);
+      }
+    }
+    bool container = value.type == JsonTokenType::kBeginObject ||
+                     value.type == JsonTokenType::kBeginArray;
+    i = container ? value.offset : i + 2;
+  }
+}
+
+std::u16string Wtf8ToUtf16(std::string_view text) {
+  std::u16string out;
+  out.reserve(text.size());
+  size_t i = 0;
+  while (i < text.size()) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    uint32_t cp;
+    if (c < 0x80) {
+      cp = c;
+      i += 1;
+    } else if (c < 0xE0) {
+      cp = ((c & 0x1Fu) << 6) | (static_cast<unsigned char>(text[i + 1]) & 0x3Fu);
+      i += 2;
+    } else if (c < 0xF0) {
+      cp = ((c & 0x0Fu) << 12) |
+           ((static_cast<unsigned char>(text[i + 1]) & 0x3Fu) << 6) |
+           (static_cast<unsigned char>(text[i + 2]) & 0x3Fu);
+      i += 3;
+    } else {
+      cp = ((c & 0x07u) << 18) |
+           ((static_cast<unsigned char>(text[i + 1]) & 0x3Fu) << 12) |
+           ((static_cast<unsigned char>(text[i + 2]) & 0x3Fu) << 6) |
+           (static_cast<unsigned char>(text[i + 3]) & 0x3Fu);
+      i += 4;
+    }
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      out.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+      out.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+    } else {
+      out.push_back(static_cast<char16_t>(cp));
+    }
+  }
+  return out;
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,205 @@
+#ifndef BAS_UTILS_SERIALIZATION_JSON_READER_H
+#define BAS_UTILS_SERIALIZATION_JSON_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bas_serde {
+
+enum class JsonTokenType : uint8_t {
+  kEnd,
+  kBeginObject,
+  kEndObject,
+  kBeginArray,
+  kEndArray,
+  kKey,
+  kString,
+  kNumber,
+  kTrue,
+  kFalse,
+  kNull,
+};
+
+struct JsonToken {
+  JsonTokenType type = JsonTokenType::kEnd;
+  // kKey/kString: unescaped UTF-8, valid until the next call to Next().
+  std::string_view text;
+  // Text is pure ASCII (can be created as latin1).
+  bool ascii = true;
+  // Text contains escaped lone surrogates encoded as WTF-8.
+  bool wtf8 = false;
+  double number = 0;
+  // kString read from a JsonTape: the base64 payload of a binary wrapper,
+  // already decoded. Null data otherwise.
+  std::string_view decoded;
+};
+
+// Thrown for malformed input; carries the byte offset of the failure.
+class JsonSyntaxError : public std::runtime_error {
+ public:
+  JsonSyntaxError(const std::string &message, size_t offset)
+      : std::runtime_error(message), offset(offset) {}
+  size_t offset;
+};
+
+// Thrown by a reader in partial mode when the input ends inside a token.
+class JsonIncomplete : public std::exception {};
+
+class JsonTape;
+
+// Pull tokenizer over a complete UTF-8 JSON document. Validates the grammar
+// (separators, nesting, trailing data) so consumers only see value tokens.
+class JsonReader {
+ public:
+  JsonReader(const char *data, size_t len) : data_(data), len_(len) {}
+  JsonReader() : data_(nullptr), len_(0) {}
+  // Replays a recorded tape, from entry `index` on; skipping a container is a
+  // single jump.
+  explicit JsonReader(const JsonTape &tape, size_t index = 0)
+      : data_(nullptr), len_(0), pos_(index), tape_(&tape) {}
+
+  JsonToken Next();
+  // Skips the value starting at the next token without decoding strings.
+  void SkipValue();
+
+  // Position snapshot for re-reading a span. Restore is valid while every
+  // container open at Save() time, except possibly the innermost, is still open.
+  struct Mark {
+    size_t pos;
+    size_t depth;
+    char top;
+    uint8_t state;
+  };
+  Mark Save() const {
+    return {pos_, stack_.size(), stack_.empty() ? '\0' : stack_.back(), state_};
+  }
+  void Restore(const Mark &mark);
+
+  size_t Offset() const { return pos_; }
+
+  // Continues on a new buffer that starts `base` bytes into the document,
+  // keeping the nesting state. In partial mode more input may follow, so
+  // running out inside a token throws JsonIncomplete instead of failing.
+  void Rebase(const char *data, size_t len, size_t base, bool partial) {
+    data_ = data;
+    len_ = len;
+    pos_ = 0;
+    base_ = base;
+    partial_ = partial;
+  }
+
+ private:
+  JsonToken NextFromTape();
+
+  enum State : uint8_t {
+    kExpectValue,
+    kExpectFirstValue,
+    kExpectFirstKey,
+    kExpectKey,
+    kExpectSeparator,
+    kExpectEnd,
+  };
+
+  JsonToken ReadValue(char c);
+  void ReadString(JsonToken &token);
+  void ReadNumber(JsonToken &token);
+  void ReadLiteral(const char *word, size_t len);
+  void AfterValue();
+  void SkipWhitespace();
+  // Throws "<what> in JSON at position N", as JSON.parse words it; without
+  // `inJson` for messages that already say where.
+  [[noreturn]] void Fail(const char *what, bool inJson = true) const;
+
+  const char *data_;
+  size_t len_;
+  size_t pos_ = 0;
+  size_t base_ = 0;
+  uint8_t state_ = kExpectValue;
+  bool skipping_ = false;
+  bool partial_ = false;
+  std::vector<char> stack_;
+  std::string scratch_;
+  // Tape mode: pos_ indexes tape entries instead of input bytes.
+  const JsonTape *tape_ = nullptr;
+};
+
+// The tokens of a whole document, recorded ahead of decoding so the byte-level
+// work (validation, unescaping, number conversion, base64 of binary wrappers)
+// can run without JS access, e.g. on a worker thread. Unescaped strings view
+// the input given to Build, which must outlive the tape.
+class JsonTape {
+ public:
+  // Tokenizes the document; throws JsonSyntaxError. Without `decodeBinary`
+  // binary payloads stay base64 text, decoded when their value is.
+  void Build(const char *data, size_t len, bool decodeBinary = true);
+
+ private:
+  friend class JsonReader;
+  friend class JsonTapeWriter;
+
+  enum Storage : uint8_t { kInput, kText, kBytes };
+  struct Entry {
+    JsonTokenType type;
+    bool ascii;
+    bool wtf8;
+    Storage storage;
+    // Strings: span in the input, text_ or bytes_. Begin tokens: offset is
+    // the index just past the matching end token.
+    size_t offset;
+    size_t length;
+    double number;
+  };
+  // An open container, and whether it is an object with a binary $$type.
+  struct OpenContainer {
+    size_t index;
+    bool binary;
+  };
+
+  size_t Record(JsonReader &in, bool final);
+  void DecodeBinaryMembers(size_t begin);
+  JsonToken Token(size_t index) const;
+
+  const char *source_ = nullptr;
+  size_t sourceLen_ = 0;
+  std::vector<Entry> entries_;
+  std::vector<OpenContainer> open_;
+  bool decodeBinary_ = true;
+  std::string text_;
+  std::string bytes_;
+};
+
+// Builds a JsonTape from a document that arrives in chunks. Strings are copied
+// into the tape, so chunks can be dropped once written. A token cut off at the
+// end of a chunk (a split UTF-8 sequence, escape or base64 payload included)
+// is kept back and read again once more input has arrived.
+class JsonTapeWriter {
+ public:
+  explicit JsonTapeWriter(JsonTape &tape) : tape_(tape) {}
+
+  // Both throw JsonSyntaxError with offsets into the whole document.
+  void Write(const char *data, size_t len);
+  void End();
+
+ private:
+  void Drain(bool final);
+
+  JsonTape &tape_;
+  JsonReader reader_;
+  // Input not yet recorded, starting `consumed_` bytes into the document.
+  std::string pending_;
+  size_t consumed_ = 0;
+  // A cut-off token is read again once pending_ has grown to this size, so a
+  // token spanning many chunks is rescanned O(log n) times rather than per chunk.
+  size_t retryAt_ = 0;
+};
+
+// Converts WTF-8 (UTF-8 that may encode lone surrogates) to UTF-16.
+std::u16string Wtf8ToUtf16(std::string_view text);
+
+}  // namespace bas_serde
+
+#endif
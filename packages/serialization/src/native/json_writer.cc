@@ -0,0 +1,219 @@
+#include "json_writer.h"
+
+#include <charconv>
+#include <cmath>
+
+#include "base64.h"
+
+namespace bas_serde {
+
+constexpr const char kHexDigits[] = "0123456789abcdef";
+
+// Short escapes JSON.stringify uses for control characters (0 = \u00XX form).
+constexpr const char kControlEscapes[0x20] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 'b', 't', 'n', 0, 'f', 'r', 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0,   0,   0,   0, 0,   0,   0, 0,
+};
+
+void JsonWriter::Key(const char *key) {
+  buf_.push_back('"');
+  buf_.append(key);
+  buf_.append("\":", 2);
+}
+
+void JsonWriter::Field(const char *key) {
+  buf_.append(",\"", 2);
+  buf_.append(key);
+  buf_.append("\":", 2);
+}
+
+void JsonWriter::AsciiString(const char *data, size_t len) {
+  buf_.push_back('"');
+  buf_.append(data, len);
+  buf_.push_back('"');
+}
+
+void JsonWriter::String(const char16_t *data, size_t len) {
+  if (deferred_) {
+    items_.push_back({buf_.size(), ItemKind::kString, strings_.size(), len, 0});
+    strings_.append(data, len);
+    return;
+  }
+  // Worst case is 6 output bytes per code unit (\uXXXX) plus quotes.
+  size_t start = buf_.size();
+  buf_.resize(start + len * 6 + 2);
+  char *out = &buf_[start];
+  char *p = out;
+  *p++ = '"';
+  for (size_t i = 0; i < len; i++) {
+    char16_t c = data[i];
+    if (c < 0x80) {
+      if (c >= 0x20 && c != '"' && c != '\\') {
+        *p++ = static_cast<char>(c);
+      } else if (c >= 0x20) {
+        *p++ = '\\';
+        *p++ = static_cast<char>(c);
+      } else if (kControlEscapes[c] != 0) {
+        *p++ = '\\';
+        *p++ = kControlEscapes[c];
+      } else {
+        *p++ = '\\';
+        *p++ = 'u';
+        *p++ = '0';
+        *p++ = '0';
+        *p++ = kHexDigits[c >> 4];
+        *p++ = kHexDigits[c & 0xF];
+      }
+    } else if (c < 0x800) {
+      *p++ = static_cast<char>(0xC0 | (c >> 6));
+      *p++ = static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+      if (c <= 0xDBFF && i + 1 < len && data[i + 1] >= 0xDC00 &&
+          data[i + 1] <= 0xDFFF) {
+        uint32_t cp = 0x10000 + ((static_cast<uint32_t>(c) - 0xD800) << 10) +
+                      (static_cast<uint32_t>(data[i + 1]) - 0xDC00);
+        *p++ = static_cast<char>(0xF0 | (cp >> 18));
+        *p++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        *p++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        *p++ = static_cast<char>(0x80 | (cp & 0x3F));
+        i++;
+      } else {
+        // Lone surrogate: escape it like JSON.stringify does.
+        *p++ = '\\';
+        *p++ = 'u';
+        *p++ = kHexDigits[(c >> 12) & 0xF];
+        *p++ = kHexDigits[(c >> 8) & 0xF];
+        *p++ = kHexDigits[(c >> 4) & 0xF];
+        *p++ = kHexDigits[c & 0xF];
+      }
+    } else {
+      *p++ = static_cast<char>(0xE0 | (c >> 12));
+      *p++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      *p++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+  }
+  *p++ = '"';
+  buf_.resize(start + static_cast<size_t>(p - out));
+}
+
+// Formats like Number.prototype.toString(): shortest round-trip digits, plain
+// notation for exponents in [-7, 21), exponential notation otherwise.
+void JsonWriter::Number(double value) {
+  if (deferred_) {
+    items_.push_back({buf_.size(), ItemKind::kNumber, 0, 0, value});
+    return;
+  }
+  if (!std::isfinite(value)) {
+    Literal("null");
+    return;
+  }
+  if (value == 0) {
+    buf_.push_back('0');
+    return;
+  }
+
+  char sci[32];
+  std::to_chars_result res =
+      std::to_chars(sci, sci + sizeof(sci), value, std::chars_format::scientific);
+  const char *p = sci;
+  const char *end = res.ptr;
+
+  bool negative = false;
+  if (*p == '-') {
+    negative = true;
+    p++;
+  }
+  char digits[20];
+  int k = 0;
+  while (p < end && *p != 'e') {
+    if (*p != '.') digits[k++] = *p;
+    p++;
+  }
+  int exponent = 0;
+  std::from_chars(p + (p[1] == '+' ? 2 : 1), end, exponent);
+  int n = exponent + 1;
+
+  char text[40];
+  char *q = text;
+  if (negative) *q++ = '-';
+  if (k <= n && n <= 21) {
+    std::memcpy(q, digits, k);
+    q += k;
+    for (int i = k; i < n; i++) *q++ = '0';
+  } else if (0 < n && n <= 21) {
+    std::memcpy(q, digits, n);
+    q += n;
+    *q++ = '.';
+    std::memcpy(q, digits + n, k - n);
+    q += k - n;
+  } else if (-6 < n && n <= 0) {
+    *q++ = '0';
+    *q++ = '.';
+    for (int i = 0; i < -n; i++) *q++ = '0';
+    std::memcpy(q, digits, k);
+    q += k;
+  } else {
+    *q++ = digits[0];
+    if (k > 1) {
+      *q++ = '.';
+      std::memcpy(q, digits + 1, k - 1);
+      q += k - 1;
+    }
+    *q++ = 'e';
+    *q++ = n - 1 < 0 ? '-' : '+';
+    q = std::to_chars(q, text + sizeof(text), std::abs(n - 1)).ptr;
+  }
+  buf_.append(text, static_cast<size_t>(q - text));
+}
+
+void JsonWriter::Uint(uint32_t value) {
+  char text[12];
+  char *end = std::to_chars(text, text + sizeof(text), value).ptr;
+  buf_.append(text, static_cast<size_t>(end - text));
+}
+
+void JsonWriter::Base64String(const uint8_t *data, size_t len) {
+  if (deferred_) {
+    items_.push_back({buf_.size(), ItemKind::kBase64, bytes_.size(), len, 0});
+    bytes_.append(reinterpret_cast<const char *>(data), len);
+    return;
+  }
+  size_t start = buf_.size();
+  size_t encodedLen = Base64EncodedLength(len);
+  buf_.resize(start + encodedLen + 2);
+  buf_[start] = '"';
+  Base64Encode(data, len, &buf_[start + 1]);
+  buf_[start + encodedLen + 1] = '"';
+}
+
+void JsonWriter::Render() {
+  if (!deferred_) return;
+  deferred_ = false;
+  std::string structure;
+  structure.swap(buf_);
+  buf_.reserve(structure.size() + strings_.size() + Base64EncodedLength(bytes_.size()) +
+               items_.size() * 8);
+  size_t last = 0;
+  for (const DeferredItem &item : items_) {
+    buf_.append(structure, last, item.at - last);
+    last = item.at;
+    switch (item.kind) {
+      case ItemKind::kString:
+        String(strings_.data() + item.offset, item.length);
+        break;
+      case ItemKind::kNumber:
+        Number(item.number);
+        break;
+      case ItemKind::kBase64:
+        Base64String(reinterpret_cast<const uint8_t *>(bytes_.data()) + item.offset,
+                     item.length);
+        break;
+    }
+  }
+  buf_.append(structure, last, std::string::npos);
+  items_ = std::vector<DeferredItem>();
+  strings_ = std::u16string();
+  bytes_ = std::string();
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,73 @@
+#ifndef BAS_UTILS_SERIALIZATION_JSON_WRITER_H
+#define BAS_UTILS_SERIALIZATION_JSON_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bas_serde {
+
+// Growable UTF-8 output buffer producing the same bytes JSON.stringify would.
+class JsonWriter {
+ public:
+  void Raw(char c) { buf_.push_back(c); }
+  void Raw(const char *data, size_t len) { buf_.append(data, len); }
+  template <size_t N>
+  void Literal(const char (&text)[N]) {
+    buf_.append(text, N - 1);
+  }
+
+  // Writes `"key":` for keys known to need no escaping.
+  void Key(const char *key);
+  // Writes `,"key":` for fields that always follow another field.
+  void Field(const char *key);
+
+  // Writes a quoted string known to need no escaping (type names, base64).
+  void AsciiString(const char *data, size_t len);
+  void AsciiString(const char *data) { AsciiString(data, std::strlen(data)); }
+
+  // Writes a quoted, escaped string from UTF-16 code units. Lone surrogates are
+  // written as \uXXXX escapes, matching well-formed JSON.stringify.
+  void String(const char16_t *data, size_t len);
+
+  // Writes a finite number using the ECMAScript Number::toString format.
+  void Number(double value);
+  void Uint(uint32_t value);
+
+  // Writes `data` as a quoted base64 string.
+  void Base64String(const uint8_t *data, size_t len);
+
+  // Deferred mode copies strings, numbers and binary payloads aside instead of
+  // formatting them. Render() then formats them in place without touching JS,
+  // so it can run on a worker thread.
+  void Defer() { deferred_ = true; }
+  void Render();
+
+  const char *Data() const { return buf_.data(); }
+  size_t Size() const { return buf_.size(); }
+  void Clear() { buf_.clear(); }
+  // Drops the first `len` bytes once they have been handed out.
+  void Discard(size_t len) { buf_.erase(0, len); }
+
+ private:
+  enum class ItemKind : uint8_t { kString, kNumber, kBase64 };
+  struct DeferredItem {
+    size_t at;  // position in buf_ the formatted item belongs at
+    ItemKind kind;
+    size_t offset;
+    size_t length;
+    double number;
+  };
+
+  std::string buf_;
+  bool deferred_ = false;
+  std::vector<DeferredItem> items_;
+  std::u16string strings_;
+  std::string bytes_;
+};
+
+}  // namespace bas_serde
+
+#endif
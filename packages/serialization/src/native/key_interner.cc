@@ -0,0 +1,55 @@
+#include "key_interner.h"
+
+#include <cstring>
+
+namespace bas_serde {
+
+static uint32_t HashBytes(std::string_view bytes) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (char c : bytes) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  return hash | 1;  // 0 marks a free entry
+}
+
+napi_value *KeyInterner::Slot(std::string_view bytes) {
+  if (bytes.size() > kMaxKeyLength) return nullptr;
+  if (entries_.empty()) entries_.resize(64);
+  uint32_t hash = HashBytes(bytes);
+  size_t mask = entries_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    Entry &entry = entries_[i];
+    if (entry.hash == 0) break;
+    if (entry.hash == hash && entry.length == bytes.size() &&
+        std::memcmp(bytes_.data() + entry.offset, bytes.data(), bytes.size()) == 0) {
+      return &entry.value;
+    }
+  }
+  if (size_ == kMaxEntries) return nullptr;
+  // Kept at most half full, so probe sequences stay short.
+  if ((size_ + 1) * 2 > entries_.size()) Grow();
+  mask = entries_.size() - 1;
+  size_t i = hash & mask;
+  while (entries_[i].hash != 0) i = (i + 1) & mask;
+  Entry &entry = entries_[i];
+  entry.hash = hash;
+  entry.offset = static_cast<uint32_t>(bytes_.size());
+  entry.length = static_cast<uint32_t>(bytes.size());
+  bytes_.append(bytes.data(), bytes.size());
+  size_++;
+  return &entry.value;
+}
+
+void KeyInterner::Grow() {
+  std::vector<Entry> old(entries_.size() * 2);
+  old.swap(entries_);
+  size_t mask = entries_.size() - 1;
+  for (const Entry &entry : old) {
+    if (entry.hash == 0) continue;
+    size_t i = entry.hash & mask;
+    while (entries_[i].hash != 0) i = (i + 1) & mask;
+    entries_[i] = entry;
+  }
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,46 @@
+#ifndef BAS_UTILS_SERIALIZATION_KEY_INTERNER_H
+#define BAS_UTILS_SERIALIZATION_KEY_INTERNER_H
+
+#include <napi.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bas_serde {
+
+// Maps the bytes of property keys to the JS strings created for them during one
+// native call, so a key repeated across many objects is created once and
+// V8 looks it up as the same (internalized) string every time. Handles are only
+// valid in the call's handle scope; the table must not outlive it. Long keys
+// and keys past kMaxEntries are not cached, which bounds the memory used for
+// objects with many distinct keys.
+class KeyInterner {
+ public:
+  static constexpr size_t kMaxKeyLength = 64;
+  static constexpr size_t kMaxEntries = 4096;
+
+  // Returns the slot for `bytes`, adding an empty one (nullptr) when the key is
+  // new, or nullptr when the key is not cached. Callers create the string on
+  // an empty slot and store it there.
+  napi_value *Slot(std::string_view bytes);
+
+ private:
+  struct Entry {
+    uint32_t hash = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    napi_value value = nullptr;
+  };
+
+  void Grow();
+
+  std::vector<Entry> entries_;
+  size_t size_ = 0;
+  std::string bytes_;
+};
+
+}  // namespace bas_serde
+
+#endif
@@ -0,0 +1,372 @@
+#include "lazy.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace bas_serde {
+
+// A member whose value is decoded on first read.
+struct LazySlot {
+  LazyObject *owner;
+  size_t value;  // tape entry the value starts at
+  size_t end;    // tape entry just past it
+  bool done;
+};
+
+// The members of an object still decoded on demand. Freed with the object.
+struct LazyObject {
+  std::shared_ptr<LazyDocument> doc;
+  size_t index;
+  Napi::Reference<Napi::Object> self;  // weak
+  std::vector<LazySlot> slots;         // in tape order
+
+  // The slot whose value contains tape entry `at`, if any.
+  LazySlot *SlotAt(size_t at) {
+    auto it = std::upper_bound(slots.begin(), slots.end(), at,
+                               [](size_t i, const LazySlot &slot) { return i < slot.value; });
+    if (it == slots.begin()) return nullptr;
+    --it;
+    return at < it->end ? &*it : nullptr;
+  }
+};
+
+constexpr napi_property_attributes kDataAttributes =
+    static_cast<napi_property_attributes>(napi_writable | napi_enumerable | napi_configurable);
+constexpr napi_property_attributes kAccessorAttributes =
+    static_cast<napi_property_attributes>(napi_enumerable | napi_configurable);
+
+// Marks a tape span as being decoded for as long as it is in scope.
+class DecodingSpan {
+ public:
+  DecodingSpan(std::vector<std::pair<size_t, size_t>> &spans, size_t begin, size_t end)
+      : spans_(spans) {
+    spans_.emplace_back(begin, end);
+  }
+  ~DecodingSpan() { spans_.pop_back(); }
+  DecodingSpan(const DecodingSpan &) = delete;
+  DecodingSpan &operator=(const DecodingSpan &) = delete;
+
+ private:
+  std::vector<std::pair<size_t, size_t>> &spans_;
+};
+
+// Sets aside the wrappers a caller is decoding before their $$id while an
+// unrelated part of the document is decoded, so the ids stored meanwhile are
+// not taken as provisional.
+class SetAsidePending {
+ public:
+  explicit SetAsidePending(DecodeContext &ctx)
+      : ctx_(ctx), pendingIds_(ctx.pendingIds), depth_(ctx.depth) {
+    provisional_.swap(ctx.provisional);
+    ctx.pendingIds = 0;
+    ctx.depth = 0;
+  }
+  ~SetAsidePending() {
+    provisional_.swap(ctx_.provisional);
+    ctx_.pendingIds = pendingIds_;
+    ctx_.depth = depth_;
+  }
+  SetAsidePending(const SetAsidePending &) = delete;
+  SetAsidePending &operator=(const SetAsidePending &) = delete;
+
+ private:
+  DecodeContext &ctx_;
+  uint32_t pendingIds_;
+  size_t depth_;
+  std::vector<uint32_t> provisional_;
+};
+
+static size_t ValueEnd(const JsonTape &tape, size_t index) {
+  JsonReader in(tape, index);
+  in.SkipValue();
+  return in.Offset();
+}
+
+Napi::Value LazyDocument::Parse(const Napi::Env &env, std::string text, DecodeContext &ctx) {
+  auto doc = std::make_shared<LazyDocument>();
+  doc->text_ = std::move(text);
+  try {
+    StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+    doc->tape_.Build(doc->text_.data(), doc->text_.size(), false);
+  } catch (const JsonSyntaxError &err) {
+    Napi::Function ctor = env.Global().Get("SyntaxError").As<Napi::Function>();
+    throw Napi::Error(env, ctor.New({Napi::String::New(env, err.what())}));
+  }
+  ctx.lazy = doc.get();
+  Napi::Value result;
+  try {
+    DecodingSpan span(doc->decoding_, 0, ValueEnd(doc->tape_, 0));
+    result = doc->DecodeObject(env, ctx, 0);
+    if (result.IsEmpty()) result = ParseTape(env, doc->tape_, ctx.data.ctors, Reviver(), ctx);
+  } catch (...) {
+    doc->Keep(ctx);
+    throw;
+  }
+  doc->Keep(ctx);
+  return result;
+}
+
+void LazyDocument::Resolve(const Napi::Env &env, DecodeContext &ctx, uint32_t id) {
+  if (ctx.refs.find(id) != ctx.refs.end()) return;
+  auto known = refs_.find(id);
+  if (known != refs_.end()) {
+    Napi::Value value = known->second.Value();
+    if (!value.IsEmpty()) {
+      ctx.refs[id] = Napi::Persistent(value);
+      return;
+    }
+  }
+  if (!indexed_) IndexIds();
+  auto def = ids_.find(id);
+  if (def == ids_.end()) return;
+  size_t index = def->second;
+  for (const auto &[begin, end] : decoding_) {
+    if (index >= begin && index < end) return;
+  }
+  SetAsidePending pending(ctx);
+  // Read the members on the way from the root, as user code would.
+  size_t at = 0;
+  while (true) {
+    auto it = objects_.find(at);
+    if (it == objects_.end()) break;
+    LazySlot *slot = it->second->SlotAt(index);
+    if (slot == nullptr) break;
+    if (!slot->done) Materialize(env, ctx, *slot);
+    if (ctx.refs.find(id) != ctx.refs.end()) return;
+    at = slot->value;
+  }
+  // The way there was replaced, or its objects were collected: nothing can
+  // hold the value any more, so decode it on its own.
+  Decode(env, ctx, index, ValueEnd(tape_, index));
+}
+
+Napi::Value LazyDocument::Decode(const Napi::Env &env, DecodeContext &ctx, size_t index,
+                                 size_t end) {
+  DecodingSpan span(decoding_, index, end);
+  Napi::Value value = DecodeObject(env, ctx, index);
+  return value.IsEmpty() ? ParseTapeValue(env, tape_, index, ctx.data.ctors, ctx) : value;
+}
+
+Napi::Value LazyDocument::DecodeObject(const Napi::Env &env, DecodeContext &ctx,
+                                       size_t index) {
+  JsonReader in(tape_, index);
+  if (in.Next().type != JsonTokenType::kBeginObject) return Napi::Value();
+  // Members are read in any order, as the text decoder reads a wrapper's.
+  WrapperType type = WrapperType::kNone;
+  bool hasId = false;
+  uint32_t id = 0;
+  size_t payload = SIZE_MAX;
+  while (true) {
+    JsonToken key = in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    size_t at = in.Offset();
+    JsonToken value = JsonReader(tape_, at).Next();
+    if (key.text == kTypeKey && type == WrapperType::kNone &&
+        value.type == JsonTokenType::kString) {
+      type = WrapperTypeFromName(value.text);
+      // A DedupedStrings header is decoded whole, by ParseTape; elsewhere the
+      // name is not a wrapper.
+      if (type == WrapperType::kDedupedStrings && index != 0) type = WrapperType::kNone;
+    } else if (key.text == kIdKey && value.type == JsonTokenType::kNumber) {
+      id = TokenUint32(value.number);
+      hasId = true;
+    } else if (key.text == kValueKey && payload == SIZE_MAX) {
+      payload = at;
+    }
+    in.SkipValue();
+  }
+  if (type == WrapperType::kNone) return CreateObject(env, ctx, index, index, false, 0);
+  if (type == WrapperType::kObject && payload != SIZE_MAX &&
+      JsonReader(tape_, payload).Next().type == JsonTokenType::kBeginObject) {
+    return CreateObject(env, ctx, index, payload, hasId, id);
+  }
+  return Napi::Value();
+}
+
+// Creates the object whose members start at tape entry `members`, with an
+// accessor for each member holding a container.
+Napi::Object LazyDocument::CreateObject(const Napi::Env &env, DecodeContext &ctx,
+                                        size_t index, size_t members, bool hasId,
+                                        uint32_t id) {
+  Napi::Object out = Napi::Object::New(env);
+  if (hasId) StoreRef(ctx, id, out);
+  SERDE_STAT(ctx.stats, Node(static_cast<size_t>(ValueKind::kPlainObject)));
+
+  struct Member {
+    napi_value name;
+    napi_value scalar;  // null for a container
+    size_t value;
+    size_t end;
+  };
+  std::vector<Member> found;
+  size_t containers = 0;
+  JsonReader in(tape_, members + 1);
+  while (true) {
+    JsonToken key = in.Next();
+    if (key.type != JsonTokenType::kKey) break;
+    Member member{MakePropertyKey(env, ctx, key), nullptr, in.Offset(), 0};
+    in.SkipValue();
+    member.end = in.Offset();
+    if (member.end - member.value == 1) {
+      member.scalar = ParseTapeValue(env, tape_, member.value, ctx.data.ctors, ctx);
+    } else {
+      containers++;
+    }
+    found.push_back(member);
+  }
+
+  std::unique_ptr<LazyObject> object;
+  if (containers > 0) {
+    object.reset(new LazyObject{shared_from_this(), index, {}, {}});
+    // Accessors point into `slots`, which must not reallocate.
+    object->slots.reserve(containers);
+  }
+  std::vector<Napi::PropertyDescriptor> props;
+  props.reserve(found.size());
+  for (const Member &member : found) {
+    Napi::Name name(env, member.name);
+    if (member.scalar != nullptr) {
+      props.push_back(Napi::PropertyDescriptor::Value(name, member.scalar, kDataAttributes));
+      continue;
+    }
+    object->slots.push_back({object.get(), member.value, member.end, false});
+    props.push_back(Napi::PropertyDescriptor::Accessor<ReadMember, WriteMember>(
+        name, kAccessorAttributes, &object->slots.back()));
+  }
+  out.DefineProperties(props);
+  if (object != nullptr) {
+    object->self = Napi::Weak(out);
+    napi_status status =
+        napi_add_finalizer(env, out, object.get(), DeleteObject, nullptr, nullptr);
+    if (status != napi_ok) throw Napi::Error::New(env);
+    objects_[index] = object.release();
+  }
+  return out;
+}
+
+// Decodes a slot's value and replaces its accessor with a data property.
+Napi::Value LazyDocument::Materialize(const Napi::Env &env, DecodeContext &ctx,
+                                      LazySlot &slot) {
+  Napi::Value value = Decode(env, ctx, slot.value, slot.end);
+  slot.done = true;
+  Napi::Object self = slot.owner->self.Value();
+  if (!self.IsEmpty()) {
+    self.DefineProperty(Napi::PropertyDescriptor::Value(
+        Napi::Name(env, MemberName(env, ctx, slot)), value, kDataAttributes));
+  }
+  return value;
+}
+
+Napi::Value LazyDocument::MemberName(const Napi::Env &env, DecodeContext &ctx,
+                                     const LazySlot &slot) {
+  JsonReader in(tape_, slot.value - 1);
+  return MakePropertyKey(env, ctx, in.Next());
+}
+
+void LazyDocument::IndexIds() {
+  indexed_ = true;
+  struct Open {
+    size_t index;
+    bool wrapper;
+    bool hasId;
+    uint32_t id;
+  };
+  std::vector<Open> open;
+  JsonReader in(tape_);
+  // The member whose value comes next: 1 for $$type, 2 for $$id.
+  int pending = 0;
+  while (true) {
+    size_t at = in.Offset();
+    JsonToken token = in.Next();
+    int member = pending;
+    pending = 0;
+    switch (token.type) {
+      case JsonTokenType::kEnd:
+        return;
+      case JsonTokenType::kBeginObject:
+      case JsonTokenType::kBeginArray:
+        open.push_back({at, false, false, 0});
+        break;
+      case JsonTokenType::kEndObject:
+      case JsonTokenType::kEndArray:
+        if (open.back().wrapper && open.back().hasId) {
+          ids_.emplace(open.back().id, open.back().index);
+        }
+        open.pop_back();
+        break;
+      case JsonTokenType::kKey:
+        pending = token.text == kTypeKey ? 1 : token.text == kIdKey ? 2 : 0;
+        break;
+      case JsonTokenType::kString:
+        if (member == 1 && !open.back().wrapper) {
+          WrapperType type = WrapperTypeFromName(token.text);
+          open.back().wrapper = type != WrapperType::kNone && type != WrapperType::kReference &&
+                                type != WrapperType::kDedupedStrings;
+        }
+        break;
+      case JsonTokenType::kNumber:
+        if (member == 2) {
+          open.back().hasId = true;
+          open.back().id = TokenUint32(token.number);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void LazyDocument::Keep(DecodeContext &ctx) {
+  for (auto &[id, ref] : ctx.refs) refs_[id] = Napi::Weak(ref.Value());
+  ctx.refs.clear();
+}
+
+Napi::Value LazyDocument::ReadMember(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  LazySlot &slot = *static_cast<LazySlot *>(info.Data());
+  std::shared_ptr<LazyDocument> doc = slot.owner->doc;
+  DecodeContext ctx(GetMutableAddonData(env));
+  ctx.stats.Discard();
+  if (slot.done) {
+    // Only an accessor taken off its object with getOwnPropertyDescriptor
+    // is read after its value was stored.
+    Napi::Object self = slot.owner->self.Value();
+    return self.IsEmpty() ? env.Undefined() : self.Get(doc->MemberName(env, ctx, slot));
+  }
+  ctx.lazy = doc.get();
+  Napi::Value value;
+  try {
+    value = doc->Materialize(env, ctx, slot);
+  } catch (...) {
+    doc->Keep(ctx);
+    throw;
+  }
+  doc->Keep(ctx);
+  return value;
+}
+
+// Assigning a member stores the value without decoding the old one.
+void LazyDocument::WriteMember(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  LazySlot &slot = *static_cast<LazySlot *>(info.Data());
+  Napi::Value receiver = info.This();
+  if (!receiver.IsObject()) return;
+  DecodeContext ctx(GetMutableAddonData(env));
+  ctx.stats.Discard();
+  Napi::Object self = slot.owner->self.Value();
+  if (!self.IsEmpty() && receiver.StrictEquals(self)) slot.done = true;
+  receiver.As<Napi::Object>().DefineProperty(Napi::PropertyDescriptor::Value(
+      Napi::Name(env, slot.owner->doc->MemberName(env, ctx, slot)), info[0],
+      kDataAttributes));
+}
+
+void LazyDocument::DeleteObject(napi_env env, void *data, void *hint) {
+  auto *object = static_cast<LazyObject *>(data);
+  auto it = object->doc->objects_.find(object->index);
+  if (it != object->doc->objects_.end() && it->second == object) {
+    object->doc->objects_.erase(it);
+  }
+  delete object;
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,72 @@
+#ifndef BAS_UTILS_SERIALIZATION_LAZY_H
+#define BAS_UTILS_SERIALIZATION_LAZY_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "decode.h"
+
+namespace bas_serde {
+
+struct LazyObject;
+struct LazySlot;
+
+// A document decoded piece by piece (parseLazy). The text is tokenized once
+// into a tape, leaving binary payloads as base64. Plain objects, and the
+// payloads of object wrappers, are created with their scalar members only;
+// each other member is an accessor that decodes its value on first read and
+// then becomes a data property. Arrays and the other wrappers are decoded
+// whole at that point. The document lives as long as an object that still
+// holds such an accessor.
+class LazyDocument : public std::enable_shared_from_this<LazyDocument> {
+ public:
+  // Tokenizes `text` and returns its root value. Malformed input throws a JS
+  // SyntaxError.
+  static Napi::Value Parse(const Napi::Env &env, std::string text, DecodeContext &ctx);
+
+  // Puts the value of reference `id` into ctx.refs when it is known or can be
+  // decoded first: through the accessors on the way to it, so it is the same
+  // object a later read there returns. Ids of values the caller is still
+  // decoding are left to the caller.
+  void Resolve(const Napi::Env &env, DecodeContext &ctx, uint32_t id);
+
+ private:
+  friend struct LazyObject;
+
+  static Napi::Value ReadMember(const Napi::CallbackInfo &info);
+  static void WriteMember(const Napi::CallbackInfo &info);
+  static void DeleteObject(napi_env env, void *data, void *hint);
+
+  // Decodes the value starting at tape entry `index`; an object when it is
+  // one decoded lazily, else in full.
+  Napi::Value Decode(const Napi::Env &env, DecodeContext &ctx, size_t index, size_t end);
+  // The lazily decoded object at `index`, or an empty value when the value
+  // there is decoded in full.
+  Napi::Value DecodeObject(const Napi::Env &env, DecodeContext &ctx, size_t index);
+  Napi::Object CreateObject(const Napi::Env &env, DecodeContext &ctx, size_t index,
+                            size_t members, bool hasId, uint32_t id);
+  Napi::Value Materialize(const Napi::Env &env, DecodeContext &ctx, LazySlot &slot);
+  Napi::Value MemberName(const Napi::Env &env, DecodeContext &ctx, const LazySlot &slot);
+  // Records where each wrapper with a $$id starts, on the first reference
+  // Resolve cannot find.
+  void IndexIds();
+  // Moves the references a call decoded into refs_, holding them weakly.
+  void Keep(DecodeContext &ctx);
+
+  std::string text_;
+  JsonTape tape_;
+  std::unordered_map<uint32_t, Napi::Reference<Napi::Value>> refs_;
+  std::unordered_map<uint32_t, size_t> ids_;
+  bool indexed_ = false;
+  // Objects with accessors left, by the tape entry their value starts at.
+  std::unordered_map<size_t, LazyObject *> objects_;
+  // Tape spans being decoded, outermost first.
+  std::vector<std::pair<size_t, size_t>> decoding_;
+};
+
+}  // namespace bas_serde
+
+#endif
@@ -3,17 +3,29 @@
 
 #include <napi.h>
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "addon_data.h"
+#include "binary_format.h"
+#include "identity_table.h"
+#include "json_writer.h"
+#include "key_interner.h"
+
 namespace bas_serde {
 
+class Dictionary;
+class LazyDocument;
+
 constexpr const char kTypeKey[] = "$$type";
 constexpr const char kValueKey[] = "value";
 constexpr const char kArrayTypeKey[] = "arrayType";
 constexpr const char kByteOffsetKey[] = "byteOffset";
+constexpr const char kBufferKey[] = "buffer";
 constexpr const char kLengthKey[] = "length";
 constexpr const char kSourceKey[] = "source";
 constexpr const char kFlagsKey[] = "flags";
@@ -25,6 +37,9 @@ constexpr const char kDescriptionKey[] = "description";
 constexpr const char kGlobalKey[] = "global";
 constexpr const char kPropsKey[] = "props";
 constexpr const char kIdKey[] = "$$id";
+constexpr const char kAttachmentKey[] = "attachment";
+constexpr const char kStringsKey[] = "strings";
+constexpr const char kDictionaryKey[] = "dictionary";
 
 constexpr const char kTypeUndefined[] = "Undefined";
 constexpr const char kTypeNumber[] = "Number";
@@ -44,51 +59,176 @@ constexpr const char kTypeArrayBuffer[] = "ArrayBuffer";
 constexpr const char kTypeTypedArray[] = "TypedArray";
 constexpr const char kTypeDataView[] = "DataView";
 constexpr const char kTypeHole[] = "Hole";
+constexpr const char kTypePackedArray[] = "PackedArray";
+constexpr const char kTypeDedupedStrings[] = "DedupedStrings";
+
+// Under a DedupedStrings header, a string value or property key starting with
+// this is a reference "~N" to entry N of the dictionary followed by the
+// header's string table, or, with the mark doubled, a literal.
+constexpr char kStringRefMark = '~';
+
+// A $$type name resolved once by WrapperTypeFromName; decoders switch on this
+// instead of comparing the name again.
+enum class WrapperType : uint8_t {
+  kNone,  // not a known wrapper name
+  kUndefined,
+  kNumber,
+  kBigInt,
+  kDate,
+  kRegExp,
+  kSet,
+  kMap,
+  kError,
+  kObject,
+  kArray,
+  kReference,
+  kPropKeyString,
+  kPropKeySymbol,
+  kBuffer,
+  kArrayBuffer,
+  kTypedArray,
+  kDataView,
+  kHole,
+  kPackedArray,
+  kDedupedStrings,
+};
 
 constexpr const char kNumNaN[] = "NaN";
 constexpr const char kNumInf[] = "Infinity";
 constexpr const char kNumNegInf[] = "-Infinity";
 
-struct Ctors {
-  Napi::Function mapCtor;
-  Napi::Function setCtor;
-  Napi::Function dateCtor;
-  Napi::Function regexpCtor;
-  Napi::Function bigintCtor;
+// Result of ClassifyValue: what a value is encoded as.
+enum class ValueKind : uint8_t {
+  kUndefined,
+  kNull,
+  kBoolean,
+  kNumber,
+  kString,
+  kBigInt,
+  kUnsupported,
+  kPlainObject,
+  kArray,
+  kArrayBuffer,
+  kBuffer,
+  kDataView,
+  kTypedArray,
+  kDate,
+  kRegExp,
+  kError,
+  kSet,
+  kMap,
+  kObject,
 };
 
-struct Replacer {
-  bool enabled = false;
-  Napi::Function fn;
-};
+// maxDepth when the option is not given: nesting is bounded by memory only.
+constexpr size_t kUnlimitedDepth = SIZE_MAX;
 
 struct ReplaceState {
   bool replaced = false;
-  napi_value value = nullptr;
+  Napi::ObjectReference holder;
 };
 
-struct Reviver {
+struct Replacer {
   bool enabled = false;
+  // One bit per ValueKind the replacer is called for (replacerTypes).
+  uint32_t kinds = ~0u;
   Napi::Function fn;
+  // The replace() argument, created once per stringify call and passed to
+  // every invocation. It owns `state`, which lives as long as the function.
+  Napi::Function replace;
+  ReplaceState *state = nullptr;
+
+  bool Wants(ValueKind kind) const {
+    return enabled && ((kinds >> static_cast<uint32_t>(kind)) & 1u) != 0;
+  }
 };
 
-struct SeenEntry {
-  Napi::Reference<Napi::Value> ref;
-  uint32_t id;
+struct Reviver {
+  bool enabled = false;
+  Napi::Function fn;
+  // Set by reviverTypes/reviverKeys: the reviver is called as (value, key) on
+  // decoded values by the text decoder, for the selected kinds (one bit per
+  // ValueKind) and property names only, rather than on raw JSON.parse nodes.
+  bool decoded = false;
+  uint32_t kinds = ~0u;
+  bool allKeys = true;  // false once reviverKeys lists the names in `keys`
+  std::vector<std::string> keys;
+
+  bool Wants(ValueKind kind) const {
+    return ((kinds >> static_cast<uint32_t>(kind)) & 1u) != 0;
+  }
 };
 
-using SeenStack = std::vector<Napi::Reference<Napi::Value>>;
-using SeenEntries = std::vector<SeenEntry>;
-
 struct EncodeContext {
-  SeenStack stack;
-  SeenEntries entries;
+  explicit EncodeContext(AddonData &data)
+      : data(data), keys(data), stats(data.statsEnabled ? &data.encodeStats : nullptr) {}
+
+  const AddonData &data;
+  KeyCache keys;
+  JsonWriter out;
+  // Output of stringifyBinary.
+  ByteWriter bytes;
+  std::u16string scratch;
+  // Objects on the current path (cycle detection) and, with allowCircular,
+  // every object already written with its $$id.
+  IdentityTable stack;
+  IdentityTable entries;
   bool allowCircular = false;
+  // packNumbers: all-number arrays are written as PackedArray wrappers.
+  bool packNumbers = false;
+  // shareArrayBuffers: views are written over their whole backing ArrayBuffer,
+  // which gets an $$id so that other views (and the buffer itself) refer to it.
+  bool shareArrayBuffers = false;
+  // dedupeStrings: the header's string table, and its indexes by text. String
+  // values found in it are written as references (see kStringRefMark).
+  bool dedupeStrings = false;
+  std::vector<std::u16string> stringTable;
+  std::unordered_map<std::u16string_view, uint32_t> strings;
+  // Strings written by index (`dictionary` option). The text encoders write
+  // them as references under a DedupedStrings header, as they do the table's.
+  const Dictionary *dictionary = nullptr;
+  // Set once a DedupedStrings header is written: string values and property
+  // keys are written through the dictionary and the string table.
+  bool stringRefs = false;
+  // trainDictionary: counts every string the binary encoder writes.
+  std::unordered_map<std::u16string, uint32_t> *stringCounts = nullptr;
   uint32_t nextId = 1;
+  // Set for attachments: 'external'; binary payloads are appended here and
+  // referenced by index instead of being base64 encoded.
+  Napi::Array attachments;
+  // Container nesting of the value being walked, limited by maxDepth.
+  size_t depth = 0;
+  size_t maxDepth = kUnlimitedDepth;
+  // This call's counters while enableStats() is on.
+  StatsRecorder stats;
 };
 
 struct DecodeContext {
+  explicit DecodeContext(AddonData &data)
+      : data(data), keys(data), stats(data.statsEnabled ? &data.decodeStats : nullptr) {}
+
+  const AddonData &data;
+  KeyCache keys;
+  // Property keys created so far, shared by every object that repeats them.
+  KeyInterner names;
   std::unordered_map<uint32_t, Napi::Reference<Napi::Value>> refs;
+  // Wrappers whose value is being decoded before their $$id is known, and the
+  // ids stored meanwhile (dropped if that value has to be decoded again).
+  uint32_t pendingIds = 0;
+  std::vector<uint32_t> provisional;
+  // Caller-supplied memory for wrappers that carry an attachment index.
+  Napi::Array attachments;
+  // The strings a payload refers to by index (`dictionary` option): kDictString
+  // in binary, references below the string table in text.
+  const Dictionary *dictionary = nullptr;
+  // parseLazy: the document being decoded piece by piece, which finds the
+  // values of ids its earlier pieces did not decode (see LazyDocument).
+  LazyDocument *lazy = nullptr;
+  // Container nesting of the value being walked, limited by maxDepth.
+  size_t depth = 0;
+  size_t maxDepth = kUnlimitedDepth;
+  // This call's counters while enableStats() is on.
+  StatsRecorder stats;
 };
 
 }  // namespace bas_serde
@@ -2,11 +2,11 @@
 
 #include <cmath>
 #include <cstring>
+#include <utility>
 
-namespace bas_serde {
+#include "dictionary.h"
 
-constexpr const char kBase64Alphabet[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+namespace bas_serde {
 
 // Pulls the last N-API error message for diagnostics.
 std::string GetNapiErrorMessage(napi_env env) {
@@ -19,43 +19,309 @@ std::string GetNapiErrorMessage(napi_env env) {
 }
 
 // Replacer callback used by stringify; stores replacement value in ReplaceState.
+// The argument handle dies with this callback's scope, so it is parked on the
+// state's holder object until the encoder picks it up.
 Napi::Value ReplaceCallback(const Napi::CallbackInfo &info) {
   auto *state = static_cast<ReplaceState *>(info.Data());
   state->replaced = true;
-  state->value = info.Length() > 0 ? info[0] : info.Env().Undefined();
+  state->holder.Value().Set(kValueKey,
+                            info.Length() > 0 ? info[0] : info.Env().Undefined());
   return info.Env().Undefined();
 }
 
-// Detects if a value is in the current recursion stack.
-bool SeenContains(const SeenStack &seen, const Napi::Value &value) {
-  for (const auto &ref : seen) {
-    if (value.StrictEquals(ref.Value())) {
-      return true;
+static void DeleteReplaceState(napi_env env, void *data, void *hint) {
+  delete static_cast<ReplaceState *>(data);
+}
+
+// Calls the replacer for `value`. Returns true and sets `replacement` when the
+// callback called replace().
+bool ApplyReplacer(const Napi::Env &env, const Napi::Value &value,
+                   const Replacer &replacer, Napi::Value *replacement) {
+  ReplaceState &state = *replacer.state;
+  state.replaced = false;
+  replacer.fn.Call(env.Undefined(), {value, replacer.replace});
+  if (!state.replaced) return false;
+  *replacement = state.holder.Value().Get(kValueKey);
+  return true;
+}
+
+static void CheckStatus(const Napi::Env &env, napi_status status, const char *call) {
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, std::string(call) + " failed: " + message);
+  }
+}
+
+static bool IsInstance(const Napi::Env &env, napi_value value,
+                       const Napi::FunctionReference &ctor) {
+  if (ctor.IsEmpty()) return false;
+  bool result = false;
+  CheckStatus(env, napi_instanceof(env, value, ctor.Value(), &result), "napi_instanceof");
+  return result;
+}
+
+// Picks the encoding for a value with one typeof and, for objects, the fewest
+// checks: objects whose prototype is Object.prototype cannot be instances of
+// any special type, so they are recognised by a single prototype compare.
+// Buffer is only tested on typed arrays, as Buffer subclasses Uint8Array.
+ValueKind ClassifyValue(const Napi::Env &env, napi_value value, const AddonData &data) {
+  napi_valuetype type;
+  CheckStatus(env, napi_typeof(env, value, &type), "napi_typeof");
+  switch (type) {
+    case napi_undefined:
+      return ValueKind::kUndefined;
+    case napi_null:
+      return ValueKind::kNull;
+    case napi_boolean:
+      return ValueKind::kBoolean;
+    case napi_number:
+      return ValueKind::kNumber;
+    case napi_string:
+      return ValueKind::kString;
+    case napi_bigint:
+      return ValueKind::kBigInt;
+    case napi_object:
+      break;
+    default:
+      return ValueKind::kUnsupported;
+  }
+
+  napi_value proto;
+  CheckStatus(env, napi_get_prototype(env, value, &proto), "napi_get_prototype");
+  bool isPlain = false;
+  CheckStatus(env, napi_strict_equals(env, proto, data.objectPrototype.Value(), &isPlain),
+              "napi_strict_equals");
+  if (isPlain) return ValueKind::kPlainObject;
+
+  bool result = false;
+  CheckStatus(env, napi_is_array(env, value, &result), "napi_is_array");
+  if (result) return ValueKind::kArray;
+  CheckStatus(env, napi_is_arraybuffer(env, value, &result), "napi_is_arraybuffer");
+  if (result) return ValueKind::kArrayBuffer;
+  CheckStatus(env, napi_is_typedarray(env, value, &result), "napi_is_typedarray");
+  if (result) {
+    return IsInstance(env, value, data.bufferCtor) ? ValueKind::kBuffer
+                                                   : ValueKind::kTypedArray;
+  }
+  CheckStatus(env, napi_is_dataview(env, value, &result), "napi_is_dataview");
+  if (result) return ValueKind::kDataView;
+  CheckStatus(env, napi_is_date(env, value, &result), "napi_is_date");
+  if (result) return ValueKind::kDate;
+  if (IsInstance(env, value, data.ctors.regexpCtor)) return ValueKind::kRegExp;
+  if (IsInstance(env, value, data.errorCtor)) return ValueKind::kError;
+  if (IsInstance(env, value, data.ctors.setCtor)) return ValueKind::kSet;
+  if (IsInstance(env, value, data.ctors.mapCtor)) return ValueKind::kMap;
+  return ValueKind::kObject;
+}
+
+// Reads the stringify options shared by the text and binary encoders.
+// Maps replacerTypes/reviverTypes names to ValueKind bits. Primitives go by
+// their typeof name, built-in objects by constructor name; "object" covers
+// every other object.
+static uint32_t ReadValueKinds(const Napi::Env &env, const Napi::Value &typesVal,
+                               const char *option) {
+  static constexpr std::pair<std::string_view, ValueKind> kNames[] = {
+      {"undefined", ValueKind::kUndefined},
+      {"null", ValueKind::kNull},
+      {"boolean", ValueKind::kBoolean},
+      {"number", ValueKind::kNumber},
+      {"string", ValueKind::kString},
+      {"bigint", ValueKind::kBigInt},
+      {"object", ValueKind::kPlainObject},
+      {"object", ValueKind::kObject},
+      {"Array", ValueKind::kArray},
+      {"ArrayBuffer", ValueKind::kArrayBuffer},
+      {"Buffer", ValueKind::kBuffer},
+      {"DataView", ValueKind::kDataView},
+      {"TypedArray", ValueKind::kTypedArray},
+      {"Date", ValueKind::kDate},
+      {"RegExp", ValueKind::kRegExp},
+      {"Error", ValueKind::kError},
+      {"Set", ValueKind::kSet},
+      {"Map", ValueKind::kMap},
+  };
+  if (!typesVal.IsArray()) {
+    throw Napi::TypeError::New(env, std::string(option) + " must be an array of type names");
+  }
+  Napi::Array types = typesVal.As<Napi::Array>();
+  uint32_t kinds = 0;
+  for (uint32_t i = 0; i < types.Length(); i++) {
+    Napi::Value typeVal = types.Get(i);
+    std::string name = typeVal.IsString() ? typeVal.As<Napi::String>().Utf8Value() : "";
+    uint32_t bits = 0;
+    for (const auto &[known, kind] : kNames) {
+      if (known == name) bits |= 1u << static_cast<uint32_t>(kind);
+    }
+    if (bits == 0) {
+      throw Napi::TypeError::New(env, "Unknown " + std::string(option) + " entry: " +
+                                          typeVal.ToString().Utf8Value());
     }
+    kinds |= bits;
   }
-  return false;
+  return kinds;
+}
+
+constexpr double kMaxSafeDepth = 9007199254740991.0;
+
+// Reads the maxDepth option shared by every encoder and decoder: a positive
+// integer, or Infinity for no limit (the default).
+size_t ReadMaxDepth(const Napi::Value &optionsVal) {
+  if (!optionsVal.IsObject()) return kUnlimitedDepth;
+  Napi::Value depthVal = optionsVal.As<Napi::Object>().Get("maxDepth");
+  if (depthVal.IsUndefined()) return kUnlimitedDepth;
+  double depth = depthVal.IsNumber() ? depthVal.As<Napi::Number>().DoubleValue() : 0;
+  if (depth == INFINITY) return kUnlimitedDepth;
+  if (!(depth >= 1 && depth <= kMaxSafeDepth) || std::trunc(depth) != depth) {
+    throw Napi::TypeError::New(optionsVal.Env(), "maxDepth must be a positive integer");
+  }
+  return static_cast<size_t>(depth);
+}
+
+void ThrowMaxDepth(const Napi::Env &env, size_t maxDepth) {
+  throw Napi::RangeError::New(
+      env, "Nesting exceeds the maximum depth of " + std::to_string(maxDepth));
+}
+
+void ReadStringifyOptions(const Napi::Value &optionsVal, Replacer &replacer,
+                          EncodeContext &ctx) {
+  Napi::Env env = optionsVal.Env();
+  if (!optionsVal.IsObject()) {
+    return;
+  }
+  Napi::Object options = optionsVal.As<Napi::Object>();
+  if (options.Has("replacer")) {
+    Napi::Value replVal = options.Get("replacer");
+    if (!replVal.IsUndefined() && !replVal.IsNull()) {
+      if (!replVal.IsFunction()) {
+        throw Napi::TypeError::New(env, "replacer must be a function");
+      }
+      replacer.enabled = true;
+      replacer.fn = replVal.As<Napi::Function>();
+      // The state is freed with the function, which user code may keep.
+      auto *state = new ReplaceState();
+      state->holder = Napi::Persistent(Napi::Object::New(env));
+      replacer.state = state;
+      replacer.replace = Napi::Function::New(env, ReplaceCallback, "replace", state);
+      napi_status status = napi_add_finalizer(env, replacer.replace, state,
+                                              DeleteReplaceState, nullptr, nullptr);
+      if (status != napi_ok) {
+        delete state;
+        throw Napi::Error::New(env);
+      }
+    }
+  }
+  if (options.Has("replacerTypes")) {
+    Napi::Value typesVal = options.Get("replacerTypes");
+    if (!typesVal.IsUndefined()) {
+      replacer.kinds = ReadValueKinds(env, typesVal, "replacerTypes");
+    }
+  }
+  if (options.Has("circularReferences")) {
+    Napi::Value circularVal = options.Get("circularReferences");
+    if (circularVal.IsBoolean()) {
+      ctx.allowCircular = circularVal.ToBoolean().Value();
+    }
+  }
+  // Only the text encoders pack; the binary format has no wrapper for it.
+  if (options.Has("packNumbers")) {
+    Napi::Value packVal = options.Get("packNumbers");
+    if (packVal.IsBoolean()) {
+      ctx.packNumbers = packVal.ToBoolean().Value();
+    }
+  }
+  // Likewise only the text encoders share buffers between views.
+  if (options.Has("shareArrayBuffers")) {
+    Napi::Value shareVal = options.Get("shareArrayBuffers");
+    if (shareVal.IsBoolean()) {
+      ctx.shareArrayBuffers = shareVal.ToBoolean().Value();
+    }
+  }
+  // And only they number repeated strings.
+  if (options.Has("dedupeStrings")) {
+    Napi::Value dedupeVal = options.Get("dedupeStrings");
+    if (dedupeVal.IsBoolean()) {
+      ctx.dedupeStrings = dedupeVal.ToBoolean().Value();
+    }
+  }
+  ctx.dictionary = ReadDictionary(options);
+  ctx.maxDepth = ReadMaxDepth(options);
 }
 
-// Finds a previously assigned id for circular reference support.
-int FindSeenId(const SeenEntries &entries, const Napi::Value &value) {
-  for (const auto &entry : entries) {
-    if (value.StrictEquals(entry.ref.Value())) {
-      return static_cast<int>(entry.id);
+// Reads the reviver, attachments and dictionary options of the text decoders.
+void ReadParseOptions(const Napi::Value &optionsVal, Reviver &reviver,
+                      DecodeContext &ctx) {
+  Napi::Env env = optionsVal.Env();
+  if (!optionsVal.IsObject()) {
+    return;
+  }
+  Napi::Object options = optionsVal.As<Napi::Object>();
+  if (options.Has("reviver")) {
+    Napi::Value revVal = options.Get("reviver");
+    if (!revVal.IsUndefined() && !revVal.IsNull()) {
+      if (!revVal.IsFunction()) {
+        throw Napi::TypeError::New(env, "reviver must be a function");
+      }
+      reviver.enabled = true;
+      reviver.fn = revVal.As<Napi::Function>();
     }
   }
-  return -1;
+  if (options.Has("reviverTypes")) {
+    Napi::Value typesVal = options.Get("reviverTypes");
+    if (!typesVal.IsUndefined()) {
+      reviver.kinds = ReadValueKinds(env, typesVal, "reviverTypes");
+      reviver.decoded = true;
+    }
+  }
+  if (options.Has("reviverKeys")) {
+    Napi::Value keysVal = options.Get("reviverKeys");
+    if (!keysVal.IsUndefined()) {
+      if (!keysVal.IsArray()) {
+        throw Napi::TypeError::New(env, "reviverKeys must be an array of strings");
+      }
+      Napi::Array keys = keysVal.As<Napi::Array>();
+      for (uint32_t i = 0; i < keys.Length(); i++) {
+        Napi::Value key = keys.Get(i);
+        if (!key.IsString()) {
+          throw Napi::TypeError::New(env, "reviverKeys must be an array of strings");
+        }
+        reviver.keys.push_back(key.As<Napi::String>().Utf8Value());
+      }
+      reviver.allKeys = false;
+      reviver.decoded = true;
+    }
+  }
+  if (options.Has("attachments")) {
+    Napi::Value attachVal = options.Get("attachments");
+    if (attachVal.IsArray()) {
+      ctx.attachments = attachVal.As<Napi::Array>();
+    } else if (!attachVal.IsUndefined() && !attachVal.IsNull()) {
+      throw Napi::TypeError::New(env, "attachments must be an array");
+    }
+  }
+  ctx.dictionary = ReadDictionary(options);
+  ctx.maxDepth = ReadMaxDepth(options);
 }
 
-// Buffer should be detected via instanceof to avoid TypedArray/DataView conflicts.
-bool IsBufferInstance(const Napi::Env &env, const Napi::Value &value) {
-  if (!value.IsObject()) {
-    return false;
+// Copies a JS string's UTF-16 code units into `scratch` and returns their
+// count. A single napi call suffices unless the string outgrows the scratch.
+size_t CopyJsString(const Napi::Env &env, napi_value value, std::u16string &scratch) {
+  if (scratch.size() < 64) scratch.resize(64);
+  size_t length = 0;
+  napi_status status = napi_get_value_string_utf16(env, value, &scratch[0],
+                                                   scratch.size(), &length);
+  if (status == napi_ok && length + 1 >= scratch.size()) {
+    status = napi_get_value_string_utf16(env, value, nullptr, 0, &length);
+    if (status == napi_ok) {
+      scratch.resize(length + 1);
+      status = napi_get_value_string_utf16(env, value, &scratch[0], scratch.size(),
+                                           &length);
+    }
   }
-  Napi::Value ctorValue = env.Global().Get("Buffer");
-  if (!ctorValue.IsFunction()) {
-    return false;
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "napi_get_value_string_utf16 failed: " + message);
   }
-  return value.As<Napi::Object>().InstanceOf(ctorValue.As<Napi::Function>());
+  return length;
 }
 
 // Maps N-API typed array kinds to constructor names.
@@ -111,63 +377,76 @@ size_t TypedArrayBytesPerElement(napi_typedarray_type type) {
   }
 }
 
-// Creates a $$type wrapper.
-Napi::Object MakeWrapper(Napi::Env env, const char *type) {
-  Napi::Object obj = Napi::Object::New(env);
-  obj.Set(kTypeKey, Napi::String::New(env, type));
-  return obj;
+// Maps constructor names back to N-API typed array kinds.
+bool TypedArrayTypeFromName(const std::string &name, napi_typedarray_type *type) {
+  static const napi_typedarray_type kTypes[] = {
+      napi_int8_array,    napi_uint8_array,     napi_uint8_clamped_array,
+      napi_int16_array,   napi_uint16_array,    napi_int32_array,
+      napi_uint32_array,  napi_float32_array,   napi_float64_array,
+      napi_bigint64_array, napi_biguint64_array,
+  };
+  for (napi_typedarray_type candidate : kTypes) {
+    if (TypedArrayName(candidate) == name) {
+      *type = candidate;
+      return true;
+    }
+  }
+  return false;
 }
 
-// Creates a $$type wrapper with a value field.
-Napi::Object MakeWrapper(Napi::Env env, const char *type, const Napi::Value &value) {
-  Napi::Object obj = Napi::Object::New(env);
-  obj.Set(kTypeKey, Napi::String::New(env, type));
-  obj.Set(kValueKey, value);
-  return obj;
+// Opens a $$type wrapper object: {"$$type":"<type>"
+void WriteWrapperOpen(JsonWriter &out, const char *type) {
+  out.Raw('{');
+  out.Key(kTypeKey);
+  out.AsciiString(type);
 }
 
-// Creates a $$type wrapper with an id for circular reference support.
-Napi::Object MakeWrapperWithId(Napi::Env env, const char *type, uint32_t id) {
-  Napi::Object obj = Napi::Object::New(env);
-  obj.Set(kTypeKey, Napi::String::New(env, type));
-  obj.Set(kIdKey, Napi::Number::New(env, id));
-  return obj;
+// Opens a $$type wrapper with an id for circular reference support.
+void WriteWrapperOpenWithId(JsonWriter &out, const char *type, uint32_t id) {
+  WriteWrapperOpen(out, type);
+  out.Field(kIdKey);
+  out.Uint(id);
 }
 
-// Creates a reference wrapper pointing at a previously seen id.
-Napi::Object MakeReference(Napi::Env env, uint32_t id) {
-  Napi::Object obj = Napi::Object::New(env);
-  obj.Set(kTypeKey, Napi::String::New(env, kTypeReference));
-  obj.Set(kIdKey, Napi::Number::New(env, id));
-  return obj;
+// Writes a reference wrapper pointing at a previously seen id.
+void WriteReference(JsonWriter &out, uint32_t id) {
+  WriteWrapperOpenWithId(out, kTypeReference, id);
+  out.Raw('}');
 }
 
-// Wraps a string property key (used for Error custom properties).
-Napi::Object MakePropKeyString(Napi::Env env, const Napi::Value &value) {
-  Napi::Object obj = Napi::Object::New(env);
-  obj.Set(kTypeKey, Napi::String::New(env, kTypePropKeyString));
-  obj.Set(kValueKey, value);
-  return obj;
+// Adds $$id to an open wrapper if circular references are enabled.
+void WriteIdIfNeeded(JsonWriter &out, bool hasId, uint32_t id) {
+  if (hasId) {
+    out.Field(kIdKey);
+    out.Uint(id);
+  }
 }
 
-// Wraps a symbol key with global flag and key/description.
-Napi::Object MakePropKeySymbol(Napi::Env env, bool isGlobal, const Napi::Value &keyOrDesc) {
-  Napi::Object obj = Napi::Object::New(env);
-  obj.Set(kTypeKey, Napi::String::New(env, kTypePropKeySymbol));
-  obj.Set(kGlobalKey, Napi::Boolean::New(env, isGlobal));
-  if (isGlobal) {
-    obj.Set(kKeyKey, keyOrDesc);
-  } else {
-    obj.Set(kDescriptionKey, keyOrDesc);
+void SetMember(const Napi::Env &env, const Napi::Object &out, const Napi::Value &name,
+               bool isProto, const Napi::Value &value) {
+  if (!isProto) {
+    out.Set(name, value);
+    return;
+  }
+  napi_property_descriptor desc = {
+      nullptr, name, nullptr, nullptr, nullptr, value,
+      static_cast<napi_property_attributes>(napi_writable | napi_enumerable |
+                                            napi_configurable),
+      nullptr};
+  napi_status status = napi_define_properties(env, out, 1, &desc);
+  if (status != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::TypeError::New(env, "napi_define_properties failed: " + message);
   }
-  return obj;
 }
 
-// Adds $$id to a wrapper if circular references are enabled.
-void SetIdIfNeeded(Napi::Env env, Napi::Object &obj, bool hasId, uint32_t id) {
-  if (hasId) {
-    obj.Set(kIdKey, Napi::Number::New(env, id));
-  }
+bool IsProtoKey(const Napi::Env &env, const Napi::Value &key) {
+  char buffer[sizeof("__proto__") + 1];
+  size_t length = 0;
+  napi_status status =
+      napi_get_value_string_utf8(env, key, buffer, sizeof(buffer), &length);
+  return status == napi_ok && length == sizeof("__proto__") - 1 &&
+         std::memcmp(buffer, "__proto__", length) == 0;
 }
 
 // Resolves a reference id during parsing.
@@ -179,110 +458,111 @@ Napi::Value GetRefValue(DecodeContext &ctx, uint32_t id, const Napi::Env &env) {
   return it->second.Value();
 }
 
-// Stores a decoded object by id for reference resolution.
+// Stores a decoded object by id for reference resolution. Re-decoding a span
+// (see ParseText) replaces earlier entries.
 void StoreRef(DecodeContext &ctx, uint32_t id, const Napi::Value &value) {
-  ctx.refs.emplace(id, Napi::Persistent(value));
+  SERDE_STAT(ctx.stats, circularIds++);
+  ctx.refs[id] = Napi::Persistent(value);
+  if (ctx.pendingIds > 0) ctx.provisional.push_back(id);
 }
 
-// Minimal Base64 encode for binary payloads.
-std::string Base64Encode(const uint8_t *data, size_t len) {
-  std::string out;
-  out.reserve(((len + 2) / 3) * 4);
-
-  size_t i = 0;
-  while (i + 2 < len) {
-    uint32_t triple = (static_cast<uint32_t>(data[i]) << 16) |
-                      (static_cast<uint32_t>(data[i + 1]) << 8) |
-                      static_cast<uint32_t>(data[i + 2]);
-    out.push_back(kBase64Alphabet[(triple >> 18) & 0x3F]);
-    out.push_back(kBase64Alphabet[(triple >> 12) & 0x3F]);
-    out.push_back(kBase64Alphabet[(triple >> 6) & 0x3F]);
-    out.push_back(kBase64Alphabet[triple & 0x3F]);
-    i += 3;
-  }
-
-  if (i < len) {
-    uint32_t triple = static_cast<uint32_t>(data[i]) << 16;
-    if (i + 1 < len) {
-      triple |= static_cast<uint32_t>(data[i + 1]) << 8;
-    }
-
-    out.push_back(kBase64Alphabet[(triple >> 18) & 0x3F]);
-    out.push_back(kBase64Alphabet[(triple >> 12) & 0x3F]);
-    if (i + 1 < len) {
-      out.push_back(kBase64Alphabet[(triple >> 6) & 0x3F]);
-      out.push_back('=');
-    } else {
-      out.push_back('=');
-      out.push_back('=');
-    }
+// Names indexed by WrapperType.
+static constexpr std::string_view kWrapperTypeNames[] = {
+    "",          kTypeUndefined,     kTypeNumber,        kTypeBigInt,
+    kTypeDate,   kTypeRegExp,        kTypeSet,           kTypeMap,
+    kTypeError,  kTypeObject,        kTypeArray,         kTypeReference,
+    kTypePropKeyString,              kTypePropKeySymbol, kTypeBuffer,
+    kTypeArrayBuffer,                kTypeTypedArray,    kTypeDataView,
+    kTypeHole,   kTypePackedArray,   kTypeDedupedStrings,
+};
+
+// Resolves a $$type name. The length and at most two characters single out
+// the one name it can be, so a single compare confirms it.
+WrapperType WrapperTypeFromName(std::string_view name) {
+  WrapperType candidate;
+  switch (name.size()) {
+    case 3:
+      candidate = name[0] == 'S' ? WrapperType::kSet : WrapperType::kMap;
+      break;
+    case 4:
+      candidate = name[0] == 'D' ? WrapperType::kDate : WrapperType::kHole;
+      break;
+    case 5:
+      candidate = name[0] == 'E' ? WrapperType::kError : WrapperType::kArray;
+      break;
+    case 6:
+      switch (name[0]) {
+        case 'N':
+          candidate = WrapperType::kNumber;
+          break;
+        case 'R':
+          candidate = WrapperType::kRegExp;
+          break;
+        case 'o':
+          candidate = WrapperType::kObject;
+          break;
+        case 'B':
+          candidate = name[1] == 'i' ? WrapperType::kBigInt : WrapperType::kBuffer;
+          break;
+        default:
+          return WrapperType::kNone;
+      }
+      break;
+    case 8:
+      candidate = WrapperType::kDataView;
+      break;
+    case 9:
+      candidate = name[0] == 'U' ? WrapperType::kUndefined : WrapperType::kReference;
+      break;
+    case 10:
+      candidate = WrapperType::kTypedArray;
+      break;
+    case 11:
+      candidate = name[0] == 'A' ? WrapperType::kArrayBuffer : WrapperType::kPackedArray;
+      break;
+    case 13:
+      candidate = name[8] == 't' ? WrapperType::kPropKeyString : WrapperType::kPropKeySymbol;
+      break;
+    case 14:
+      candidate = WrapperType::kDedupedStrings;
+      break;
+    default:
+      return WrapperType::kNone;
   }
-
-  return out;
+  return name == kWrapperTypeNames[static_cast<size_t>(candidate)] ? candidate
+                                                                    : WrapperType::kNone;
 }
 
-int Base64Index(char c) {
-  if (c >= 'A' && c <= 'Z') return c - 'A';
-  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
-  if (c >= '0' && c <= '9') return c - '0' + 52;
-  if (c == '+') return 62;
-  if (c == '/') return 63;
-  return -1;
-}
-
-// Minimal Base64 decode for binary payloads.
-std::vector<uint8_t> Base64Decode(const std::string &input) {
-  std::vector<uint8_t> out;
-  size_t len = input.size();
-  if (len == 0) return out;
-
-  size_t i = 0;
-  while (i < len) {
-    int idx0 = Base64Index(input[i]);
-    int idx1 = (i + 1 < len) ? Base64Index(input[i + 1]) : -1;
-    if (idx0 < 0 || idx1 < 0) break;
-
-    int idx2 = -1;
-    int idx3 = -1;
-    char c2 = (i + 2 < len) ? input[i + 2] : '=';
-    char c3 = (i + 3 < len) ? input[i + 3] : '=';
-
-    if (c2 != '=') idx2 = Base64Index(c2);
-    if (c3 != '=') idx3 = Base64Index(c3);
-
-    uint32_t triple = (static_cast<uint32_t>(idx0) << 18) |
-                      (static_cast<uint32_t>(idx1) << 12);
-    if (idx2 >= 0) triple |= static_cast<uint32_t>(idx2) << 6;
-    if (idx3 >= 0) triple |= static_cast<uint32_t>(idx3);
-
-    out.push_back(static_cast<uint8_t>((triple >> 16) & 0xFF));
-    if (c2 != '=') out.push_back(static_cast<uint8_t>((triple >> 8) & 0xFF));
-    if (c3 != '=') out.push_back(static_cast<uint8_t>(triple & 0xFF));
-
-    i += 4;
+// Resolves a $$type value read from an object; kNone unless it is a string
+// naming a wrapper. The name is copied to the stack, not into a std::string.
+WrapperType ReadWrapperType(const Napi::Env &env, napi_value typeVal) {
+  napi_valuetype valueType;
+  if (typeVal == nullptr || napi_typeof(env, typeVal, &valueType) != napi_ok ||
+      valueType != napi_string) {
+    return WrapperType::kNone;
   }
-
-  return out;
+  // Longer values are cut at a character boundary, so a cut read keeps at least
+  // 28 bytes: more than any name has, so it cannot come back as one.
+  char name[32];
+  size_t len = 0;
+  if (napi_get_value_string_utf8(env, typeVal, name, sizeof(name), &len) != napi_ok) {
+    return WrapperType::kNone;
+  }
+  return WrapperTypeFromName(std::string_view(name, len));
 }
 
-// Checks if a value is a wrapper of a specific $$type.
-bool IsWrapperType(const Napi::Env &env, const Napi::Value &value, const char *type) {
-  if (!value.IsObject()) return false;
-  Napi::Object obj = value.As<Napi::Object>();
-  Napi::Value typeVal = obj.Get(kTypeKey);
-  if (!typeVal.IsString()) return false;
-  std::string t = typeVal.As<Napi::String>().Utf8Value();
-  return t == type;
+// Checks if a wrapper's payload is raw bytes.
+bool IsBinaryWrapperType(WrapperType type) {
+  return type == WrapperType::kBuffer || type == WrapperType::kArrayBuffer ||
+         type == WrapperType::kTypedArray || type == WrapperType::kDataView ||
+         type == WrapperType::kPackedArray;
 }
 
-// Checks if $$type is one of the supported wrapper types.
-bool IsKnownWrapperType(const std::string &t) {
-  return t == kTypeUndefined || t == kTypeHole || t == kTypeNumber ||
-         t == kTypeBigInt || t == kTypeDate || t == kTypeRegExp || t == kTypeSet ||
-         t == kTypeMap || t == kTypeError || t == kTypeObject || t == kTypeArray ||
-         t == kTypeReference || t == kTypePropKeyString || t == kTypePropKeySymbol ||
-         t == kTypeBuffer || t == kTypeArrayBuffer || t == kTypeTypedArray ||
-         t == kTypeDataView;
+// Checks if a wrapper's value holds child values that may reference it.
+bool IsContainerWrapperType(WrapperType type) {
+  return type == WrapperType::kObject || type == WrapperType::kArray ||
+         type == WrapperType::kSet || type == WrapperType::kMap ||
+         type == WrapperType::kError;
 }
 
 }  // namespace bas_serde
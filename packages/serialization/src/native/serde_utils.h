@@ -1,6 +1,8 @@
 #ifndef BAS_UTILS_SERIALIZATION_SERDE_UTILS_H
 #define BAS_UTILS_SERIALIZATION_SERDE_UTILS_H
 
+#include <string_view>
+
 #include "serde_types.h"
 
 namespace bas_serde {
@@ -8,31 +10,55 @@ namespace bas_serde {
 std::string GetNapiErrorMessage(napi_env env);
 
 Napi::Value ReplaceCallback(const Napi::CallbackInfo &info);
+bool ApplyReplacer(const Napi::Env &env, const Napi::Value &value,
+                   const Replacer &replacer, Napi::Value *replacement);
+void ReadStringifyOptions(const Napi::Value &options, Replacer &replacer,
+                          EncodeContext &ctx);
+void ReadParseOptions(const Napi::Value &options, Reviver &reviver, DecodeContext &ctx);
+size_t ReadMaxDepth(const Napi::Value &options);
+
+[[noreturn]] void ThrowMaxDepth(const Napi::Env &env, size_t maxDepth);
+
+// Enters one level of container nesting (arrays, objects, Sets, Maps, Errors)
+// of an encoder or decoder context; past its maxDepth this throws a RangeError.
+template <typename Context>
+void EnterContainer(const Napi::Env &env, Context &ctx) {
+  if (ctx.depth == ctx.maxDepth) ThrowMaxDepth(env, ctx.maxDepth);
+  ctx.depth++;
+  SERDE_STAT(ctx.stats, Depth(ctx.depth));
+}
 
-bool SeenContains(const SeenStack &seen, const Napi::Value &value);
-int FindSeenId(const SeenEntries &entries, const Napi::Value &value);
+template <typename Context>
+void LeaveContainer(Context &ctx) {
+  ctx.depth--;
+}
 
-bool IsBufferInstance(const Napi::Env &env, const Napi::Value &value);
+size_t CopyJsString(const Napi::Env &env, napi_value value, std::u16string &scratch);
+
+ValueKind ClassifyValue(const Napi::Env &env, napi_value value, const AddonData &data);
 
 std::string TypedArrayName(napi_typedarray_type type);
 size_t TypedArrayBytesPerElement(napi_typedarray_type type);
+bool TypedArrayTypeFromName(const std::string &name, napi_typedarray_type *type);
+
+void WriteWrapperOpen(JsonWriter &out, const char *type);
+void WriteWrapperOpenWithId(JsonWriter &out, const char *type, uint32_t id);
+void WriteReference(JsonWriter &out, uint32_t id);
+void WriteIdIfNeeded(JsonWriter &out, bool hasId, uint32_t id);
 
-Napi::Object MakeWrapper(Napi::Env env, const char *type);
-Napi::Object MakeWrapper(Napi::Env env, const char *type, const Napi::Value &value);
-Napi::Object MakeWrapperWithId(Napi::Env env, const char *type, uint32_t id);
-Napi::Object MakeReference(Napi::Env env, uint32_t id);
-Napi::Object MakePropKeyString(Napi::Env env, const Napi::Value &value);
-Napi::Object MakePropKeySymbol(Napi::Env env, bool isGlobal, const Napi::Value &keyOrDesc);
-void SetIdIfNeeded(Napi::Env env, Napi::Object &obj, bool hasId, uint32_t id);
+// Sets an own data property; "__proto__" is defined rather than assigned so it
+// cannot replace the prototype, matching JSON.parse.
+void SetMember(const Napi::Env &env, const Napi::Object &out, const Napi::Value &name,
+               bool isProto, const Napi::Value &value);
+bool IsProtoKey(const Napi::Env &env, const Napi::Value &key);
 
 Napi::Value GetRefValue(DecodeContext &ctx, uint32_t id, const Napi::Env &env);
 void StoreRef(DecodeContext &ctx, uint32_t id, const Napi::Value &value);
 
-std::string Base64Encode(const uint8_t *data, size_t len);
-std::vector<uint8_t> Base64Decode(const std::string &input);
-
-bool IsWrapperType(const Napi::Env &env, const Napi::Value &value, const char *type);
-bool IsKnownWrapperType(const std::string &t);
+WrapperType WrapperTypeFromName(std::string_view name);
+WrapperType ReadWrapperType(const Napi::Env &env, napi_value typeVal);
+bool IsBinaryWrapperType(WrapperType type);
+bool IsContainerWrapperType(WrapperType type);
 
 }  // namespace bas_serde
 
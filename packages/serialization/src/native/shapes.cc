@@ -0,0 +1,149 @@
+#include "shapes.h"
+
+#include <algorithm>
+
+namespace bas_serde {
+
+// The encoder's side of the registry: one call per object checks its keys with
+// for...in (the order GetPropertyNames reports) and reads the values.
+constexpr const char kShapeRegistrySource[] =
+    "(function () {\n"
+    "  const byFirstKey = new Map();\n"
+    "  function matches(object, keys) {\n"
+    "    let i = 0;\n"
+    "    for (const key in object) {\n"
+    "      if (key !== keys[i++]) return false;\n"
+    "    }\n"
+    "    return i === keys.length;\n"
+    "  }\n"
+    "  return {\n"
+    "    add(id, keys) {\n"
+    "      const list = byFirstKey.get(keys[0]);\n"
+    "      if (list === undefined) byFirstKey.set(keys[0], [{ id, keys }]);\n"
+    "      else list.push({ id, keys });\n"
+    "    },\n"
+    "    match(object) {\n"
+    "      for (const first in object) {\n"
+    "        const candidates = byFirstKey.get(first);\n"
+    "        if (candidates === undefined) return undefined;\n"
+    "        for (const { id, keys } of candidates) {\n"
+    "          if (!matches(object, keys)) continue;\n"
+    "          const values = [id];\n"
+    "          for (let i = 0; i < keys.length; i++) values.push(object[keys[i]]);\n"
+    "          return values;\n"
+    "        }\n"
+    "        return undefined;\n"
+    "      }\n"
+    "      return undefined;\n"
+    "    },\n"
+    "  };\n"
+    "})()";
+
+static bool HasLoneSurrogate(const char16_t *units, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char16_t unit = units[i];
+    if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < len && units[i + 1] >= 0xDC00 &&
+        units[i + 1] <= 0xDFFF) {
+      i++;
+    } else if (unit >= 0xD800 && unit <= 0xDFFF) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void RegisterShape(const Napi::Env &env, const Napi::Value &keysVal) {
+  AddonData &data = GetMutableAddonData(env);
+  if (!keysVal.IsArray() || keysVal.As<Napi::Array>().Length() == 0) {
+    throw Napi::TypeError::New(env, "registerShape expects a non-empty array of keys");
+  }
+  Napi::Array keys = keysVal.As<Napi::Array>();
+  uint32_t count = keys.Length();
+
+  Shape shape;
+  Napi::Array copy = Napi::Array::New(env, count);
+  std::u16string scratch;
+  std::string params;
+  std::string literal;
+  for (uint32_t i = 0; i < count; i++) {
+    Napi::Value key = keys.Get(i);
+    if (!key.IsString()) {
+      throw Napi::TypeError::New(env, "Shape keys must be strings");
+    }
+    size_t length = CopyJsString(env, key, scratch);
+    if (HasLoneSurrogate(scratch.data(), length)) {
+      throw Napi::TypeError::New(env, "Shape keys must be well-formed strings");
+    }
+    std::string name = key.As<Napi::String>().Utf8Value();
+    if (name == kTypeKey) {
+      throw Napi::TypeError::New(env, "$$type cannot be a shape key");
+    }
+    if (std::find(shape.keys.begin(), shape.keys.end(), name) != shape.keys.end()) {
+      throw Napi::TypeError::New(env, "Shape keys must be unique");
+    }
+    JsonWriter quoted;
+    quoted.String(scratch.data(), length);
+    std::string text(quoted.Data(), quoted.Size());
+
+    std::string param = "v" + std::to_string(i);
+    if (i > 0) {
+      params += ", ";
+      literal += ", ";
+    }
+    params += param;
+    // A literal __proto__ member would set the prototype, not define a key.
+    literal += name == "__proto__" ? "[" + text + "]" : text;
+    literal += ": " + param;
+    shape.fragments.push_back(text + ":");
+    shape.keys.push_back(std::move(name));
+    copy.Set(i, key);
+  }
+
+  for (const Shape &existing : data.shapes) {
+    if (existing.keys == shape.keys) return;
+  }
+  std::string source = "(function (" + params + ") {\n  return {" + literal + "};\n})";
+  shape.create = Napi::Persistent(RunScript(env, source).As<Napi::Function>());
+  if (data.addShape.IsEmpty()) {
+    Napi::Object registry = RunScript(env, kShapeRegistrySource).As<Napi::Object>();
+    data.addShape = Napi::Persistent(registry.Get("add").As<Napi::Function>());
+    data.matchShape = Napi::Persistent(registry.Get("match").As<Napi::Function>());
+  }
+  uint32_t id = static_cast<uint32_t>(data.shapes.size());
+  data.addShape.Call({Napi::Number::New(env, id), copy});
+
+  // The decoder's side: a trie over key positions, so each key read is one
+  // lookup however many shapes there are.
+  if (data.shapeNodes.empty()) data.shapeNodes.emplace_back();
+  size_t node = 0;
+  shape.nodes.push_back(node);
+  for (const std::string &name : shape.keys) {
+    auto it = data.shapeNodes[node].next.find(name);
+    if (it != data.shapeNodes[node].next.end()) {
+      node = it->second;
+    } else {
+      size_t child = data.shapeNodes.size();
+      data.shapeNodes[node].next.emplace(name, child);
+      data.shapeNodes.emplace_back();
+      data.shapeNodes[child].shape = id;
+      node = child;
+    }
+    shape.nodes.push_back(node);
+  }
+  data.shapeNodes[node].exact = id;
+  data.shapes.push_back(std::move(shape));
+}
+
+size_t FindShape(const AddonData &data, size_t prefix, size_t matched, std::string_view key) {
+  if (data.shapeNodes.empty()) return kNoShape;
+  size_t node = matched == 0 ? 0 : data.shapes[prefix].nodes[matched];
+  const auto &next = data.shapeNodes[node].next;
+  auto it = next.find(key);
+  return it == next.end() ? kNoShape : data.shapeNodes[it->second].shape;
+}
+
+size_t FindShapePrefix(const AddonData &data, size_t prefix, size_t matched) {
+  return data.shapeNodes[data.shapes[prefix].nodes[matched]].exact;
+}
+
+}  // namespace bas_serde
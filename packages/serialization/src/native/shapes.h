@@ -0,0 +1,27 @@
+#ifndef BAS_UTILS_SERIALIZATION_SHAPES_H
+#define BAS_UTILS_SERIALIZATION_SHAPES_H
+
+#include <string_view>
+
+#include "serde_utils.h"
+
+namespace bas_serde {
+
+// Registers the key list of a repeated object layout for this environment.
+// Objects whose enumerable keys are exactly these, in this order, have
+// their keys written from precomputed text and are decoded with one call that
+// builds the object from a literal. Registering the same keys again is a no-op.
+void RegisterShape(const Napi::Env &env, const Napi::Value &keys);
+
+// Finds the id of a shape that starts with the first `matched` keys of shape
+// `prefix` (any shape when `matched` is 0) and continues with `key`; the first
+// registered one. Ids rather than pointers are passed around, since JS code run
+// meanwhile may register more shapes.
+size_t FindShape(const AddonData &data, size_t prefix, size_t matched, std::string_view key);
+
+// Finds the id of a shape that is exactly the first `matched` keys of `prefix`.
+size_t FindShapePrefix(const AddonData &data, size_t prefix, size_t matched);
+
+}  // namespace bas_serde
+
+#endif
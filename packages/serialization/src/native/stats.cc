@@ -0,0 +1,87 @@
+#include "stats.h"
+
+#include "serde_types.h"
+
+namespace bas_serde {
+
+static_assert(Stats::kReferenceSlot == static_cast<size_t>(ValueKind::kObject) + 1,
+              "Stats::nodes has one slot per ValueKind and one for references");
+
+// Names of the node slots, in ValueKind order; the same vocabulary as
+// replacerTypes, with wrapped objects counted as "object".
+static constexpr const char *kNodeNames[Stats::kNodeSlots] = {
+    "undefined", "null",     "boolean",    "number", "string", "bigint", "unsupported",
+    "object",    "Array",    "ArrayBuffer", "Buffer", "DataView", "TypedArray", "Date",
+    "RegExp",    "Error",    "Set",        "Map",    "object", "reference",
+};
+
+void Stats::Add(const Stats &other) {
+  calls += other.calls;
+  for (size_t i = 0; i < kNodeSlots; i++) nodes[i] += other.nodes[i];
+  base64Bytes += other.base64Bytes;
+  callbacks += other.callbacks;
+  circularIds += other.circularIds;
+  if (other.maxDepth > maxDepth) maxDepth = other.maxDepth;
+  totalNs += other.totalNs;
+  base64Ns += other.base64Ns;
+  textNs += other.textNs;
+}
+
+static Napi::Number Milliseconds(const Napi::Env &env, uint64_t ns) {
+  return Napi::Number::New(env, static_cast<double>(ns) / 1e6);
+}
+
+Napi::Object Stats::ToObject(const Napi::Env &env, const char *callbacksName) const {
+  Napi::Object nodesObj = Napi::Object::New(env);
+  uint64_t counts[kNodeSlots] = {};
+  for (size_t i = 0; i < kNodeSlots; i++) {
+    size_t slot = i == static_cast<size_t>(ValueKind::kObject)
+                      ? static_cast<size_t>(ValueKind::kPlainObject)
+                      : i;
+    counts[slot] += nodes[i];
+  }
+  for (size_t i = 0; i < kNodeSlots; i++) {
+    if (counts[i] != 0) {
+      nodesObj.Set(kNodeNames[i], Napi::Number::New(env, static_cast<double>(counts[i])));
+    }
+  }
+
+  // Whatever is not base64 or text conversion is the walk over the value graph.
+  uint64_t walkNs = totalNs > base64Ns + textNs ? totalNs - base64Ns - textNs : 0;
+  Napi::Object time = Napi::Object::New(env);
+  time.Set("total", Milliseconds(env, totalNs));
+  time.Set("walk", Milliseconds(env, walkNs));
+  time.Set("base64", Milliseconds(env, base64Ns));
+  time.Set("text", Milliseconds(env, textNs));
+
+  Napi::Object out = Napi::Object::New(env);
+  out.Set("calls", Napi::Number::New(env, static_cast<double>(calls)));
+  out.Set("nodes", nodesObj);
+  out.Set("base64Bytes", Napi::Number::New(env, static_cast<double>(base64Bytes)));
+  out.Set(callbacksName, Napi::Number::New(env, static_cast<double>(callbacks)));
+  out.Set("circularIds", Napi::Number::New(env, static_cast<double>(circularIds)));
+  out.Set("maxDepth", Napi::Number::New(env, static_cast<double>(maxDepth)));
+  out.Set("timeMs", time);
+  return out;
+}
+
+#if BAS_SERDE_STATS
+
+StatsRecorder::StatsRecorder(Stats *totals) : totals_(totals) {
+  if (totals_) {
+    stats_ = std::make_unique<Stats>();
+    stats_->calls = 1;
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+void StatsRecorder::Flush() {
+  if (!stats_) return;
+  stats_->totalNs += StatsTimer::ElapsedNs(start_);
+  totals_->Add(*stats_);
+  stats_.reset();
+}
+
+#endif
+
+}  // namespace bas_serde
@@ -0,0 +1,122 @@
+#ifndef BAS_UTILS_SERIALIZATION_STATS_H
+#define BAS_UTILS_SERIALIZATION_STATS_H
+
+#include <napi.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// Statistics are only collected while enabled with enableStats(). Building with
+// BAS_SERDE_STATS=0 removes the counters and timers from the codec entirely.
+#ifndef BAS_SERDE_STATS
+#define BAS_SERDE_STATS 1
+#endif
+
+namespace bas_serde {
+
+// Counters for one direction (encoding or decoding), summed over calls.
+struct Stats {
+  // Values by ValueKind, plus references to objects seen earlier.
+  static constexpr size_t kNodeSlots = 20;
+  static constexpr size_t kReferenceSlot = kNodeSlots - 1;
+
+  uint64_t calls = 0;
+  uint64_t nodes[kNodeSlots] = {};
+  uint64_t base64Bytes = 0;  // binary payload bytes encoded to or decoded from base64
+  uint64_t callbacks = 0;    // replacer or reviver calls
+  uint64_t circularIds = 0;  // $$id values written, or stored while decoding
+  uint64_t maxDepth = 0;     // deepest container nesting
+  uint64_t totalNs = 0;
+  uint64_t base64Ns = 0;
+  uint64_t textNs = 0;  // moving text or bytes between JS and native buffers
+
+  void Node(size_t slot) { nodes[slot]++; }
+  void Depth(uint64_t depth) {
+    if (depth > maxDepth) maxDepth = depth;
+  }
+  // A value written as a reference to an earlier object: counted as a
+  // reference rather than by its kind.
+  void Reference(size_t slot) {
+    nodes[slot]--;
+    nodes[kReferenceSlot]++;
+  }
+  void Add(const Stats &other);
+  Napi::Object ToObject(const Napi::Env &env, const char *callbacksName) const;
+};
+
+#if BAS_SERDE_STATS
+
+// Collects the statistics of one native call and adds them to the
+// environment's totals when flushed (at the latest when destroyed).
+class StatsRecorder {
+ public:
+  explicit StatsRecorder(Stats *totals);
+  ~StatsRecorder() { Flush(); }
+  StatsRecorder(const StatsRecorder &) = delete;
+  StatsRecorder &operator=(const StatsRecorder &) = delete;
+
+  // The counters of this call, or null while stats are off.
+  Stats *Get() const { return stats_.get(); }
+  void Flush();
+  // Drops this call's counters, for a context that only read options.
+  void Discard() { stats_.reset(); }
+
+ private:
+  Stats *totals_;
+  std::unique_ptr<Stats> stats_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Adds the time until the end of its scope to one of the timers.
+class StatsTimer {
+ public:
+  StatsTimer(Stats *stats, uint64_t Stats::*timer) : stats_(stats), timer_(timer) {
+    if (stats_) start_ = std::chrono::steady_clock::now();
+  }
+  ~StatsTimer() {
+    if (stats_) stats_->*timer_ += ElapsedNs(start_);
+  }
+  static uint64_t ElapsedNs(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count());
+  }
+
+ private:
+  Stats *stats_;
+  uint64_t Stats::*timer_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#define SERDE_STAT(recorder, ...)                                         \
+  do {                                                                    \
+    if (::bas_serde::Stats *serdeStats = (recorder).Get()) {              \
+      serdeStats->__VA_ARGS__;                                            \
+    }                                                                     \
+  } while (0)
+
+#else
+
+class StatsRecorder {
+ public:
+  explicit StatsRecorder(Stats *) {}
+  constexpr Stats *Get() const { return nullptr; }
+  void Flush() {}
+  void Discard() {}
+};
+
+class StatsTimer {
+ public:
+  StatsTimer(Stats *, uint64_t Stats::*) {}
+};
+
+#define SERDE_STAT(recorder, ...) \
+  do {                            \
+  } while (0)
+
+#endif
+
+}  // namespace bas_serde
+
+#endif
@@ -0,0 +1,89 @@
+#include "stream_decoder.h"
+
+#include "dictionary.h"
+
+namespace bas_serde {
+
+static Napi::Error ToSyntaxError(const Napi::Env &env, const JsonSyntaxError &err) {
+  Napi::Function ctor = env.Global().Get("SyntaxError").As<Napi::Function>();
+  return Napi::Error(env, ctor.New({Napi::String::New(env, err.what())}));
+}
+
+Napi::Function PushParser::Init(Napi::Env env) {
+  return DefineClass(env, "PushParser",
+                     {InstanceMethod("write", &PushParser::Write),
+                      InstanceMethod("end", &PushParser::End)});
+}
+
+PushParser::PushParser(const Napi::CallbackInfo &info)
+    : Napi::ObjectWrap<PushParser>(info) {
+  DecodeContext ctx(GetMutableAddonData(info.Env()));
+  ctx.stats.Discard();
+  Reviver reviver;
+  ReadParseOptions(info[0], reviver, ctx);
+  if (reviver.enabled) {
+    throw Napi::TypeError::New(info.Env(), "createParser does not support a reviver");
+  }
+  if (!ctx.attachments.IsEmpty()) {
+    attachments_ = Napi::Persistent(static_cast<Napi::Object>(ctx.attachments));
+  }
+  dictionary_ = HoldDictionary(info[0]);
+  maxDepth_ = ctx.maxDepth;
+}
+
+Napi::Value PushParser::Write(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (closed_) {
+    throw Napi::Error::New(env, "Parser has already ended");
+  }
+  Napi::Value chunk = info[0];
+  StatsTimer timer(GetAddonData(env).statsEnabled ? &writes_ : nullptr, &Stats::textNs);
+  try {
+    if (chunk.IsString()) {
+      std::string text = chunk.As<Napi::String>().Utf8Value();
+      writer_.Write(text.data(), text.size());
+    } else if (chunk.IsArrayBuffer()) {
+      Napi::ArrayBuffer buf = chunk.As<Napi::ArrayBuffer>();
+      writer_.Write(static_cast<const char *>(buf.Data()), buf.ByteLength());
+    } else if (chunk.IsTypedArray() &&
+               chunk.As<Napi::TypedArray>().TypedArrayType() == napi_uint8_array) {
+      Napi::Uint8Array view = chunk.As<Napi::Uint8Array>();
+      writer_.Write(reinterpret_cast<const char *>(view.Data()), view.ByteLength());
+    } else {
+      throw Napi::TypeError::New(env, "Expected a string or Buffer chunk");
+    }
+  } catch (const JsonSyntaxError &err) {
+    closed_ = true;
+    throw ToSyntaxError(env, err);
+  }
+  return env.Undefined();
+}
+
+Napi::Value PushParser::End(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  if (closed_) {
+    throw Napi::Error::New(env, "Parser has already ended");
+  }
+  closed_ = true;
+  try {
+    StatsTimer timer(GetAddonData(env).statsEnabled ? &writes_ : nullptr, &Stats::textNs);
+    writer_.End();
+  } catch (const JsonSyntaxError &err) {
+    throw ToSyntaxError(env, err);
+  }
+
+  AddonData &data = GetMutableAddonData(env);
+  DecodeContext ctx(data);
+  ctx.maxDepth = maxDepth_;
+  writes_.totalNs = writes_.textNs;
+  SERDE_STAT(ctx.stats, Add(writes_));
+  if (!attachments_.IsEmpty()) {
+    ctx.attachments = attachments_.Value().As<Napi::Array>();
+  }
+  if (!dictionary_.IsEmpty()) ctx.dictionary = Dictionary::Unwrap(dictionary_.Value());
+  Napi::Value result = ParseTape(env, tape_, data.ctors, Reviver(), ctx);
+  tape_ = JsonTape();
+  return result;
+}
+
+}  // namespace bas_serde
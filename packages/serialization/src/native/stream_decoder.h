@@ -0,0 +1,32 @@
+#ifndef BAS_UTILS_SERIALIZATION_STREAM_DECODER_H
+#define BAS_UTILS_SERIALIZATION_STREAM_DECODER_H
+
+#include "decode.h"
+
+namespace bas_serde {
+
+// Native half of createParser. Written chunks are tokenized straight away into
+// a JsonTape; end() builds the JS values from the finished tape.
+class PushParser : public Napi::ObjectWrap<PushParser> {
+ public:
+  static Napi::Function Init(Napi::Env env);
+  explicit PushParser(const Napi::CallbackInfo &info);
+
+ private:
+  // Accepts a string, Buffer/Uint8Array or ArrayBuffer chunk of the document.
+  Napi::Value Write(const Napi::CallbackInfo &info);
+  // Returns the decoded value; the parser cannot be written to afterwards.
+  Napi::Value End(const Napi::CallbackInfo &info);
+
+  JsonTape tape_;
+  JsonTapeWriter writer_{tape_};
+  Napi::ObjectReference attachments_;
+  Napi::ObjectReference dictionary_;
+  size_t maxDepth_ = kUnlimitedDepth;
+  bool closed_ = false;
+  Stats writes_;  // time spent tokenizing chunks, added to the stats of end()
+};
+
+}  // namespace bas_serde
+
+#endif
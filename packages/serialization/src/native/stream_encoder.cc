@@ -0,0 +1,131 @@
+#include "stream_encoder.h"
+
+#include <uv.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "dictionary.h"
+
+namespace bas_serde {
+
+// Largest single write; uv_buf_t lengths are 32-bit on Windows.
+constexpr size_t kMaxWriteSize = 1u << 30;
+
+size_t ReadChunkSize(const Napi::Value &optionsVal) {
+  if (!optionsVal.IsObject()) {
+    return kDefaultChunkSize;
+  }
+  Napi::Value sizeVal = optionsVal.As<Napi::Object>().Get("highWaterMark");
+  if (sizeVal.IsUndefined()) {
+    return kDefaultChunkSize;
+  }
+  double size = sizeVal.IsNumber() ? sizeVal.As<Napi::Number>().DoubleValue() : 0;
+  if (!(size >= 1 && size <= kMaxWriteSize) || std::floor(size) != size) {
+    throw Napi::TypeError::New(optionsVal.Env(),
+                               "highWaterMark must be a positive integer");
+  }
+  return static_cast<size_t>(size);
+}
+
+Napi::Function StringifyStream::Init(Napi::Env env) {
+  return DefineClass(env, "StringifyStream",
+                     {InstanceMethod("read", &StringifyStream::Read)});
+}
+
+StringifyStream::StringifyStream(const Napi::CallbackInfo &info)
+    : Napi::ObjectWrap<StringifyStream>(info), ctx_(GetMutableAddonData(info.Env())) {
+  Replacer replacer;
+  ReadStringifyOptions(info[1], replacer, ctx_);
+  dictionary_ = HoldDictionary(info[1]);
+  chunkSize_ = ReadChunkSize(info[1]);
+  encoder_ = std::make_unique<JsonEncoder>(ctx_, replacer);
+  encoder_->Start(info.Env(), info[0], true);
+  encoder_->Suspend(info.Env());
+}
+
+Napi::Value StringifyStream::Read(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  JsonWriter &out = ctx_.out;
+  if (out.Size() - flushed_ < chunkSize_ && encoder_ && !encoder_->Done()) {
+    // What is left over is shorter than a chunk, so moving it is cheap.
+    out.Discard(flushed_);
+    flushed_ = 0;
+    try {
+      encoder_->Resume(env);
+      if (encoder_->Run(env, chunkSize_)) ctx_.stats.Flush();
+      encoder_->Suspend(env);
+    } catch (...) {
+      // The stack is unusable after a failed step; the stream ends here.
+      encoder_.reset();
+      out.Clear();
+      throw;
+    }
+  }
+
+  size_t len = std::min(chunkSize_, out.Size() - flushed_);
+  if (len == 0) {
+    return env.Null();
+  }
+  StatsTimer timer(ctx_.stats.Get(), &Stats::textNs);
+  Napi::Buffer<char> chunk = Napi::Buffer<char>::Copy(env, out.Data() + flushed_, len);
+  flushed_ += len;
+  if (flushed_ == out.Size()) {
+    out.Clear();
+    flushed_ = 0;
+  }
+  return chunk;
+}
+
+// Writes all of `data`, waiting out EAGAIN from non-blocking pipes.
+static void WriteAll(const Napi::Env &env, uv_loop_t *loop, int fd, const char *data,
+                     size_t len) {
+  while (len > 0) {
+    uv_buf_t buf = uv_buf_init(const_cast<char *>(data),
+                               static_cast<unsigned int>(std::min(len, kMaxWriteSize)));
+    uv_fs_t req;
+    int result = uv_fs_write(loop, &req, fd, &buf, 1, -1, nullptr);
+    uv_fs_req_cleanup(&req);
+    if (result == UV_EAGAIN) {
+      uv_sleep(1);
+      continue;
+    }
+    if (result < 0) {
+      throw Napi::Error::New(env, std::string("write failed: ") + uv_strerror(result));
+    }
+    data += result;
+    len -= static_cast<size_t>(result);
+  }
+}
+
+size_t StringifyToFd(const Napi::Env &env, const Napi::Value &value, int fd,
+                     EncodeContext &ctx, const Replacer &replacer, size_t chunkSize) {
+  uv_loop_t *loop = nullptr;
+  if (napi_get_uv_event_loop(env, &loop) != napi_ok) {
+    std::string message = GetNapiErrorMessage(env);
+    throw Napi::Error::New(env, "napi_get_uv_event_loop failed: " + message);
+  }
+
+  JsonEncoder encoder(ctx, replacer);
+  encoder.Start(env, value, true);
+  size_t written = 0;
+  bool done = false;
+  while (!done) {
+    {
+      // Handles made while encoding a chunk are released with it.
+      Napi::HandleScope scope(env);
+      encoder.Resume(env);
+      done = encoder.Run(env, chunkSize);
+      if (!done) encoder.Suspend(env);
+    }
+    {
+      StatsTimer timer(ctx.stats.Get(), &Stats::textNs);
+      WriteAll(env, loop, fd, ctx.out.Data(), ctx.out.Size());
+    }
+    written += ctx.out.Size();
+    ctx.out.Clear();
+  }
+  return written;
+}
+
+}  // namespace bas_serde
@@ -0,0 +1,43 @@
+#ifndef BAS_UTILS_SERIALIZATION_STREAM_ENCODER_H
+#define BAS_UTILS_SERIALIZATION_STREAM_ENCODER_H
+
+#include <memory>
+
+#include "encode.h"
+
+namespace bas_serde {
+
+constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+// Reads the `highWaterMark` option: the chunk size in bytes.
+size_t ReadChunkSize(const Napi::Value &options);
+
+// Native half of createStringifyStream. Each read() encodes only as much of the
+// value as one chunk needs, so memory stays bounded by the chunk size plus the
+// traversal stack instead of growing with the output.
+class StringifyStream : public Napi::ObjectWrap<StringifyStream> {
+ public:
+  static Napi::Function Init(Napi::Env env);
+  explicit StringifyStream(const Napi::CallbackInfo &info);
+
+ private:
+  // Returns the next chunk of UTF-8 text as a Buffer, or null once done.
+  Napi::Value Read(const Napi::CallbackInfo &info);
+
+  EncodeContext ctx_;
+  // Keeps the dictionary ctx_ writes references to alive between reads.
+  Napi::ObjectReference dictionary_;
+  std::unique_ptr<JsonEncoder> encoder_;
+  size_t chunkSize_ = kDefaultChunkSize;
+  // Bytes at the start of ctx_.out that were already returned.
+  size_t flushed_ = 0;
+};
+
+// Writes the JSON text for value to `fd` in chunks of about `chunkSize` bytes
+// and returns the number of bytes written.
+size_t StringifyToFd(const Napi::Env &env, const Napi::Value &value, int fd,
+                     EncodeContext &ctx, const Replacer &replacer, size_t chunkSize);
+
+}  // namespace bas_serde
+
+#endif
@@ -1,5 +1,28 @@
+import { closeSync, mkdtempSync, openSync, readFileSync, rmSync } from 'node:fs';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { gunzipSync, inflateSync } from 'node:zlib';
 import { describe, it, expect } from 'vitest';
-import { stringify, parse } from '../src/index.js';
+import {
+  stringify,
+  parse,
+  createStringifyStream,
+  stringifyToFd,
+  createParser,
+  stringifyAsync,
+  parseAsync,
+  parseLazy,
+  registerShape,
+  stringifyBinary,
+  parseBinary,
+  trainDictionary,
+  createDictionary,
+  diff,
+  applyPatch,
+  enableStats,
+  getStats,
+  resetStats,
+} from '../src/index.js';
 
 function assertNativeAvailable(): void {
   if (process.env.SKIP_NATIVE === '1') {
@@ -36,6 +59,11 @@ describe('serialization', () => {
     expect(output.negInf).toBe(-Infinity);
     expect(output.undef).toBeUndefined();
     expect(output.bigint).toBe(123n);
+
+    for (const options of [{}, { reviver: (value: unknown) => value }]) {
+      expect(parse('{"$$type":"Number","value":"1e3"}', options)).toBe(1000);
+      expect(parse('{"$$type":"Number","value":"x"}', options)).toBe(NaN);
+    }
   });
 
   it('roundtrips Set and Map', () => {
@@ -65,6 +93,14 @@ describe('serialization', () => {
 
     expect(output.date instanceof Date).toBe(true);
     expect(output.date.toISOString()).toBe('2024-01-01T00:00:00.000Z');
+    const invalid = parse('{"$$type":"Date"}') as Date;
+    expect(invalid instanceof Date).toBe(true);
+    expect(Number.isNaN(invalid.getTime())).toBe(true);
+    for (const type of ['RegExp', 'Number', 'BigInt']) {
+      const text = `{"$$type":"${type}"}`;
+      expect(() => parse(text)).toThrow('Malformed wrapper payload');
+      expect(() => parse(text, { reviver: (value: unknown) => value })).toThrow(TypeError);
+    }
 
     expect(output.regex instanceof RegExp).toBe(true);
     expect(output.regex.source).toBe('test');
@@ -86,6 +122,76 @@ describe('serialization', () => {
     expect(Array.from(arrayView)).toEqual([1, 2, 3]);
   });
 
+  it('roundtrips large binary payloads', () => {
+    const bytes = new Uint8Array(100_003);
+    for (let i = 0; i < bytes.length; i++) {
+      bytes[i] = (i * 131 + 7) & 0xff;
+    }
+    const buf = Buffer.from(bytes);
+
+    const encoded = stringify({ buf, floats: new Float32Array(bytes.buffer, 0, 25_000) });
+    expect(encoded).toContain(buf.toString('base64'));
+
+    const output = parse(encoded) as { buf: Buffer; floats: Float32Array };
+    expect(output.buf.equals(buf)).toBe(true);
+    expect(Buffer.from(output.floats.buffer).equals(buf.subarray(0, 100_000))).toBe(true);
+  });
+
+  it('rejects malformed base64 payloads', () => {
+    expect(() => parse('{"$$type":"Buffer","value":"aGVsbG8*"}')).toThrow(TypeError);
+    expect(() => parse('{"$$type":"Buffer","value":"aGVsbG8"}')).toThrow(TypeError);
+    expect(() => parse('{"$$type":"ArrayBuffer","value":"aG=sbG8="}')).toThrow(TypeError);
+  });
+
+  it('moves binary payloads out of band with external attachments', () => {
+    const buf = Buffer.from('hello');
+    const backing = new ArrayBuffer(16);
+    const floats = new Float32Array(backing, 4, 2);
+    floats.set([1.5, -2]);
+    const view = new DataView(backing, 2, 4);
+
+    const { text, attachments } = stringify(
+      { buf, floats, view, raw: backing },
+      { attachments: 'external' }
+    );
+    expect(text).not.toContain(buf.toString('base64'));
+    expect(attachments).toEqual([buf, floats, view, backing]);
+
+    // Frames typically arrive packed into one receive buffer.
+    const frame = Buffer.alloc(64);
+    const received = attachments.map((part, i) => {
+      const bytes = ArrayBuffer.isView(part)
+        ? new Uint8Array(part.buffer, part.byteOffset, part.byteLength)
+        : new Uint8Array(part);
+      const offset = i * 16;
+      frame.set(bytes, offset);
+      return frame.subarray(offset, offset + bytes.length);
+    });
+
+    const output = parse(text, { attachments: received }) as {
+      buf: Buffer;
+      floats: Float32Array;
+      view: DataView;
+      raw: ArrayBuffer;
+    };
+    expect(output.buf.toString()).toBe('hello');
+    expect(Array.from(output.floats)).toEqual([1.5, -2]);
+    expect(output.view.byteLength).toBe(4);
+    expect(new Uint8Array(output.raw).length).toBe(16);
+
+    // Views share the received memory instead of copying it.
+    expect(output.buf.buffer).toBe(frame.buffer);
+    expect(output.floats.buffer).toBe(frame.buffer);
+    frame[0] = 'j'.charCodeAt(0);
+    expect(output.buf.toString()).toBe('jello');
+  });
+
+  it('rejects missing or undersized attachments', () => {
+    const { text } = stringify(new Float64Array(4), { attachments: 'external' });
+    expect(() => parse(text)).toThrow(TypeError);
+    expect(() => parse(text, { attachments: [new ArrayBuffer(8)] })).toThrow(TypeError);
+  });
+
   it('roundtrips TypedArray and DataView', () => {
     const typed = new Uint16Array([500, 1000]);
     const viewBuffer = new ArrayBuffer(4);
@@ -105,6 +211,193 @@ describe('serialization', () => {
     expect(output.view.getUint8(1)).toBe(9);
   });
 
+  it('keeps views over one ArrayBuffer shared with shareArrayBuffers', () => {
+    const buffer = new ArrayBuffer(64);
+    new Uint8Array(buffer).forEach((_, i, bytes) => (bytes[i] = i));
+    const value = {
+      floats: new Float32Array(buffer, 8, 4),
+      view: new DataView(buffer, 32),
+      bytes: new Uint8Array(buffer, 60),
+      buffer,
+    };
+
+    const text = stringify(value, { shareArrayBuffers: true });
+    const output = parse(text) as typeof value;
+
+    expect(text.match(/"ArrayBuffer"/g)?.length).toBe(1);
+    expect(output.floats.buffer).toBe(output.buffer);
+    expect(output.view.buffer).toBe(output.buffer);
+    expect(output.bytes.buffer).toBe(output.buffer);
+    expect(output.floats.byteOffset).toBe(8);
+    expect(output.view.byteOffset).toBe(32);
+    expect(Array.from(output.bytes)).toEqual([60, 61, 62, 63]);
+    output.view.setUint8(28, 99);
+    expect(output.bytes[0]).toBe(99);
+  });
+
+  it('writes repeated long strings once with dedupeStrings', () => {
+    const tenant = 'tenant-0f8e7d6c-5b4a-3928-1706-f5e4d3c2b1a0';
+    const symbol = '\u{1F4C8} quarterly-revenue-forecast-adjusted';
+    const value = {
+      rows: Array.from({ length: 20 }, (_, id) => ({ id, tenant, symbol, status: 'open' })),
+      tags: new Set([tenant]),
+    };
+
+    const plain = stringify(value);
+    const text = stringify(value, { dedupeStrings: true });
+    const output = parse(text) as typeof value;
+
+    expect(text.length < plain.length).toBe(true);
+    expect(text.split(tenant).length).toBe(2);
+    expect(output).toEqual(value);
+    expect(output.rows[19].symbol).toBe(symbol);
+    expect(parse(text, { reviver: (v) => v, reviverTypes: ['string'] })).toEqual(value);
+  });
+
+  it('writes repeated short strings by reference with dedupeStrings', () => {
+    const statuses = ['open', 'filled', 'cancelled'];
+    const symbols = ['AAPL', 'MSFT', 'NVDA', 'BRK.B'];
+    const value = Array.from({ length: 300 }, (_, i) => ({
+      status: statuses[i % 3],
+      tenant: `acme-${i % 5}`,
+      symbol: symbols[i % 4],
+      note: i % 100 === 0 ? '~ manual' : '',
+    }));
+
+    const plain = stringify(value);
+    const text = stringify(value, { dedupeStrings: true });
+
+    expect(text.length < plain.length * 0.9).toBe(true);
+    for (const name of [...statuses, ...symbols, 'acme-0']) {
+      expect(text.split(`"${name}"`).length).toBe(2);
+    }
+    expect(parse(text)).toEqual(value);
+    expect(() => parse('{"$$type":"DedupedStrings","strings":["a"],"value":"~1"}')).toThrow(
+      'Unknown string reference'
+    );
+  });
+
+  it('writes keys and values from a dictionary as references', () => {
+    const message = (i: number) => ({
+      type: 'order.updated',
+      tenantId: 'tenant-0042',
+      status: ['open', 'closed'][i % 2],
+      '~note': i % 3 === 0 ? '~ manual' : 'open',
+      seq: i,
+    });
+    const dictionary = trainDictionary(Array.from({ length: 50 }, (_, i) => message(i)));
+    const value = Array.from({ length: 20 }, (_, i) => message(i));
+
+    const text = stringify(value, { dictionary });
+    expect(text.length).toBeLessThan(stringify(value).length * 0.7);
+    expect(text).not.toContain('tenantId');
+    expect(parse(text, { dictionary: createDictionary(dictionary.strings) })).toEqual(value);
+    expect(parse(stringify(value, { dictionary, dedupeStrings: true }), { dictionary })).toEqual(
+      value
+    );
+    expect(() => parse(text)).toThrow(TypeError);
+    expect(() => parse(text, { dictionary: createDictionary(['seq']) })).toThrow(TypeError);
+  });
+
+  it('compresses output and parses compressed input with compress', () => {
+    const value = {
+      rows: Array.from({ length: 500 }, (_, id) => ({ id, name: `row-${id % 10}` })),
+      when: new Date(0),
+      data: new Uint8Array([1, 2, 3]),
+    };
+    const text = stringify(value);
+
+    const gzip = stringify(value, { compress: 'gzip' });
+    const deflate = stringify(value, { compress: 'deflate' });
+
+    expect(gzip.length).toBeLessThan(text.length / 5);
+    expect(gunzipSync(gzip).toString()).toBe(text);
+    expect(inflateSync(deflate).toString()).toBe(text);
+    expect(parse(gzip)).toEqual(value);
+    expect(parse(new Uint8Array(deflate))).toEqual(value);
+    expect(parse(gzip, { reviver: (v) => v })).toEqual(value);
+    expect(() => parse(gzip.subarray(0, gzip.length - 8))).toThrow('Invalid compressed data');
+  });
+
+  it('writes the changes between two snapshots with diff and replays them with applyPatch', () => {
+    const snapshot = () => ({
+      rows: Array.from({ length: 200 }, (_, id) => ({ id, name: `row-${id}`, at: new Date(id) })),
+      index: new Map<unknown, unknown>([['a', { n: 1 }], [2n, 'two']]),
+      tags: new Set(['x', 'y']),
+      pixels: new Uint8Array(4096),
+    });
+    const prev = snapshot();
+    const next = snapshot();
+    next.rows[150].name = 'changed';
+    next.rows.push({ id: -1, name: 'new', at: new Date(0) });
+    next.index.set('a', { n: 2 });
+    next.index.delete(2n);
+    next.tags.delete('x');
+    next.tags.add('z');
+    next.pixels[1000] = 7;
+
+    const patch = diff(prev, next);
+    expect(patch.length * 20).toBeLessThan(stringify(next).length);
+    expect(diff(prev, snapshot())).toBe('[]');
+    const replica = parse(stringify(prev));
+    expect(applyPatch(replica, patch)).toBe(replica);
+    expect(stringify(replica)).toBe(stringify(next));
+    expect(applyPatch(replica, diff(next, [1]))).toEqual([1]);
+    expect(() => applyPatch({}, patch)).toThrow('Invalid patch');
+  });
+
+  it('decodes members on first read with parseLazy', () => {
+    const shared = { k: 1 };
+    const cycle: Record<string, unknown> = { n: 1 };
+    cycle.self = cycle;
+    const input = {
+      headers: { route: '/orders', id: 7 },
+      body: { rows: [shared, shared], blob: Buffer.from('payload'), index: new Map([[1, cycle]]) },
+      extra: { deep: { same: shared }, cycle },
+    };
+    const text = stringify(input, { circularReferences: true });
+    const output = parseLazy(text) as typeof input;
+    expect(Object.keys(output)).toEqual(['headers', 'body', 'extra']);
+    expect(typeof Object.getOwnPropertyDescriptor(output, 'body')?.get).toBe('function');
+    expect(output.headers).toEqual({ route: '/orders', id: 7 });
+    expect(Object.getOwnPropertyDescriptor(output, 'headers')?.value).toBe(output.headers);
+    // References read before the value they point to.
+    expect(output.extra.deep.same).toBe(output.body.rows[1]);
+    expect(output.extra.cycle.self).toBe(output.body.index.get(1));
+    expect(output.body.blob.equals(input.body.blob)).toBe(true);
+    expect(stringify(output, { circularReferences: true })).toBe(text);
+    const assigned = parseLazy(stringify(input, { circularReferences: true })) as typeof input;
+    assigned.body = input.body;
+    expect(assigned.body).toBe(input.body);
+    expect(parseLazy('[1, {"a": [2]}]')).toEqual([1, { a: [2] }]);
+    expect(() => parseLazy('{"a":')).toThrow(SyntaxError);
+  });
+
+  it('classifies subclasses and non-plain objects', () => {
+    class Point {
+      x: number;
+      y: number;
+      constructor(x: number, y: number) {
+        this.x = x;
+        this.y = y;
+      }
+    }
+    class Stamp extends Date {}
+    class Tags extends Set<string> {}
+    const bare = Object.create(null);
+    bare.k = 'v';
+
+    const output = parse(
+      stringify({ point: new Point(1, 2), stamp: new Stamp(0), tags: new Tags(['a']), bare })
+    ) as { point: unknown; stamp: Date; tags: Set<string>; bare: unknown };
+
+    expect(output.point).toEqual({ x: 1, y: 2 });
+    expect(output.stamp instanceof Date).toBe(true);
+    expect(output.stamp.getTime()).toBe(0);
+    expect(Array.from(output.tags)).toEqual(['a']);
+    expect(output.bare).toEqual({ k: 'v' });
+  });
+
   it('preserves array holes', () => {
     const input: Array<number> = [];
     input[2] = 5;
@@ -117,6 +410,119 @@ describe('serialization', () => {
     expect(output[2]).toBe(5);
   });
 
+  it('decodes only exact $$type names as wrappers', () => {
+    const names = ['Sex', 'set', 'Dat', 'Datee', 'PropKeyStrinx', 'ArrayBufferArrayBuffer', ''];
+    // Longer than the name buffer, ending in multi-byte characters.
+    names.push('PropKeyString€', 'DedupedStringsé', `Date${'é'.repeat(20)}`);
+    const text = JSON.stringify(names.map((name) => ({ $$type: name, value: 1 })));
+    const expected = names.map((name) => ({ $$type: name, value: 1 }));
+
+    expect(parse(text)).toEqual(expected);
+    expect(parse(text, { reviver: (value) => value })).toEqual(expected);
+    expect(parse('[{"value":[],"$$type":"Set"}]')).toEqual([new Set()]);
+
+    // DedupedStrings is only a header at the root. PackedArray is read anywhere, so objects
+    // that earlier versions wrote with this $$type now read back as arrays.
+    const nested = [{ $$type: 'DedupedStrings', value: 1 }];
+    expect(parse(JSON.stringify(nested))).toEqual(nested);
+    expect(parse(JSON.stringify(nested), { reviver: (value) => value })).toEqual(nested);
+    expect(parse('{"$$type":"PackedArray","value":"AAAAAAAA8D8=","length":1}')).toEqual([1]);
+  });
+
+  it('packs all-number arrays with packNumbers', () => {
+    const series = Array.from({ length: 64 }, (_, i) => Math.sin(i));
+    series[1] = -0;
+    series[2] = NaN;
+    // Unpacked, -0 is written as 0, as JSON.stringify does; only packing keeps it.
+    const value = { series, short: [1, 2, 3], mixed: [...series.slice(2), 'x'] };
+
+    const text = stringify(value, { packNumbers: true });
+    const output = parse(text) as typeof value;
+    const viaReviver = parse(text, { reviver: (item) => item }) as typeof value;
+    const { text: external, attachments } = stringify(value, {
+      packNumbers: true,
+      attachments: 'external',
+    });
+    const viaAttachment = parse(external, { attachments }) as typeof value;
+
+    expect(text.match(/"PackedArray"/g)?.length).toBe(1);
+    for (const decoded of [output, viaReviver, viaAttachment]) {
+      expect(Array.isArray(decoded.series)).toBe(true);
+      expect(decoded.series).toEqual(series);
+      expect(Object.is(decoded.series[1], -0)).toBe(true);
+      expect(decoded.short).toEqual([1, 2, 3]);
+      expect(decoded.mixed).toEqual(value.mixed);
+    }
+    expect(attachments.length).toBe(1);
+    expect(stringify(value, { packNumbers: true, replacer: () => undefined })).toBe(
+      stringify(value)
+    );
+  });
+
+  it('encodes and decodes registered shapes', () => {
+    registerShape(['shapeId', 'shapeName', 'shapeTags']);
+    registerShape(['shapeId', 'shapeName']);
+    const value = [
+      { shapeId: 1, shapeName: 'a', shapeTags: [{ shapeId: 2, shapeName: 'b' }] },
+      { shapeId: 3, shapeName: 'c', shapeTags: [], extra: new Date(0) },
+      { shapeId: 4 },
+      { shapeName: 'd', shapeId: 5 },
+    ];
+    const text = stringify(value);
+
+    expect(text.startsWith(`[${JSON.stringify(value[0])},`)).toBe(true);
+    expect(text.endsWith(`,${JSON.stringify(value.slice(2)).slice(1)}`)).toBe(true);
+    for (const decoded of [parse(text), parse(text, { reviver: (item) => item })]) {
+      expect(decoded).toEqual(value);
+      expect(Object.keys((decoded as object[])[3])).toEqual(['shapeName', 'shapeId']);
+    }
+    expect(() => registerShape(['shapeId', 'shapeId'])).toThrow('Shape keys must be unique');
+    expect(() => registerShape([])).toThrow(TypeError);
+  });
+
+  it('collects statistics while enabled', () => {
+    const value: any = { list: [1, 'a', new Date(0)], bytes: Buffer.from('abc') };
+    value.self = value;
+    resetStats();
+    enableStats();
+    try {
+      const text = stringify(value, { circularReferences: true, replacer: () => {} });
+      parseBinary(stringifyBinary([[1]]));
+      parse(text);
+      const stats = getStats();
+      const { timeMs: encodeTime, ...encoded } = stats.stringify;
+      const { timeMs: decodeTime, ...decoded } = stats.parse;
+      const nodes = { object: 1, Array: 3, number: 2, string: 1, Date: 1, Buffer: 1 };
+
+      expect(stats.enabled).toBe(true);
+      expect(encoded).toEqual({
+        calls: 2,
+        nodes: { ...nodes, reference: 1 },
+        base64Bytes: 3,
+        replacerCalls: 7,
+        circularIds: 4,
+        maxDepth: 2,
+      });
+      expect(decoded).toEqual({
+        calls: 2,
+        nodes: { ...nodes, reference: 1 },
+        base64Bytes: 3,
+        reviverCalls: 0,
+        circularIds: 4,
+        maxDepth: 2,
+      });
+      for (const time of [encodeTime, decodeTime]) {
+        expect(time.total).toBeGreaterThanOrEqual(time.base64 + time.text);
+      }
+    } finally {
+      enableStats(false);
+    }
+    stringify(1);
+    expect(getStats().stringify.calls).toBe(2);
+    resetStats();
+    expect(getStats().parse.calls).toBe(0);
+  });
+
   it('throws on circular references', () => {
     const obj: Record<string, unknown> = {};
     obj.self = obj;
@@ -134,6 +540,70 @@ describe('serialization', () => {
     expect(output.self).toBe(output);
   });
 
+  it('resolves circular references into Set and Map', () => {
+    const set: Set<unknown> = new Set();
+    const map: Map<string, unknown> = new Map();
+    set.add(set);
+    set.add(map);
+    map.set('owner', set);
+    map.set('self', map);
+
+    const output = parse(stringify(set, { circularReferences: true })) as Set<any>;
+    const [first, second] = Array.from(output.values());
+
+    expect(first).toBe(output);
+    expect(second instanceof Map).toBe(true);
+    expect(second.get('owner')).toBe(output);
+    expect(second.get('self')).toBe(second);
+
+    // Each Map's $$id follows its entries; a reference back to the root from
+    // deep inside must not re-decode every level in between.
+    const root = new Map();
+    let inner = root;
+    for (let i = 0; i < 2000; i++) inner.set('next', (inner = new Map()));
+    inner.set('root', root);
+    const started = Date.now();
+    let nested = parse(stringify(root, { circularReferences: true })) as Map<string, any>;
+    expect(Date.now() - started).toBeLessThan(1000);
+    const decodedRoot = nested;
+    for (let i = 0; i < 2000; i++) nested = nested.get('next');
+    expect(nested.get('root')).toBe(decodedRoot);
+  });
+
+  it('decodes deeply nested values and enforces maxDepth', () => {
+    let list: any = null;
+    for (let i = 0; i < 100_000; i++) list = { next: list, item: [i] };
+
+    let output = parse(stringify(list)) as any;
+    let binary = parseBinary(stringifyBinary(list)) as any;
+    for (let i = 99_999; i >= 0; i--) {
+      expect(output.item[0]).toBe(i);
+      expect(binary.item[0]).toBe(i);
+      output = output.next;
+      binary = binary.next;
+    }
+    expect(output).toBe(null);
+    expect(binary).toBe(null);
+
+    const value = { a: [new Set([new Map([[1, [2]]])])] };
+    expect(() => stringify(value, { maxDepth: 4 })).toThrow(RangeError);
+    expect(() => stringifyBinary(value, { maxDepth: 4 })).toThrow(RangeError);
+    expect(() => parse(stringify(value), { maxDepth: 4 })).toThrow(RangeError);
+    expect(() => parseBinary(stringifyBinary(value), { maxDepth: 4 })).toThrow(RangeError);
+    expect(parse(stringify(value), { maxDepth: 5 })).toEqual(value);
+    expect(() => parse('1', { maxDepth: 0 })).toThrow(TypeError);
+  });
+
+  it('throws SyntaxError on malformed input', () => {
+    expect(() => parse('{"a":1,}')).toThrow(SyntaxError);
+    expect(() => parse('[1] 2')).toThrow(SyntaxError);
+    expect(() => parse('[1] 2')).toThrow('Unexpected non-whitespace character after JSON at position 4');
+    expect(() => parse('')).toThrow(SyntaxError);
+    // A syntax error anywhere wins over an earlier malformed wrapper.
+    expect(() => parse('[{"$$type":"Buffer","value":"*"},{"a":1,}]')).toThrow(SyntaxError);
+    expect(() => parse('[{"$$type":"Buffer","value":"*"},{"a":1}]')).toThrow(TypeError);
+  });
+
   it('throws on unsupported values', () => {
     expect(() => stringify(() => {})).toThrow(TypeError);
     expect(() => stringify(Symbol('x'))).toThrow(TypeError);
@@ -185,6 +655,25 @@ describe('serialization', () => {
     expect(output.c).toBe('keep');
   });
 
+  it('calls the replacer only for replacerTypes', () => {
+    const input = { when: new Date(0), secret: new Map([['k', 1]]), n: 1, items: [2, 'x'] };
+    const seen: string[] = [];
+    const replacer = (value: unknown, replace: (next: unknown) => void) => {
+      seen.push(Object.prototype.toString.call(value));
+      if (value instanceof Map) replace('[redacted]');
+    };
+
+    const text = stringify(input, { replacer, replacerTypes: ['Date', 'Map'] });
+    const binary = stringifyBinary(input, { replacer, replacerTypes: ['Map'] });
+
+    expect(seen).toEqual(['[object Date]', '[object Map]', '[object Map]']);
+    expect(parse(text)).toEqual({ ...input, secret: '[redacted]' });
+    expect(parseBinary(binary)).toEqual({ ...input, secret: '[redacted]' });
+    expect(() => stringify(input, { replacer, replacerTypes: ['Symbol' as 'Map'] })).toThrow(
+      'Unknown replacerTypes entry: Symbol'
+    );
+  });
+
   it('supports reviver callback on parse', () => {
     const input = { a: 1, b: 2 };
     const output = parse(stringify(input), {
@@ -199,4 +688,320 @@ describe('serialization', () => {
     expect(output.a).toBe(1);
     expect(output.b).toBe(20);
   });
+
+  it('decodes repeated and __proto__ keys as own properties', () => {
+    const text = '[{"__proto__":{"polluted":1},"key":1},{"__proto__":2,"key":2}]';
+    const rows = Array.from({ length: 100 }, (_, i) => ({ id: i, ['k'.repeat(80)]: i }));
+
+    for (const reviver of [undefined, (item: unknown) => item]) {
+      const [first, second] = parse(text, { reviver }) as Array<Record<string, unknown>>;
+      expect(Object.getPrototypeOf(first)).toBe(Object.prototype);
+      expect(Object.keys(first)).toEqual(['__proto__', 'key']);
+      expect(first.polluted).toBeUndefined();
+      expect(Object.keys(second)).toEqual(['__proto__', 'key']);
+      expect(parse(stringify(rows), { reviver })).toEqual(rows);
+    }
+    expect(parseBinary(stringifyBinary(rows))).toEqual(rows);
+  });
+
+  it('revives decoded values selected by reviverTypes and reviverKeys', async () => {
+    const input = {
+      when: new Date(5),
+      list: [1, new Date(6)],
+      byName: new Map([['k', new Date(7)]]),
+      nested: { when: 'text' },
+    };
+    const text = stringify(input);
+    const calls: unknown[] = [];
+    const reviver = (value: unknown, key?: unknown) => {
+      calls.push(key);
+      return value instanceof Date ? value.getTime() : `${String(key)}:${String(value)}`;
+    };
+
+    const byType = parse(text, { reviver, reviverTypes: ['Date'] });
+    expect(calls).toEqual(['when', 1, 'k']);
+    expect(byType).toEqual({ ...input, when: 5, list: [1, 6], byName: new Map([['k', 7]]) });
+
+    calls.length = 0;
+    const byKey = parse(text, { reviver, reviverKeys: ['when'] }) as typeof input;
+    expect(calls).toEqual(['when', 'when']);
+    expect(byKey.when).toBe(5);
+    expect(byKey.nested.when).toBe('when:text');
+
+    const async = await parseAsync(text, { reviver, reviverTypes: ['Date'] });
+    expect(async).toEqual(byType);
+    expect(() => parse(text, { reviver, reviverTypes: ['date' as 'Date'] })).toThrow(
+      'Unknown reviverTypes entry: date'
+    );
+  });
+
+  describe('binary format', () => {
+    it('roundtrips every supported type', () => {
+      const err = new RangeError('out of range');
+      (err as any).code = 7;
+      (err as any)[Symbol.for('errMeta')] = 'sym-value';
+      const sparse: number[] = [];
+      sparse[2] = 5;
+      const input = {
+        str: 'héllo',
+        wide: 'snow \u2603 \ud83d\ude00 \ud800',
+        ints: [0, -1, 42, 2 ** 40, -(2 ** 52)],
+        doubles: [0.5, -0, NaN, Infinity, -Infinity, 1e300],
+        flags: [true, false, null, undefined],
+        big: [0n, -123n, 2n ** 100n],
+        date: new Date('2024-01-01T00:00:00.000Z'),
+        regex: /te.st/gi,
+        set: new Set([1, 'a']),
+        map: new Map<unknown, unknown>([[{ k: 1 }, [2]]]),
+        buf: Buffer.from('hello'),
+        arrayBuf: new Uint8Array([1, 2, 3]).buffer,
+        typed: new Float64Array([1.5, -2.25]),
+        view: new DataView(new Uint8Array([7, 9]).buffer),
+        sparse,
+        err,
+      };
+
+      const output = parseBinary(stringifyBinary(input)) as any;
+
+      expect(output.str).toBe(input.str);
+      expect(output.wide).toBe(input.wide);
+      expect(output.ints).toEqual(input.ints);
+      expect(Object.is(output.doubles[1], -0)).toBe(true);
+      expect(Number.isNaN(output.doubles[2])).toBe(true);
+      expect(output.doubles.slice(3)).toEqual(input.doubles.slice(3));
+      expect(output.flags).toEqual(input.flags);
+      expect(output.big).toEqual(input.big);
+      expect(output.date.getTime()).toBe(input.date.getTime());
+      expect(output.regex.source).toBe('te.st');
+      expect(output.regex.flags).toBe('gi');
+      expect(Array.from(output.set)).toEqual([1, 'a']);
+      expect(Array.from(output.map)).toEqual([[{ k: 1 }, [2]]]);
+      expect(output.buf.equals(input.buf)).toBe(true);
+      expect(Array.from(new Uint8Array(output.arrayBuf))).toEqual([1, 2, 3]);
+      expect(output.typed instanceof Float64Array).toBe(true);
+      expect(Array.from(output.typed)).toEqual([1.5, -2.25]);
+      expect(output.view.getUint8(1)).toBe(9);
+      expect(output.sparse.length).toBe(3);
+      expect(0 in output.sparse).toBe(false);
+      expect(output.err instanceof RangeError).toBe(true);
+      expect(output.err.message).toBe('out of range');
+      expect(output.err.code).toBe(7);
+      expect(output.err[Symbol.for('errMeta')]).toBe('sym-value');
+    });
+
+    it('restores shared and circular references', () => {
+      const shared = { name: 'shared' };
+      const root: any = { a: shared, b: shared, list: [] };
+      root.list.push(root);
+
+      const output = parseBinary(stringifyBinary(root, { circularReferences: true })) as any;
+
+      expect(output.a).toBe(output.b);
+      expect(output.list[0]).toBe(output);
+      expect(() => stringifyBinary(root)).toThrow(TypeError);
+    });
+
+    it('is smaller than the text format', () => {
+      const rows = Array.from({ length: 100 }, (_, i) => ({
+        id: i,
+        score: i / 3,
+        samples: new Float32Array(16),
+      }));
+
+      expect(stringifyBinary(rows).length * 2).toBeLessThan(stringify(rows).length);
+    });
+
+    it('rejects malformed payloads', () => {
+      const encoded = stringifyBinary({ a: [1, 2, 3] });
+      expect(() => parseBinary(encoded.subarray(0, encoded.length - 1))).toThrow(TypeError);
+      expect(() => parseBinary(Buffer.from('{"a":1}'))).toThrow(TypeError);
+      expect(() => parseBinary(Buffer.concat([encoded, Buffer.from([0])]))).toThrow(TypeError);
+    });
+
+    it('writes strings from a trained dictionary as indexes', () => {
+      const message = (i: number) => ({
+        type: 'order.updated',
+        tenantId: 'tenant-0042',
+        status: ['open', 'closed'][i % 2],
+        tags: new Set(['priority']),
+        seq: i,
+      });
+      const dictionary = trainDictionary(Array.from({ length: 50 }, (_, i) => message(i)));
+      expect(dictionary.strings).toContain('tenantId');
+      expect(dictionary.strings).toContain('order.updated');
+
+      const encoded = stringifyBinary(message(7), { dictionary });
+      expect(encoded.length * 2).toBeLessThan(stringifyBinary(message(7)).length);
+      const restored = createDictionary(dictionary.strings);
+      expect(parseBinary(encoded, { dictionary: restored })).toEqual(message(7));
+      expect(() => parseBinary(encoded)).toThrow(TypeError);
+      expect(() => parseBinary(encoded, { dictionary: createDictionary(['seq']) })).toThrow(
+        TypeError
+      );
+    });
+  });
+
+  describe('async API', () => {
+    const sample = () => {
+      const shared = { tag: 'shared \u2603 "quoted"\n' };
+      return {
+        nums: [0, -0.5, 1e21, 123456789.123, NaN],
+        text: 'x'.repeat(1000) + '\ud800',
+        buf: Buffer.from('async payload'),
+        typed: new Int16Array([1, -2, 3]),
+        when: new Date(0),
+        set: new Set([shared, shared]),
+        map: new Map([['k', shared]]),
+      };
+    };
+
+    it('produces the same text as stringify', async () => {
+      const input = sample();
+      expect(await stringifyAsync(input)).toBe(stringify(input));
+      expect(await stringifyAsync(input, { circularReferences: true })).toBe(
+        stringify(input, { circularReferences: true })
+      );
+
+      const { text, attachments } = await stringifyAsync(input, { attachments: 'external' });
+      expect(text).toBe(stringify(input, { attachments: 'external' }).text);
+      expect(attachments).toEqual([input.buf, input.typed]);
+    });
+
+    it('decodes the same values as parse', async () => {
+      const input = sample();
+      const encoded = stringify(input, { circularReferences: true });
+      const output = (await parseAsync(encoded)) as ReturnType<typeof sample>;
+
+      expect(stringify(output, { circularReferences: true })).toBe(encoded);
+      expect(output.map.get('k')).toBe(Array.from(output.set)[0]);
+      expect(output.buf.toString()).toBe('async payload');
+
+      const revived = await parseAsync(stringify({ a: 1, b: 2 }), {
+        reviver: (value) => (value === 2 ? 20 : value),
+      });
+      expect(revived).toEqual({ a: 1, b: 20 });
+    });
+
+    it('rejects instead of throwing', async () => {
+      const obj: Record<string, unknown> = {};
+      obj.self = obj;
+
+      await expect(stringifyAsync(obj)).rejects.toThrow(TypeError);
+      await expect(parseAsync('{"a":')).rejects.toThrow(SyntaxError);
+      await expect(parseAsync('{"$$type":"Buffer","value":"a*=="}')).rejects.toThrow(TypeError);
+    });
+  });
+
+  describe('streaming encoder', () => {
+    const sample = () => {
+      const rows = Array.from({ length: 2000 }, (_, i) => ({
+        id: i,
+        name: `row ${i} \u00e9\u2603`,
+        tags: new Set(['a', 'b']),
+        seen: new Date(i * 1000),
+      }));
+      const root: Record<string, unknown> = { rows, blob: Buffer.alloc(5000, 7) };
+      root.index = new Map(rows.slice(0, 10).map((row) => [row.id, row]));
+      root.self = root;
+      return root;
+    };
+
+    it('emits the same text as stringify in bounded chunks', async () => {
+      const input = sample();
+      const options = { circularReferences: true, highWaterMark: 1024 };
+      const chunks: Buffer[] = [];
+      for await (const chunk of createStringifyStream(input, options)) {
+        chunks.push(chunk as Buffer);
+      }
+
+      expect(chunks.length).toBeGreaterThan(10);
+      expect(chunks.slice(0, -1).every((chunk) => chunk.length === 1024)).toBe(true);
+      expect(Buffer.concat(chunks).toString('utf8')).toBe(stringify(input, options));
+    });
+
+    it('writes to a file descriptor', () => {
+      const input = sample();
+      const dir = mkdtempSync(join(tmpdir(), 'bas-serde-'));
+      const file = join(dir, 'out.json');
+      try {
+        const fd = openSync(file, 'w');
+        let written: number;
+        try {
+          written = stringifyToFd(input, fd, { circularReferences: true, highWaterMark: 4096 });
+        } finally {
+          closeSync(fd);
+        }
+        const text = readFileSync(file, 'utf8');
+        expect(text).toBe(stringify(input, { circularReferences: true }));
+        expect(written).toBe(Buffer.byteLength(text));
+      } finally {
+        rmSync(dir, { recursive: true, force: true });
+      }
+    });
+
+    it('reports encoding errors on the stream', async () => {
+      const input = sample();
+      const stream = createStringifyStream(input, { highWaterMark: 256 });
+      await expect(stream.toArray()).rejects.toThrow('Circular reference detected');
+      expect(() => stringifyToFd(input, -1)).toThrow(TypeError);
+    });
+  });
+
+  describe('push parser', () => {
+    const parseChunks = (chunks: Array<string | Uint8Array>) => {
+      const parser = createParser();
+      for (const chunk of chunks) parser.write(chunk);
+      return parser.end();
+    };
+    const split = <T extends { length: number; slice(a: number, b?: number): T }>(
+      data: T,
+      size: number
+    ): T[] => {
+      const chunks: T[] = [];
+      for (let i = 0; i < data.length; i += size) chunks.push(data.slice(i, i + size));
+      return chunks;
+    };
+
+    it('decodes documents split at any byte', () => {
+      const input = {
+        text: 'caf\u00e9 \u2603 \ud83d\ude00 "quoted"\n',
+        nums: [0, -12.5e-3, 123456789012345680000, NaN],
+        flags: [true, false, null, undefined],
+        buf: Buffer.from('push parser payload'),
+        floats: new Float32Array([1.5, -2.25]),
+        when: new Date(86400000),
+        map: new Map([['k', new Set([1, 2])]]),
+      };
+      const encoded = stringify(input, { circularReferences: true });
+      const bytes = Buffer.from(encoded);
+      for (const size of [1, 2, 3, 5, 64]) {
+        const output = parseChunks(split(bytes, size));
+        expect(stringify(output, { circularReferences: true })).toBe(encoded);
+      }
+      // String chunks may split a surrogate pair.
+      const output = parseChunks(split(encoded, 1));
+      expect(stringify(output, { circularReferences: true })).toBe(encoded);
+    });
+
+    it('decodes a base64 payload spread over many chunks', () => {
+      const buf = Buffer.alloc(200000);
+      for (let i = 0; i < buf.length; i++) buf[i] = (i * 31) & 0xff;
+      const output = parseChunks(split(Buffer.from(stringify({ buf })), 4096)) as {
+        buf: Buffer;
+      };
+      expect(output.buf.equals(buf)).toBe(true);
+    });
+
+    it('reports syntax errors with document offsets', () => {
+      expect(() => parseChunks(['{"a":', '1,', ' x}'])).toThrow(
+        'Expected property name in JSON at position 8'
+      );
+      expect(() => parseChunks(['[1, 2', '3'])).toThrow('Unexpected end of JSON input');
+      expect(() => parseChunks(['tr', 'ue'])).not.toThrow();
+      const parser = createParser();
+      parser.write('1');
+      expect(parser.end()).toBe(1);
+      expect(() => parser.write('2')).toThrow('Parser has already ended');
+    });
+  });
 });
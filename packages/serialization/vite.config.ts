@@ -15,6 +15,9 @@ export default defineConfig(() => ({
     environment: 'node',
     include: ['tests/**/*.{test,spec}.{js,mjs,cjs,ts,mts,cts,jsx,tsx}'],
     reporters: ['default'],
+    benchmark: {
+      include: ['bench/**/*.bench.ts'],
+    },
     coverage: {
       reportsDirectory: './test-output/vitest/coverage',
       provider: 'v8' as const,